@@ -55,13 +55,7 @@ function accountSetPermanentlyIgnored(accountId)
 
 function accountAlreadyConfigured (requestData)
 {
-    var accounts = plugin.listAccounts();
-    for (var i=0; i<accounts.length; i++) {
-        var account = accounts[i];
-        if (account.providerType == requestData.provider && account.identity == requestData.identity)
-          return true;
-    }
-    return false;
+    return plugin.isAccountConfigured(JSON.stringify(requestData));
 }
 
 function loginDetected(request, sender) {
@@ -17,8 +17,11 @@
  * along with this program. If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <string.h>
+
 #include "goabrowser.h"
 
+#include "collected-data.h"
 #include "json-gvariant.h"
 
 enum
@@ -162,20 +165,261 @@ goabrowser_object_new (GoaClient *client)
   return g_object_new (GOABROWSER_TYPE_OBJECT, "goa-client", client, NULL);
 }
 
+/* The data collected by the content scripts carries all the cookies of
+ * the provider, about 250 bytes and 19 nodes each: a full cookie jar of a
+ * few thousand of them takes a megabyte or two, like the cookies-5000.json
+ * of the corpus. The limits leave room for twice as much, while the depth
+ * and the length of the strings stay close to what the members need, so
+ * that a misbehaving page cannot make the conversion go much further. */
+static const JsonGVariantLimits collected_data_limits =
+{
+  4 * 1024 * 1024, /* max_bytes */
+  128 * 1024,      /* max_nodes */
+  16,              /* max_depth */
+  8 * 1024         /* max_string_length */
+};
+
+const JsonGVariantLimits *
+goabrowser_get_collected_data_limits (void)
+{
+  return &collected_data_limits;
+}
+
+/* The content scripts send the same data again each time the page where a
+ * login has been detected navigates, so the last few preseeds are kept:
+ * they are never modified once built and can be handed out as they are.
+ * Entries are found by a hash of the JSON text, which is then compared in
+ * full, so that a collision can only cost a conversion. */
+#define PRESEED_CACHE_SIZE 8
+
+/* larger data is converted every time rather than kept twice, as text and
+ * as preseed, by each entry */
+#define PRESEED_CACHE_MAX_LENGTH (512 * 1024)
+
+typedef struct
+{
+  guint64   hash;
+  gchar    *json;
+  gsize     length;
+  GVariant *preseed;
+} PreseedCacheEntry;
+
+/* the most recently used entry first */
+static GQueue preseed_cache = G_QUEUE_INIT;
+static guint64 preseed_cache_hits = 0;
+static guint64 preseed_cache_misses = 0;
+G_LOCK_DEFINE_STATIC (preseed_cache);
+
+/* Hashes the text 8 bytes at a time, mixing each word in with a multiply */
+static guint64
+preseed_cache_hash (const gchar *json,
+                    gsize        length)
+{
+  const guint64 k = G_GUINT64_CONSTANT (0x9e3779b97f4a7c15);
+  guint64 hash = length * k;
+  guint64 word;
+  gsize i;
+
+  for (i = 0; i + sizeof word <= length; i += sizeof word)
+    {
+      memcpy (&word, json + i, sizeof word);
+      hash = (hash ^ word) * k;
+      hash ^= hash >> 29;
+    }
+
+  if (i < length)
+    {
+      word = 0;
+      memcpy (&word, json + i, length - i);
+      hash = (hash ^ word) * k;
+      hash ^= hash >> 29;
+    }
+
+  return hash;
+}
+
+static void
+preseed_cache_entry_free (PreseedCacheEntry *entry)
+{
+  g_variant_unref (entry->preseed);
+  g_free (entry->json);
+  g_free (entry);
+}
+
+/* Returns a new reference to the cached preseed for 'json', if any */
+static GVariant *
+preseed_cache_lookup (guint64      hash,
+                      const gchar *json,
+                      gsize        length)
+{
+  GVariant *preseed = NULL;
+  GList *l;
+
+  G_LOCK (preseed_cache);
+
+  for (l = preseed_cache.head; l != NULL; l = l->next)
+    {
+      PreseedCacheEntry *entry = l->data;
+
+      if (entry->hash == hash && entry->length == length &&
+          memcmp (entry->json, json, length) == 0)
+        {
+          g_queue_unlink (&preseed_cache, l);
+          g_queue_push_head_link (&preseed_cache, l);
+          preseed = g_variant_ref (entry->preseed);
+          break;
+        }
+    }
+
+  if (preseed != NULL)
+    preseed_cache_hits++;
+  else
+    preseed_cache_misses++;
+
+  G_UNLOCK (preseed_cache);
+
+  return preseed;
+}
+
+/* Adds 'preseed', converted from 'json', dropping the least recently used
+ * entry if the cache is full */
+static void
+preseed_cache_insert (guint64      hash,
+                      const gchar *json,
+                      gsize        length,
+                      GVariant    *preseed)
+{
+  PreseedCacheEntry *entry;
+
+  entry = g_new (PreseedCacheEntry, 1);
+  entry->hash = hash;
+  entry->json = g_memdup (json, length);
+  entry->length = length;
+  entry->preseed = g_variant_ref (preseed);
+
+  G_LOCK (preseed_cache);
+
+  g_queue_push_head (&preseed_cache, entry);
+  if (preseed_cache.length > PRESEED_CACHE_SIZE)
+    preseed_cache_entry_free (g_queue_pop_tail (&preseed_cache));
+
+  G_UNLOCK (preseed_cache);
+}
+
+/* Converts the data collected by the content scripts to the preseed for
+ * the creation of a new account, or returns the one converted last time
+ * the same data was seen. Returns a new reference to the preseed, which
+ * must not be modified, or NULL on errors. */
+GVariant *
+goabrowser_parse_collected_data (const gchar  *collected_data_json,
+                                 gssize        length,
+                                 GError      **error)
+{
+  GVariant *preseed;
+  gboolean cached;
+  guint64 hash = 0;
+
+  if (length < 0)
+    length = strlen (collected_data_json);
+
+  /* no point in hashing what is going to be rejected anyway */
+  cached = (gsize) length <= MIN (collected_data_limits.max_bytes,
+                                  PRESEED_CACHE_MAX_LENGTH);
+  if (cached)
+    {
+      hash = preseed_cache_hash (collected_data_json, length);
+      preseed = preseed_cache_lookup (hash, collected_data_json, length);
+      if (preseed != NULL)
+        return preseed;
+    }
+
+  /* the preseed is serialized again as soon as it is sent over D-Bus, so
+   * have it written in serialized form right away, with its members sorted
+   * so that they can be looked up without going through all of them; the
+   * converter generated from collected-data.schema gives the same a{sv} as
+   * the generic one, matching the members it knows about directly */
+  preseed = collected_data_deserialize (collected_data_json, length,
+                                        JSON_GVARIANT_FLAGS_SORTED,
+                                        &collected_data_limits,
+                                        error);
+  if (preseed == NULL)
+    return NULL;
+
+  g_variant_ref_sink (preseed);
+  if (cached)
+    preseed_cache_insert (hash, collected_data_json, length, preseed);
+
+  return preseed;
+}
+
+/* Returns how many times goabrowser_parse_collected_data() has found the
+ * preseed in its cache and how many times it had to convert the data */
+void
+goabrowser_get_preseed_cache_stats (guint64 *hits,
+                                    guint64 *misses)
+{
+  G_LOCK (preseed_cache);
+
+  if (hits != NULL)
+    *hits = preseed_cache_hits;
+  if (misses != NULL)
+    *misses = preseed_cache_misses;
+
+  G_UNLOCK (preseed_cache);
+}
+
+/* Gets the provider and the identity of the account described by the
+ * collected data without converting the rest: the cookies can then be left
+ * alone when the account turns out to exist already. Of the members with
+ * the same key the last one is used, as in the preseed. Either of
+ * 'provider' and 'identity' may be NULL, and they are set to NULL if the
+ * data has no such member; on failure they are left alone. The values of
+ * the other members are not validated. */
+gboolean
+goabrowser_peek_collected_account (const gchar  *collected_data_json,
+                                   gssize        length,
+                                   gchar       **provider,
+                                   gchar       **identity,
+                                   GError      **error)
+{
+  JsonGVariantMember members[] = {
+    { "provider", "s", NULL },
+    { "identity", "s", NULL }
+  };
+
+  /* only the members asked for are converted */
+  if (!json_gvariant_extract_members (collected_data_json, length,
+                                      members + (provider == NULL),
+                                      (provider != NULL) + (identity != NULL),
+                                      &collected_data_limits, error))
+    return FALSE;
+
+  if (provider != NULL)
+    *provider = members[0].value != NULL ? g_variant_dup_string (members[0].value, NULL) : NULL;
+  if (identity != NULL)
+    *identity = members[1].value != NULL ? g_variant_dup_string (members[1].value, NULL) : NULL;
+
+  g_clear_pointer (&members[0].value, g_variant_unref);
+  g_clear_pointer (&members[1].value, g_variant_unref);
+
+  return TRUE;
+}
+
 void
 goabrowser_object_login_detected (GoaBrowserObject *self,
-                                  gchar            *collected_data_json)
+                                  const gchar      *collected_data_json,
+                                  gssize            length)
 {
   static const gchar *app_id = "org.gnome.ControlCenter";
   static const gchar *action_id = "launch-panel";
   GError *error = NULL;
-  GVariant *params, *preseed = NULL, *v;
+  GVariant *params, *preseed = NULL, *provider = NULL;
   GVariantBuilder *builder = NULL;
   GApplication *gnomecc = NULL;
   g_debug ("%s()", G_STRFUNC);
-  g_debug ("%s() collected data:\n%s", G_STRFUNC, collected_data_json);
+  g_debug ("%s() collected data:\n%.*s", G_STRFUNC, (gint) length, collected_data_json);
 
-  preseed = json_gvariant_deserialize_data (collected_data_json, -1, NULL, &error);
+  preseed = goabrowser_parse_collected_data (collected_data_json, length, &error);
   if (preseed == NULL)
     {
       g_warning ("Unable to parse the request for the creation of a new GNOME Online Account: %s",
@@ -184,6 +428,15 @@ goabrowser_object_login_detected (GoaBrowserObject *self,
       goto out;
     }
 
+  /* taken from the preseed itself, so that both agree on the provider
+   * even when the data has more than one */
+  provider = json_gvariant_lookup_value (preseed, "provider", G_VARIANT_TYPE_STRING);
+  if (provider == NULL)
+    {
+      g_warning ("The request for the creation of a new GNOME Online Account has no provider");
+      goto out;
+    }
+
   g_debug ("%s() requesting new account creation", G_STRFUNC);
 
   builder = g_variant_builder_new (G_VARIANT_TYPE ("av"));
@@ -193,8 +446,7 @@ goabrowser_object_login_detected (GoaBrowserObject *self,
   g_variant_builder_add (builder, "v", g_variant_new ("a{sv}", NULL));
 
   g_variant_builder_add (builder, "v", g_variant_new_string ("add"));
-  v = g_variant_lookup_value (preseed, "provider", G_VARIANT_TYPE_STRING);
-  g_variant_builder_add (builder, "v", v);
+  g_variant_builder_add (builder, "v", provider);
   g_variant_builder_add (builder, "v", preseed);
   params = g_variant_new ("(s@av)", "online-accounts", g_variant_builder_end (builder));
 
@@ -209,6 +461,8 @@ goabrowser_object_login_detected (GoaBrowserObject *self,
   g_debug ("%s() activating action '%s'", G_STRFUNC, action_id);
   g_action_group_activate_action (G_ACTION_GROUP (gnomecc), action_id, params);
 out:
+  g_clear_pointer (&provider, g_variant_unref);
+  g_clear_pointer (&preseed, g_variant_unref);
   g_clear_object (&gnomecc);
 }
 
@@ -219,3 +473,26 @@ goabrowser_object_list_accounts (GoaBrowserObject *self)
 
   return priv->accounts;
 }
+
+/* Whether the account for 'identity' at 'provider' has been configured
+ * already */
+gboolean
+goabrowser_object_has_account (GoaBrowserObject *self,
+                               const gchar      *provider,
+                               const gchar      *identity)
+{
+  GoaBrowserObjectPrivate *priv = self->priv;
+  GList *a;
+
+  for (a = priv->accounts; a != NULL; a = g_list_next (a))
+    {
+      GoaAccount *account = goa_object_peek_account (GOA_OBJECT (a->data));
+
+      if (account != NULL &&
+          g_strcmp0 (goa_account_get_provider_type (account), provider) == 0 &&
+          g_strcmp0 (goa_account_get_identity (account), identity) == 0)
+        return TRUE;
+    }
+
+  return FALSE;
+}
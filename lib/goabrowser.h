@@ -24,6 +24,8 @@
 #define GOA_API_IS_SUBJECT_TO_CHANGE
 #include <goa/goa.h>
 
+#include "json-gvariant.h"
+
 G_BEGIN_DECLS
 
 #define GOABROWSER_TYPE_OBJECT            (goabrowser_object_get_type ())
@@ -50,8 +52,24 @@ struct _GoaBrowserObject {
 GType             goabrowser_object_get_type        (void) G_GNUC_CONST;
 GoaBrowserObject *goabrowser_object_new             (GoaClient *client);
 void              goabrowser_object_login_detected  (GoaBrowserObject *self,
-                                                     gchar            *collected_data_json);
+                                                     const gchar      *collected_data_json,
+                                                     gssize            length);
 const GList      *goabrowser_object_list_accounts   (GoaBrowserObject *self);
+gboolean          goabrowser_object_has_account     (GoaBrowserObject *self,
+                                                     const gchar      *provider,
+                                                     const gchar      *identity);
+
+const JsonGVariantLimits *goabrowser_get_collected_data_limits (void);
+GVariant                 *goabrowser_parse_collected_data       (const gchar  *collected_data_json,
+                                                                 gssize        length,
+                                                                 GError      **error);
+void                      goabrowser_get_preseed_cache_stats    (guint64      *hits,
+                                                                 guint64      *misses);
+gboolean                  goabrowser_peek_collected_account     (const gchar  *collected_data_json,
+                                                                 gssize        length,
+                                                                 gchar       **provider,
+                                                                 gchar       **identity,
+                                                                 GError      **error);
 
 #ifndef g_clear_pointer /* Remove this when we can depend on GLib >= 2.34 */
 #define g_clear_pointer(pp, destroy) \
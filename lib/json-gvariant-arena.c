@@ -0,0 +1,309 @@
+/* json-gvariant-arena.c - Scratch memory for the JSON GVariant converters
+ *
+ * Copyright (C) 2013  Intel Corporation.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Author:
+ *   Emanuele Aina <emanuele.aina@collabora.com>
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string.h>
+
+#include "json-gvariant.h"
+#include "json-gvariant-private.h"
+
+#define ARENA_CHUNK_SIZE   (16 * 1024)
+#define ARENA_RETAIN_SIZE  (1024 * 1024)
+/* a node of the tape takes about ten times the text of its token: the
+ * nodes of texts of a couple hundred kilobytes are kept */
+#define ARENA_RETAIN_NODES (64 * 1024)
+#define ARENA_ALIGN(size)  (((size) + 2 * sizeof (gpointer) - 1) & ~(2 * sizeof (gpointer) - 1))
+
+struct _JsonGVariantArenaChunk
+{
+  JsonGVariantArenaChunk *prev;
+  gsize                   size;
+  gsize                   used;
+  gpointer                data[];
+};
+
+struct _JsonGVariantArena
+{
+  JsonGVariantArenaChunk *chunk;
+  JsonGVariantArenaChunk *spare;
+  gsize                   spare_size;
+  GString                *buffer;
+  JsonTape                tape;
+
+  gboolean                in_use;
+  guint                   n_allocations;
+  guint                   last_n_allocations;
+};
+
+static void
+json_gvariant_arena_free (gpointer data)
+{
+  JsonGVariantArena *arena = data;
+  JsonGVariantArenaMark empty = { NULL, 0 };
+
+  json_gvariant_arena_release (arena, &empty);
+  while (arena->spare != NULL)
+    {
+      JsonGVariantArenaChunk *chunk = arena->spare;
+
+      arena->spare = chunk->prev;
+      g_free (chunk);
+    }
+  g_string_free (arena->buffer, TRUE);
+  json_tape_clear (&arena->tape);
+  g_free (arena);
+}
+
+static GPrivate thread_arena = G_PRIVATE_INIT (json_gvariant_arena_free);
+
+static JsonGVariantArena *
+json_gvariant_arena_new (void)
+{
+  JsonGVariantArena *arena;
+
+  arena = g_new0 (JsonGVariantArena, 1);
+  arena->buffer = g_string_sized_new (64);
+  json_tape_init (&arena->tape);
+
+  return arena;
+}
+
+/* Returns the arena of the calling thread, ready for a new conversion.
+ * Conversions nested in another one on the same thread get an arena of
+ * their own.
+ */
+JsonGVariantArena *
+json_gvariant_arena_begin (void)
+{
+  JsonGVariantArena *arena;
+
+  arena = g_private_get (&thread_arena);
+  if (G_UNLIKELY (arena == NULL))
+    {
+      arena = json_gvariant_arena_new ();
+      g_private_set (&thread_arena, arena);
+    }
+  else if (G_UNLIKELY (arena->in_use))
+    {
+      arena = json_gvariant_arena_new ();
+    }
+
+  arena->in_use = TRUE;
+  arena->n_allocations = 0;
+
+  return arena;
+}
+
+/* Gives back all the memory of the conversion and records how many heap
+ * allocations it made for its temporaries */
+void
+json_gvariant_arena_end (JsonGVariantArena *arena)
+{
+  JsonGVariantArenaMark empty = { NULL, 0 };
+  JsonGVariantArena *last;
+
+  json_gvariant_arena_release (arena, &empty);
+
+  if (arena->buffer->allocated_len > ARENA_RETAIN_SIZE)
+    {
+      g_string_free (arena->buffer, TRUE);
+      arena->buffer = g_string_sized_new (64);
+    }
+
+  g_clear_error (&arena->tape.error);
+  if (arena->tape.size > ARENA_RETAIN_NODES ||
+      arena->tape.strings->allocated_len > ARENA_RETAIN_SIZE)
+    {
+      json_tape_clear (&arena->tape);
+      json_tape_init (&arena->tape);
+    }
+
+  last = g_private_get (&thread_arena);
+  last->last_n_allocations = arena->n_allocations;
+
+  if (arena != last)
+    json_gvariant_arena_free (arena);
+  else
+    arena->in_use = FALSE;
+}
+
+gpointer
+json_gvariant_arena_alloc (JsonGVariantArena *arena,
+                           gsize              size)
+{
+  JsonGVariantArenaChunk *chunk = arena->chunk;
+  gpointer mem;
+
+  size = ARENA_ALIGN (size);
+
+  if (G_UNLIKELY (chunk == NULL || chunk->size - chunk->used < size))
+    {
+      JsonGVariantArenaChunk **spare = &arena->spare;
+
+      /* reuse the first chunk given back which is large enough */
+      while (*spare != NULL && (*spare)->size < size)
+        spare = &(*spare)->prev;
+
+      if (*spare != NULL)
+        {
+          chunk = *spare;
+          *spare = chunk->prev;
+          arena->spare_size -= chunk->size;
+        }
+      else
+        {
+          gsize chunk_size = MAX (ARENA_CHUNK_SIZE, 2 * size);
+
+          chunk = g_malloc (sizeof (JsonGVariantArenaChunk) + chunk_size);
+          chunk->size = chunk_size;
+          arena->n_allocations++;
+        }
+
+      chunk->used = 0;
+      chunk->prev = arena->chunk;
+      arena->chunk = chunk;
+    }
+
+  mem = (gchar *) chunk->data + chunk->used;
+  chunk->used += size;
+
+  return mem;
+}
+
+/* Resizes 'mem', which must be the last block allocated from 'arena'.
+ * The block is extended in place when the chunk has room for it.
+ */
+gpointer
+json_gvariant_arena_grow (JsonGVariantArena *arena,
+                          gpointer           mem,
+                          gsize              old_size,
+                          gsize              new_size)
+{
+  JsonGVariantArenaChunk *chunk = arena->chunk;
+  gpointer new_mem;
+
+  old_size = ARENA_ALIGN (old_size);
+  new_size = ARENA_ALIGN (new_size);
+
+  if (mem == NULL)
+    return json_gvariant_arena_alloc (arena, new_size);
+
+  g_assert ((gchar *) mem + old_size == (gchar *) chunk->data + chunk->used);
+
+  if (chunk->size - (chunk->used - old_size) >= new_size)
+    {
+      chunk->used = chunk->used - old_size + new_size;
+      return mem;
+    }
+
+  /* the old block stays behind until the caller releases its mark */
+  new_mem = json_gvariant_arena_alloc (arena, new_size);
+  memcpy (new_mem, mem, old_size);
+
+  return new_mem;
+}
+
+void
+json_gvariant_arena_mark (JsonGVariantArena     *arena,
+                          JsonGVariantArenaMark *mark)
+{
+  mark->chunk = arena->chunk;
+  mark->used = arena->chunk != NULL ? arena->chunk->used : 0;
+}
+
+/* Frees everything allocated after 'mark' was taken. The chunks given back
+ * are kept for the next allocations, up to ARENA_RETAIN_SIZE bytes.
+ */
+void
+json_gvariant_arena_release (JsonGVariantArena     *arena,
+                             JsonGVariantArenaMark *mark)
+{
+  while (arena->chunk != mark->chunk)
+    {
+      JsonGVariantArenaChunk *chunk = arena->chunk;
+
+      arena->chunk = chunk->prev;
+
+      if (arena->spare_size + chunk->size <= ARENA_RETAIN_SIZE)
+        {
+          chunk->prev = arena->spare;
+          arena->spare = chunk;
+          arena->spare_size += chunk->size;
+        }
+      else
+        {
+          g_free (chunk);
+        }
+    }
+
+  if (arena->chunk != NULL)
+    arena->chunk->used = mark->used;
+}
+
+/* Returns the string buffer reused by the scanners of the conversion */
+GString *
+json_gvariant_arena_get_buffer (JsonGVariantArena *arena)
+{
+  return arena->buffer;
+}
+
+/* Returns the tape reused by the conversions recording their text */
+JsonTape *
+json_gvariant_arena_get_tape (JsonGVariantArena *arena)
+{
+  return &arena->tape;
+}
+
+/* Makes 'scanner' count the heap allocations for its buffer, its window
+ * and the tape it records with the ones of 'arena' */
+void
+json_gvariant_arena_count_scanner (JsonGVariantArena *arena,
+                                   JsonScanner       *scanner)
+{
+  scanner->n_allocations = &arena->n_allocations;
+}
+
+/* Returns the number of heap allocations the conversion using 'arena' has
+ * made so far for its temporaries */
+guint
+json_gvariant_arena_get_n_allocations (JsonGVariantArena *arena)
+{
+  return arena->n_allocations;
+}
+
+/* Returns the number of calls to malloc() and realloc() the last
+ * conversion on the calling thread made for its temporaries: the chunks of
+ * its arena, the string buffer and the input window of its scanners, and
+ * the nodes and strings of its tape. The allocations for the resulting
+ * GVariant, for errors, for interning and the ones made by json-c to build
+ * its tree are not included, nor are those of the threads converting an
+ * array in parallel, which count their own.
+ */
+guint
+json_gvariant_get_scratch_allocation_count (void)
+{
+  JsonGVariantArena *arena = g_private_get (&thread_arena);
+
+  return arena != NULL ? arena->last_n_allocations : 0;
+}
@@ -0,0 +1,1380 @@
+/* json-gvariant-bench.c - Benchmarks for the JSON to GVariant conversion
+ *
+ * Copyright (C) 2013  Intel Corporation.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Author:
+ *   Emanuele Aina <emanuele.aina@collabora.com>
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string.h>
+#include <sys/resource.h>
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
+#include <glib.h>
+#include <gio/gio.h>
+#include <json.h>
+
+#include "collected-data.h"
+#include "goabrowser.h"
+#include "json-gvariant.h"
+#include "json-scanner.h"
+
+typedef GVariant * (*ConvertFunc) (const gchar  *json,
+                                   gsize         length,
+                                   const gchar  *signature,
+                                   GError      **error);
+
+static gint iterations_scale = 1;
+static gchar *corpus_dir = NULL;
+static gboolean corpus_serialized = FALSE;
+static gboolean corpus_intern = FALSE;
+static gboolean corpus_compact = FALSE;
+static gint corpus_threads = 0;
+static JsonGVariantFlags corpus_flags = JSON_GVARIANT_FLAGS_NONE;
+
+#ifdef __GLIBC__
+/* Every heap allocation of the process goes through these wrappers, so
+ * that the corpus benchmark can count all the allocations made by a
+ * conversion, including the ones for its result */
+extern void *__libc_malloc (size_t size);
+extern void *__libc_calloc (size_t n_members, size_t size);
+extern void *__libc_realloc (void *mem, size_t size);
+
+static gint n_allocations = 0;
+
+void *
+malloc (size_t size)
+{
+  g_atomic_int_inc (&n_allocations);
+  return __libc_malloc (size);
+}
+
+void *
+calloc (size_t n_members,
+        size_t size)
+{
+  g_atomic_int_inc (&n_allocations);
+  return __libc_calloc (n_members, size);
+}
+
+void *
+realloc (void   *mem,
+         size_t  size)
+{
+  g_atomic_int_inc (&n_allocations);
+  return __libc_realloc (mem, size);
+}
+#define HAVE_ALLOCATION_COUNT 1
+#endif
+
+/* Returns the number of bytes currently allocated from the heap */
+static gssize
+get_heap_size (void)
+{
+#if defined (__GLIBC__) && __GLIBC_PREREQ (2, 33)
+  struct mallinfo2 info = mallinfo2 ();
+
+  return info.uordblks + info.hblkhd;
+#elif defined (__GLIBC__)
+  struct mallinfo info = mallinfo ();
+
+  return (gsize) info.uordblks + (gsize) info.hblkhd;
+#else
+  return -1;
+#endif
+}
+
+/* Builds a collected-data payload like the ones sent by the content
+ * scripts, with a cookie jar of 'n_cookies' entries */
+static gchar *
+build_preseed (guint n_cookies)
+{
+  GString *json;
+  guint i;
+
+  json = g_string_new ("{\"identity\":\"someone@gmail.com\","
+                       "\"provider\":\"google\","
+                       "\"services\":[\"mail\",\"chat\",\"contacts\"],"
+                       "\"authenticationDomain\":\"google.com\","
+                       "\"cookies\":[");
+
+  for (i = 0; i < n_cookies; i++)
+    g_string_append_printf (json,
+                            "%s{\"name\":\"COOKIE%u\","
+                            "\"value\":\"%08x%08x%08x\","
+                            "\"domain\":\".google.com\","
+                            "\"path\":\"/\","
+                            "\"secure\":%s,"
+                            "\"httpOnly\":%s,"
+                            "\"expirationDate\":%u.%u}",
+                            i > 0 ? "," : "",
+                            i, i * 2654435761u, i ^ 0x5bd1e995, ~i,
+                            i % 2 ? "true" : "false",
+                            i % 3 ? "true" : "false",
+                            1380000000 + i * 3600, i % 10);
+
+  g_string_append (json, "]}");
+
+  return g_string_free (json, FALSE);
+}
+
+/* Builds an object with 'n_members' members of mixed types */
+static gchar *
+build_wide_object (guint n_members)
+{
+  GString *json;
+  guint i;
+
+  json = g_string_new ("{");
+
+  for (i = 0; i < n_members; i++)
+    {
+      if (i > 0)
+        g_string_append_c (json, ',');
+
+      switch (i % 4)
+        {
+        case 0:
+          g_string_append_printf (json, "\"key%u\":\"value%u\"", i, i);
+          break;
+        case 1:
+          g_string_append_printf (json, "\"key%u\":%u", i, i);
+          break;
+        case 2:
+          g_string_append_printf (json, "\"key%u\":%s", i, i % 3 ? "true" : "false");
+          break;
+        default:
+          g_string_append_printf (json, "\"key%u\":%u.5", i, i);
+          break;
+        }
+    }
+
+  g_string_append_c (json, '}');
+
+  return g_string_free (json, FALSE);
+}
+
+/* Builds an array of 'n_elements' small objects */
+static gchar *
+build_object_array (guint n_elements)
+{
+  GString *json;
+  guint i;
+
+  json = g_string_new ("[");
+
+  for (i = 0; i < n_elements; i++)
+    g_string_append_printf (json,
+                            "%s{\"name\":\"item%u\",\"id\":%u,\"enabled\":%s}",
+                            i > 0 ? "," : "",
+                            i, i, i % 2 ? "true" : "false");
+
+  g_string_append_c (json, ']');
+
+  return g_string_free (json, FALSE);
+}
+
+/* Builds an array of 'n_elements' integers */
+static gchar *
+build_int_array (guint n_elements)
+{
+  GString *json;
+  guint i;
+
+  json = g_string_sized_new (n_elements * 8 + 2);
+  g_string_append_c (json, '[');
+
+  for (i = 0; i < n_elements; i++)
+    g_string_append_printf (json, "%s%u", i > 0 ? "," : "", i * 7);
+
+  g_string_append_c (json, ']');
+
+  return g_string_free (json, FALSE);
+}
+
+static GVariant *
+convert_json_c (const gchar  *json,
+                gsize         length,
+                const gchar  *signature,
+                GError      **error)
+{
+  json_object *json_node;
+  GVariant *variant;
+
+  json_node = json_gvariant_parse_data (json, length, error);
+  if (json_node == NULL)
+    return NULL;
+
+  variant = json_gvariant_deserialize (json_node, signature, error);
+  json_object_put (json_node);
+
+  return variant;
+}
+
+/* Checks the JSON text with a new tokener, as done before the tokeners
+ * were reused */
+static gboolean
+check_new_tokener (const gchar *json,
+                   gsize        length)
+{
+  json_tokener *tokener;
+  json_object *json_node;
+
+  tokener = json_tokener_new ();
+  json_node = json_tokener_parse_ex (tokener, json, length);
+  json_tokener_free (tokener);
+
+  if (json_node == NULL)
+    return FALSE;
+
+  json_object_put (json_node);
+  return TRUE;
+}
+
+static gboolean
+check_thread_tokener (const gchar *json,
+                      gsize        length)
+{
+  json_object *json_node;
+
+  json_node = json_gvariant_parse_data (json, length, NULL);
+  if (json_node == NULL)
+    return FALSE;
+
+  json_object_put (json_node);
+  return TRUE;
+}
+
+static gboolean
+check_validate (const gchar *json,
+                gsize        length)
+{
+  return json_gvariant_validate (json, length, "a{sv}", NULL, NULL, NULL);
+}
+
+static GVariant *
+convert_stream (const gchar  *json,
+                gsize         length,
+                const gchar  *signature,
+                GError      **error)
+{
+  return json_gvariant_deserialize_data (json, length, signature, error);
+}
+
+static GVariant *
+convert_serialized (const gchar  *json,
+                    gsize         length,
+                    const gchar  *signature,
+                    GError      **error)
+{
+  return json_gvariant_deserialize_data_full (json, length, signature,
+                                              JSON_GVARIANT_FLAGS_SERIALIZED,
+                                              error);
+}
+
+static GVariant *
+convert_parallel (const gchar  *json,
+                  gsize         length,
+                  const gchar  *signature,
+                  GError      **error)
+{
+  return json_gvariant_deserialize_data_full (json, length, signature,
+                                              JSON_GVARIANT_FLAGS_PARALLEL,
+                                              error);
+}
+
+/* Converts with the flags selected on the command line */
+static GVariant *
+convert_corpus (const gchar  *json,
+                gsize         length,
+                const gchar  *signature,
+                GError      **error)
+{
+  return json_gvariant_deserialize_data_full (json, length, signature,
+                                              corpus_flags, error);
+}
+
+/* Returns the average time per conversion in microseconds */
+static gdouble
+run (ConvertFunc  func,
+     const gchar *json,
+     const gchar *signature,
+     guint        iterations)
+{
+  gsize length = strlen (json);
+  gint64 start;
+  guint i;
+
+  start = g_get_monotonic_time ();
+
+  for (i = 0; i < iterations; i++)
+    {
+      GError *error = NULL;
+      GVariant *variant;
+
+      variant = func (json, length, signature, &error);
+      if (variant == NULL)
+        g_error ("Conversion failed: %s", error->message);
+
+      g_variant_unref (g_variant_ref_sink (variant));
+    }
+
+  return (g_get_monotonic_time () - start) / (gdouble) iterations;
+}
+
+static void
+bench_json_c_vs_stream (void)
+{
+  static const guint sizes[] = { 0, 50, 500, 5000 };
+  static const gchar *signatures[] = { NULL, "a{sv}" };
+  guint i, j;
+
+  g_print ("%-8s %-10s %10s %14s %14s %16s %8s\n",
+           "cookies", "signature", "bytes", "json-c (us)", "stream (us)",
+           "serialized (us)", "speedup");
+
+  for (i = 0; i < G_N_ELEMENTS (sizes); i++)
+    {
+      gchar *json = build_preseed (sizes[i]);
+      guint iterations = MAX (10, 200000 / (sizes[i] + 20)) * iterations_scale;
+
+      for (j = 0; j < G_N_ELEMENTS (signatures); j++)
+        {
+          gdouble json_c, stream, serialized;
+
+          json_c = run (convert_json_c, json, signatures[j], iterations);
+          stream = run (convert_stream, json, signatures[j], iterations);
+          serialized = run (convert_serialized, json, signatures[j], iterations);
+
+          g_print ("%-8u %-10s %10" G_GSIZE_FORMAT " %14.2f %14.2f %16.2f %7.2fx\n",
+                   sizes[i], signatures[j] ? signatures[j] : "(none)",
+                   strlen (json), json_c, stream, serialized,
+                   json_c / MIN (stream, serialized));
+        }
+
+      g_free (json);
+    }
+}
+
+/* Per-element cost of the dictionary and array paths, which is dominated
+ * by how each element type is resolved from the signature */
+static void
+bench_per_element (void)
+{
+  static const guint sizes[] = { 100, 10000 };
+  guint i;
+
+  g_print ("\n%-8s %-8s %16s %16s\n",
+           "shape", "elements", "json-c (ns/el)", "stream (ns/el)");
+
+  for (i = 0; i < G_N_ELEMENTS (sizes); i++)
+    {
+      guint iterations = MAX (10, 1000000 / sizes[i]) * iterations_scale;
+      gchar *json;
+      gdouble json_c, stream;
+
+      json = build_wide_object (sizes[i]);
+      json_c = run (convert_json_c, json, "a{sv}", iterations);
+      stream = run (convert_stream, json, "a{sv}", iterations);
+      g_print ("%-8s %-8u %16.1f %16.1f\n", "a{sv}", sizes[i],
+               json_c * 1000 / sizes[i], stream * 1000 / sizes[i]);
+      g_free (json);
+
+      json = build_object_array (sizes[i]);
+      json_c = run (convert_json_c, json, "aa{sv}", iterations);
+      stream = run (convert_stream, json, "aa{sv}", iterations);
+      g_print ("%-8s %-8u %16.1f %16.1f\n", "aa{sv}", sizes[i],
+               json_c * 1000 / sizes[i], stream * 1000 / sizes[i]);
+      g_free (json);
+    }
+}
+
+/* Compares the cost of checking the small preseeds with a json-c parse,
+ * using a new tokener per call or the tokener kept by the thread, and with
+ * json_gvariant_validate() */
+static void
+bench_tokener (void)
+{
+  static const guint n_cookies[] = { 0, 1, 10 };
+  static const struct
+  {
+    const gchar  *name;
+    gboolean    (*check) (const gchar *json, gsize length);
+  } checks[] = {
+    { "new", check_new_tokener },
+    { "thread", check_thread_tokener },
+    { "validate", check_validate }
+  };
+  guint i, j, k;
+
+  g_print ("\n%-8s %-8s %12s\n", "cookies", "check", "ns/call");
+
+  for (i = 0; i < G_N_ELEMENTS (n_cookies); i++)
+    {
+      gchar *json = build_preseed (n_cookies[i]);
+      gsize length = strlen (json);
+      guint iterations = 200000 * iterations_scale;
+
+      for (j = 0; j < G_N_ELEMENTS (checks); j++)
+        {
+          gint64 start;
+
+          if (!checks[j].check (json, length))
+            g_error ("Check of the preseed failed");
+
+          start = g_get_monotonic_time ();
+          for (k = 0; k < iterations; k++)
+            checks[j].check (json, length);
+
+          g_print ("%-8u %-8s %12.1f\n", n_cookies[i], checks[j].name,
+                   (g_get_monotonic_time () - start) * 1000.0 / iterations);
+        }
+
+      g_free (json);
+    }
+}
+
+/* Checks that the conversion time grows linearly with the array length:
+ * ns/element should stay flat across the rows */
+static void
+bench_array_scaling (void)
+{
+  static const guint sizes[] = { 1000, 10000, 100000, 1000000 };
+  static const gchar *signatures[] = { "ax", NULL };
+  guint i, j;
+
+  g_print ("\n%-8s %-10s %16s %16s\n",
+           "elements", "signature", "json-c (ns/el)", "stream (ns/el)");
+
+  for (i = 0; i < G_N_ELEMENTS (sizes); i++)
+    {
+      gchar *json = build_int_array (sizes[i]);
+      guint iterations = MAX (2, 2000000 / sizes[i]) * iterations_scale;
+
+      for (j = 0; j < G_N_ELEMENTS (signatures); j++)
+        {
+          gdouble json_c, stream;
+
+          json_c = run (convert_json_c, json, signatures[j], iterations);
+          stream = run (convert_stream, json, signatures[j], iterations);
+
+          g_print ("%-8u %-10s %16.1f %16.1f\n",
+                   sizes[i], signatures[j] ? signatures[j] : "(none)",
+                   json_c * 1000 / sizes[i], stream * 1000 / sizes[i]);
+        }
+
+      g_free (json);
+    }
+}
+
+/* Converts large arrays with JSON_GVARIANT_FLAGS_PARALLEL from 1 thread up
+ * to the number of processors: the speedup is relative to the sequential
+ * conversion */
+static void
+bench_parallel_scaling (void)
+{
+  static const struct
+  {
+    const gchar *name;
+    const gchar *signature;
+  } inputs[] = {
+    { "ints", "ax" },
+    { "objects", "aa{sv}" },
+    { "objects", NULL }
+  };
+  guint n_processors = g_get_num_processors ();
+  guint i, n_threads;
+
+  g_print ("\n%-8s %-10s %8s %12s %8s\n",
+           "input", "signature", "threads", "ns/el", "speedup");
+
+  for (i = 0; i < G_N_ELEMENTS (inputs); i++)
+    {
+      guint n_elements = 200000;
+      guint iterations = 5 * iterations_scale;
+      gchar *json;
+      gdouble sequential;
+
+      if (strcmp (inputs[i].name, "ints") == 0)
+        json = build_int_array (n_elements);
+      else
+        json = build_object_array (n_elements);
+
+      sequential = run (convert_stream, json, inputs[i].signature, iterations);
+
+      for (n_threads = 1; n_threads <= n_processors; n_threads++)
+        {
+          gdouble parallel;
+
+          json_gvariant_set_max_threads (n_threads);
+          parallel = run (convert_parallel, json, inputs[i].signature, iterations);
+
+          g_print ("%-8s %-10s %8u %12.1f %8.2f\n",
+                   inputs[i].name,
+                   inputs[i].signature ? inputs[i].signature : "(none)",
+                   n_threads, parallel * 1000 / n_elements, sequential / parallel);
+        }
+
+      g_free (json);
+    }
+
+  json_gvariant_set_max_threads (n_processors);
+}
+
+/* Converts a batch of small preseeds one at a time and with
+ * json_gvariant_deserialize_batch(), from 1 thread up to the number of
+ * processors */
+static void
+bench_batch (void)
+{
+  const guint n_documents = 2000;
+  JsonGVariantDocument *documents;
+  GVariant **results;
+  gchar **texts;
+  guint n_processors = g_get_num_processors ();
+  guint iterations = 5 * iterations_scale;
+  gdouble sequential;
+  gint64 start = 0;
+  guint i, j, n_threads;
+
+  documents = g_new (JsonGVariantDocument, n_documents);
+  results = g_new (GVariant *, n_documents);
+  texts = g_new (gchar *, n_documents);
+  for (i = 0; i < n_documents; i++)
+    {
+      texts[i] = build_preseed (i % 20);
+      documents[i].json = texts[i];
+      documents[i].length = strlen (texts[i]);
+      documents[i].signature = "a{sv}";
+    }
+
+  /* both hold all the results until the end of the batch, the first
+   * round only warms up the heap */
+  for (j = 0; j <= iterations; j++)
+    {
+      for (i = 0; i < n_documents; i++)
+        results[i] = g_variant_ref_sink (convert_stream (documents[i].json,
+                                                         documents[i].length,
+                                                         documents[i].signature,
+                                                         NULL));
+      for (i = 0; i < n_documents; i++)
+        g_variant_unref (results[i]);
+
+      if (j == 0)
+        start = g_get_monotonic_time ();
+    }
+  sequential = (g_get_monotonic_time () - start) / (gdouble) (iterations * n_documents);
+
+  g_print ("\n%-10s %8s %12s %8s\n", "batch", "threads", "us/doc", "speedup");
+  g_print ("%-10s %8u %12.2f %8.2f\n", "sequential", 1, sequential, 1.0);
+
+  for (n_threads = 1; n_threads <= n_processors; n_threads++)
+    {
+      gdouble batch;
+
+      json_gvariant_set_max_threads (n_threads);
+
+      start = g_get_monotonic_time ();
+      for (j = 0; j < iterations; j++)
+        {
+          if (!json_gvariant_deserialize_batch (documents, n_documents,
+                                                JSON_GVARIANT_FLAGS_NONE,
+                                                results, NULL))
+            g_error ("Batch conversion failed");
+
+          for (i = 0; i < n_documents; i++)
+            g_variant_unref (results[i]);
+        }
+      batch = (g_get_monotonic_time () - start) / (gdouble) (iterations * n_documents);
+
+      g_print ("%-10s %8u %12.2f %8.2f\n", "batch", n_threads, batch, sequential / batch);
+    }
+
+  json_gvariant_set_max_threads (n_processors);
+
+  for (i = 0; i < n_documents; i++)
+    g_free (texts[i]);
+  g_free (texts);
+  g_free (results);
+  g_free (documents);
+}
+
+/* Converts the preseeds to a{sv} and back to JSON text, checking that the
+ * text converts again to the same value */
+static void
+bench_round_trip (void)
+{
+  static const guint sizes[] = { 0, 50, 500, 5000 };
+  guint i;
+
+  g_print ("\n%-8s %10s %18s %14s %16s %10s\n",
+           "cookies", "bytes", "to gvariant (us)", "to json (us)", "round trip (us)",
+           "MB/s");
+
+  for (i = 0; i < G_N_ELEMENTS (sizes); i++)
+    {
+      gchar *json = build_preseed (sizes[i]);
+      gsize length = strlen (json);
+      guint iterations = MAX (10, 200000 / (sizes[i] + 20)) * iterations_scale;
+      GError *error = NULL;
+      GVariant *variant, *again;
+      gdouble to_gvariant, to_json;
+      gchar *text;
+      gint64 start;
+      guint j;
+
+      variant = convert_serialized (json, length, "a{sv}", &error);
+      if (variant == NULL)
+        g_error ("Conversion failed: %s", error->message);
+      g_variant_ref_sink (variant);
+
+      text = json_gvariant_serialize_data (variant, NULL);
+      again = convert_serialized (text, strlen (text), "a{sv}", &error);
+      if (again == NULL)
+        g_error ("Conversion failed: %s", error->message);
+      if (!g_variant_equal (variant, again))
+        g_error ("Round trip mismatch for %u cookies", sizes[i]);
+      g_variant_unref (g_variant_ref_sink (again));
+      g_free (text);
+
+      to_gvariant = run (convert_serialized, json, "a{sv}", iterations);
+
+      start = g_get_monotonic_time ();
+      for (j = 0; j < iterations; j++)
+        g_free (json_gvariant_serialize_data (variant, NULL));
+      to_json = (g_get_monotonic_time () - start) / (gdouble) iterations;
+
+      g_print ("%-8u %10" G_GSIZE_FORMAT " %18.2f %14.2f %16.2f %10.1f\n",
+               sizes[i], length, to_gvariant, to_json, to_gvariant + to_json,
+               length / (to_gvariant + to_json));
+
+      g_variant_unref (variant);
+      g_free (json);
+    }
+}
+
+/* Builds an object of 'n_members' long token-like strings, as the values
+ * of authentication cookies */
+static gchar *
+build_tokens (guint n_members,
+              guint token_length)
+{
+  GString *json;
+  guint i, j;
+
+  json = g_string_new ("{");
+
+  for (i = 0; i < n_members; i++)
+    {
+      g_string_append_printf (json, "%s\"token%u\":\"", i > 0 ? "," : "", i);
+      for (j = 0; j < token_length; j++)
+        g_string_append_c (json, "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_"[(i * 31 + j * 7) % 64]);
+      g_string_append_c (json, '"');
+    }
+
+  g_string_append_c (json, '}');
+
+  return g_string_free (json, FALSE);
+}
+
+/* Throughput of the scanner on string-heavy text with each of the
+ * instruction sets it supports */
+static void
+bench_simd (void)
+{
+  static const gchar *names[] = { "scalar", "sse2", "avx2" };
+  JsonScannerSimd best = json_scanner_get_simd ();
+  gchar *payloads[2];
+  guint i, j, k;
+
+  payloads[0] = build_preseed (500);
+  payloads[1] = build_tokens (64, 1024);
+
+  g_print ("\n%-8s %-8s %10s %16s %16s\n",
+           "payload", "simd", "bytes", "validate (MB/s)", "serialized (MB/s)");
+
+  for (i = 0; i < G_N_ELEMENTS (payloads); i++)
+    {
+      gsize length = strlen (payloads[i]);
+      guint iterations = MAX (10, 50000000 / length) * iterations_scale;
+
+      for (j = JSON_SCANNER_SIMD_NONE; j <= best; j++)
+        {
+          gdouble validate, serialized;
+          gint64 start;
+
+          json_scanner_set_simd (j);
+
+          start = g_get_monotonic_time ();
+          for (k = 0; k < iterations; k++)
+            if (!json_gvariant_validate (payloads[i], length, "a{sv}", NULL, NULL, NULL))
+              g_error ("Validation failed");
+          validate = (g_get_monotonic_time () - start) / (gdouble) iterations;
+
+          serialized = run (convert_serialized, payloads[i], "a{sv}", iterations);
+
+          g_print ("%-8s %-8s %10" G_GSIZE_FORMAT " %16.1f %16.1f\n",
+                   i == 0 ? "cookies" : "tokens", names[j], length,
+                   length / validate, length / serialized);
+        }
+    }
+
+  json_scanner_set_simd (best);
+
+  for (i = 0; i < G_N_ELEMENTS (payloads); i++)
+    g_free (payloads[i]);
+}
+
+/* Builds an array of 'n_elements' expiration dates, as doubles with a
+ * fractional part if 'fraction' is TRUE and as integers otherwise */
+static gchar *
+build_timestamps (guint    n_elements,
+                  gboolean fraction)
+{
+  GString *json;
+  guint i;
+
+  json = g_string_sized_new (n_elements * 16 + 2);
+  g_string_append_c (json, '[');
+
+  for (i = 0; i < n_elements; i++)
+    {
+      if (fraction)
+        g_string_append_printf (json, "%s%u.%06u", i > 0 ? "," : "",
+                                1380000000 + i * 3600, (i * 7919) % 1000000);
+      else
+        g_string_append_printf (json, "%s%" G_GUINT64_FORMAT, i > 0 ? "," : "",
+                                G_GUINT64_CONSTANT (13800000000000) + i * 3600000);
+    }
+
+  g_string_append_c (json, ']');
+
+  return g_string_free (json, FALSE);
+}
+
+/* Cost of the numbers in number-heavy arrays, converting each with GLib as
+ * done before the scanner had its own parsers, and with the conversions */
+static void
+bench_numbers (void)
+{
+  static const guint n_elements = 100000;
+  static const gchar *signatures[] = { "ad", "ax" };
+  guint i, j;
+
+  g_print ("\n%-10s %10s %14s %14s %14s %16s\n",
+           "signature", "elements", "glib (ns/el)", "parser (ns/el)",
+           "stream (ns/el)", "serialized (ns/el)");
+
+  for (i = 0; i < G_N_ELEMENTS (signatures); i++)
+    {
+      gchar *json = build_timestamps (n_elements, i == 0);
+      guint iterations = 10 * iterations_scale;
+      gdouble glib, parser, stream, serialized;
+      gchar **numbers;
+      guint k;
+      gint64 start;
+
+      /* the numbers alone, as the scanner buffers them */
+      numbers = g_strsplit_set (json + 1, ",]", -1);
+
+      start = g_get_monotonic_time ();
+      for (k = 0; k < iterations; k++)
+        for (j = 0; j < n_elements; j++)
+          {
+            volatile gdouble value;
+
+            if (i == 0)
+              value = g_ascii_strtod (numbers[j], NULL);
+            else
+              value = g_ascii_strtoll (numbers[j], NULL, 10);
+            (void) value;
+          }
+      glib = (g_get_monotonic_time () - start) * 1000.0 / iterations;
+
+      start = g_get_monotonic_time ();
+      for (k = 0; k < iterations; k++)
+        for (j = 0; j < n_elements; j++)
+          {
+            gsize length = strlen (numbers[j]);
+            gdouble double_value;
+            gint64 int_value;
+
+            if (i == 0 ? !json_scanner_parse_double (numbers[j], length, &double_value)
+                       : !json_scanner_parse_int64 (numbers[j], length, &int_value))
+              g_error ("Number not parsed: %s", numbers[j]);
+          }
+      parser = (g_get_monotonic_time () - start) * 1000.0 / iterations;
+
+      stream = run (convert_stream, json, signatures[i], iterations) * 1000;
+      serialized = run (convert_serialized, json, signatures[i], iterations) * 1000;
+
+      g_print ("%-10s %10u %14.1f %14.1f %14.1f %16.1f\n",
+               signatures[i], n_elements,
+               glib / n_elements, parser / n_elements,
+               stream / n_elements, serialized / n_elements);
+
+      g_strfreev (numbers);
+      g_free (json);
+    }
+}
+
+/* Cost of the preseed when the same collected data is sent again, as done
+ * on every navigation of the page, converting it from scratch and getting
+ * it from the cache of goabrowser_parse_collected_data() */
+static void
+bench_preseed_cache (void)
+{
+  static const guint sizes[] = { 0, 10, 100 };
+  guint i;
+
+  g_print ("\n%-8s %8s %14s %14s %10s\n",
+           "cookies", "bytes", "convert (us)", "cached (us)", "speedup");
+
+  for (i = 0; i < G_N_ELEMENTS (sizes); i++)
+    {
+      gchar *json = build_preseed (sizes[i]);
+      gsize length = strlen (json);
+      guint iterations = MAX (100, 20000 / (sizes[i] + 1)) * iterations_scale;
+      const JsonGVariantLimits *limits = goabrowser_get_collected_data_limits ();
+      gdouble convert, cached;
+      gint64 start;
+      guint j;
+
+      start = g_get_monotonic_time ();
+      for (j = 0; j < iterations; j++)
+        g_variant_unref (g_variant_ref_sink (json_gvariant_deserialize_limited (json, length, "a{sv}",
+                                                                                JSON_GVARIANT_FLAGS_SERIALIZED |
+                                                                                JSON_GVARIANT_FLAGS_SORTED,
+                                                                                limits, NULL)));
+      convert = (g_get_monotonic_time () - start) / (gdouble) iterations;
+
+      start = g_get_monotonic_time ();
+      for (j = 0; j < iterations; j++)
+        g_variant_unref (goabrowser_parse_collected_data (json, length, NULL));
+      cached = (g_get_monotonic_time () - start) / (gdouble) iterations;
+
+      g_print ("%-8u %8" G_GSIZE_FORMAT " %14.2f %14.3f %9.1fx\n",
+               sizes[i], length, convert, cached, convert / MAX (cached, 0.001));
+
+      g_free (json);
+    }
+}
+
+/* Cost of converting the collected data with the generic converter, which
+ * interprets the plan of a{sv} for each value, and with the one generated
+ * from collected-data.schema, which matches the known members directly */
+static void
+bench_generated (void)
+{
+  static const guint sizes[] = { 0, 10, 50, 150 };
+  guint i;
+
+  g_print ("\n%-8s %8s %14s %14s %10s\n",
+           "cookies", "bytes", "generic (us)", "generated (us)", "speedup");
+
+  for (i = 0; i < G_N_ELEMENTS (sizes); i++)
+    {
+      gchar *json = build_preseed (sizes[i]);
+      gsize length = strlen (json);
+      guint iterations = MAX (100, 20000 / (sizes[i] + 1)) * iterations_scale;
+      const JsonGVariantLimits *limits = goabrowser_get_collected_data_limits ();
+      gdouble generic, generated;
+      gint64 start;
+      guint j;
+
+      start = g_get_monotonic_time ();
+      for (j = 0; j < iterations; j++)
+        g_variant_unref (g_variant_ref_sink (json_gvariant_deserialize_limited (json, length, "a{sv}",
+                                                                                JSON_GVARIANT_FLAGS_SERIALIZED |
+                                                                                JSON_GVARIANT_FLAGS_SORTED,
+                                                                                limits, NULL)));
+      generic = (g_get_monotonic_time () - start) / (gdouble) iterations;
+
+      start = g_get_monotonic_time ();
+      for (j = 0; j < iterations; j++)
+        g_variant_unref (g_variant_ref_sink (collected_data_deserialize (json, length,
+                                                                         JSON_GVARIANT_FLAGS_SORTED,
+                                                                         limits, NULL)));
+      generated = (g_get_monotonic_time () - start) / (gdouble) iterations;
+
+      g_print ("%-8u %8" G_GSIZE_FORMAT " %14.2f %14.2f %9.2fx\n",
+               sizes[i], length, generic, generated, generic / generated);
+
+      g_free (json);
+    }
+}
+
+/* Cost of getting the provider and identity of the collected data by
+ * converting all of it, by extracting them alone, and of finding out that
+ * a member is missing, which skips over all the cookies */
+static void
+bench_extract (void)
+{
+  static const guint sizes[] = { 10, 1000, 10000 };
+  guint i;
+
+  g_print ("\n%-8s %9s %14s %14s %14s\n",
+           "cookies", "bytes", "convert (us)", "extract (us)", "missing (us)");
+
+  for (i = 0; i < G_N_ELEMENTS (sizes); i++)
+    {
+      gchar *json = build_preseed (sizes[i]);
+      gsize length = strlen (json);
+      guint iterations = MAX (10, 200000 / (sizes[i] + 1)) * iterations_scale;
+      gdouble convert, extract, missing;
+      gint64 start;
+      guint j;
+
+      start = g_get_monotonic_time ();
+      for (j = 0; j < iterations; j++)
+        {
+          GVariant *preseed = json_gvariant_deserialize_data_full (json, length, "a{sv}",
+                                                                   JSON_GVARIANT_FLAGS_SERIALIZED,
+                                                                   NULL);
+
+          g_variant_ref_sink (preseed);
+          g_variant_unref (g_variant_lookup_value (preseed, "provider", G_VARIANT_TYPE_STRING));
+          g_variant_unref (g_variant_lookup_value (preseed, "identity", G_VARIANT_TYPE_STRING));
+          g_variant_unref (preseed);
+        }
+      convert = (g_get_monotonic_time () - start) / (gdouble) iterations;
+
+      start = g_get_monotonic_time ();
+      for (j = 0; j < iterations; j++)
+        {
+          JsonGVariantMember members[] = {
+            { "provider", "s", NULL },
+            { "identity", "s", NULL }
+          };
+
+          json_gvariant_extract_members (json, length, members, 2, NULL, NULL);
+          g_variant_unref (members[0].value);
+          g_variant_unref (members[1].value);
+        }
+      extract = (g_get_monotonic_time () - start) / (gdouble) iterations;
+
+      start = g_get_monotonic_time ();
+      for (j = 0; j < iterations; j++)
+        {
+          JsonGVariantMember member = { "missing", NULL, NULL };
+
+          json_gvariant_extract_members (json, length, &member, 1, NULL, NULL);
+        }
+      missing = (g_get_monotonic_time () - start) / (gdouble) iterations;
+
+      g_print ("%-8u %9" G_GSIZE_FORMAT " %14.2f %14.2f %14.2f\n",
+               sizes[i], length, convert, extract, missing);
+
+      g_free (json);
+    }
+}
+
+static GVariant *
+convert_compact (const gchar  *json,
+                 gsize         length,
+                 const gchar  *signature,
+                 GError      **error)
+{
+  return json_gvariant_deserialize_data_full (json, length, signature,
+                                              JSON_GVARIANT_FLAGS_COMPACT,
+                                              error);
+}
+
+static GVariant *
+convert_compact_serialized (const gchar  *json,
+                            gsize         length,
+                            const gchar  *signature,
+                            GError      **error)
+{
+  return json_gvariant_deserialize_data_full (json, length, signature,
+                                              JSON_GVARIANT_FLAGS_COMPACT |
+                                              JSON_GVARIANT_FLAGS_SERIALIZED,
+                                              error);
+}
+
+/* Cost of inferring compact types, which looks ahead at the values before
+ * converting them: the text is scanned once into a tape and replayed */
+static void
+bench_compact (void)
+{
+  static const gchar *names[] = { "cookies", "objects", "wide" };
+  gchar *payloads[3];
+  guint i;
+
+  payloads[0] = build_preseed (500);
+  payloads[1] = build_object_array (10000);
+  payloads[2] = build_wide_object (4096);
+
+  g_print ("\n%-8s %10s %14s %14s %16s\n",
+           "payload", "bytes", "plain (us)", "compact (us)", "serialized (us)");
+
+  for (i = 0; i < G_N_ELEMENTS (payloads); i++)
+    {
+      gsize length = strlen (payloads[i]);
+      guint iterations = MAX (10, 20000000 / length) * iterations_scale;
+      gdouble plain, compact, serialized;
+
+      plain = run (convert_stream, payloads[i], NULL, iterations);
+      compact = run (convert_compact, payloads[i], NULL, iterations);
+      serialized = run (convert_compact_serialized, payloads[i], NULL, iterations);
+
+      g_print ("%-8s %10" G_GSIZE_FORMAT " %14.2f %14.2f %16.2f\n",
+               names[i], length, plain, compact, serialized);
+    }
+
+  for (i = 0; i < G_N_ELEMENTS (payloads); i++)
+    g_free (payloads[i]);
+}
+
+/* Looks up every member of wide objects, linearly with
+ * g_variant_lookup_value() and with a binary search over the entries
+ * sorted by JSON_GVARIANT_FLAGS_SORTED, which makes the conversion itself
+ * a bit slower */
+static void
+bench_lookup (void)
+{
+  static const guint sizes[] = { 16, 256, 4096 };
+  guint i;
+
+  g_print ("\n%-8s %14s %14s %16s %16s %8s\n",
+           "members", "convert (us)", "sorted (us)", "linear (ns/get)", "sorted (ns/get)",
+           "speedup");
+
+  for (i = 0; i < G_N_ELEMENTS (sizes); i++)
+    {
+      gchar *json = build_wide_object (sizes[i]);
+      gsize length = strlen (json);
+      guint iterations = MAX (10, 20000 / sizes[i]) * iterations_scale;
+      GVariant *unsorted, *sorted;
+      gdouble convert, convert_sorted, linear, binary;
+      gint64 start;
+      guint j, k;
+
+      unsorted = json_gvariant_deserialize_data_full (json, length, "a{sv}",
+                                                      JSON_GVARIANT_FLAGS_SERIALIZED,
+                                                      NULL);
+      sorted = json_gvariant_deserialize_data_full (json, length, "a{sv}",
+                                                    JSON_GVARIANT_FLAGS_SERIALIZED |
+                                                    JSON_GVARIANT_FLAGS_SORTED,
+                                                    NULL);
+      g_variant_ref_sink (unsorted);
+      g_variant_ref_sink (sorted);
+
+      start = g_get_monotonic_time ();
+      for (j = 0; j < iterations; j++)
+        g_variant_unref (g_variant_ref_sink (json_gvariant_deserialize_data_full (json, length, "a{sv}",
+                                                                                  JSON_GVARIANT_FLAGS_SERIALIZED,
+                                                                                  NULL)));
+      convert = (g_get_monotonic_time () - start) / (gdouble) iterations;
+
+      start = g_get_monotonic_time ();
+      for (j = 0; j < iterations; j++)
+        g_variant_unref (g_variant_ref_sink (json_gvariant_deserialize_data_full (json, length, "a{sv}",
+                                                                                  JSON_GVARIANT_FLAGS_SERIALIZED |
+                                                                                  JSON_GVARIANT_FLAGS_SORTED,
+                                                                                  NULL)));
+      convert_sorted = (g_get_monotonic_time () - start) / (gdouble) iterations;
+
+      start = g_get_monotonic_time ();
+      for (k = 0; k < sizes[i]; k++)
+        {
+          gchar key[16];
+
+          g_snprintf (key, sizeof key, "key%u", k);
+          g_variant_unref (g_variant_lookup_value (unsorted, key, NULL));
+        }
+      linear = (g_get_monotonic_time () - start) * 1000.0 / sizes[i];
+
+      start = g_get_monotonic_time ();
+      for (k = 0; k < sizes[i]; k++)
+        {
+          gchar key[16];
+
+          g_snprintf (key, sizeof key, "key%u", k);
+          g_variant_unref (json_gvariant_lookup_value (sorted, key, NULL));
+        }
+      binary = (g_get_monotonic_time () - start) * 1000.0 / sizes[i];
+
+      g_print ("%-8u %14.2f %14.2f %16.1f %16.1f %7.2fx\n",
+               sizes[i], convert, convert_sorted, linear, binary,
+               linear / MAX (binary, 1.0));
+
+      g_variant_unref (unsorted);
+      g_variant_unref (sorted);
+      g_free (json);
+    }
+}
+
+/* Counts the JSON values in 'json', member names excluded */
+static guint
+count_nodes (const gchar *json,
+             gsize        length)
+{
+  JsonScanner scanner;
+  JsonToken token;
+  guint n_nodes = 0;
+
+  json_scanner_init (&scanner, json, length, NULL);
+
+  while ((token = json_scanner_next (&scanner, NULL)) > JSON_TOKEN_EOF)
+    {
+      switch (token)
+        {
+        case JSON_TOKEN_BEGIN_OBJECT:
+        case JSON_TOKEN_BEGIN_ARRAY:
+        case JSON_TOKEN_STRING:
+        case JSON_TOKEN_INT:
+        case JSON_TOKEN_DOUBLE:
+        case JSON_TOKEN_BOOLEAN:
+        case JSON_TOKEN_NULL:
+          n_nodes++;
+          break;
+        case JSON_TOKEN_COLON:
+          /* the string before was a member name */
+          n_nodes--;
+          break;
+        default:
+          break;
+        }
+    }
+
+  json_scanner_clear (&scanner);
+
+  return n_nodes;
+}
+
+static void
+bench_corpus_entry (const gchar *file,
+                    const gchar *signature,
+                    gboolean     first)
+{
+  ConvertFunc func = convert_corpus;
+  GError *error = NULL;
+  GVariant *variant;
+  gsize variant_size;
+  struct rusage usage;
+  gchar *path, *json;
+  gsize length;
+  guint n_nodes, iterations = 0;
+  gint allocations = -1;
+  guint scratch_allocations;
+  gssize retained;
+  gint64 start, elapsed;
+
+  path = g_build_filename (corpus_dir, file, NULL);
+  if (!g_file_get_contents (path, &json, &length, &error))
+    g_error ("Unable to read the corpus: %s", error->message);
+  g_free (path);
+
+  n_nodes = count_nodes (json, length);
+
+  /* the first call warms up the caches and the thread arena */
+  variant = func (json, length, signature, &error);
+  if (variant == NULL)
+    g_error ("Conversion of %s failed: %s", file, error->message);
+  /* the size of the serialized data, as sent over D-Bus */
+  variant_size = g_variant_get_size (variant);
+  g_variant_unref (g_variant_ref_sink (variant));
+
+  /* the memory still in use after the call is the one held by the result */
+  retained = get_heap_size ();
+#ifdef HAVE_ALLOCATION_COUNT
+  allocations = g_atomic_int_get (&n_allocations);
+#endif
+  variant = func (json, length, signature, NULL);
+#ifdef HAVE_ALLOCATION_COUNT
+  allocations = g_atomic_int_get (&n_allocations) - allocations;
+#endif
+  if (retained >= 0)
+    retained = get_heap_size () - retained;
+  scratch_allocations = json_gvariant_get_scratch_allocation_count ();
+  g_variant_unref (g_variant_ref_sink (variant));
+
+  /* run for at least 200ms per scale unit */
+  start = g_get_monotonic_time ();
+  do
+    {
+      variant = func (json, length, signature, NULL);
+      g_variant_unref (g_variant_ref_sink (variant));
+      iterations++;
+      elapsed = g_get_monotonic_time () - start;
+    }
+  while (iterations < 5 || elapsed < 200000 * iterations_scale);
+
+  getrusage (RUSAGE_SELF, &usage);
+
+  g_print ("%s    {\"file\": \"%s\", ", first ? "" : ",\n", file);
+  if (signature != NULL)
+    g_print ("\"signature\": \"%s\", ", signature);
+  else
+    g_print ("\"signature\": null, ");
+  g_print ("\"bytes\": %" G_GSIZE_FORMAT ", \"variant_bytes\": %" G_GSIZE_FORMAT ", "
+           "\"nodes\": %u, \"iterations\": %u, "
+           "\"mb_per_s\": %.2f, \"ns_per_node\": %.2f, ",
+           length, variant_size, n_nodes, iterations,
+           (gdouble) length * iterations / elapsed,
+           elapsed * 1000.0 / iterations / MAX (n_nodes, 1));
+  if (allocations >= 0)
+    g_print ("\"allocs_per_call\": %d, ", allocations);
+  else
+    g_print ("\"allocs_per_call\": null, ");
+  if (retained >= 0)
+    g_print ("\"retained_bytes\": %" G_GSSIZE_FORMAT ", ", retained);
+  else
+    g_print ("\"retained_bytes\": null, ");
+  /* ru_maxrss is in kilobytes on Linux */
+  g_print ("\"scratch_allocs_per_call\": %u, \"peak_rss_kb\": %ld}",
+           scratch_allocations, (glong) usage.ru_maxrss);
+
+  g_free (json);
+}
+
+/* Runs the conversion over the files listed in the corpus index, printing
+ * the results as JSON */
+static void
+bench_corpus (void)
+{
+  GError *error = NULL;
+  gchar *path, *index;
+  gchar **lines;
+  gboolean first = TRUE;
+  guint i;
+
+  path = g_build_filename (corpus_dir, "index", NULL);
+  if (!g_file_get_contents (path, &index, NULL, &error))
+    g_error ("Unable to read the corpus index: %s", error->message);
+  g_free (path);
+
+  g_print ("{\n");
+#ifdef PACKAGE_VERSION
+  g_print ("  \"version\": \"%s\",\n", PACKAGE_VERSION);
+#endif
+  g_print ("  \"mode\": \"%s%s%s%s\",\n",
+           corpus_serialized ? "serialized" : "data",
+           corpus_intern ? "+intern" : "",
+           corpus_compact ? "+compact" : "",
+           corpus_threads > 0 ? "+parallel" : "");
+  if (corpus_threads > 0)
+    g_print ("  \"threads\": %d,\n", corpus_threads);
+  g_print ("  \"results\": [\n");
+
+  lines = g_strsplit (index, "\n", -1);
+  for (i = 0; lines[i] != NULL; i++)
+    {
+      gchar **fields;
+      guint n_fields = 0;
+      guint j;
+
+      if (lines[i][0] == '#')
+        continue;
+
+      /* drop the empty fields between consecutive separators */
+      fields = g_strsplit_set (lines[i], " \t", -1);
+      for (j = 0; fields[j] != NULL; j++)
+        if (fields[j][0] != '\0')
+          fields[n_fields++] = fields[j];
+        else
+          g_free (fields[j]);
+      fields[n_fields] = NULL;
+
+      if (n_fields > 0)
+        {
+          bench_corpus_entry (fields[0], NULL, first);
+          first = FALSE;
+        }
+      if (n_fields > 1)
+        bench_corpus_entry (fields[0], fields[1], FALSE);
+
+      g_strfreev (fields);
+    }
+  g_strfreev (lines);
+  g_free (index);
+
+  g_print ("\n  ]\n}\n");
+}
+
+int
+main (int    argc,
+      char **argv)
+{
+  GOptionContext *context;
+  GError *error = NULL;
+  GOptionEntry entries[] = {
+    { "scale", 's', 0, G_OPTION_ARG_INT, &iterations_scale,
+      "Multiply the number of iterations by N", "N" },
+    { "corpus", 'c', 0, G_OPTION_ARG_FILENAME, &corpus_dir,
+      "Run over the corpus in DIR and print the results as JSON", "DIR" },
+    { "serialized", 0, 0, G_OPTION_ARG_NONE, &corpus_serialized,
+      "Convert the corpus with JSON_GVARIANT_FLAGS_SERIALIZED", NULL },
+    { "intern", 0, 0, G_OPTION_ARG_NONE, &corpus_intern,
+      "Convert the corpus with JSON_GVARIANT_FLAGS_INTERN", NULL },
+    { "compact", 0, 0, G_OPTION_ARG_NONE, &corpus_compact,
+      "Convert the corpus with JSON_GVARIANT_FLAGS_COMPACT", NULL },
+    { "threads", 0, 0, G_OPTION_ARG_INT, &corpus_threads,
+      "Convert the corpus with JSON_GVARIANT_FLAGS_PARALLEL on N threads", "N" },
+    { NULL }
+  };
+
+  context = g_option_context_new ("- benchmark the JSON to GVariant conversion");
+  g_option_context_add_main_entries (context, entries, NULL);
+  if (!g_option_context_parse (context, &argc, &argv, &error))
+    {
+      g_printerr ("%s\n", error->message);
+      return 1;
+    }
+  g_option_context_free (context);
+
+  if (corpus_dir != NULL)
+    {
+      if (corpus_serialized)
+        corpus_flags |= JSON_GVARIANT_FLAGS_SERIALIZED;
+      if (corpus_intern)
+        corpus_flags |= JSON_GVARIANT_FLAGS_INTERN;
+      if (corpus_compact)
+        corpus_flags |= JSON_GVARIANT_FLAGS_COMPACT;
+      if (corpus_threads > 0)
+        {
+          corpus_flags |= JSON_GVARIANT_FLAGS_PARALLEL;
+          json_gvariant_set_max_threads (corpus_threads);
+        }
+
+      bench_corpus ();
+      return 0;
+    }
+
+  bench_json_c_vs_stream ();
+  bench_tokener ();
+  bench_per_element ();
+  bench_array_scaling ();
+  bench_parallel_scaling ();
+  bench_batch ();
+  bench_round_trip ();
+  bench_lookup ();
+  bench_simd ();
+  bench_compact ();
+  bench_numbers ();
+  bench_preseed_cache ();
+  bench_generated ();
+  bench_extract ();
+
+  return 0;
+}
@@ -0,0 +1,2014 @@
+/* json-gvariant-check.c - Checks of the fast paths of the JSON conversion
+ *
+ * Copyright (C) 2013  Intel Corporation.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Author:
+ *   Emanuele Aina <emanuele.aina@collabora.com>
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <errno.h>
+#include <string.h>
+
+#include <glib.h>
+
+#include "goabrowser.h"
+#include "json-gvariant.h"
+#include "json-gvariant-private.h"
+#include "json-scanner.h"
+
+/* where the payloads of 'make bench' are, see corpus/index */
+#ifndef JSON_GVARIANT_CORPUS_DIR
+#define JSON_GVARIANT_CORPUS_DIR "corpus"
+#endif
+
+/* The number parsers, the vectorized loops of the scanner and the writer
+ * of serialized data all replace something simpler: each is compared
+ * here with what it replaces, over the values where they are the most
+ * likely to differ. The other ways of converting, validating or looking
+ * into the JSON texts are compared with the plain conversion of the same
+ * text or json-c tree. Run with 'make check'.
+ */
+
+/* ========================================================================== */
+/* Corpus */
+/* ========================================================================== */
+
+static const gchar *corpus_files[] = {
+  "cookies-50.json", "cookies-500.json", "cookies-5000.json",
+  "deep-nesting.json", "facebook-preseed.json", "google-preseed.json",
+  "wide-array-ints.json", "wide-array-objects.json"
+};
+
+static gchar *
+load_corpus_file (const gchar *name,
+                  gsize       *length)
+{
+  GError *error = NULL;
+  gchar *path, *json;
+
+  path = g_build_filename (JSON_GVARIANT_CORPUS_DIR, name, NULL);
+  if (!g_file_get_contents (path, &json, length, &error))
+    g_error ("Unable to load %s: %s", path, error->message);
+  g_free (path);
+
+  return json;
+}
+
+/* ========================================================================== */
+/* Numbers */
+/* ========================================================================== */
+
+static const gchar *integers[] = {
+  "0", "-0", "1", "-1", "7", "10", "99999999", "100000000", "-100000000",
+  "1234567890123456789", "-1234567890123456789",
+  "9223372036854775806", "9223372036854775807", "9223372036854775808",
+  "-9223372036854775807", "-9223372036854775808", "-9223372036854775809",
+  "9999999999999999999", "10000000000000000000", "-10000000000000000000",
+  "18446744073709551615", "18446744073709551616", "99999999999999999999",
+  "00000000000000000000000001", "-0000000000000000000009223372036854775808"
+};
+
+static const gchar *doubles[] = {
+  "0", "-0", "0.0", "-0.0", "0e0", "0.000e-999", "1", "-1", "1.5", "0.1",
+  "0.3", "1E+2", "1e-0", "3.141592653589793", "2.718281828459045",
+  "1e22", "1e23", "-1e23", "8.98846567431158e307",
+  "9007199254740992", "9007199254740993", "9007199254740995",
+  "9007199254740993e0", "900719925474099.3e1", "9007199254740993.0",
+  "1.8446744073709552e19", "18446744073709551615e0",
+  "1.7976931348623157e308", "1.7976931348623158e308",
+  "1.7976931348623159e308", "-1.7976931348623157e308", "1e308", "1e309",
+  "2.2250738585072011e-308", "2.2250738585072014e-308", "1e-307",
+  "1e-308", "4.9406564584124654e-324", "2.4703282292062328e-324",
+  "2.4703282292062327e-324", "1e-323", "1e-324", "1e-342", "1e-343",
+  "9999999999999999999e-342", "9999999999999999999e-343",
+  "9999999999999999999e288", "9999999999999999999e289",
+  "1234567890123456789e-40", "12345678901234567890e-5",
+  "0.000000000000000000000000000001", "1e100000", "1e-100000"
+};
+
+/* Fails unless 'string' converts as with g_ascii_strtoll() and
+ * g_ascii_strtoull() when the parsers convert it. Returns whether they do.
+ */
+static gboolean
+check_integer (const gchar *string)
+{
+  gsize length = strlen (string);
+  gboolean parsed = FALSE;
+  gint64 value;
+  guint64 unsigned_value;
+
+  if (json_scanner_parse_int64 (string, length, &value))
+    {
+      errno = 0;
+      g_assert_cmpint (value, ==, g_ascii_strtoll (string, NULL, 10));
+      g_assert_cmpint (errno, ==, 0);
+      parsed = TRUE;
+    }
+
+  if (json_scanner_parse_uint64 (string, length, &unsigned_value))
+    {
+      errno = 0;
+      g_assert_cmpuint (unsigned_value, ==, g_ascii_strtoull (string, NULL, 10));
+      g_assert_cmpint (errno, ==, 0);
+      parsed = TRUE;
+    }
+
+  return parsed;
+}
+
+/* Like check_integer(), comparing the bits of the results of
+ * json_scanner_parse_double() and g_ascii_strtod() */
+static gboolean
+check_double (const gchar *string)
+{
+  gdouble value, expected;
+
+  if (!json_scanner_parse_double (string, strlen (string), &value))
+    return FALSE;
+
+  errno = 0;
+  expected = g_ascii_strtod (string, NULL);
+  if (memcmp (&value, &expected, sizeof value) != 0 || errno != 0)
+    g_error ("%s parsed as %.17g instead of %.17g", string, value, expected);
+
+  return TRUE;
+}
+
+static void
+test_integers (void)
+{
+  gchar string[32];
+  guint i, n;
+
+  for (i = 0; i < G_N_ELEMENTS (integers); i++)
+    check_integer (integers[i]);
+
+  /* all the integers of up to 19 digits are parsed, whatever their digits */
+  for (n = 1; n <= 20; n++)
+    {
+      memset (string, '9', n);
+      string[n] = '\0';
+      g_assert (check_integer (string) || n == 20);
+
+      memset (string, '0', n);
+      string[0] = '1';
+      g_assert (check_integer (string) || n == 20);
+
+      for (i = 0; i < 100; i++)
+        {
+          guint j;
+
+          string[0] = '-';
+          for (j = 1; j <= n; j++)
+            string[j] = '0' + g_test_rand_int_range (0, 10);
+          string[n + 1] = '\0';
+
+          g_assert (check_integer (string + 1) || n == 20);
+          check_integer (string);
+        }
+    }
+}
+
+/* Prints the integer 'value' in 'string' as it is, and as a single digit
+ * followed by the others after the decimal point and an exponent */
+static void
+print_mantissa (gchar   *string,
+                gsize    size,
+                guint64  value,
+                gint     power,
+                gboolean point)
+{
+  gchar digits[32];
+  gint n;
+
+  n = g_snprintf (digits, sizeof digits, "%" G_GUINT64_FORMAT, value);
+
+  if (point && n > 1)
+    g_snprintf (string, size, "%c.%se%d", digits[0], digits + 1, power + n - 1);
+  else
+    g_snprintf (string, size, "%se%d", digits, power);
+}
+
+static void
+test_doubles (void)
+{
+  gchar string[64];
+  guint n_parsed = 0;
+  guint i, shift;
+  gint power;
+
+  for (i = 0; i < G_N_ELEMENTS (doubles); i++)
+    check_double (doubles[i]);
+
+  /* integers with 54 significant bits, the last one set, are exactly
+   * halfway between two doubles and must round to the even one */
+  for (i = 0; i < 1000; i++)
+    {
+      guint64 halfway = G_GUINT64_CONSTANT (1) << 53;
+
+      halfway |= (guint64) g_test_rand_int () << 21;
+      halfway |= (guint64) g_test_rand_int_range (0, 1 << 20) << 1;
+      halfway |= 1;
+
+      for (shift = 0; shift < 10 && halfway < G_GUINT64_CONSTANT (10000000000000000000); shift++)
+        {
+          g_snprintf (string, sizeof string, "%" G_GUINT64_FORMAT, halfway);
+          n_parsed += check_double (string);
+          print_mantissa (string, sizeof string, halfway, 0, FALSE);
+          n_parsed += check_double (string);
+          print_mantissa (string, sizeof string, halfway, 0, TRUE);
+          n_parsed += check_double (string);
+
+          halfway <<= 1;
+        }
+    }
+
+  /* all the powers of ten the parser knows about, and a few past them,
+   * with mantissas of up to 20 digits */
+  for (power = -350; power <= 315; power++)
+    {
+      for (i = 0; i < 20; i++)
+        {
+          guint64 mantissa = g_test_rand_int ();
+
+          mantissa = mantissa << 32 | (guint32) g_test_rand_int ();
+          mantissa >>= g_test_rand_int_range (0, 64);
+
+          print_mantissa (string, sizeof string, mantissa, power, i % 2 == 0);
+          n_parsed += check_double (string);
+        }
+
+      g_snprintf (string, sizeof string, "1e%d", power);
+      n_parsed += check_double (string);
+      g_snprintf (string, sizeof string, "-9999999999999999999e%d", power);
+      n_parsed += check_double (string);
+    }
+
+  /* most of them do not need GLib */
+  g_assert_cmpuint (n_parsed, >, 10000);
+}
+
+/* ========================================================================== */
+/* Strings */
+/* ========================================================================== */
+
+static const gchar *simd_names[] = { "scalar", "SSE2", "AVX2" };
+
+/* Compares json_scanner_find_special() with each instruction set to the
+ * scalar loop, over strings of up to 64 bytes starting at each offset
+ * from 0 to 32, with their special character and first non-ASCII byte
+ * at every position, or with none */
+static void
+test_simd (void)
+{
+  static const gchar specials[] = { '"', '\\', '\0', '\n', 0x1f };
+  JsonScannerSimd best, simd;
+  guint offset, length;
+  gint special, high;
+
+  json_scanner_set_simd (JSON_SCANNER_SIMD_AVX2);
+  best = json_scanner_get_simd ();
+
+  if (best == JSON_SCANNER_SIMD_NONE)
+    {
+      g_test_message ("Only the scalar loop is available");
+      return;
+    }
+
+  for (offset = 0; offset <= 32; offset++)
+    for (length = 0; length <= 64; length++)
+      {
+        /* exactly sized, so that reading past the end can be noticed */
+        gchar *data = g_malloc (MAX (offset + length, 1));
+        const gchar *p = data + offset;
+        const gchar *end = p + length;
+
+        for (special = -1; special < (gint) length; special++)
+          for (high = -1; high < (gint) length; high++)
+            {
+              const gchar *expected;
+              gboolean expected_non_ascii = FALSE;
+              guint i;
+
+              for (i = 0; i < offset + length; i++)
+                {
+                  /* every printable character but the special ones */
+                  data[i] = ' ' + (i * 7) % 95;
+                  if (data[i] == '"' || data[i] == '\\')
+                    data[i] = 'a';
+                }
+              if (special >= 0)
+                data[offset + special] = specials[special % G_N_ELEMENTS (specials)];
+              if (high >= 0)
+                data[offset + high] = high % 2 ? '\x80' : '\xff';
+
+              json_scanner_set_simd (JSON_SCANNER_SIMD_NONE);
+              expected = json_scanner_find_special (p, end, &expected_non_ascii);
+
+              for (simd = JSON_SCANNER_SIMD_SSE2; simd <= best; simd++)
+                {
+                  gboolean non_ascii = FALSE;
+                  const gchar *found;
+
+                  json_scanner_set_simd (simd);
+                  found = json_scanner_find_special (p, end, &non_ascii);
+
+                  if (found != expected || non_ascii != expected_non_ascii)
+                    g_error ("%s found %d (non-ASCII: %d) instead of %d (%d) "
+                             "at offset %u in %u bytes",
+                             simd_names[simd],
+                             (gint) (found - p), non_ascii,
+                             (gint) (expected - p), expected_non_ascii,
+                             offset, length);
+                }
+            }
+
+        g_free (data);
+      }
+
+  json_scanner_set_simd (best);
+}
+
+/* ========================================================================== */
+/* Serialized data */
+/* ========================================================================== */
+
+static const gchar *values[][2] = {
+  { "{\"provider\":\"google\",\"n\":[1,2.5,true,\"x\"]}", NULL },
+  { "{\"provider\":\"google\",\"n\":[1,2,3]}", "a{sv}" },
+  { "[1,2,3]", "ax" },
+  { "[1,\"a\",true]", "(xsb)" },
+  { "[1,\"a\"]", "(xsb)" },
+  { "{\"5\":\"x\",\"6\":\"y\"}", "a{is}" },
+  { "{\"5\":\"x\"}", "{is}" },
+  { "[null,3]", "amx" },
+  { "[[],[1]]", "aax" },
+  { "[[1,\"x\"],[2,\"y\"]]", "a(xs)" },
+  { "-5", "x" },
+  { "{\"a\":{\"b\":[]}}", NULL },
+  { "1", "mv" },
+  { "null", "mv" },
+  { "[[1,[2,\"a\"]]]", "a(x(xs))" },
+  { "{\"a\":{\"1\":[true]}}", "a{sa{iab}}" },
+  { "[1,2]", "ay" },
+  { "[]", "()" },
+  { "[[1,2,3],[4,5,6]]", "a(ynx)" },
+  { "[[1,[]],[2,[]]]", "a(y())" },
+  { "[\"a\",null,\"ccc\"]", "ams" },
+  { "[\"/a\",\"/b/c\"]", "ao" },
+  { "[\"/a\",\"b\"]", "ao" },
+  { "[\"a{sv}\",\"i\"]", "ag" },
+  { "{\"1\":1.5}", "a{nd}" },
+  { "[1,{\"a\":[null,[]]},\"s\",2.5]", NULL },
+  { "[3,4]", "(dd)" },
+  { "{\"a\":1,}", NULL },
+  { "{\"a\":1} x", NULL },
+  { "[1,[1,2]]", "(xmv)" },
+  { "\"\\u00e9\\ud83d\\ude00\"", "s" }
+};
+
+static const gchar *signatures[] = {
+  NULL, "av", "a{sv}", "aav", "v", "(iv)", "a{sas}", "mv"
+};
+
+/* Appends a random JSON value, nested 'depth' levels at most */
+static void
+append_random_value (GString *json,
+                     guint    depth)
+{
+  guint i, n;
+
+  switch (g_test_rand_int_range (depth > 0 ? 0 : 3, 11))
+    {
+    case 0:
+    case 1:
+      n = g_test_rand_int_range (0, 5);
+      g_string_append_c (json, '[');
+      for (i = 0; i < n; i++)
+        {
+          if (i > 0)
+            g_string_append_c (json, ',');
+          append_random_value (json, depth - 1);
+        }
+      g_string_append_c (json, ']');
+      break;
+
+    case 2:
+      n = g_test_rand_int_range (0, 4);
+      g_string_append_c (json, '{');
+      for (i = 0; i < n; i++)
+        {
+          if (i > 0)
+            g_string_append_c (json, ',');
+          g_string_append_printf (json, "\"k%d\":", g_test_rand_int_range (0, 4));
+          append_random_value (json, depth - 1);
+        }
+      g_string_append_c (json, '}');
+      break;
+
+    case 3:
+      g_string_append_printf (json, "%d", g_test_rand_int_range (-1000, 1000));
+      break;
+
+    case 4:
+      g_string_append_printf (json, "%d.%de%d",
+                              g_test_rand_int_range (0, 100),
+                              g_test_rand_int_range (0, 10),
+                              g_test_rand_int_range (-5, 5));
+      break;
+
+    case 5:
+      g_string_append (json, g_test_rand_bit () ? "true" : "false");
+      break;
+
+    case 6:
+      g_string_append (json, "null");
+      break;
+
+    case 7:
+      g_string_append (json, "\"ab\\u00e9\\\"c\"");
+      break;
+
+    default:
+      g_string_append_printf (json, "\"s%d\"", g_test_rand_int_range (0, 3));
+      break;
+    }
+}
+
+/* Converts 'json' with JSON_GVARIANT_FLAGS_SERIALIZED added to 'flags' and
+ * without it, and fails unless the data written is the normal form of the
+ * value built, or both fail with the same error */
+static void
+check_serialized (const gchar       *json,
+                  const gchar       *signature,
+                  JsonGVariantFlags  flags)
+{
+  GError *built_error = NULL, *written_error = NULL;
+  GVariant *built, *written, *normal;
+
+  built = json_gvariant_deserialize_data_full (json, -1, signature, flags,
+                                               &built_error);
+  written = json_gvariant_deserialize_data_full (json, -1, signature,
+                                                 flags | JSON_GVARIANT_FLAGS_SERIALIZED,
+                                                 &written_error);
+
+  if (built == NULL || written == NULL)
+    {
+      if (built != NULL || written != NULL)
+        g_error ("Only one conversion of %s as %s failed: %s", json,
+                 signature != NULL ? signature : "*",
+                 built_error != NULL ? built_error->message : written_error->message);
+
+      g_assert_error (written_error, built_error->domain, built_error->code);
+      g_assert_cmpstr (built_error->message, ==, written_error->message);
+      g_error_free (built_error);
+      g_error_free (written_error);
+      return;
+    }
+
+  g_variant_ref_sink (built);
+  g_variant_ref_sink (written);
+  normal = g_variant_get_normal_form (built);
+
+  g_assert_cmpstr (g_variant_get_type_string (normal), ==,
+                   g_variant_get_type_string (written));
+  g_assert (g_variant_is_normal_form (written));
+  /* the data of empty values can be NULL */
+  if (g_variant_get_size (normal) != g_variant_get_size (written) ||
+      (g_variant_get_size (normal) > 0 &&
+       memcmp (g_variant_get_data (normal), g_variant_get_data (written),
+               g_variant_get_size (normal)) != 0))
+    g_error ("The data written for %s as %s is not the normal form", json,
+             signature != NULL ? signature : "*");
+
+  g_variant_unref (normal);
+  g_variant_unref (written);
+  g_variant_unref (built);
+}
+
+static void
+test_serialized (void)
+{
+  static const JsonGVariantFlags flags[] = {
+    JSON_GVARIANT_FLAGS_NONE,
+    JSON_GVARIANT_FLAGS_COMPACT,
+    JSON_GVARIANT_FLAGS_SORTED | JSON_GVARIANT_FLAGS_INTERN
+  };
+  guint i, j, k;
+
+  for (i = 0; i < G_N_ELEMENTS (values); i++)
+    for (k = 0; k < G_N_ELEMENTS (flags); k++)
+      check_serialized (values[i][0], values[i][1], flags[k]);
+
+  for (i = 0; i < 2000; i++)
+    {
+      GString *json = g_string_new (NULL);
+
+      append_random_value (json, 6);
+
+      for (j = 0; j < G_N_ELEMENTS (signatures); j++)
+        for (k = 0; k < G_N_ELEMENTS (flags); k++)
+          check_serialized (json->str, signatures[j], flags[k]);
+
+      g_string_free (json, TRUE);
+    }
+
+  /* and the documents of the corpus */
+  for (i = 0; i < G_N_ELEMENTS (corpus_files); i++)
+    {
+      gchar *json = load_corpus_file (corpus_files[i], NULL);
+
+      for (j = 0; j < G_N_ELEMENTS (signatures); j++)
+        for (k = 0; k < G_N_ELEMENTS (flags); k++)
+          check_serialized (json, signatures[j], flags[k]);
+
+      g_free (json);
+    }
+}
+
+/* ========================================================================== */
+/* Collected data */
+/* ========================================================================== */
+
+static const gchar *cookies_files[] = {
+  "cookies-50.json", "cookies-500.json", "cookies-5000.json"
+};
+
+/* The cookies of the corpus, up to a full cookie jar, are within the
+ * limits of the collected data, and are converted as without them */
+static void
+test_collected_data_limits (void)
+{
+  const JsonGVariantLimits *limits = goabrowser_get_collected_data_limits ();
+  guint i;
+
+  for (i = 0; i < G_N_ELEMENTS (cookies_files); i++)
+    {
+      GError *error = NULL;
+      GVariant *preseed, *expected;
+      gsize length;
+      gchar *json;
+
+      json = load_corpus_file (cookies_files[i], &length);
+
+      json_gvariant_validate (json, length, "a{sv}", limits, NULL, &error);
+      g_assert_no_error (error);
+
+      preseed = goabrowser_parse_collected_data (json, length, &error);
+      g_assert_no_error (error);
+
+      expected = json_gvariant_deserialize_data_full (json, length, "a{sv}",
+                                                      JSON_GVARIANT_FLAGS_SORTED,
+                                                      &error);
+      g_assert_no_error (error);
+      g_variant_ref_sink (expected);
+      g_assert (g_variant_equal (preseed, expected));
+
+      g_variant_unref (expected);
+      g_variant_unref (preseed);
+      g_free (json);
+    }
+}
+
+/* The account found without converting the collected data is the one of
+ * the preseed, even with the same keys more than once */
+static void
+test_collected_data_duplicates (void)
+{
+  static const gchar *texts[] = {
+    "{\"provider\":\"google\",\"identity\":\"a@b.c\",\"provider\":\"facebook\"}",
+    "{\"identity\":\"a@b.c\",\"provider\":\"google\",\"cookies\":[],"
+    "\"identity\":\"d@e.f\",\"provider\":\"facebook\",\"identity\":\"g@h.i\"}"
+  };
+  guint i;
+
+  for (i = 0; i < G_N_ELEMENTS (texts); i++)
+    {
+      GError *error = NULL;
+      GVariant *preseed, *provider, *identity;
+      gchar *peeked_provider, *peeked_identity;
+
+      preseed = goabrowser_parse_collected_data (texts[i], -1, &error);
+      g_assert_no_error (error);
+      provider = json_gvariant_lookup_value (preseed, "provider", G_VARIANT_TYPE_STRING);
+      identity = json_gvariant_lookup_value (preseed, "identity", G_VARIANT_TYPE_STRING);
+
+      goabrowser_peek_collected_account (texts[i], -1,
+                                         &peeked_provider, &peeked_identity,
+                                         &error);
+      g_assert_no_error (error);
+
+      g_assert_cmpstr (peeked_provider, ==, "facebook");
+      g_assert_cmpstr (peeked_provider, ==, g_variant_get_string (provider, NULL));
+      g_assert_cmpstr (peeked_identity, ==, g_variant_get_string (identity, NULL));
+
+      g_free (peeked_provider);
+      g_free (peeked_identity);
+      g_variant_unref (identity);
+      g_variant_unref (provider);
+      g_variant_unref (preseed);
+    }
+}
+
+/* ========================================================================== */
+/* Limits */
+/* ========================================================================== */
+
+typedef struct
+{
+  const gchar        *json;
+  const gchar        *signature;
+  JsonGVariantLimits  limits;
+  gint                code;
+} LimitsCase;
+
+/* 'code' is the JSON_GVARIANT_ERROR expected, -1 for none */
+static const LimitsCase limits_cases[] = {
+  { "{\"a\":[1,2],\"bb\":\"xyz\"}", "a{sv}", { 0, 0, 0, 0 }, -1 },
+  { "{\"a\":[1,2],\"bb\":\"xyz\"}", "a{sv}", { 64, 10, 3, 8 }, -1 },
+  { "{\"a\":[1,2],\"bb\":\"xyz\"}", NULL, { 64, 10, 3, 8 }, -1 },
+  { "[1,2,3,4,5,6,7,8,9,10,11,12,13,14,15,16,17,18,19,20,21,22,23,24,25]", NULL,
+    { 64, 0, 0, 0 }, JSON_GVARIANT_ERROR_TOO_LARGE },
+  { "[1,2,3,4,5,6,7,8,9,10]", "ax", { 0, 10, 0, 0 }, JSON_GVARIANT_ERROR_TOO_MANY_NODES },
+  { "[1,2,3,4,5,6,7,8,9]", "ax", { 0, 10, 0, 0 }, -1 },
+  { "{\"a\":1,\"b\":2,\"c\":3,\"d\":4,\"e\":5}", NULL, { 0, 10, 0, 0 },
+    JSON_GVARIANT_ERROR_TOO_MANY_NODES },
+  { "[[[[1]]]]", NULL, { 0, 0, 3, 0 }, JSON_GVARIANT_ERROR_TOO_DEEP },
+  { "[[[1]]]", NULL, { 0, 0, 3, 0 }, -1 },
+  { "{\"a\":{\"b\":{\"c\":[]}}}", "a{sv}", { 0, 0, 3, 0 }, JSON_GVARIANT_ERROR_TOO_DEEP },
+  { "[\"123456789\"]", "as", { 0, 0, 0, 8 }, JSON_GVARIANT_ERROR_STRING_TOO_LONG },
+  { "[\"12345678\"]", "as", { 0, 0, 0, 8 }, -1 },
+  { "[\"1234567\\n\\n\"]", "as", { 0, 0, 0, 8 }, JSON_GVARIANT_ERROR_STRING_TOO_LONG },
+  { "[\"123456\\n\\n\"]", "as", { 0, 0, 0, 8 }, -1 },
+  { "{\"123456789\":1}", "a{sv}", { 0, 0, 0, 8 }, JSON_GVARIANT_ERROR_STRING_TOO_LONG }
+};
+
+/* Checks that 'error' is the one expected for 'test' */
+static void
+check_limits_error (const LimitsCase *test,
+                    GError           *error)
+{
+  if (test->code < 0)
+    g_assert_no_error (error);
+  else
+    g_assert_error (error, JSON_GVARIANT_ERROR, test->code);
+}
+
+/* The conversions and validations of texts past their limits fail with the
+ * error of the limit, whatever the flags, and the others convert as
+ * without limits */
+static void
+test_limits (void)
+{
+  JsonGVariantLimits node_limits = { 0, 1500, 0, 0 };
+  GError *error = NULL;
+  GVariant *variant;
+  GString *json;
+  gsize offset;
+  guint i;
+  gint flags;
+
+  for (flags = 0; flags < JSON_GVARIANT_FLAGS_SORTED << 1; flags++)
+    for (i = 0; i < G_N_ELEMENTS (limits_cases); i++)
+      {
+        const LimitsCase *test = &limits_cases[i];
+
+        variant = json_gvariant_deserialize_limited (test->json, -1, test->signature,
+                                                     flags, &test->limits, &error);
+        check_limits_error (test, error);
+        if (variant != NULL)
+          {
+            GVariant *expected;
+
+            expected = json_gvariant_deserialize_data_full (test->json, -1, test->signature,
+                                                            flags, &error);
+            g_assert_no_error (error);
+            g_assert (g_variant_equal (variant, expected));
+            g_variant_unref (g_variant_ref_sink (expected));
+            g_variant_unref (g_variant_ref_sink (variant));
+          }
+        g_clear_error (&error);
+
+        offset = G_MAXSIZE;
+        json_gvariant_validate (test->json, -1, test->signature, &test->limits,
+                                &offset, &error);
+        check_limits_error (test, error);
+        if (test->code == JSON_GVARIANT_ERROR_TOO_LARGE)
+          g_assert_cmpuint (offset, ==, 0);
+        else if (test->code >= 0)
+          g_assert_cmpuint (offset, >, 0);
+        g_clear_error (&error);
+
+        /* the members skipped are within the limits too */
+        if (flags == 0 && test->json[0] == '{')
+          {
+            JsonGVariantMember member = { "a", NULL, NULL };
+
+            json_gvariant_extract_members (test->json, -1, &member, 1,
+                                           &test->limits, &error);
+            check_limits_error (test, error);
+            if (member.value != NULL)
+              g_variant_unref (member.value);
+            g_clear_error (&error);
+          }
+      }
+
+  /* the elements of arrays split over threads are counted too */
+  json = g_string_new ("[");
+  for (i = 0; i < 2000; i++)
+    g_string_append_printf (json, "%s%u", i > 0 ? "," : "", i);
+  g_string_append_c (json, ']');
+
+  json_gvariant_set_max_threads (4);
+  variant = json_gvariant_deserialize_limited (json->str, json->len, "ax",
+                                               JSON_GVARIANT_FLAGS_PARALLEL,
+                                               &node_limits, &error);
+  g_assert (variant == NULL);
+  g_assert_error (error, JSON_GVARIANT_ERROR, JSON_GVARIANT_ERROR_TOO_MANY_NODES);
+  g_clear_error (&error);
+  node_limits.max_nodes = 2001;
+  variant = json_gvariant_deserialize_limited (json->str, json->len, "ax",
+                                               JSON_GVARIANT_FLAGS_PARALLEL,
+                                               &node_limits, &error);
+  g_assert_no_error (error);
+  g_variant_unref (g_variant_ref_sink (variant));
+  json_gvariant_set_max_threads (g_get_num_processors ());
+  g_string_free (json, TRUE);
+
+  /* the length given is checked before scanning the text */
+  node_limits.max_bytes = 10;
+  node_limits.max_nodes = 0;
+  json = g_string_new ("[\"xxxxxxxxxxxxxxxx\"]");
+  g_assert (json_gvariant_deserialize_limited (json->str, json->len, NULL,
+                                               JSON_GVARIANT_FLAGS_NONE,
+                                               &node_limits, &error) == NULL);
+  g_assert_error (error, JSON_GVARIANT_ERROR, JSON_GVARIANT_ERROR_TOO_LARGE);
+  g_clear_error (&error);
+  g_string_free (json, TRUE);
+}
+
+/* ========================================================================== */
+/* Compact types */
+/* ========================================================================== */
+
+/* Checks that 'json' converts with 'flags' as without them, or fails with
+ * the same error */
+static void
+check_same_conversion (const gchar       *json,
+                       gsize              length,
+                       const gchar       *signature,
+                       JsonGVariantFlags  reference_flags,
+                       JsonGVariantFlags  flags)
+{
+  GError *expected_error = NULL, *error = NULL;
+  GVariant *expected, *variant;
+
+  expected = json_gvariant_deserialize_data_full (json, length, signature,
+                                                  reference_flags, &expected_error);
+  variant = json_gvariant_deserialize_data_full (json, length, signature,
+                                                 flags, &error);
+
+  if (expected != NULL)
+    {
+      g_assert_no_error (error);
+      g_assert (g_variant_equal (variant, expected));
+      g_variant_unref (g_variant_ref_sink (variant));
+      g_variant_unref (g_variant_ref_sink (expected));
+    }
+  else
+    {
+      g_assert (variant == NULL);
+      g_assert_error (error, expected_error->domain, expected_error->code);
+      g_assert_cmpstr (error->message, ==, expected_error->message);
+      g_error_free (expected_error);
+      g_error_free (error);
+    }
+}
+
+/* Arrays split over threads replay the tape recorded for inferring the
+ * compact types, with the same results and errors */
+static void
+test_compact_parallel (void)
+{
+  static const gchar *signatures[] = { NULL, "av", "aa{sv}" };
+  GString *json;
+  gsize length;
+  gchar *objects;
+  guint i, j;
+
+  json_gvariant_set_max_threads (4);
+
+  objects = load_corpus_file ("wide-array-objects.json", &length);
+  for (i = 0; i < G_N_ELEMENTS (signatures); i++)
+    {
+      check_same_conversion (objects, length, signatures[i],
+                             JSON_GVARIANT_FLAGS_COMPACT,
+                             JSON_GVARIANT_FLAGS_COMPACT | JSON_GVARIANT_FLAGS_PARALLEL);
+      check_same_conversion (objects, length, signatures[i],
+                             JSON_GVARIANT_FLAGS_COMPACT | JSON_GVARIANT_FLAGS_SERIALIZED,
+                             JSON_GVARIANT_FLAGS_COMPACT | JSON_GVARIANT_FLAGS_SERIALIZED |
+                             JSON_GVARIANT_FLAGS_PARALLEL);
+    }
+  g_free (objects);
+
+  /* the first of the elements failing is the one reported */
+  json = g_string_new ("[");
+  for (i = 0; i < 3000; i++)
+    g_string_append_printf (json, "%s%s", i > 0 ? "," : "",
+                            i >= 700 && i % 3 == 0 ? "\"bad\"" : "[1,true]");
+  g_string_append_c (json, ']');
+
+  for (j = 0; j < 2; j++)
+    check_same_conversion (json->str, json->len, j == 0 ? NULL : "a(ib)",
+                           JSON_GVARIANT_FLAGS_COMPACT,
+                           JSON_GVARIANT_FLAGS_COMPACT | JSON_GVARIANT_FLAGS_PARALLEL);
+  g_string_free (json, TRUE);
+
+  json_gvariant_set_max_threads (g_get_num_processors ());
+}
+
+/* The types inferred for the values of the test */
+static const gchar *compact_types[][2] = {
+  { "[\"a\",\"b\"]", "as" },
+  { "[1,2,3]", "ax" },
+  { "[1,2.5]", "av" },
+  { "[]", "av" },
+  { "[[1],[]]", "aax" },
+  { "[1,null,2]", "amx" },
+  { "{\"a\":\"x\",\"b\":\"y\"}", "a{ss}" },
+  { "[{\"a\":\"x\"},{\"b\":2}]", "aa{sv}" },
+  { "[[\"a\",1],[\"b\",null]]", "a(smx)" },
+  { "[[\"a\",1],[\"b\",2,3]]", "aav" },
+  { "[[[1,\"a\"],[2,\"b\"]],[[3,\"c\"]]]", "aa(xs)" },
+  { "[{\"x\":[1,2]},{\"x\":[3]}]", "aa{sax}" },
+  { "[[1,[\"a\"]],[2,[]]]", "a(xas)" },
+  { "{\"a\":[null]}", "a{samv}" },
+  { "[[],null]", "amav" },
+  { "[[1,\"a\"],null,[2,\"b\"]]", "am(xs)" },
+  { "[[1,\"a\"],[2,\"b\"],[3,\"c\"],[4,\"d\"],[5,\"e\"],[6,\"f\"],[7,\"g\"],[8,\"h\"],"
+    "[9,\"i\"],[10,\"j\"],[11,\"k\"],[12,\"l\"],[13,\"m\"],[14,\"n\"],[15,\"o\"],"
+    "[16,\"p\"],[17,\"q\"],[18,\"r\"]]", "a(xs)" }
+};
+
+/* Converts 'json' from its text, or from its json-c tree if 'json_node' is
+ * not NULL, with 'flags', and returns the JSON text of the result */
+static gchar *
+convert_to_json (const gchar       *json,
+                 json_object       *json_node,
+                 const gchar       *signature,
+                 JsonGVariantFlags  flags)
+{
+  GError *error = NULL;
+  GVariant *variant;
+  gchar *converted;
+
+  if (json_node != NULL)
+    variant = json_gvariant_deserialize_full (json_node, signature, flags, &error);
+  else
+    variant = json_gvariant_deserialize_data_full (json, -1, signature, flags, &error);
+  g_assert_no_error (error);
+
+  g_variant_ref_sink (variant);
+  converted = json_gvariant_serialize_data (variant, NULL);
+  g_variant_unref (variant);
+
+  return converted;
+}
+
+/* Checks that 'json', which must be an array or an object, converts with
+ * JSON_GVARIANT_FLAGS_COMPACT to the same JSON as without it, from its text
+ * and from its json-c tree. The texts may have members with the same key,
+ * which the trees drop, so they are not compared with one another. */
+static void
+check_compact (const gchar *json,
+               const gchar *signature)
+{
+  GError *error = NULL;
+  json_object *json_node;
+  gchar *expected, *converted;
+
+  json_node = json_gvariant_parse_data (json, -1, &error);
+  g_assert_no_error (error);
+
+  expected = convert_to_json (json, NULL, signature, JSON_GVARIANT_FLAGS_NONE);
+  converted = convert_to_json (json, NULL, signature, JSON_GVARIANT_FLAGS_COMPACT);
+  g_assert_cmpstr (converted, ==, expected);
+  g_free (converted);
+  g_free (expected);
+
+  expected = convert_to_json (json, json_node, signature, JSON_GVARIANT_FLAGS_NONE);
+  converted = convert_to_json (json, json_node, signature, JSON_GVARIANT_FLAGS_COMPACT);
+  g_assert_cmpstr (converted, ==, expected);
+  g_free (converted);
+  g_free (expected);
+
+  /* the serialized conversion infers the same types */
+  check_same_conversion (json, strlen (json), signature,
+                         JSON_GVARIANT_FLAGS_COMPACT,
+                         JSON_GVARIANT_FLAGS_COMPACT | JSON_GVARIANT_FLAGS_SERIALIZED);
+
+  json_object_put (json_node);
+}
+
+/* The types inferred hold the same JSON values, for the texts as for the
+ * json-c trees */
+static void
+test_compact_types (void)
+{
+  GError *error = NULL;
+  json_object *json_node;
+  GVariant *variant, *expected;
+  gsize length;
+  gchar *json;
+  guint i, j;
+
+  for (i = 0; i < G_N_ELEMENTS (compact_types); i++)
+    {
+      variant = json_gvariant_deserialize_data_full (compact_types[i][0], -1, NULL,
+                                                     JSON_GVARIANT_FLAGS_COMPACT, &error);
+      g_assert_no_error (error);
+      g_assert_cmpstr (g_variant_get_type_string (variant), ==, compact_types[i][1]);
+      g_variant_unref (g_variant_ref_sink (variant));
+
+      check_compact (compact_types[i][0], NULL);
+    }
+
+  for (i = 0; i < 1000; i++)
+    {
+      GString *random = g_string_new ("[");
+
+      append_random_value (random, 6);
+      g_string_append_c (random, ']');
+      for (j = 0; j < G_N_ELEMENTS (signatures); j++)
+        {
+          GVariant *plain;
+
+          plain = json_gvariant_deserialize_data (random->str, random->len, signatures[j], NULL);
+          if (plain == NULL)
+            continue;
+          g_variant_unref (g_variant_ref_sink (plain));
+
+          check_compact (random->str, signatures[j]);
+        }
+      g_string_free (random, TRUE);
+    }
+
+  /* the texts without members with the same key infer as the trees */
+  for (i = 0; i < G_N_ELEMENTS (cookies_files); i++)
+    {
+      json = load_corpus_file (cookies_files[i], &length);
+      json_node = json_gvariant_parse_data (json, length, &error);
+      g_assert_no_error (error);
+
+      for (j = 0; j < 2; j++)
+        {
+          const gchar *signature = j == 0 ? NULL : "a{sv}";
+
+          variant = json_gvariant_deserialize_data_full (json, length, signature,
+                                                         JSON_GVARIANT_FLAGS_COMPACT, &error);
+          g_assert_no_error (error);
+          expected = json_gvariant_deserialize_full (json_node, signature,
+                                                     JSON_GVARIANT_FLAGS_COMPACT, &error);
+          g_assert_no_error (error);
+          g_assert (g_variant_equal (variant, expected));
+          g_variant_unref (g_variant_ref_sink (variant));
+          g_variant_unref (g_variant_ref_sink (expected));
+        }
+
+      json_object_put (json_node);
+      g_free (json);
+    }
+}
+
+/* ========================================================================== */
+/* Nesting */
+/* ========================================================================== */
+
+static const JsonGVariantFlags text_flags[] = {
+  JSON_GVARIANT_FLAGS_NONE,
+  JSON_GVARIANT_FLAGS_COMPACT,
+  JSON_GVARIANT_FLAGS_SERIALIZED,
+  JSON_GVARIANT_FLAGS_SERIALIZED | JSON_GVARIANT_FLAGS_COMPACT
+};
+
+/* Converts 'json' reading it from a stream */
+static GVariant *
+deserialize_stream (const gchar       *json,
+                    gsize              length,
+                    const gchar       *signature,
+                    JsonGVariantFlags  flags,
+                    GError           **error)
+{
+  GInputStream *stream;
+  GVariant *variant;
+
+  stream = g_memory_input_stream_new_from_data (json, length, NULL);
+  variant = json_gvariant_deserialize_stream (stream, signature, flags, NULL, error);
+  g_object_unref (stream);
+
+  return variant;
+}
+
+/* The deepest document of the corpus is converted from its text as from
+ * the json-c tree, which is not converted recursively */
+static void
+test_nesting_deep (void)
+{
+  static const gchar *signatures[] = { NULL, "a{sv}" };
+  GError *error = NULL;
+  json_object *json_node;
+  gsize length;
+  gchar *json;
+  guint i, j;
+
+  json = load_corpus_file ("deep-nesting.json", &length);
+  json_node = json_gvariant_parse_data (json, length, &error);
+  g_assert_no_error (error);
+
+  for (i = 0; i < G_N_ELEMENTS (signatures); i++)
+    {
+      GVariant *expected, *variant;
+
+      for (j = 0; j < G_N_ELEMENTS (text_flags); j++)
+        {
+          expected = json_gvariant_deserialize_full (json_node, signatures[i],
+                                                     text_flags[j], &error);
+          g_assert_no_error (error);
+          g_variant_ref_sink (expected);
+
+          variant = json_gvariant_deserialize_data_full (json, length, signatures[i],
+                                                         text_flags[j], &error);
+          g_assert_no_error (error);
+          g_assert (g_variant_equal (variant, expected));
+          g_variant_unref (g_variant_ref_sink (variant));
+
+          /* the types are not inferred when reading from a stream */
+          if (!(text_flags[j] & JSON_GVARIANT_FLAGS_COMPACT))
+            {
+              variant = deserialize_stream (json, length, signatures[i],
+                                            text_flags[j], &error);
+              g_assert_no_error (error);
+              g_assert (g_variant_equal (variant, expected));
+              g_variant_unref (g_variant_ref_sink (variant));
+            }
+
+          g_variant_unref (expected);
+        }
+
+      json_gvariant_validate (json, length, signatures[i], NULL, NULL, &error);
+      g_assert_no_error (error);
+    }
+
+  json_object_put (json_node);
+  g_free (json);
+}
+
+/* Text nested deeper than the converters can recurse fails with an error
+ * even when the global limit is higher, like text nested deeper than the
+ * global limit */
+static void
+test_nesting_too_deep (void)
+{
+  static const guint depths[] = { 256, JSON_SCANNER_MAX_DEPTH };
+  guint i, j;
+
+  for (i = 0; i < G_N_ELEMENTS (depths); i++)
+    {
+      GError *error = NULL;
+      GString *json;
+      GVariant *variant;
+      guint k;
+
+      json = g_string_new (NULL);
+      for (k = 0; k <= depths[i]; k++)
+        g_string_append (json, "[1,");
+      g_string_append (json, "1");
+      for (k = 0; k <= depths[i]; k++)
+        g_string_append_c (json, ']');
+
+      json_gvariant_set_max_depth (i == 0 ? depths[i] : G_MAXINT);
+
+      for (j = 0; j < G_N_ELEMENTS (text_flags); j++)
+        {
+          variant = json_gvariant_deserialize_data_full (json->str, json->len, NULL,
+                                                         text_flags[j], &error);
+          g_assert (variant == NULL);
+          g_assert_error (error, JSON_GVARIANT_ERROR, JSON_GVARIANT_ERROR_TOO_DEEP);
+          g_clear_error (&error);
+
+          variant = deserialize_stream (json->str, json->len, NULL, text_flags[j], &error);
+          g_assert (variant == NULL);
+          g_assert_error (error, JSON_GVARIANT_ERROR, JSON_GVARIANT_ERROR_TOO_DEEP);
+          g_clear_error (&error);
+        }
+
+      g_assert (!json_gvariant_validate (json->str, json->len, NULL, NULL, NULL, &error));
+      g_assert_error (error, JSON_GVARIANT_ERROR, JSON_GVARIANT_ERROR_TOO_DEEP);
+      g_clear_error (&error);
+
+      g_string_free (json, TRUE);
+    }
+
+  json_gvariant_set_max_depth (256);
+}
+
+/* ========================================================================== */
+/* Scratch memory */
+/* ========================================================================== */
+
+/* Once the scratch memory of the thread has grown to the size needed, the
+ * same conversion does not get any more from the heap */
+static void
+test_scratch_allocations (void)
+{
+  static const struct
+  {
+    const gchar       *signature;
+    JsonGVariantFlags  flags;
+  } conversions[] = {
+    { NULL, JSON_GVARIANT_FLAGS_NONE },
+    { "a{sv}", JSON_GVARIANT_FLAGS_NONE },
+    { NULL, JSON_GVARIANT_FLAGS_COMPACT },
+    { NULL, JSON_GVARIANT_FLAGS_COMPACT | JSON_GVARIANT_FLAGS_SERIALIZED }
+  };
+  gsize length;
+  gchar *json;
+  guint i, j;
+
+  json = load_corpus_file ("cookies-500.json", &length);
+
+  for (i = 0; i < G_N_ELEMENTS (conversions); i++)
+    for (j = 0; j < 2; j++)
+      {
+        GError *error = NULL;
+        GVariant *variant;
+
+        variant = json_gvariant_deserialize_data_full (json, length,
+                                                       conversions[i].signature,
+                                                       conversions[i].flags,
+                                                       &error);
+        g_assert_no_error (error);
+        g_variant_unref (g_variant_ref_sink (variant));
+
+        if (j > 0)
+          g_assert_cmpuint (json_gvariant_get_scratch_allocation_count (), ==, 0);
+      }
+
+  g_free (json);
+}
+
+/* ========================================================================== */
+/* Validation */
+/* ========================================================================== */
+
+/* Checks that 'json' validates if it converts, or fails with the same
+ * error */
+static void
+check_validate (const gchar *json,
+                const gchar *signature)
+{
+  GError *expected_error = NULL, *error = NULL;
+  GVariant *expected;
+  gsize offset = G_MAXSIZE;
+  gboolean valid;
+
+  expected = json_gvariant_deserialize_data (json, -1, signature, &expected_error);
+  valid = json_gvariant_validate (json, -1, signature, NULL, &offset, &error);
+
+  if (expected != NULL)
+    {
+      g_assert (valid);
+      g_assert_no_error (error);
+      g_variant_unref (g_variant_ref_sink (expected));
+    }
+  else
+    {
+      g_assert (!valid);
+      g_assert_error (error, expected_error->domain, expected_error->code);
+      g_assert_cmpstr (error->message, ==, expected_error->message);
+      g_assert_cmpuint (offset, <=, strlen (json));
+      g_error_free (expected_error);
+      g_error_free (error);
+    }
+}
+
+static void
+test_validate (void)
+{
+  gsize length;
+  gchar *json;
+  guint i, j;
+
+  for (i = 0; i < G_N_ELEMENTS (values); i++)
+    {
+      check_validate (values[i][0], values[i][1]);
+      for (j = 0; j < G_N_ELEMENTS (signatures); j++)
+        check_validate (values[i][0], signatures[j]);
+    }
+
+  /* nothing is allocated once the buffer of the thread is large enough */
+  json = load_corpus_file ("cookies-500.json", &length);
+  for (i = 0; i < 2; i++)
+    {
+      g_assert (json_gvariant_validate (json, length, "a{sv}", NULL, NULL, NULL));
+      if (i > 0)
+        g_assert_cmpuint (json_gvariant_get_scratch_allocation_count (), ==, 0);
+    }
+  g_free (json);
+}
+
+/* ========================================================================== */
+/* Member extraction */
+/* ========================================================================== */
+
+/* Checks that the member 'key' of the object in 'json' is extracted as its
+ * value in the json-c tree is converted */
+static void
+check_extract_member (const gchar *json,
+                      const gchar *key,
+                      const gchar *signature)
+{
+  JsonGVariantMember member = { key, signature, NULL };
+  GError *expected_error = NULL, *error = NULL;
+  GVariant *expected = NULL;
+  json_object *json_node;
+  gboolean found;
+
+  json_node = json_gvariant_parse_data (json, -1, NULL);
+  g_assert (json_node != NULL);
+  found = FALSE;
+  {
+    /* json-c keeps the last of the members with the same key */
+    json_object_object_foreach (json_node, member_key, member_value)
+      if (strcmp (member_key, key) == 0)
+        {
+          expected = json_gvariant_deserialize (member_value, signature, &expected_error);
+          found = TRUE;
+        }
+  }
+
+  if (!found || expected != NULL)
+    {
+      g_assert (json_gvariant_extract_members (json, -1, &member, 1, NULL, &error));
+      g_assert_no_error (error);
+      if (found)
+        {
+          g_assert (member.value != NULL);
+          g_assert (g_variant_equal (member.value, expected));
+          g_variant_unref (member.value);
+          g_variant_unref (g_variant_ref_sink (expected));
+        }
+      else
+        {
+          g_assert (member.value == NULL);
+        }
+    }
+  else
+    {
+      g_assert (!json_gvariant_extract_members (json, -1, &member, 1, NULL, &error));
+      g_assert (member.value == NULL);
+      g_assert_error (error, expected_error->domain, expected_error->code);
+      g_error_free (expected_error);
+      g_error_free (error);
+    }
+
+  json_object_put (json_node);
+}
+
+/* The members are extracted as the json-c tree converts them, the last
+ * of the ones with the same key included */
+static void
+test_extract_members (void)
+{
+  static const gchar *objects[] = {
+    "{}",
+    "{\"a\":1,\"b\":[1,2],\"a\":\"x\"}",
+    "{\"a\":{\"b\":[true,null]},\"c\":\"d\",\"b\":[]}",
+    "{\"c\":[\"x\",\"y\"],\"a\":[[1,2],{\"a\":1}],\"b\":-3}"
+  };
+  static const gchar *keys[] = { "a", "b", "c", "missing" };
+  static const gchar *member_signatures[] = { NULL, "s", "x", "ax", "as", "v", "a{sv}", "mv" };
+  static const gchar *malformed[] = {
+    "{\"a\":1", "{\"a\":1} x", "[1]", "{\"a\" 1}", "{\"b\":[1,}"
+  };
+  JsonGVariantMember members[] = {
+    { "identity", "s", NULL },
+    { "provider", NULL, NULL },
+    { "cookies", "aa{sv}", NULL }
+  };
+  GError *error = NULL;
+  GVariant *expected;
+  gsize length;
+  gchar *json;
+  guint i, j, k;
+
+  for (i = 0; i < G_N_ELEMENTS (objects); i++)
+    for (j = 0; j < G_N_ELEMENTS (keys); j++)
+      for (k = 0; k < G_N_ELEMENTS (member_signatures); k++)
+        check_extract_member (objects[i], keys[j], member_signatures[k]);
+
+  /* the errors of the text are those of its conversion to a dictionary */
+  for (i = 0; i < G_N_ELEMENTS (malformed); i++)
+    {
+      GError *expected_error = NULL;
+
+      g_assert (json_gvariant_deserialize_data (malformed[i], -1, "a{sv}", &expected_error) == NULL);
+      g_assert (!json_gvariant_extract_members (malformed[i], -1, members, 1, NULL, &error));
+      g_assert_error (error, expected_error->domain, expected_error->code);
+      g_clear_error (&expected_error);
+      g_clear_error (&error);
+    }
+
+  /* a few members of the collected data */
+  json = load_corpus_file ("cookies-500.json", &length);
+  expected = json_gvariant_deserialize_data_full (json, length, "a{sv}",
+                                                  JSON_GVARIANT_FLAGS_SORTED, &error);
+  g_assert_no_error (error);
+  g_variant_ref_sink (expected);
+
+  g_assert (json_gvariant_extract_members (json, length, members,
+                                           G_N_ELEMENTS (members), NULL, &error));
+  g_assert_no_error (error);
+  for (i = 0; i < G_N_ELEMENTS (members); i++)
+    {
+      GVariant *value;
+
+      value = json_gvariant_lookup_value (expected, members[i].key, NULL);
+      if (members[i].signature != NULL)
+        g_assert_cmpstr (g_variant_get_type_string (members[i].value), ==, members[i].signature);
+      else
+        g_assert (g_variant_equal (members[i].value, value));
+      g_variant_unref (members[i].value);
+      g_variant_unref (value);
+    }
+
+  g_variant_unref (expected);
+  g_free (json);
+}
+
+/* ========================================================================== */
+/* Streams */
+/* ========================================================================== */
+
+/* Checks that 'variant', or 'error', is what 'json' converts to from its
+ * text with 'flags' */
+static void
+check_stream_conversion (const gchar       *json,
+                         gsize              length,
+                         const gchar       *signature,
+                         JsonGVariantFlags  flags,
+                         GVariant          *variant,
+                         GError            *error)
+{
+  GError *expected_error = NULL;
+  GVariant *expected;
+
+  expected = json_gvariant_deserialize_data_full (json, length, signature,
+                                                  flags, &expected_error);
+  if (expected != NULL)
+    {
+      g_assert_no_error (error);
+      g_assert (g_variant_equal (variant, expected));
+      g_variant_unref (g_variant_ref_sink (expected));
+    }
+  else
+    {
+      g_assert (variant == NULL);
+      g_assert_error (error, expected_error->domain, expected_error->code);
+      g_assert_cmpstr (error->message, ==, expected_error->message);
+      g_error_free (expected_error);
+    }
+}
+
+static void
+stream_converted (GObject      *source_object,
+                  GAsyncResult *result,
+                  gpointer      user_data)
+{
+  GAsyncResult **stream_result = user_data;
+
+  *stream_result = g_object_ref (result);
+}
+
+/* Streams, read at once or asynchronously, convert as the texts they
+ * hold, in chunks smaller than some of the tokens */
+static void
+test_stream (void)
+{
+  static const JsonGVariantFlags stream_flags[] = {
+    JSON_GVARIANT_FLAGS_NONE,
+    JSON_GVARIANT_FLAGS_SERIALIZED
+  };
+  GCancellable *cancellable;
+  GInputStream *stream;
+  GError *error = NULL;
+  GVariant *variant;
+  gsize length;
+  gchar *json;
+  guint i, j;
+
+  for (i = 0; i < G_N_ELEMENTS (stream_flags); i++)
+    {
+      for (j = 0; j < G_N_ELEMENTS (values); j++)
+        {
+          length = strlen (values[j][0]);
+          variant = deserialize_stream (values[j][0], length, values[j][1],
+                                        stream_flags[i], &error);
+          check_stream_conversion (values[j][0], length, values[j][1],
+                                   stream_flags[i], variant, error);
+          if (variant != NULL)
+            g_variant_unref (variant);
+          g_clear_error (&error);
+        }
+
+      for (j = 0; j < G_N_ELEMENTS (cookies_files); j++)
+        {
+          GAsyncResult *result = NULL;
+
+          json = load_corpus_file (cookies_files[j], &length);
+
+          variant = deserialize_stream (json, length, "a{sv}", stream_flags[i], &error);
+          check_stream_conversion (json, length, "a{sv}", stream_flags[i], variant, error);
+          g_variant_unref (variant);
+
+          /* the callback is invoked in the main context of the caller */
+          stream = g_memory_input_stream_new_from_data (json, length, NULL);
+          json_gvariant_deserialize_stream_async (stream, NULL, stream_flags[i],
+                                                  NULL, stream_converted, &result);
+          while (result == NULL)
+            g_main_context_iteration (NULL, TRUE);
+          variant = json_gvariant_deserialize_stream_finish (stream, result, &error);
+          check_stream_conversion (json, length, NULL, stream_flags[i], variant, error);
+          g_variant_unref (variant);
+          g_object_unref (result);
+          g_object_unref (stream);
+
+          /* a truncated stream fails as the truncated text */
+          variant = deserialize_stream (json, length / 2, NULL, stream_flags[i], &error);
+          check_stream_conversion (json, length / 2, NULL, stream_flags[i], variant, error);
+          g_clear_error (&error);
+
+          g_free (json);
+        }
+    }
+
+  /* a cancelled conversion fails as such */
+  cancellable = g_cancellable_new ();
+  g_cancellable_cancel (cancellable);
+  stream = g_memory_input_stream_new_from_data ("[1,2]", -1, NULL);
+  variant = json_gvariant_deserialize_stream (stream, NULL, JSON_GVARIANT_FLAGS_NONE,
+                                              cancellable, &error);
+  g_assert (variant == NULL);
+  g_assert_error (error, G_IO_ERROR, G_IO_ERROR_CANCELLED);
+  g_clear_error (&error);
+  g_object_unref (stream);
+  g_object_unref (cancellable);
+}
+
+/* ========================================================================== */
+/* Batches */
+/* ========================================================================== */
+
+/* Each document of a batch gets the result or the error of its own
+ * conversion, with the documents failing mixed with the others */
+static void
+test_batch (void)
+{
+  guint n_documents = G_N_ELEMENTS (values) + G_N_ELEMENTS (cookies_files);
+  JsonGVariantDocument *documents;
+  GVariant **results;
+  GError **errors;
+  gboolean all_converted;
+  gchar **corpus;
+  guint i, j;
+
+  documents = g_new0 (JsonGVariantDocument, n_documents);
+  corpus = g_new0 (gchar *, G_N_ELEMENTS (cookies_files) + 1);
+  for (i = 0; i < G_N_ELEMENTS (values); i++)
+    {
+      documents[i].json = values[i][0];
+      documents[i].length = -1;
+      documents[i].signature = values[i][1];
+    }
+  for (i = 0; i < G_N_ELEMENTS (cookies_files); i++)
+    {
+      gsize length;
+
+      corpus[i] = load_corpus_file (cookies_files[i], &length);
+      documents[G_N_ELEMENTS (values) + i].json = corpus[i];
+      documents[G_N_ELEMENTS (values) + i].length = length;
+      documents[G_N_ELEMENTS (values) + i].signature = i % 2 ? NULL : "a{sv}";
+    }
+
+  results = g_new0 (GVariant *, n_documents);
+  errors = g_new0 (GError *, n_documents);
+
+  for (i = 0; i < G_N_ELEMENTS (text_flags); i++)
+    {
+      gboolean expected_all_converted = TRUE;
+
+      all_converted = json_gvariant_deserialize_batch (documents, n_documents,
+                                                       text_flags[i] | JSON_GVARIANT_FLAGS_PARALLEL,
+                                                       results, errors);
+
+      for (j = 0; j < n_documents; j++)
+        {
+          GError *expected_error = NULL;
+          GVariant *expected;
+
+          expected = json_gvariant_deserialize_data_full (documents[j].json,
+                                                          documents[j].length,
+                                                          documents[j].signature,
+                                                          text_flags[i],
+                                                          &expected_error);
+          if (expected != NULL)
+            {
+              g_assert (results[j] != NULL);
+              g_assert (errors[j] == NULL);
+              g_assert (g_variant_equal (results[j], expected));
+              g_variant_unref (g_variant_ref_sink (expected));
+              g_variant_unref (results[j]);
+            }
+          else
+            {
+              g_assert (results[j] == NULL);
+              g_assert_error (errors[j], expected_error->domain, expected_error->code);
+              g_assert_cmpstr (errors[j]->message, ==, expected_error->message);
+              g_error_free (expected_error);
+              g_clear_error (&errors[j]);
+              expected_all_converted = FALSE;
+            }
+        }
+
+      g_assert_cmpint (all_converted, ==, expected_all_converted);
+    }
+
+  /* the errors can be left out */
+  g_assert (!json_gvariant_deserialize_batch (documents, n_documents,
+                                              JSON_GVARIANT_FLAGS_NONE,
+                                              results, NULL));
+  for (j = 0; j < n_documents; j++)
+    if (results[j] != NULL)
+      g_variant_unref (results[j]);
+
+  /* and an empty batch succeeds */
+  g_assert (json_gvariant_deserialize_batch (NULL, 0, JSON_GVARIANT_FLAGS_NONE, NULL, NULL));
+
+  g_free (errors);
+  g_free (results);
+  g_strfreev (corpus);
+  g_free (documents);
+}
+
+/* ========================================================================== */
+/* Sorted dictionaries */
+/* ========================================================================== */
+
+/* Checks that the dictionaries in 'variant' have their keys in increasing
+ * order, each one only once */
+static void
+check_sorted (GVariant *variant)
+{
+  GVariant *previous = NULL;
+  gboolean dictionary;
+  gsize i, n;
+
+  if (g_variant_is_of_type (variant, G_VARIANT_TYPE_VARIANT))
+    {
+      GVariant *boxed = g_variant_get_variant (variant);
+
+      check_sorted (boxed);
+      g_variant_unref (boxed);
+      return;
+    }
+
+  if (!g_variant_is_container (variant))
+    return;
+
+  dictionary = g_variant_is_of_type (variant, G_VARIANT_TYPE ("a{s*}"));
+  n = g_variant_n_children (variant);
+  for (i = 0; i < n; i++)
+    {
+      GVariant *child = g_variant_get_child_value (variant, i);
+
+      if (dictionary)
+        {
+          GVariant *key = g_variant_get_child_value (child, 0);
+
+          if (previous != NULL)
+            {
+              g_assert_cmpint (g_variant_compare (previous, key), <, 0);
+              g_variant_unref (previous);
+            }
+          previous = key;
+        }
+
+      check_sorted (child);
+      g_variant_unref (child);
+    }
+
+  if (previous != NULL)
+    g_variant_unref (previous);
+}
+
+/* Checks that the members of the object in 'json' are found in its SORTED
+ * conversion with 'flags' as by GLib, and that it is the conversion of
+ * the json-c tree, which keeps the last of the members with the same key.
+ * The types inferred for the text by JSON_GVARIANT_FLAGS_COMPACT also
+ * account for the members replaced, so only the keys are compared then.
+ */
+static void
+check_sorted_lookups (const gchar       *json,
+                      gsize              length,
+                      const gchar       *signature,
+                      JsonGVariantFlags  flags)
+{
+  GError *error = NULL;
+  GVariant *sorted, *expected, *value, *expected_value;
+  json_object *json_node;
+  gsize i;
+
+  sorted = json_gvariant_deserialize_data_full (json, length, signature,
+                                                flags | JSON_GVARIANT_FLAGS_SORTED, &error);
+  g_assert_no_error (error);
+  g_variant_ref_sink (sorted);
+  check_sorted (sorted);
+
+  json_node = json_gvariant_parse_data (json, length, &error);
+  g_assert_no_error (error);
+  expected = json_gvariant_deserialize_full (json_node, signature,
+                                             flags | JSON_GVARIANT_FLAGS_SORTED, &error);
+  g_assert_no_error (error);
+  g_variant_ref_sink (expected);
+  if (!(flags & JSON_GVARIANT_FLAGS_COMPACT))
+    g_assert (g_variant_equal (sorted, expected));
+  g_assert_cmpuint (g_variant_n_children (sorted), ==,
+                    json_object_object_length (json_node));
+
+  for (i = 0; i < g_variant_n_children (expected); i++)
+    {
+      GVariant *entry = g_variant_get_child_value (expected, i);
+      const gchar *key;
+
+      g_variant_get_child (entry, 0, "&s", &key);
+      value = json_gvariant_lookup_value (sorted, key, NULL);
+      expected_value = g_variant_lookup_value (sorted, key, NULL);
+      g_assert (value != NULL && expected_value != NULL);
+      g_assert (g_variant_equal (value, expected_value));
+      g_variant_unref (value);
+
+      /* the values of other types are not returned */
+      value = json_gvariant_lookup_value (sorted, key, g_variant_get_type (expected_value));
+      g_assert (value != NULL);
+      g_variant_unref (value);
+      g_assert (json_gvariant_lookup_value (sorted, key, G_VARIANT_TYPE ("(ii)")) == NULL);
+
+      g_variant_unref (expected_value);
+      g_variant_unref (entry);
+    }
+
+  /* neither are the missing ones */
+  g_assert (json_gvariant_lookup_value (sorted, "", NULL) == NULL);
+  g_assert (json_gvariant_lookup_value (sorted, "k", NULL) == NULL);
+  g_assert (json_gvariant_lookup_value (sorted, "\xff", NULL) == NULL);
+
+  json_object_put (json_node);
+  g_variant_unref (expected);
+  g_variant_unref (sorted);
+}
+
+/* Dictionaries are sorted as the json-c tree, and are looked up as by
+ * GLib, the compact and serialized ones as well */
+static void
+test_sorted (void)
+{
+  static const JsonGVariantFlags sorted_flags[] = {
+    JSON_GVARIANT_FLAGS_SORTED,
+    JSON_GVARIANT_FLAGS_SORTED | JSON_GVARIANT_FLAGS_COMPACT
+  };
+  guint i, j, k;
+
+  for (i = 0; i < 500; i++)
+    {
+      GString *json = g_string_new ("{");
+      guint n = g_test_rand_int_range (0, 12);
+
+      for (j = 0; j < n; j++)
+        {
+          g_string_append_printf (json, "%s\"k%d\":", j > 0 ? "," : "",
+                                  g_test_rand_int_range (0, 8));
+          append_random_value (json, 3);
+        }
+      g_string_append_c (json, '}');
+
+      for (k = 0; k < G_N_ELEMENTS (sorted_flags); k++)
+        {
+          check_sorted_lookups (json->str, json->len, "a{sv}", sorted_flags[k]);
+          check_sorted_lookups (json->str, json->len, NULL, sorted_flags[k]);
+          check_same_conversion (json->str, json->len, NULL,
+                                 sorted_flags[k],
+                                 sorted_flags[k] | JSON_GVARIANT_FLAGS_SERIALIZED);
+        }
+
+      g_string_free (json, TRUE);
+    }
+
+  for (i = 0; i < G_N_ELEMENTS (cookies_files); i++)
+    {
+      gsize length;
+      gchar *json;
+
+      json = load_corpus_file (cookies_files[i], &length);
+      for (k = 0; k < G_N_ELEMENTS (sorted_flags); k++)
+        {
+          check_sorted_lookups (json, length, "a{sv}", sorted_flags[k]);
+          check_same_conversion (json, length, "a{sv}",
+                                 sorted_flags[k],
+                                 sorted_flags[k] | JSON_GVARIANT_FLAGS_SERIALIZED);
+        }
+      g_free (json);
+    }
+}
+
+/* ========================================================================== */
+/* Interned strings */
+/* ========================================================================== */
+
+/* Returns the value boxed in the child of 'variant' at 'index' */
+static GVariant *
+get_boxed_child (GVariant *variant,
+                 gsize     index)
+{
+  GVariant *child, *boxed;
+
+  child = g_variant_get_child_value (variant, index);
+  boxed = g_variant_get_variant (child);
+  g_variant_unref (child);
+
+  return boxed;
+}
+
+/* Interning changes how the values are built, not what they are: the
+ * results and the errors are the same as without it, and the identical
+ * strings and booleans end up being the same GVariant */
+static void
+test_intern (void)
+{
+  static const JsonGVariantFlags intern_flags[] = {
+    JSON_GVARIANT_FLAGS_NONE,
+    JSON_GVARIANT_FLAGS_COMPACT,
+    JSON_GVARIANT_FLAGS_SORTED,
+    JSON_GVARIANT_FLAGS_SERIALIZED,
+    JSON_GVARIANT_FLAGS_PARALLEL | JSON_GVARIANT_FLAGS_COMPACT
+  };
+  GError *error = NULL;
+  GVariant *variant, *first, *second;
+  json_object *json_node;
+  gsize length;
+  gchar *json;
+  guint i, j, k;
+
+  for (k = 0; k < G_N_ELEMENTS (intern_flags); k++)
+    {
+      for (i = 0; i < G_N_ELEMENTS (values); i++)
+        check_same_conversion (values[i][0], strlen (values[i][0]), values[i][1],
+                               intern_flags[k], intern_flags[k] | JSON_GVARIANT_FLAGS_INTERN);
+
+      for (i = 0; i < 200; i++)
+        {
+          GString *random = g_string_new (NULL);
+
+          append_random_value (random, 5);
+          for (j = 0; j < G_N_ELEMENTS (signatures); j++)
+            check_same_conversion (random->str, random->len, signatures[j],
+                                   intern_flags[k], intern_flags[k] | JSON_GVARIANT_FLAGS_INTERN);
+          g_string_free (random, TRUE);
+        }
+
+      for (i = 0; i < G_N_ELEMENTS (cookies_files); i++)
+        {
+          json = load_corpus_file (cookies_files[i], &length);
+          check_same_conversion (json, length, "a{sv}",
+                                 intern_flags[k], intern_flags[k] | JSON_GVARIANT_FLAGS_INTERN);
+          g_free (json);
+        }
+    }
+
+  /* the json-c trees as well */
+  json = load_corpus_file ("cookies-500.json", &length);
+  json_node = json_gvariant_parse_data (json, length, &error);
+  g_assert_no_error (error);
+  first = json_gvariant_deserialize_full (json_node, NULL, JSON_GVARIANT_FLAGS_NONE, &error);
+  g_assert_no_error (error);
+  second = json_gvariant_deserialize_full (json_node, NULL, JSON_GVARIANT_FLAGS_INTERN, &error);
+  g_assert_no_error (error);
+  g_assert (g_variant_equal (first, second));
+  g_variant_unref (g_variant_ref_sink (first));
+  g_variant_unref (g_variant_ref_sink (second));
+  json_object_put (json_node);
+  g_free (json);
+
+  /* the identical values are shared */
+  variant = json_gvariant_deserialize_data_full ("[\"a\",true,\"a\",true]", -1, "av",
+                                                 JSON_GVARIANT_FLAGS_INTERN, &error);
+  g_assert_no_error (error);
+  g_variant_ref_sink (variant);
+  for (i = 0; i < 2; i++)
+    {
+      first = get_boxed_child (variant, i);
+      second = get_boxed_child (variant, i + 2);
+      g_assert (first == second);
+      g_variant_unref (first);
+      g_variant_unref (second);
+    }
+  g_variant_unref (variant);
+}
+
+/* ========================================================================== */
+/* Plan cache */
+/* ========================================================================== */
+
+static const gchar *plan_signatures[] = {
+  "s", "ax", "a{sv}", "(sxa{s(ii)})", "aa(ybnqiuxthdsog)", "m(as)", "a{oa{sv}}", "(())"
+};
+
+/* Checks that 'plan' is the same as 'expected', node by node */
+static void
+check_same_plan (const JsonGVariantPlan *plan,
+                 const JsonGVariantPlan *expected)
+{
+  guint i;
+
+  g_assert (g_variant_type_equal (plan->type, expected->type));
+  g_assert_cmpint (plan->class, ==, expected->class);
+  g_assert_cmpuint (plan->alignment, ==, expected->alignment);
+  g_assert_cmpuint (plan->fixed_size, ==, expected->fixed_size);
+  g_assert_cmpuint (plan->n_children, ==, expected->n_children);
+
+  for (i = 0; i < plan->n_children; i++)
+    check_same_plan (&plan->children[i], &expected->children[i]);
+}
+
+static gpointer
+get_plan_thread (gpointer data)
+{
+  return (gpointer) json_gvariant_plan_get (data, NULL);
+}
+
+/* The plans are compiled once per signature, whatever the thread asking
+ * for them, and the signatures which are not valid are never cached, so
+ * that they fail every time as the first time */
+static void
+test_plan_cache (void)
+{
+  static const gchar *invalid[][2] = {
+    { "a{", "Invalid GVariant signature" },
+    { "(sx", "Invalid GVariant signature" },
+    { "a{vs}", "Invalid GVariant signature" },
+    { "a*", "GVariant class '*' not supported" },
+    { "(s?)", "GVariant class '?' not supported" },
+    { "ar", "GVariant class 'r' not supported" }
+  };
+  const JsonGVariantPlan *plan;
+  JsonGVariantPlan *uncached;
+  GThread *threads[8];
+  GError *error = NULL;
+  GVariant *variant;
+  gchar *signature;
+  guint i, j;
+
+  for (i = 0; i < G_N_ELEMENTS (plan_signatures); i++)
+    {
+      plan = json_gvariant_plan_get (plan_signatures[i], &error);
+      g_assert_no_error (error);
+      g_assert (plan == json_gvariant_plan_get (plan_signatures[i], NULL));
+      g_assert (plan == json_gvariant_plan_lookup (plan_signatures[i]));
+      g_assert_cmpstr (g_variant_type_peek_string (plan->type), ==, plan_signatures[i]);
+
+      uncached = json_gvariant_plan_new_uncached (plan_signatures[i]);
+      g_assert (uncached != plan);
+      check_same_plan (uncached, plan);
+      g_free (uncached);
+    }
+
+  /* the signatures come from the callers, which may free them */
+  signature = g_strdup ("a(sa{sx})");
+  plan = json_gvariant_plan_get (signature, NULL);
+  g_free (signature);
+  g_assert (plan == json_gvariant_plan_lookup ("a(sa{sx})"));
+
+  /* the first threads asking for a signature get the same plan */
+  g_assert (json_gvariant_plan_lookup ("a(sa{sb})") == NULL);
+  for (i = 0; i < G_N_ELEMENTS (threads); i++)
+    threads[i] = g_thread_new ("plan", get_plan_thread, (gpointer) "a(sa{sb})");
+  plan = g_thread_join (threads[0]);
+  for (i = 1; i < G_N_ELEMENTS (threads); i++)
+    g_assert (g_thread_join (threads[i]) == plan);
+  g_assert (plan == json_gvariant_plan_lookup ("a(sa{sb})"));
+
+  for (i = 0; i < G_N_ELEMENTS (invalid); i++)
+    for (j = 0; j < 2; j++)
+      {
+        json_object *json_node;
+
+        variant = json_gvariant_deserialize_data (values[0][0], -1, invalid[i][0], &error);
+        g_assert (variant == NULL);
+        g_assert_cmpstr (error->message, ==, invalid[i][1]);
+        g_assert (!json_gvariant_validate (values[0][0], -1, invalid[i][0], NULL, NULL, NULL));
+        g_assert (json_gvariant_plan_lookup (invalid[i][0]) == NULL);
+
+        json_node = json_gvariant_parse_data (values[0][0], -1, NULL);
+        g_assert (json_gvariant_deserialize (json_node, invalid[i][0], NULL) == NULL);
+        json_object_put (json_node);
+
+        g_clear_error (&error);
+      }
+
+  /* the conversions do not depend on whether the plan was cached: the
+   * values are wrapped in tuples for signatures seen for the first time */
+  for (i = 0; i < G_N_ELEMENTS (values); i++)
+    {
+      GError *expected_error = NULL;
+      GVariant *expected;
+      gchar *json;
+
+      if (values[i][1] == NULL)
+        continue;
+
+      json = g_strdup_printf ("[%s,\"plans\"]", values[i][0]);
+      signature = g_strdup_printf ("(%ss)", values[i][1]);
+      if (json_gvariant_plan_lookup (signature) != NULL)
+        {
+          g_free (signature);
+          g_free (json);
+          continue;
+        }
+
+      expected = json_gvariant_deserialize_data (json, -1, signature, &expected_error);
+      g_assert (json_gvariant_plan_lookup (signature) != NULL);
+      variant = json_gvariant_deserialize_data (json, -1, signature, &error);
+      if (expected != NULL)
+        {
+          g_assert (g_variant_equal (variant, expected));
+          g_variant_unref (g_variant_ref_sink (variant));
+          g_variant_unref (g_variant_ref_sink (expected));
+        }
+      else
+        {
+          g_assert (variant == NULL);
+          g_assert_error (error, expected_error->domain, expected_error->code);
+          g_assert_cmpstr (error->message, ==, expected_error->message);
+          g_clear_error (&expected_error);
+          g_clear_error (&error);
+        }
+
+      g_free (signature);
+      g_free (json);
+    }
+}
+
+int
+main (int    argc,
+      char **argv)
+{
+  g_test_init (&argc, &argv, NULL);
+
+  g_test_add_func ("/numbers/integers", test_integers);
+  g_test_add_func ("/numbers/doubles", test_doubles);
+  g_test_add_func ("/strings/simd", test_simd);
+  g_test_add_func ("/serialized/normal-form", test_serialized);
+  g_test_add_func ("/collected-data/limits", test_collected_data_limits);
+  g_test_add_func ("/collected-data/duplicates", test_collected_data_duplicates);
+  g_test_add_func ("/limits/errors", test_limits);
+  g_test_add_func ("/compact/parallel", test_compact_parallel);
+  g_test_add_func ("/compact/types", test_compact_types);
+  g_test_add_func ("/nesting/deep", test_nesting_deep);
+  g_test_add_func ("/nesting/too-deep", test_nesting_too_deep);
+  g_test_add_func ("/scratch/allocations", test_scratch_allocations);
+  g_test_add_func ("/validate/conversions", test_validate);
+  g_test_add_func ("/extract/members", test_extract_members);
+  g_test_add_func ("/stream/conversions", test_stream);
+  g_test_add_func ("/batch/documents", test_batch);
+  g_test_add_func ("/sorted/lookups", test_sorted);
+  g_test_add_func ("/intern/conversions", test_intern);
+  g_test_add_func ("/plans/cache", test_plan_cache);
+
+  return g_test_run ();
+}
@@ -0,0 +1,464 @@
+#!/usr/bin/env python
+# json-gvariant-codegen.py - Generates JSON to GVariant converters from schemas
+#
+# Copyright (C) 2013  Intel Corporation.
+#
+# This library is free software; you can redistribute it and/or
+# modify it under the terms of the GNU Lesser General Public
+# License as published by the Free Software Foundation; either
+# version 2.1 of the License, or (at your option) any later version.
+#
+# This library is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+# Lesser General Public License for more details.
+#
+# You should have received a copy of the GNU Lesser General Public
+# License along with this library. If not, see <http://www.gnu.org/licenses/>.
+#
+# Author:
+#   Emanuele Aina <emanuele.aina@collabora.com>
+
+"""Generates a converter from JSON text to serialized GVariant data for
+the JSON objects described by a schema like this one:
+
+    # comments start with '#'
+    converter collected_data
+
+    object preseed
+      provider  string
+      services  array of string
+      cookies   array of cookie
+
+    object cookie
+      name            string
+      secure          boolean
+      expirationDate  double
+
+The first object is the one converted, to 'a{sv}', and the types of the
+members are 'string', 'boolean', 'int', 'double', 'array of TYPE' or the
+name of another object. The result is the same as the one of the generic
+conversion without a schema: the types of the values in the variants are
+inferred from the JSON values, and members not listed or with a value of
+another type are converted by the generic code. The converter only skips
+the type dispatching of the generic code for the values it expects.
+
+The converter is written to NAME.c and NAME.h, with NAME being the one of
+the converter with dashes instead of underscores, and its entry point is
+NAME_deserialize(), which takes the same arguments as
+json_gvariant_deserialize_limited() except for the signature.
+"""
+
+import optparse
+import os
+import re
+import sys
+
+# GVariant type, JSON token and C code writing the value at the scanner,
+# for each of the basic types
+BASIC_TYPES = {
+    'string': ('s', 'JSON_TOKEN_STRING',
+               ['json_gvariant_writer_write_string (writer,',
+                '                                   scanner->buffer->str,',
+                '                                   scanner->buffer->len);']),
+    'boolean': ('b', 'JSON_TOKEN_BOOLEAN',
+                ['guint8 value = scanner->boolean_value;',
+                 '',
+                 'json_gvariant_writer_write (writer, &value, sizeof value);']),
+    'int': ('x', 'JSON_TOKEN_INT',
+            ['gint64 value = json_gvariant_generated_get_int (scanner);',
+             '',
+             'json_gvariant_writer_write (writer, &value, sizeof value);']),
+    'double': ('d', 'JSON_TOKEN_DOUBLE',
+               ['gdouble value = json_gvariant_generated_get_double (scanner);',
+                '',
+                'json_gvariant_writer_write (writer, &value, sizeof value);']),
+}
+
+
+class SchemaError(Exception):
+    pass
+
+
+class Schema(object):
+    def __init__(self, path):
+        self.path = path
+        self.name = None
+        self.objects = []
+        self.members = {}
+        self.parse()
+        self.check()
+
+    def error(self, lineno, message):
+        raise SchemaError('%s:%d: %s' % (self.path, lineno, message))
+
+    def parse(self):
+        current = None
+        with open(self.path) as f:
+            for lineno, line in enumerate(f, 1):
+                line = line.split('#', 1)[0].rstrip()
+                if not line:
+                    continue
+                words = line.split()
+                if not line[0].isspace():
+                    if len(words) != 2 or words[0] not in ('converter', 'object'):
+                        self.error(lineno, "expected 'converter NAME' or 'object NAME'")
+                    if not re.match(r'^[a-z][a-z0-9_]*$', words[1]):
+                        self.error(lineno, "invalid name '%s'" % words[1])
+                    if words[0] == 'converter':
+                        self.name = words[1]
+                    else:
+                        if words[1] in self.members:
+                            self.error(lineno, "object '%s' defined twice" % words[1])
+                        current = words[1]
+                        self.objects.append(current)
+                        self.members[current] = []
+                    continue
+                if current is None:
+                    self.error(lineno, 'member outside of an object')
+                if len(words) < 2:
+                    self.error(lineno, "expected 'MEMBER TYPE'")
+                member = (words[0], self.parse_type(lineno, words[1:]), lineno)
+                if member[0] in [m[0] for m in self.members[current]]:
+                    self.error(lineno, "member '%s' listed twice" % member[0])
+                self.members[current].append(member)
+
+    def parse_type(self, lineno, words):
+        if words[:2] == ['array', 'of']:
+            return ('array', self.parse_type(lineno, words[2:]))
+        if len(words) != 1:
+            self.error(lineno, "invalid type '%s'" % ' '.join(words))
+        return words[0]
+
+    def check(self):
+        if self.name is None:
+            raise SchemaError("%s: no 'converter NAME' line" % self.path)
+        if not self.objects:
+            raise SchemaError('%s: no objects' % self.path)
+        for name in self.objects:
+            for member, type_, lineno in self.members[name]:
+                while isinstance(type_, tuple):
+                    type_ = type_[1]
+                if type_ not in BASIC_TYPES and type_ not in self.members:
+                    self.error(lineno, "unknown type '%s'" % type_)
+
+
+def type_name(type_):
+    if isinstance(type_, tuple):
+        return 'array_of_' + type_name(type_[1])
+    return type_
+
+
+def c_string(string):
+    return '"%s"' % string.replace('\\', '\\\\').replace('"', '\\"')
+
+
+class Generator(object):
+    def __init__(self, schema):
+        self.schema = schema
+        self.prefix = schema.name
+        self.arrays = []
+        self.functions = []
+
+    def enum_name(self, obj, member):
+        name = re.sub(r'([a-z0-9])([A-Z])', r'\1_\2', member)
+        name = re.sub(r'[^A-Za-z0-9]', '_', name)
+        return '%s_%s_%s' % (self.prefix.upper(), obj.upper(), name.upper())
+
+    def function(self, name, body, returns='gboolean',
+                 args=('JsonGVariantContext  *context',
+                       'JsonScanner          *scanner',
+                       'GError              **error')):
+        code = ['static %s' % returns]
+        head = '%s (' % name
+        code.append(head + args[0] + (',' if len(args) > 1 else ')'))
+        for i, arg in enumerate(args[1:], 2):
+            code.append(' ' * len(head) + arg + (',' if i < len(args) else ')'))
+        code.append('{')
+        code.extend(body)
+        code.append('}')
+        self.functions.append(code)
+
+    def value(self, type_, indent):
+        """Code writing the value at the scanner in a variant, the writer
+        being aligned for the variant: no value needs more alignment than
+        the variant has"""
+        if isinstance(type_, tuple):
+            if type_ not in self.arrays:
+                self.arrays.append(type_)
+            token, signature = 'JSON_TOKEN_BEGIN_ARRAY', 'av'
+            write = ['if (!%s_write_%s (context, scanner, error))' %
+                     (self.prefix, type_name(type_)),
+                     '  return FALSE;']
+        elif type_ in BASIC_TYPES:
+            signature, token, write = BASIC_TYPES[type_]
+        else:
+            token, signature = 'JSON_TOKEN_BEGIN_OBJECT', 'a{sv}'
+            write = ['if (!%s_write_%s (context, scanner, error))' %
+                     (self.prefix, type_),
+                     '  return FALSE;']
+        code = ['if (scanner->token == %s)' % token, '  {']
+        code.extend(('    ' + line).rstrip() for line in write)
+        code.append('')
+        code.append('    /* the value is followed by a zero byte and its type string */')
+        code.append('    json_gvariant_writer_write (writer, "\\0%s", %d);' %
+                    (signature, len(signature) + 1))
+        code.append('  }')
+        code.append('else if (!json_gvariant_generated_write_variant (context, scanner, error))')
+        code.append('  return FALSE;')
+        return [(' ' * indent + line).rstrip() for line in code]
+
+    def match(self, obj):
+        members = self.schema.members[obj]
+        by_length = {}
+        for member, type_, lineno in members:
+            length = len(member.encode('utf-8'))
+            by_length.setdefault(length, []).append(member)
+        body = ['  switch (length)', '    {']
+        for length in sorted(by_length):
+            body.append('    case %d:' % length)
+            for member in by_length[length]:
+                body.append('      if (memcmp (key, %s, %d) == 0)' % (c_string(member), length))
+                body.append('        return %s;' % self.enum_name(obj, member))
+            body.append('      break;')
+            body.append('')
+        body.append('    default:')
+        body.append('      break;')
+        body.append('    }')
+        body.append('')
+        body.append('  return 0;')
+        self.function('%s_match_%s' % (self.prefix, obj), body, returns='guint',
+                      args=('const gchar *key', 'gsize        length'))
+
+    def object(self, obj):
+        members = self.schema.members[obj]
+        body = ['  JsonGVariantWriter *writer = json_gvariant_generated_get_writer (context);',
+                '  JsonGVariantWriterFrame frame;',
+                '  gboolean first = TRUE;',
+                '',
+                '  json_gvariant_writer_open (writer, &frame);',
+                '',
+                '  while (json_gvariant_generated_next_member (scanner, first, error))',
+                '    {',
+                '      JsonGVariantWriterFrame entry;',
+                '      guint member;',
+                '',
+                '      member = %s_match_%s (scanner->buffer->str, scanner->buffer->len);' %
+                (self.prefix, obj),
+                '',
+                '      json_gvariant_writer_align (writer, 8);',
+                '      json_gvariant_writer_open (writer, &entry);',
+                '      json_gvariant_writer_write_string (writer,',
+                '                                         scanner->buffer->str,',
+                '                                         scanner->buffer->len);',
+                '      json_gvariant_writer_add_offset (writer, &entry);',
+                '',
+                '      if (!json_gvariant_generated_next_value (scanner, error))',
+                '        return FALSE;',
+                '',
+                '      json_gvariant_writer_align (writer, 8);',
+                '',
+                '      switch (member)',
+                '        {']
+        # members of the same type share their code
+        types = []
+        for member, type_, lineno in members:
+            if type_ not in types:
+                types.append(type_)
+        for type_ in types:
+            for member, member_type, lineno in members:
+                if member_type == type_:
+                    body.append('        case %s:' % self.enum_name(obj, member))
+            body.extend(self.value(type_, 10))
+            body.append('          break;')
+            body.append('')
+        body.extend(['        default:',
+                     '          if (!json_gvariant_generated_write_variant (context, scanner, error))',
+                     '            return FALSE;',
+                     '          break;',
+                     '        }',
+                     '',
+                     '      json_gvariant_writer_close_tuple (writer, &entry, 0);',
+                     '      json_gvariant_writer_add_offset (writer, &frame);',
+                     '',
+                     '      first = FALSE;',
+                     '    }',
+                     '',
+                     '  if (scanner->token == JSON_TOKEN_ERROR)',
+                     '    return FALSE;',
+                     '',
+                     '  if (json_gvariant_generated_is_sorted (context))',
+                     '    json_gvariant_writer_sort_entries (writer, &frame,',
+                     '                                       json_gvariant_plan_get_default (JSON_G_VARIANT_CLASS_DICTIONARY)->children);',
+                     '',
+                     '  json_gvariant_writer_close_array (writer, &frame);',
+                     '',
+                     '  return TRUE;'])
+        self.function('%s_write_%s' % (self.prefix, obj), body)
+
+    def array(self, type_):
+        body = ['  JsonGVariantWriter *writer = json_gvariant_generated_get_writer (context);',
+                '  JsonGVariantWriterFrame frame;',
+                '  gboolean first = TRUE;',
+                '',
+                '  json_gvariant_writer_open (writer, &frame);',
+                '',
+                '  while (json_gvariant_generated_next_element (scanner, JSON_TOKEN_END_ARRAY, first, error))',
+                '    {',
+                '      json_gvariant_writer_align (writer, 8);',
+                '']
+        body.extend(self.value(type_[1], 6))
+        body.extend(['',
+                     '      json_gvariant_writer_add_offset (writer, &frame);',
+                     '',
+                     '      first = FALSE;',
+                     '    }',
+                     '',
+                     '  if (scanner->token == JSON_TOKEN_ERROR)',
+                     '    return FALSE;',
+                     '',
+                     '  json_gvariant_writer_close_array (writer, &frame);',
+                     '',
+                     '  return TRUE;'])
+        self.function('%s_write_%s' % (self.prefix, type_name(type_)), body)
+
+    def generate(self, header_name):
+        schema = self.schema
+        root = schema.objects[0]
+        source_name = os.path.basename(schema.path)
+
+        for obj in schema.objects:
+            self.match(obj)
+            self.object(obj)
+        # the arrays are collected while generating the code for the values
+        i = 0
+        while i < len(self.arrays):
+            self.array(self.arrays[i])
+            i += 1
+        self.function('%s_write' % self.prefix,
+                      ['  /* anything but an object fails as for any other a{sv} */',
+                       '  if (scanner->token != JSON_TOKEN_BEGIN_OBJECT)',
+                       '    return json_gvariant_generated_write_value (context, scanner,',
+                       '                                                json_gvariant_plan_get_default (JSON_G_VARIANT_CLASS_DICTIONARY),',
+                       '                                                error);',
+                       '',
+                       '  return %s_write_%s (context, scanner, error);' % (self.prefix, root)])
+
+        out = ['/* Generated by json-gvariant-codegen.py from %s, do not edit */' % source_name,
+               '',
+               '#ifdef HAVE_CONFIG_H',
+               '#include "config.h"',
+               '#endif',
+               '',
+               '#include <string.h>',
+               '',
+               '#include "json-gvariant-private.h"',
+               '#include "%s"' % header_name,
+               '']
+        for obj in schema.objects:
+            if not schema.members[obj]:
+                continue
+            out.append('enum')
+            out.append('{')
+            for i, (member, type_, lineno) in enumerate(schema.members[obj]):
+                out.append('  %s%s,' % (self.enum_name(obj, member), ' = 1' if i == 0 else ''))
+            out[-1] = out[-1].rstrip(',')
+            out.append('};')
+            out.append('')
+        for obj in schema.objects:
+            out.append('static gboolean %s_write_%s (JsonGVariantContext  *context,' % (self.prefix, obj))
+            pad = ' ' * len('static gboolean %s_write_%s (' % (self.prefix, obj))
+            out.append(pad + 'JsonScanner          *scanner,')
+            out.append(pad + 'GError              **error);')
+        for type_ in self.arrays:
+            out.append('static gboolean %s_write_%s (JsonGVariantContext  *context,' % (self.prefix, type_name(type_)))
+            pad = ' ' * len('static gboolean %s_write_%s (' % (self.prefix, type_name(type_)))
+            out.append(pad + 'JsonScanner          *scanner,')
+            out.append(pad + 'GError              **error);')
+        out.append('')
+        for code in self.functions:
+            out.extend(code)
+            out.append('')
+        out.append('static const JsonGVariantGenerated %s_converter =' % self.prefix)
+        out.append('{')
+        out.append('  "a{sv}",')
+        out.append('  %s_write' % self.prefix)
+        out.append('};')
+        out.append('')
+        out.extend(self.entry_point(False))
+        source = '\n'.join(out) + '\n'
+
+        guard = '__%s__' % re.sub(r'[^A-Z0-9]', '_', header_name.upper())
+        out = ['/* Generated by json-gvariant-codegen.py from %s, do not edit */' % source_name,
+               '',
+               '#ifndef %s' % guard,
+               '#define %s' % guard,
+               '',
+               '#include "json-gvariant.h"',
+               '',
+               'G_BEGIN_DECLS',
+               '']
+        out.extend(self.entry_point(True))
+        out.extend(['',
+                    'G_END_DECLS',
+                    '',
+                    '#endif /* %s */' % guard])
+        header = '\n'.join(out) + '\n'
+
+        return source, header
+
+    def entry_point(self, declaration):
+        name = '%s_deserialize' % self.prefix
+        args = ['const gchar               *json',
+                'gssize                     length',
+                'JsonGVariantFlags          flags',
+                'const JsonGVariantLimits  *limits',
+                'GError                   **error']
+        if declaration:
+            head = 'GVariant * %s (' % name
+            code = [head + args[0] + ',']
+        else:
+            head = '%s (' % name
+            code = ['/* Converts the JSON text to a serialized a{sv} as',
+                    ' * json_gvariant_deserialize_limited() does */',
+                    'GVariant *',
+                    head + args[0] + ',']
+        for i, arg in enumerate(args[1:], 2):
+            code.append(' ' * len(head) + arg + (',' if i < len(args) else ')'))
+        if declaration:
+            code[-1] += ';'
+        else:
+            code.extend(['{',
+                         '  return json_gvariant_deserialize_generated (json, length,',
+                         '                                              &%s_converter,' % self.prefix,
+                         '                                              flags, limits, error);',
+                         '}'])
+        return code
+
+
+def main(argv):
+    parser = optparse.OptionParser(usage='%prog [options] SCHEMA')
+    parser.add_option('--output-directory', dest='output_directory', default='.',
+                      help='write the converter to DIR', metavar='DIR')
+    options, args = parser.parse_args(argv[1:])
+    if len(args) != 1:
+        parser.error('a single schema is expected')
+
+    try:
+        schema = Schema(args[0])
+    except (IOError, SchemaError) as e:
+        sys.stderr.write('%s\n' % e)
+        return 1
+
+    base = schema.name.replace('_', '-')
+    source, header = Generator(schema).generate(base + '.h')
+
+    for name, contents in ((base + '.c', source), (base + '.h', header)):
+        with open(os.path.join(options.output_directory, name), 'w') as f:
+            f.write(contents)
+
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main(sys.argv))
@@ -0,0 +1,751 @@
+/* json-gvariant-infer.c - Compact GVariant types inferred from JSON values
+ *
+ * Copyright (C) 2013  Intel Corporation.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Author:
+ *   Emanuele Aina <emanuele.aina@collabora.com>
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string.h>
+
+#include "json-gvariant.h"
+#include "json-gvariant-private.h"
+
+/* arrays longer than this are never considered records */
+#define JSON_GVARIANT_INFER_MAX_MEMBERS 16
+
+/* What is known about the JSON values found at the same place in the
+ * input, for instance all the elements of an array.
+ *
+ * 'class' is 0 until a value other than null is seen, and becomes
+ * G_VARIANT_CLASS_VARIANT as soon as two values disagree. 'element' merges
+ * the member values of objects and the elements of arrays.
+ *
+ * Short arrays keep their elements apart in 'members' instead, one per
+ * position, for as long as all the arrays merged have the same length:
+ * this is what tells arrays of records like [["a", 1], ["b", 2]] apart
+ * from mixed ones. They are only merged into 'element' when that is no
+ * longer possible, or when the type is printed.
+ */
+struct _JsonGVariantShape
+{
+  gchar              class;
+  gboolean           nullable;
+  gboolean           records;
+  guint              n_arrays;
+  guint              n_members;
+  JsonGVariantShape *element;
+  JsonGVariantShape *members;
+};
+
+static void json_gvariant_shape_merge (JsonGVariantArena       *arena,
+                                       JsonGVariantShape       *dest,
+                                       const JsonGVariantShape *src);
+
+static JsonGVariantShape *
+json_gvariant_shape_new (JsonGVariantArena *arena,
+                         guint              n_shapes)
+{
+  JsonGVariantShape *shapes;
+
+  shapes = json_gvariant_arena_alloc (arena, n_shapes * sizeof (JsonGVariantShape));
+  memset (shapes, 0, n_shapes * sizeof (JsonGVariantShape));
+
+  return shapes;
+}
+
+static void
+json_gvariant_shape_copy (JsonGVariantArena       *arena,
+                          JsonGVariantShape       *dest,
+                          const JsonGVariantShape *src)
+{
+  guint i;
+
+  *dest = *src;
+
+  if (src->element != NULL)
+    {
+      dest->element = json_gvariant_shape_new (arena, 1);
+      json_gvariant_shape_copy (arena, dest->element, src->element);
+    }
+
+  if (src->records && src->n_members > 0)
+    {
+      dest->members = json_gvariant_shape_new (arena, src->n_members);
+      for (i = 0; i < src->n_members; i++)
+        json_gvariant_shape_copy (arena, &dest->members[i], &src->members[i]);
+    }
+}
+
+/* Merges the elements of the array 'src' into 'element' */
+static void
+json_gvariant_shape_merge_elements (JsonGVariantArena       *arena,
+                                    JsonGVariantShape       *element,
+                                    const JsonGVariantShape *src)
+{
+  guint i;
+
+  if (src->records)
+    {
+      for (i = 0; i < src->n_members; i++)
+        json_gvariant_shape_merge (arena, element, &src->members[i]);
+    }
+  else
+    {
+      json_gvariant_shape_merge (arena, element, src->element);
+    }
+}
+
+/* Gives up on the members of an array, merging them into its element */
+static void
+json_gvariant_shape_collapse (JsonGVariantArena *arena,
+                              JsonGVariantShape *shape)
+{
+  JsonGVariantShape *element;
+
+  if (!shape->records)
+    return;
+
+  element = json_gvariant_shape_new (arena, 1);
+  json_gvariant_shape_merge_elements (arena, element, shape);
+
+  shape->element = element;
+  shape->records = FALSE;
+  shape->members = NULL;
+  shape->n_members = 0;
+}
+
+/* Widens 'dest' to also describe the values of 'src'. Nothing of 'src' is
+ * shared with 'dest', so that the members of arrays are never modified by
+ * merging them. */
+static void
+json_gvariant_shape_merge (JsonGVariantArena       *arena,
+                           JsonGVariantShape       *dest,
+                           const JsonGVariantShape *src)
+{
+  gboolean nullable = dest->nullable || src->nullable;
+  guint i;
+
+  if (src->class == 0 || dest->class == G_VARIANT_CLASS_VARIANT)
+    {
+      dest->nullable = nullable;
+      return;
+    }
+
+  if (dest->class == 0)
+    {
+      json_gvariant_shape_copy (arena, dest, src);
+      dest->nullable = nullable;
+      return;
+    }
+
+  dest->nullable = nullable;
+
+  if (dest->class != src->class)
+    {
+      dest->class = G_VARIANT_CLASS_VARIANT;
+      return;
+    }
+
+  switch (dest->class)
+    {
+    case G_VARIANT_CLASS_ARRAY:
+      dest->n_arrays += src->n_arrays;
+
+      if (dest->records && src->records && dest->n_members == src->n_members)
+        {
+          for (i = 0; i < dest->n_members; i++)
+            json_gvariant_shape_merge (arena, &dest->members[i], &src->members[i]);
+        }
+      else
+        {
+          json_gvariant_shape_collapse (arena, dest);
+          json_gvariant_shape_merge_elements (arena, dest->element, src);
+        }
+      break;
+
+    case JSON_G_VARIANT_CLASS_DICTIONARY:
+      json_gvariant_shape_merge (arena, dest->element, src->element);
+      break;
+
+    default:
+      break;
+    }
+}
+
+/* Values of different types, or no values at all, can only be variants */
+static gboolean
+json_gvariant_shape_is_mixed (const JsonGVariantShape *shape)
+{
+  return shape->class == G_VARIANT_CLASS_VARIANT ||
+         (shape->class == 0 && !shape->nullable);
+}
+
+/* Decides the type of the arrays in 'shape': arrays of records become
+ * arrays of tuples if their elements cannot share a single type, and the
+ * members of all the other arrays are merged into their element.
+ */
+static void
+json_gvariant_shape_finish (JsonGVariantArena *arena,
+                            JsonGVariantShape *shape)
+{
+  gchar class = 0;
+  guint i;
+
+  if (shape->class == JSON_G_VARIANT_CLASS_DICTIONARY)
+    json_gvariant_shape_finish (arena, shape->element);
+
+  if (shape->class != G_VARIANT_CLASS_ARRAY)
+    return;
+
+  if (shape->records)
+    {
+      /* merging the members only gives a variant if their classes differ */
+      for (i = 0; i < shape->n_members; i++)
+        {
+          if (shape->members[i].class == 0)
+            continue;
+
+          if (class == 0)
+            class = shape->members[i].class;
+          else if (class != shape->members[i].class)
+            class = G_VARIANT_CLASS_VARIANT;
+        }
+
+      if (class == G_VARIANT_CLASS_VARIANT &&
+          shape->n_arrays > 1 && shape->n_members > 1)
+        {
+          for (i = 0; i < shape->n_members; i++)
+            json_gvariant_shape_finish (arena, &shape->members[i]);
+          return;
+        }
+
+      json_gvariant_shape_collapse (arena, shape);
+    }
+
+  json_gvariant_shape_finish (arena, shape->element);
+}
+
+/* Writes the type string for a finished 'shape' to 'out' and returns its
+ * length. If 'out' is NULL only the length is computed. */
+static gsize
+json_gvariant_shape_print (const JsonGVariantShape *shape,
+                           gchar                   *out)
+{
+  gsize length = 0;
+  guint i;
+
+#define PUT(c) G_STMT_START { if (out != NULL) out[length] = (c); length++; } G_STMT_END
+#define PRINT(s) (length += json_gvariant_shape_print ((s), out != NULL ? out + length : NULL))
+
+  if (json_gvariant_shape_is_mixed (shape))
+    {
+      PUT (G_VARIANT_CLASS_VARIANT);
+      return length;
+    }
+
+  if (shape->nullable)
+    {
+      PUT (G_VARIANT_CLASS_MAYBE);
+
+      /* nothing but nulls */
+      if (shape->class == 0)
+        {
+          PUT (G_VARIANT_CLASS_VARIANT);
+          return length;
+        }
+    }
+
+  switch (shape->class)
+    {
+    case G_VARIANT_CLASS_ARRAY:
+      if (shape->records)
+        {
+          PUT ('(');
+          for (i = 0; i < shape->n_members; i++)
+            PRINT (&shape->members[i]);
+          PUT (')');
+        }
+      else
+        {
+          PUT (G_VARIANT_CLASS_ARRAY);
+          PRINT (shape->element);
+        }
+      break;
+
+    case JSON_G_VARIANT_CLASS_DICTIONARY:
+      PUT (G_VARIANT_CLASS_ARRAY);
+      PUT ('{');
+      PUT (G_VARIANT_CLASS_STRING);
+      PRINT (shape->element);
+      PUT ('}');
+      break;
+
+    default:
+      PUT (shape->class);
+      break;
+    }
+
+#undef PRINT
+#undef PUT
+
+  return length;
+}
+
+static JsonGVariantPlan *
+json_gvariant_shape_compile (JsonGVariantArena *arena,
+                             JsonGVariantShape *shape)
+{
+  gchar *signature;
+  gsize length;
+
+  json_gvariant_shape_finish (arena, shape);
+
+  length = json_gvariant_shape_print (shape, NULL);
+  signature = json_gvariant_arena_alloc (arena, length + 1);
+  json_gvariant_shape_print (shape, signature);
+  signature[length] = '\0';
+
+  /* too deeply nested values give invalid signatures */
+  return json_gvariant_plan_new_uncached (signature);
+}
+
+static void
+json_gvariant_shape_begin_array (JsonGVariantShape *shape)
+{
+  shape->class = G_VARIANT_CLASS_ARRAY;
+  shape->n_arrays = 1;
+  shape->records = TRUE;
+}
+
+/* Returns the shape to fill with the element of 'shape' at 'index': one of
+ * its members, or 'scratch' once it has too many of them, in which case
+ * the caller merges it into the element.
+ */
+static JsonGVariantShape *
+json_gvariant_shape_get_member (JsonGVariantArena *arena,
+                                JsonGVariantShape *shape,
+                                guint              index,
+                                JsonGVariantShape *scratch)
+{
+  if (index == JSON_GVARIANT_INFER_MAX_MEMBERS)
+    json_gvariant_shape_collapse (arena, shape);
+
+  if (!shape->records)
+    {
+      memset (scratch, 0, sizeof (JsonGVariantShape));
+      return scratch;
+    }
+
+  /* most arrays are short, grow the members 4 at a time */
+  if (index % 4 == 0)
+    {
+      JsonGVariantShape *members = json_gvariant_shape_new (arena, index + 4);
+
+      if (index > 0)
+        memcpy (members, shape->members, index * sizeof (JsonGVariantShape));
+      shape->members = members;
+    }
+
+  shape->n_members = index + 1;
+
+  return &shape->members[index];
+}
+
+/* ========================================================================== */
+/* json-c trees */
+/* ========================================================================== */
+
+/* 'depth' is the number of arrays and objects around 'json_node' */
+static void
+json_gvariant_infer_node (JsonGVariantArena *arena,
+                          json_object       *json_node,
+                          guint              depth,
+                          JsonGVariantShape *shape)
+{
+  /* the conversion fails before getting here, do not look any deeper */
+  if (G_UNLIKELY (depth > json_gvariant_get_max_depth ()))
+    {
+      shape->class = G_VARIANT_CLASS_VARIANT;
+      return;
+    }
+
+  switch (json_object_get_type (json_node))
+    {
+    case json_type_null:
+      shape->nullable = TRUE;
+      break;
+
+    case json_type_boolean:
+      shape->class = G_VARIANT_CLASS_BOOLEAN;
+      break;
+
+    case json_type_int:
+      shape->class = G_VARIANT_CLASS_INT64;
+      break;
+
+    case json_type_double:
+      shape->class = G_VARIANT_CLASS_DOUBLE;
+      break;
+
+    case json_type_string:
+      shape->class = G_VARIANT_CLASS_STRING;
+      break;
+
+    case json_type_array:
+      {
+        guint len = json_object_array_length (json_node);
+        guint i;
+
+        json_gvariant_shape_begin_array (shape);
+
+        for (i = 0; i < len; i++)
+          {
+            JsonGVariantShape scratch;
+            JsonGVariantShape *member;
+
+            member = json_gvariant_shape_get_member (arena, shape, i, &scratch);
+            json_gvariant_infer_node (arena,
+                                      json_object_array_get_idx (json_node, i),
+                                      depth + 1,
+                                      member);
+            if (member == &scratch)
+              json_gvariant_shape_merge (arena, shape->element, member);
+          }
+      }
+      break;
+
+    case json_type_object:
+      {
+        struct lh_entry *member;
+
+        shape->class = JSON_G_VARIANT_CLASS_DICTIONARY;
+        shape->element = json_gvariant_shape_new (arena, 1);
+
+        /* only the values matter, as keys are always strings */
+        for (member = json_object_get_object (json_node)->head;
+             member != NULL;
+             member = member->next)
+          {
+            JsonGVariantShape value = { 0, };
+
+            json_gvariant_infer_node (arena, (json_object *) member->v, depth + 1, &value);
+            json_gvariant_shape_merge (arena, shape->element, &value);
+          }
+      }
+      break;
+    }
+}
+
+/* Returns the plan of the tightest type able to hold 'json_node', to be
+ * freed with g_free(), or NULL if there is none */
+JsonGVariantPlan *
+json_gvariant_infer_plan (JsonGVariantArena  *arena,
+                          struct json_object *json_node)
+{
+  JsonGVariantArenaMark mark;
+  JsonGVariantShape *shape;
+  JsonGVariantPlan *plan;
+
+  json_gvariant_arena_mark (arena, &mark);
+
+  shape = json_gvariant_shape_new (arena, 1);
+  json_gvariant_infer_node (arena, json_node, 0, shape);
+  plan = json_gvariant_shape_compile (arena, shape);
+
+  json_gvariant_arena_release (arena, &mark);
+
+  return plan;
+}
+
+/* ========================================================================== */
+/* JSON text */
+/* ========================================================================== */
+
+static gboolean json_gvariant_infer_token (JsonGVariantArena  *arena,
+                                           JsonScanner        *scanner,
+                                           JsonGVariantShape **shapes,
+                                           JsonGVariantShape  *shape);
+
+/* Moves to the next element of the array or object being read, see
+ * json_stream_next_element() */
+static gboolean
+json_gvariant_infer_next (JsonScanner *scanner,
+                          JsonToken    end,
+                          gboolean     first,
+                          gboolean    *done)
+{
+  JsonToken token;
+
+  token = json_scanner_next (scanner, NULL);
+
+  *done = token == end;
+  if (*done)
+    return TRUE;
+
+  if (!first)
+    {
+      if (token != JSON_TOKEN_COMMA)
+        return FALSE;
+
+      token = json_scanner_next (scanner, NULL);
+    }
+
+  return token != JSON_TOKEN_ERROR;
+}
+
+static gboolean
+json_gvariant_infer_array (JsonGVariantArena  *arena,
+                           JsonScanner        *scanner,
+                           JsonGVariantShape **shapes,
+                           JsonGVariantShape  *shape)
+{
+  gboolean done;
+  guint i;
+
+  json_gvariant_shape_begin_array (shape);
+
+  for (i = 0; ; i++)
+    {
+      JsonGVariantShape scratch;
+      JsonGVariantShape *member;
+
+      if (!json_gvariant_infer_next (scanner, JSON_TOKEN_END_ARRAY, i == 0, &done))
+        return FALSE;
+      if (done)
+        break;
+
+      member = json_gvariant_shape_get_member (arena, shape, i, &scratch);
+      if (!json_gvariant_infer_token (arena, scanner, shapes, member))
+        return FALSE;
+
+      if (member == &scratch)
+        json_gvariant_shape_merge (arena, shape->element, member);
+    }
+
+  return TRUE;
+}
+
+static gboolean
+json_gvariant_infer_object (JsonGVariantArena  *arena,
+                            JsonScanner        *scanner,
+                            JsonGVariantShape **shapes,
+                            JsonGVariantShape  *shape)
+{
+  gboolean done;
+  gboolean first = TRUE;
+
+  shape->class = JSON_G_VARIANT_CLASS_DICTIONARY;
+  shape->element = json_gvariant_shape_new (arena, 1);
+
+  while (TRUE)
+    {
+      JsonGVariantShape value = { 0, };
+
+      if (!json_gvariant_infer_next (scanner, JSON_TOKEN_END_OBJECT, first, &done))
+        return FALSE;
+      if (done)
+        break;
+
+      if (scanner->token != JSON_TOKEN_STRING ||
+          json_scanner_next (scanner, NULL) != JSON_TOKEN_COLON ||
+          json_scanner_next (scanner, NULL) == JSON_TOKEN_ERROR)
+        return FALSE;
+
+      if (!json_gvariant_infer_token (arena, scanner, shapes, &value))
+        return FALSE;
+
+      json_gvariant_shape_merge (arena, shape->element, &value);
+      first = FALSE;
+    }
+
+  return TRUE;
+}
+
+/* Infers the shape of the array or object at the scanner. When reading a
+ * tape, and if 'shapes' is not NULL, a copy of it is also kept there at the
+ * index of the node of its opening token.
+ */
+static gboolean
+json_gvariant_infer_container (JsonGVariantArena  *arena,
+                               JsonScanner        *scanner,
+                               JsonGVariantShape **shapes,
+                               JsonGVariantShape  *shape)
+{
+  gsize node = scanner->tape_pos - 1;
+  gboolean valid;
+
+  if (scanner->token == JSON_TOKEN_BEGIN_ARRAY)
+    valid = json_gvariant_infer_array (arena, scanner, shapes, shape);
+  else
+    valid = json_gvariant_infer_object (arena, scanner, shapes, shape);
+
+  /* nothing modifies a shape once all of its value has been seen, so the
+   * members and element can be shared with the copy */
+  if (valid && shapes != NULL && scanner->tape != NULL)
+    {
+      shapes[node] = json_gvariant_shape_new (arena, 1);
+      *shapes[node] = *shape;
+    }
+
+  return valid;
+}
+
+static gboolean
+json_gvariant_infer_token (JsonGVariantArena  *arena,
+                           JsonScanner        *scanner,
+                           JsonGVariantShape **shapes,
+                           JsonGVariantShape  *shape)
+{
+  switch (scanner->token)
+    {
+    case JSON_TOKEN_NULL:
+      shape->nullable = TRUE;
+      return TRUE;
+
+    case JSON_TOKEN_BOOLEAN:
+      shape->class = G_VARIANT_CLASS_BOOLEAN;
+      return TRUE;
+
+    case JSON_TOKEN_INT:
+      shape->class = G_VARIANT_CLASS_INT64;
+      return TRUE;
+
+    case JSON_TOKEN_DOUBLE:
+      shape->class = G_VARIANT_CLASS_DOUBLE;
+      return TRUE;
+
+    case JSON_TOKEN_STRING:
+      shape->class = G_VARIANT_CLASS_STRING;
+      return TRUE;
+
+    case JSON_TOKEN_BEGIN_ARRAY:
+    case JSON_TOKEN_BEGIN_OBJECT:
+      return json_gvariant_infer_container (arena, scanner, shapes, shape);
+
+    default:
+      return FALSE;
+    }
+}
+
+/* Copies 'scanner' to look ahead at the value at its current token */
+static void
+json_gvariant_infer_lookahead (JsonScanner *scanner,
+                               JsonScanner *lookahead)
+{
+  /* the buffer holds nothing for the opening token, so it can be shared */
+  if (scanner->tape != NULL)
+    {
+      /* replaying the tape from the same node is enough */
+      *lookahead = *scanner;
+      lookahead->owns_buffer = FALSE;
+    }
+  else
+    {
+      json_scanner_init (lookahead,
+                         scanner->pos,
+                         scanner->end - scanner->pos,
+                         scanner->buffer);
+      lookahead->token = scanner->token;
+      lookahead->depth = scanner->depth;
+      lookahead->max_depth = scanner->max_depth;
+      lookahead->n_nodes = scanner->n_nodes;
+      lookahead->max_nodes = scanner->max_nodes;
+      lookahead->max_string_length = scanner->max_string_length;
+      lookahead->n_allocations = scanner->n_allocations;
+    }
+}
+
+/* Looks ahead at the array or object starting at the current token of
+ * 'scanner', which must replay a tape, and returns the shapes of all the
+ * arrays and objects in it, indexed by the node of their opening token on
+ * the tape, for json_gvariant_infer_plan_scanner(). The shapes are
+ * allocated from 'arena' and last until it is released past them; the
+ * ones of malformed values are left NULL. 'scanner' is left untouched.
+ */
+JsonGVariantShape **
+json_gvariant_infer_shapes (JsonGVariantArena *arena,
+                            JsonScanner       *scanner)
+{
+  JsonGVariantShape **shapes;
+  JsonGVariantShape shape = { 0, };
+  JsonScanner lookahead;
+  gsize size;
+
+  g_assert (scanner->tape != NULL);
+  g_assert (scanner->token == JSON_TOKEN_BEGIN_ARRAY ||
+            scanner->token == JSON_TOKEN_BEGIN_OBJECT);
+
+  size = scanner->tape->n_nodes * sizeof (JsonGVariantShape *);
+  shapes = json_gvariant_arena_alloc (arena, size);
+  memset (shapes, 0, size);
+
+  json_gvariant_infer_lookahead (scanner, &lookahead);
+  json_gvariant_infer_token (arena, &lookahead, shapes, &shape);
+  json_scanner_clear (&lookahead);
+
+  return shapes;
+}
+
+/* Like json_gvariant_infer_plan(), for the array or object starting at the
+ * current token of 'scanner', which must read from memory or from a tape.
+ * The type is compiled from 'shapes' if it has the one of the value, see
+ * json_gvariant_infer_shapes(); otherwise the value is looked ahead with a
+ * scanner of its own. 'scanner' is left untouched.
+ * Returns NULL if the value is malformed, leaving the error to be found
+ * when it is converted.
+ */
+JsonGVariantPlan *
+json_gvariant_infer_plan_scanner (JsonGVariantArena  *arena,
+                                  JsonScanner        *scanner,
+                                  JsonGVariantShape **shapes)
+{
+  JsonGVariantArenaMark mark;
+  JsonGVariantShape *shape;
+  JsonGVariantPlan *plan = NULL;
+  JsonScanner lookahead;
+
+  g_assert (scanner->stream == NULL);
+  g_assert (scanner->token == JSON_TOKEN_BEGIN_ARRAY ||
+            scanner->token == JSON_TOKEN_BEGIN_OBJECT);
+
+  json_gvariant_arena_mark (arena, &mark);
+  shape = json_gvariant_shape_new (arena, 1);
+
+  if (shapes != NULL && scanner->tape != NULL &&
+      shapes[scanner->tape_pos - 1] != NULL)
+    {
+      /* finishing the shape modifies it, and the kept one can be needed
+       * again for the values nested in it */
+      json_gvariant_shape_copy (arena, shape, shapes[scanner->tape_pos - 1]);
+      plan = json_gvariant_shape_compile (arena, shape);
+    }
+  else
+    {
+      json_gvariant_infer_lookahead (scanner, &lookahead);
+      if (json_gvariant_infer_token (arena, &lookahead, NULL, shape))
+        plan = json_gvariant_shape_compile (arena, shape);
+      json_scanner_clear (&lookahead);
+    }
+
+  json_gvariant_arena_release (arena, &mark);
+
+  return plan;
+}
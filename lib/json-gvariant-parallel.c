@@ -0,0 +1,195 @@
+/* json-gvariant-parallel.c - Thread pool shared by the JSON GVariant converters
+ *
+ * Copyright (C) 2013  Intel Corporation.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Author:
+ *   Emanuele Aina <emanuele.aina@collabora.com>
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "json-gvariant.h"
+#include "json-gvariant-private.h"
+
+/* The jobs of a json_gvariant_parallel_for() call. Helpers may only get to
+ * run after all the jobs are done, so they hold a reference of their own
+ * and never touch 'func' and 'data' unless they claim a job.
+ */
+typedef struct
+{
+  gint                      ref_count;
+
+  JsonGVariantParallelFunc  func;
+  gpointer                  data;
+  guint                     n_jobs;
+
+  gint                      next_job;
+  gint                      n_done;
+  GMutex                    mutex;
+  GCond                     cond;
+} JsonGVariantParallelRun;
+
+static GThreadPool *pool = NULL;
+static guint max_threads = 0;
+G_LOCK_DEFINE_STATIC (pool);
+
+static void
+json_gvariant_parallel_run_unref (JsonGVariantParallelRun *run)
+{
+  if (!g_atomic_int_dec_and_test (&run->ref_count))
+    return;
+
+  g_mutex_clear (&run->mutex);
+  g_cond_clear (&run->cond);
+  g_free (run);
+}
+
+/* Runs the jobs not claimed yet, until there are none left */
+static void
+json_gvariant_parallel_run_jobs (JsonGVariantParallelRun *run)
+{
+  while (TRUE)
+    {
+      guint job = g_atomic_int_add (&run->next_job, 1);
+
+      if (job >= run->n_jobs)
+        break;
+
+      run->func (run->data, job);
+
+      if (g_atomic_int_add (&run->n_done, 1) + 1 == (gint) run->n_jobs)
+        {
+          g_mutex_lock (&run->mutex);
+          g_cond_signal (&run->cond);
+          g_mutex_unlock (&run->mutex);
+        }
+    }
+}
+
+static void
+json_gvariant_parallel_helper (gpointer               data,
+                               G_GNUC_UNUSED gpointer user_data)
+{
+  JsonGVariantParallelRun *run = data;
+
+  json_gvariant_parallel_run_jobs (run);
+  json_gvariant_parallel_run_unref (run);
+}
+
+/* Returns the shared pool and the number of threads to use, or NULL if
+ * conversions are not to use more than one thread */
+static GThreadPool *
+json_gvariant_parallel_get_pool (guint *n_threads)
+{
+  GThreadPool *result;
+
+  G_LOCK (pool);
+
+  if (max_threads == 0)
+    max_threads = g_get_num_processors ();
+
+  /* the calling thread always takes part, so the pool has one less */
+  if (pool == NULL && max_threads > 1)
+    pool = g_thread_pool_new (json_gvariant_parallel_helper, NULL,
+                              max_threads - 1, FALSE, NULL);
+
+  result = max_threads > 1 ? pool : NULL;
+  *n_threads = max_threads;
+
+  G_UNLOCK (pool);
+
+  return result;
+}
+
+/* Returns how many threads json_gvariant_parallel_for() runs the jobs on */
+guint
+json_gvariant_parallel_get_n_threads (void)
+{
+  guint n_threads;
+
+  json_gvariant_parallel_get_pool (&n_threads);
+
+  return n_threads;
+}
+
+/* Calls 'func' for every job from 0 to 'n_jobs' - 1, in no particular
+ * order, on the calling thread and on the threads of the shared pool.
+ * Returns when all of them are done.
+ *
+ * The jobs must not wait for anything done by the pool themselves, or
+ * they could wait on each other: nested conversions run sequentially.
+ */
+void
+json_gvariant_parallel_for (guint                     n_jobs,
+                            JsonGVariantParallelFunc  func,
+                            gpointer                  data)
+{
+  JsonGVariantParallelRun *run;
+  GThreadPool *thread_pool;
+  guint n_threads;
+  guint n_helpers;
+  guint i;
+
+  thread_pool = json_gvariant_parallel_get_pool (&n_threads);
+  n_helpers = thread_pool != NULL && n_jobs > 0 ? MIN (n_jobs, n_threads) - 1 : 0;
+
+  if (n_helpers == 0)
+    {
+      for (i = 0; i < n_jobs; i++)
+        func (data, i);
+      return;
+    }
+
+  run = g_new0 (JsonGVariantParallelRun, 1);
+  run->ref_count = 1 + n_helpers;
+  run->func = func;
+  run->data = data;
+  run->n_jobs = n_jobs;
+  g_mutex_init (&run->mutex);
+  g_cond_init (&run->cond);
+
+  for (i = 0; i < n_helpers; i++)
+    g_thread_pool_push (thread_pool, run, NULL);
+
+  json_gvariant_parallel_run_jobs (run);
+
+  g_mutex_lock (&run->mutex);
+  while (g_atomic_int_get (&run->n_done) < (gint) n_jobs)
+    g_cond_wait (&run->cond, &run->mutex);
+  g_mutex_unlock (&run->mutex);
+
+  json_gvariant_parallel_run_unref (run);
+}
+
+/* Sets how many threads, the calling one included, a conversion with
+ * JSON_GVARIANT_FLAGS_PARALLEL may use. Defaults to the number of
+ * processors; 1 disables the thread pool.
+ */
+void
+json_gvariant_set_max_threads (guint n_threads)
+{
+  g_return_if_fail (n_threads > 0);
+
+  G_LOCK (pool);
+
+  max_threads = n_threads;
+  if (pool != NULL)
+    g_thread_pool_set_max_threads (pool, MAX (n_threads - 1, 1), NULL);
+
+  G_UNLOCK (pool);
+}
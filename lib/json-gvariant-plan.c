@@ -0,0 +1,299 @@
+/* json-gvariant-plan.c - Compiled GVariant signatures
+ *
+ * Copyright (C) 2013  Intel Corporation.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Author:
+ *   Emanuele Aina <emanuele.aina@collabora.com>
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string.h>
+
+#include <glib/gi18n-lib.h>
+#include <gio/gio.h>
+
+#include "json-gvariant-private.h"
+
+/* signature string -> JsonGVariantPlan, never freed */
+static GHashTable *plans = NULL;
+G_LOCK_DEFINE_STATIC (plans);
+
+/* Compiles the complete type at 'type_string' into 'node', taking the
+ * storage for its children from 'free_nodes'. Returns the end of the
+ * complete type.
+ */
+static const gchar *
+json_gvariant_plan_compile (JsonGVariantPlan  *node,
+                            JsonGVariantPlan **free_nodes,
+                            const gchar       *type_string)
+{
+  JsonGVariantPlan *children;
+  const gchar *end;
+  guint i;
+
+  node->type = (const GVariantType *) type_string;
+  node->class = type_string[0];
+  node->children = NULL;
+  node->n_children = 0;
+  node->alignment = 1;
+  node->fixed_size = 0;
+
+  switch (type_string[0])
+    {
+    case G_VARIANT_CLASS_ARRAY:
+    case G_VARIANT_CLASS_MAYBE:
+      if (type_string[0] == G_VARIANT_CLASS_ARRAY &&
+          type_string[1] == G_VARIANT_CLASS_DICT_ENTRY)
+        node->class = JSON_G_VARIANT_CLASS_DICTIONARY;
+
+      children = *free_nodes;
+      *free_nodes += 1;
+
+      node->children = children;
+      node->n_children = 1;
+      end = json_gvariant_plan_compile (children, free_nodes, type_string + 1);
+      node->alignment = children[0].alignment;
+      break;
+
+    case G_VARIANT_CLASS_TUPLE:
+    case G_VARIANT_CLASS_DICT_ENTRY:
+      {
+        gsize offset = 0;
+        gboolean fixed = TRUE;
+
+        node->n_children = g_variant_type_n_items (node->type);
+
+        children = *free_nodes;
+        *free_nodes += node->n_children;
+
+        node->children = children;
+        end = type_string + 1;
+        for (i = 0; i < node->n_children; i++)
+          {
+            end = json_gvariant_plan_compile (&children[i], free_nodes, end);
+
+            node->alignment = MAX (node->alignment, children[i].alignment);
+            offset = JSON_GVARIANT_ALIGN_UP (offset, children[i].alignment) + children[i].fixed_size;
+            fixed = fixed && children[i].fixed_size > 0;
+          }
+
+        /* the unit tuple is serialized as a single zero byte */
+        if (node->n_children == 0)
+          node->fixed_size = 1;
+        else if (fixed)
+          node->fixed_size = JSON_GVARIANT_ALIGN_UP (offset, node->alignment);
+
+        /* skip the closing ')' or '}' */
+        end++;
+      }
+      break;
+
+    case G_VARIANT_CLASS_BOOLEAN:
+    case G_VARIANT_CLASS_BYTE:
+      node->fixed_size = 1;
+      end = type_string + 1;
+      break;
+
+    case G_VARIANT_CLASS_INT16:
+    case G_VARIANT_CLASS_UINT16:
+      node->alignment = node->fixed_size = 2;
+      end = type_string + 1;
+      break;
+
+    case G_VARIANT_CLASS_INT32:
+    case G_VARIANT_CLASS_UINT32:
+    case G_VARIANT_CLASS_HANDLE:
+      node->alignment = node->fixed_size = 4;
+      end = type_string + 1;
+      break;
+
+    case G_VARIANT_CLASS_INT64:
+    case G_VARIANT_CLASS_UINT64:
+    case G_VARIANT_CLASS_DOUBLE:
+      node->alignment = node->fixed_size = 8;
+      end = type_string + 1;
+      break;
+
+    case G_VARIANT_CLASS_VARIANT:
+      node->alignment = 8;
+      end = type_string + 1;
+      break;
+
+    default:
+      end = type_string + 1;
+      break;
+    }
+
+  return end;
+}
+
+static JsonGVariantPlan *
+json_gvariant_plan_new (const gchar *signature)
+{
+  JsonGVariantPlan *nodes;
+  JsonGVariantPlan *free_nodes;
+  gchar *type_string;
+  gsize length;
+  guint n_nodes = 0;
+  const gchar *p;
+
+  /* every character but the closing brackets starts a complete type */
+  for (p = signature; *p != '\0'; p++)
+    if (*p != ')' && *p != '}')
+      n_nodes++;
+
+  /* the nodes and the signature they point to share the same block */
+  length = p - signature;
+  nodes = g_malloc (n_nodes * sizeof (JsonGVariantPlan) + length + 1);
+  type_string = (gchar *) (nodes + n_nodes);
+  memcpy (type_string, signature, length + 1);
+
+  free_nodes = nodes + 1;
+  json_gvariant_plan_compile (nodes, &free_nodes, type_string);
+  g_assert (free_nodes == nodes + n_nodes);
+
+  return nodes;
+}
+
+/* Returns the compiled plan for 'signature', which is validated and
+ * compiled only the first time it is seen by the process.
+ */
+const JsonGVariantPlan *
+json_gvariant_plan_get (const gchar  *signature,
+                        GError      **error)
+{
+  JsonGVariantPlan *plan;
+  JsonGVariantPlan *cached;
+
+  G_LOCK (plans);
+  if (G_UNLIKELY (plans == NULL))
+    plans = g_hash_table_new (g_str_hash, g_str_equal);
+  plan = g_hash_table_lookup (plans, signature);
+  G_UNLOCK (plans);
+
+  if (G_LIKELY (plan != NULL))
+    return plan;
+
+  if (! g_variant_type_string_is_valid (signature))
+    {
+      g_set_error_literal (error,
+                           G_IO_ERROR,
+                           G_IO_ERROR_INVALID_ARGUMENT,
+                           _("Invalid GVariant signature"));
+      return NULL;
+    }
+
+  /* the converters only produce values of definite types: report the
+   * first class standing for several types as they would */
+  if (G_UNLIKELY (!g_variant_type_is_definite (G_VARIANT_TYPE (signature))))
+    {
+      g_set_error (error,
+                   G_IO_ERROR,
+                   G_IO_ERROR_INVALID_DATA,
+                   _("GVariant class '%c' not supported"),
+                   signature[strcspn (signature, "*?r")]);
+      return NULL;
+    }
+
+  plan = json_gvariant_plan_new (signature);
+
+  /* another thread may have compiled the same signature in the meantime */
+  G_LOCK (plans);
+  cached = g_hash_table_lookup (plans, signature);
+  if (cached == NULL)
+    g_hash_table_insert (plans,
+                         (gpointer) g_variant_type_peek_string (plan->type),
+                         plan);
+  G_UNLOCK (plans);
+
+  if (cached != NULL)
+    {
+      g_free (plan);
+      plan = cached;
+    }
+
+  return plan;
+}
+
+/* Returns the plan for 'signature' if it is in the cache of
+ * json_gvariant_plan_get(), or NULL, without adding it there */
+const JsonGVariantPlan *
+json_gvariant_plan_lookup (const gchar *signature)
+{
+  const JsonGVariantPlan *plan = NULL;
+
+  G_LOCK (plans);
+  if (plans != NULL)
+    plan = g_hash_table_lookup (plans, signature);
+  G_UNLOCK (plans);
+
+  return plan;
+}
+
+/* Compiles 'signature' without going through the cache, for signatures
+ * which are not expected to be seen again. The plan is owned by the caller
+ * and freed with g_free(). Returns NULL if the signature is not valid.
+ */
+JsonGVariantPlan *
+json_gvariant_plan_new_uncached (const gchar *signature)
+{
+  if (! g_variant_type_string_is_valid (signature))
+    return NULL;
+
+  return json_gvariant_plan_new (signature);
+}
+
+/* Returns the plan used to convert JSON values when no signature is given,
+ * according to the class inferred from the JSON value: 'a{sv}' for
+ * objects, 'av' for arrays, 'mv' for nulls and 'b', 'x', 'd' and 's' for
+ * the basic values.
+ */
+const JsonGVariantPlan *
+json_gvariant_plan_get_default (gchar class)
+{
+  static const struct
+  {
+    gchar        class;
+    const gchar *signature;
+  } defaults[] = {
+    { JSON_G_VARIANT_CLASS_DICTIONARY, "a{sv}" },
+    { G_VARIANT_CLASS_ARRAY, "av" },
+    { G_VARIANT_CLASS_MAYBE, "mv" },
+    { G_VARIANT_CLASS_BOOLEAN, "b" },
+    { G_VARIANT_CLASS_INT64, "x" },
+    { G_VARIANT_CLASS_DOUBLE, "d" },
+    { G_VARIANT_CLASS_STRING, "s" }
+  };
+  static gsize plans[G_N_ELEMENTS (defaults)] = { 0, };
+  guint i;
+
+  for (i = 0; i < G_N_ELEMENTS (defaults); i++)
+    {
+      if (defaults[i].class != class)
+        continue;
+
+      if (g_once_init_enter (&plans[i]))
+        g_once_init_leave (&plans[i], (gsize) json_gvariant_plan_get (defaults[i].signature, NULL));
+
+      return (const JsonGVariantPlan *) plans[i];
+    }
+
+  g_assert_not_reached ();
+  return NULL;
+}
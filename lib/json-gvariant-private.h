@@ -0,0 +1,263 @@
+/* json-gvariant-private.h - Internals shared by the JSON GVariant converters
+ *
+ * Copyright (C) 2013  Intel Corporation.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Author:
+ *   Emanuele Aina <emanuele.aina@collabora.com>
+ */
+
+#ifndef __JSON_GVARIANT_PRIVATE_H__
+#define __JSON_GVARIANT_PRIVATE_H__
+
+#include <glib.h>
+
+#include "json-gvariant.h"
+#include "json-scanner.h"
+
+G_BEGIN_DECLS
+
+/* custom extension to the GVariantClass enumeration to differentiate
+ * a single dictionary entry from an array of dictionary entries
+ */
+#define JSON_G_VARIANT_CLASS_DICTIONARY 'c'
+
+#define JSON_GVARIANT_ALIGN_UP(offset, alignment) \
+  (((offset) + (alignment) - 1) & ~((gsize) (alignment) - 1))
+
+typedef struct _JsonGVariantPlan JsonGVariantPlan;
+
+/* A signature compiled into a tree of nodes, one per complete type.
+ *
+ * The children of a node are stored contiguously: the element of arrays
+ * and maybes, the members of tuples and the key and value of dictionary
+ * entries. Arrays of dictionary entries use the
+ * JSON_G_VARIANT_CLASS_DICTIONARY class and have the entry as their only
+ * child. 'type' points inside the signature the plan was compiled from,
+ * and as such it is not NUL-terminated.
+ *
+ * 'alignment' and 'fixed_size' describe the serialized form of the type,
+ * as in the GVariant specification: values are aligned to 'alignment'
+ * bytes and take exactly 'fixed_size' bytes, or a variable amount if it
+ * is 0.
+ *
+ * Plans are immutable and cached for the lifetime of the process.
+ */
+struct _JsonGVariantPlan
+{
+  const GVariantType     *type;
+  const JsonGVariantPlan *children;
+  guint                   n_children;
+  gchar                   class;
+  guint8                  alignment;
+  gsize                   fixed_size;
+};
+
+const JsonGVariantPlan * json_gvariant_plan_get         (const gchar   *signature,
+                                                         GError       **error);
+const JsonGVariantPlan * json_gvariant_plan_get_default (gchar          class);
+const JsonGVariantPlan * json_gvariant_plan_lookup      (const gchar   *signature);
+JsonGVariantPlan *       json_gvariant_plan_new_uncached (const gchar  *signature);
+
+typedef struct _JsonGVariantArena JsonGVariantArena;
+typedef struct _JsonGVariantArenaChunk JsonGVariantArenaChunk;
+
+/* Stack-like bump allocator owning the temporaries of a conversion.
+ *
+ * Memory is handed out from large chunks and given back in LIFO order by
+ * releasing to a mark. Each thread keeps its arena, and the chunks it
+ * has grown, across conversions: once warm, a conversion does not touch
+ * the heap for its temporaries at all.
+ */
+typedef struct
+{
+  JsonGVariantArenaChunk *chunk;
+  gsize                   used;
+} JsonGVariantArenaMark;
+
+JsonGVariantArena * json_gvariant_arena_begin   (void);
+void                json_gvariant_arena_end     (JsonGVariantArena     *arena);
+
+gpointer            json_gvariant_arena_alloc   (JsonGVariantArena     *arena,
+                                                 gsize                  size);
+gpointer            json_gvariant_arena_grow    (JsonGVariantArena     *arena,
+                                                 gpointer               mem,
+                                                 gsize                  old_size,
+                                                 gsize                  new_size);
+void                json_gvariant_arena_mark    (JsonGVariantArena     *arena,
+                                                 JsonGVariantArenaMark *mark);
+void                json_gvariant_arena_release (JsonGVariantArena     *arena,
+                                                 JsonGVariantArenaMark *mark);
+GString *           json_gvariant_arena_get_buffer (JsonGVariantArena  *arena);
+JsonTape *          json_gvariant_arena_get_tape   (JsonGVariantArena  *arena);
+void                json_gvariant_arena_count_scanner (JsonGVariantArena *arena,
+                                                       JsonScanner       *scanner);
+guint               json_gvariant_arena_get_n_allocations (JsonGVariantArena *arena);
+
+/* Writes serialized GVariant data straight into a single buffer.
+ *
+ * Values are written depth-first: containers are opened with a frame on
+ * the stack of the caller, their children written in order and the
+ * framing offsets appended when the container is closed. The offsets
+ * still pending are kept in a stack allocated from 'arena', which must
+ * not be used for anything else while the writer is active.
+ */
+typedef struct
+{
+  GByteArray        *data;
+  JsonGVariantArena *arena;
+  gsize             *offsets;
+  gsize              n_offsets;
+  gsize              size;
+} JsonGVariantWriter;
+
+typedef struct
+{
+  gsize start;
+  gsize first_offset;
+} JsonGVariantWriterFrame;
+
+void       json_gvariant_writer_init        (JsonGVariantWriter      *writer,
+                                             JsonGVariantArena       *arena,
+                                             gsize                    size_hint);
+void       json_gvariant_writer_clear       (JsonGVariantWriter      *writer);
+GVariant * json_gvariant_writer_finish      (JsonGVariantWriter      *writer,
+                                             const GVariantType      *type);
+
+void       json_gvariant_writer_align       (JsonGVariantWriter      *writer,
+                                             guint                    alignment);
+void       json_gvariant_writer_write       (JsonGVariantWriter      *writer,
+                                             gconstpointer            data,
+                                             gsize                    size);
+void       json_gvariant_writer_write_string (JsonGVariantWriter     *writer,
+                                             const gchar             *string,
+                                             gsize                    length);
+
+void       json_gvariant_writer_open        (JsonGVariantWriter      *writer,
+                                             JsonGVariantWriterFrame *frame);
+void       json_gvariant_writer_add_offset  (JsonGVariantWriter      *writer,
+                                             JsonGVariantWriterFrame *frame);
+void       json_gvariant_writer_close_array (JsonGVariantWriter      *writer,
+                                             JsonGVariantWriterFrame *frame);
+void       json_gvariant_writer_close_tuple (JsonGVariantWriter      *writer,
+                                             JsonGVariantWriterFrame *frame,
+                                             gsize                    fixed_size);
+void       json_gvariant_writer_sort_entries (JsonGVariantWriter     *writer,
+                                             JsonGVariantWriterFrame *frame,
+                                             const JsonGVariantPlan  *entry);
+
+/* Runs independent jobs on the calling thread and a thread pool shared by
+ * all the conversions, see JSON_GVARIANT_FLAGS_PARALLEL */
+typedef void (* JsonGVariantParallelFunc) (gpointer data,
+                                           guint    job);
+
+guint json_gvariant_parallel_get_n_threads (void);
+void  json_gvariant_parallel_for           (guint                     n_jobs,
+                                            JsonGVariantParallelFunc  func,
+                                            gpointer                  data);
+
+/* The cost of a conversion by JSON path, see json_gvariant_profile_dump().
+ * The containers set the path of each of their values before converting
+ * it, and the value is measured between entering and leaving it. */
+typedef struct _JsonGVariantProfile JsonGVariantProfile;
+
+typedef struct
+{
+  gsize   parent_length;
+  gsize   offset;
+  guint   n_nodes;
+  guint64 n_allocations;
+  gint64  time;
+} JsonGVariantProfileProbe;
+
+JsonGVariantProfile * json_gvariant_profile_begin       (JsonGVariantArena        *arena);
+void                  json_gvariant_profile_end         (JsonGVariantProfile      *profile);
+void                  json_gvariant_profile_set_member  (JsonGVariantProfile      *profile,
+                                                         const gchar              *key,
+                                                         gsize                     length);
+void                  json_gvariant_profile_set_element (JsonGVariantProfile      *profile,
+                                                         gint                      index);
+void                  json_gvariant_profile_add_allocation (JsonGVariantProfile   *profile);
+gboolean              json_gvariant_profile_enter       (JsonGVariantProfile      *profile,
+                                                         JsonScanner              *scanner,
+                                                         JsonGVariantProfileProbe *probe);
+void                  json_gvariant_profile_leave       (JsonGVariantProfile      *profile,
+                                                         JsonScanner              *scanner,
+                                                         JsonGVariantProfileProbe *probe);
+
+/* The maximum nesting of arrays and objects accepted by the parsers and
+ * the converters, see json_gvariant_set_max_depth() */
+guint json_gvariant_get_max_depth (void);
+
+/* Converters generated by json-gvariant-codegen.py from a schema of the
+ * JSON text: 'write' writes the value at the scanner as 'signature' with
+ * the writer of 'context', which the json_gvariant_generated_*() functions
+ * give access to. Values not matching the schema are converted with the
+ * generic code by json_gvariant_generated_write_value() and
+ * json_gvariant_generated_write_variant(). */
+typedef struct _JsonGVariantContext JsonGVariantContext;
+
+typedef struct
+{
+  const gchar *signature;
+  gboolean   (* write) (JsonGVariantContext  *context,
+                        JsonScanner          *scanner,
+                        GError              **error);
+} JsonGVariantGenerated;
+
+GVariant *           json_gvariant_deserialize_generated   (const gchar                  *json,
+                                                            gssize                        length,
+                                                            const JsonGVariantGenerated  *generated,
+                                                            JsonGVariantFlags             flags,
+                                                            const JsonGVariantLimits     *limits,
+                                                            GError                      **error);
+JsonGVariantWriter * json_gvariant_generated_get_writer    (JsonGVariantContext          *context);
+gboolean             json_gvariant_generated_is_sorted     (JsonGVariantContext          *context);
+gboolean             json_gvariant_generated_next_element  (JsonScanner                  *scanner,
+                                                            JsonToken                     end,
+                                                            gboolean                      first,
+                                                            GError                      **error);
+gboolean             json_gvariant_generated_next_member   (JsonScanner                  *scanner,
+                                                            gboolean                      first,
+                                                            GError                      **error);
+gboolean             json_gvariant_generated_next_value    (JsonScanner                  *scanner,
+                                                            GError                      **error);
+gint64               json_gvariant_generated_get_int       (JsonScanner                  *scanner);
+gdouble              json_gvariant_generated_get_double    (JsonScanner                  *scanner);
+gboolean             json_gvariant_generated_write_value   (JsonGVariantContext          *context,
+                                                            JsonScanner                  *scanner,
+                                                            const JsonGVariantPlan       *plan,
+                                                            GError                      **error);
+gboolean             json_gvariant_generated_write_variant (JsonGVariantContext          *context,
+                                                            JsonScanner                  *scanner,
+                                                            GError                      **error);
+
+/* Compact types inferred from the JSON values themselves, see
+ * JSON_GVARIANT_FLAGS_COMPACT */
+struct json_object;
+
+typedef struct _JsonGVariantShape JsonGVariantShape;
+
+JsonGVariantPlan *   json_gvariant_infer_plan         (JsonGVariantArena   *arena,
+                                                       struct json_object  *json_node);
+JsonGVariantShape ** json_gvariant_infer_shapes       (JsonGVariantArena   *arena,
+                                                       JsonScanner         *scanner);
+JsonGVariantPlan *   json_gvariant_infer_plan_scanner (JsonGVariantArena   *arena,
+                                                       JsonScanner         *scanner,
+                                                       JsonGVariantShape  **shapes);
+
+G_END_DECLS
+
+#endif /* __JSON_GVARIANT_PRIVATE_H__ */
@@ -0,0 +1,150 @@
+/* json-gvariant-profile-cli.c - Prints the cost of converting JSON files
+ *
+ * Copyright (C) 2013  Intel Corporation.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Author:
+ *   Emanuele Aina <emanuele.aina@collabora.com>
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <glib.h>
+
+#include "json-gvariant.h"
+
+static gchar *signature = NULL;
+static gboolean serialized = FALSE;
+static gboolean intern = FALSE;
+static gboolean compact = FALSE;
+static gint iterations = 1;
+static gchar **files = NULL;
+
+/* Reads the whole of 'path', or of the standard input if it is "-" */
+static gboolean
+read_input (const gchar  *path,
+            gchar       **contents,
+            gsize        *length,
+            GError      **error)
+{
+  GIOChannel *channel;
+  gboolean result;
+
+  if (g_strcmp0 (path, "-") != 0)
+    return g_file_get_contents (path, contents, length, error);
+
+  channel = g_io_channel_unix_new (0);
+  g_io_channel_set_encoding (channel, NULL, NULL);
+  result = g_io_channel_read_to_end (channel, contents, length, error) == G_IO_STATUS_NORMAL;
+  g_io_channel_unref (channel);
+
+  return result;
+}
+
+static gboolean
+profile_file (const gchar        *path,
+              JsonGVariantFlags   flags)
+{
+  GError *error = NULL;
+  gchar *json;
+  gsize length;
+  gint i;
+
+  if (!read_input (path, &json, &length, &error))
+    {
+      g_printerr ("%s: %s\n", path, error->message);
+      g_error_free (error);
+      return FALSE;
+    }
+
+  for (i = 0; i < iterations; i++)
+    {
+      GVariant *variant;
+
+      variant = json_gvariant_deserialize_data_full (json, length, signature,
+                                                     flags, &error);
+      if (variant == NULL)
+        {
+          g_printerr ("%s: %s\n", path, error->message);
+          g_error_free (error);
+          g_free (json);
+          return FALSE;
+        }
+
+      g_variant_unref (g_variant_ref_sink (variant));
+    }
+
+  g_free (json);
+
+  return TRUE;
+}
+
+int
+main (int    argc,
+      char **argv)
+{
+  GOptionContext *context;
+  GError *error = NULL;
+  JsonGVariantFlags flags = JSON_GVARIANT_FLAGS_NONE;
+  gboolean result = TRUE;
+  gchar *dump;
+  guint i;
+  GOptionEntry entries[] = {
+    { "signature", 's', 0, G_OPTION_ARG_STRING, &signature,
+      "Convert to the GVariant type SIGNATURE instead of inferring it", "SIGNATURE" },
+    { "serialized", 0, 0, G_OPTION_ARG_NONE, &serialized,
+      "Convert with JSON_GVARIANT_FLAGS_SERIALIZED", NULL },
+    { "intern", 0, 0, G_OPTION_ARG_NONE, &intern,
+      "Convert with JSON_GVARIANT_FLAGS_INTERN", NULL },
+    { "compact", 0, 0, G_OPTION_ARG_NONE, &compact,
+      "Convert with JSON_GVARIANT_FLAGS_COMPACT", NULL },
+    { "iterations", 'n', 0, G_OPTION_ARG_INT, &iterations,
+      "Convert each file N times", "N" },
+    { G_OPTION_REMAINING, 0, 0, G_OPTION_ARG_FILENAME_ARRAY, &files,
+      NULL, "[FILE...]" },
+    { NULL }
+  };
+
+  context = g_option_context_new ("- print the cost of converting JSON files to GVariant by JSON path");
+  g_option_context_add_main_entries (context, entries, NULL);
+  if (!g_option_context_parse (context, &argc, &argv, &error))
+    {
+      g_printerr ("%s\n", error->message);
+      return 1;
+    }
+  g_option_context_free (context);
+
+  if (serialized)
+    flags |= JSON_GVARIANT_FLAGS_SERIALIZED;
+  if (intern)
+    flags |= JSON_GVARIANT_FLAGS_INTERN;
+  if (compact)
+    flags |= JSON_GVARIANT_FLAGS_COMPACT;
+
+  json_gvariant_profile_set_enabled (TRUE);
+
+  if (files == NULL)
+    result = profile_file ("-", flags);
+  for (i = 0; files != NULL && files[i] != NULL; i++)
+    result = profile_file (files[i], flags) && result;
+
+  dump = json_gvariant_profile_dump ();
+  g_print ("%s\n", dump);
+  g_free (dump);
+
+  return result ? 0 : 1;
+}
@@ -0,0 +1,355 @@
+/* json-gvariant-profile.c - Cost of the conversions by JSON path
+ *
+ * Copyright (C) 2013  Intel Corporation.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Author:
+ *   Emanuele Aina <emanuele.aina@collabora.com>
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string.h>
+#include <time.h>
+
+#include "json-gvariant.h"
+#include "json-gvariant-private.h"
+
+/* While profiling is enabled, the conversions from JSON text keep track of
+ * the JSON pointer of the value being converted, with '*' standing for
+ * the index of array elements, and add the cost of each value to the
+ * totals of its path: '/cookies/0/value' and '/cookies/1/value' both
+ * count for the path with '*' in place of the index. The costs of a value
+ * include the ones of the values it contains.
+ *
+ * Each conversion collects its totals on its own, and adds them to the
+ * ones of the process when it ends.
+ */
+typedef struct
+{
+  guint64 count;
+  guint64 nodes;
+  guint64 bytes;
+  guint64 allocations;
+  guint64 time;
+} JsonGVariantProfileEntry;
+
+struct _JsonGVariantProfile
+{
+  JsonGVariantArena *arena;
+  GHashTable        *entries;
+  GString           *path;
+  gsize              parent_length;
+  gboolean           pending;
+  guint64            n_allocations;
+};
+
+static gint profile_enabled = FALSE;
+static GHashTable *profile_entries = NULL;
+static guint64 profile_conversions = 0;
+G_LOCK_DEFINE_STATIC (profile);
+
+static gint64
+json_gvariant_profile_get_time (void)
+{
+#ifdef CLOCK_MONOTONIC
+  struct timespec now;
+
+  if (clock_gettime (CLOCK_MONOTONIC, &now) == 0)
+    return (gint64) now.tv_sec * G_GINT64_CONSTANT (1000000000) + now.tv_nsec;
+#endif
+
+  return g_get_monotonic_time () * 1000;
+}
+
+static GHashTable *
+json_gvariant_profile_entries_new (void)
+{
+  return g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+}
+
+static JsonGVariantProfileEntry *
+json_gvariant_profile_entries_get (GHashTable  *entries,
+                                   const gchar *path)
+{
+  JsonGVariantProfileEntry *entry;
+
+  entry = g_hash_table_lookup (entries, path);
+  if (entry == NULL)
+    {
+      entry = g_new0 (JsonGVariantProfileEntry, 1);
+      g_hash_table_insert (entries, g_strdup (path), entry);
+    }
+
+  return entry;
+}
+
+/* Returns the profile for a new conversion, or NULL if profiling is not
+ * enabled. The path of the first value converted is the empty one. */
+JsonGVariantProfile *
+json_gvariant_profile_begin (JsonGVariantArena *arena)
+{
+  JsonGVariantProfile *profile;
+
+  if (G_LIKELY (!g_atomic_int_get (&profile_enabled)))
+    return NULL;
+
+  profile = g_new0 (JsonGVariantProfile, 1);
+  profile->arena = arena;
+  profile->entries = json_gvariant_profile_entries_new ();
+  profile->path = g_string_new (NULL);
+  profile->pending = TRUE;
+
+  return profile;
+}
+
+/* Adds the totals of the conversion to the ones of the process */
+void
+json_gvariant_profile_end (JsonGVariantProfile *profile)
+{
+  GHashTableIter iter;
+  gpointer key, value;
+
+  if (profile == NULL)
+    return;
+
+  G_LOCK (profile);
+
+  if (profile_entries == NULL)
+    profile_entries = json_gvariant_profile_entries_new ();
+  profile_conversions++;
+
+  g_hash_table_iter_init (&iter, profile->entries);
+  while (g_hash_table_iter_next (&iter, &key, &value))
+    {
+      JsonGVariantProfileEntry *entry = value;
+      JsonGVariantProfileEntry *total;
+
+      total = json_gvariant_profile_entries_get (profile_entries, key);
+      total->count += entry->count;
+      total->nodes += entry->nodes;
+      total->bytes += entry->bytes;
+      total->allocations += entry->allocations;
+      total->time += entry->time;
+    }
+
+  G_UNLOCK (profile);
+
+  g_hash_table_unref (profile->entries);
+  g_string_free (profile->path, TRUE);
+  g_free (profile);
+}
+
+/* Sets the path of the next value converted to the one of the member
+ * 'key' of the current value, escaped as in JSON pointers */
+void
+json_gvariant_profile_set_member (JsonGVariantProfile *profile,
+                                  const gchar         *key,
+                                  gsize                length)
+{
+  gsize i;
+
+  profile->parent_length = profile->path->len;
+  profile->pending = TRUE;
+
+  g_string_append_c (profile->path, '/');
+  for (i = 0; i < length; i++)
+    {
+      if (key[i] == '~')
+        g_string_append (profile->path, "~0");
+      else if (key[i] == '/')
+        g_string_append (profile->path, "~1");
+      else
+        g_string_append_c (profile->path, key[i]);
+    }
+}
+
+/* Sets the path of the next value converted to the one of an element of
+ * the current value: tuples keep the 'index' of their elements, as they
+ * differ from each other, arrays use '*' */
+void
+json_gvariant_profile_set_element (JsonGVariantProfile *profile,
+                                   gint                 index)
+{
+  profile->parent_length = profile->path->len;
+  profile->pending = TRUE;
+
+  if (index < 0)
+    g_string_append (profile->path, "/*");
+  else
+    g_string_append_printf (profile->path, "/%d", index);
+}
+
+/* Counts the GVariant instances the conversion creates for the values */
+void
+json_gvariant_profile_add_allocation (JsonGVariantProfile *profile)
+{
+  profile->n_allocations++;
+}
+
+/* Starts measuring the value at the current token of 'scanner', if its
+ * path has been set. Values converted more than once, as the contents of
+ * variants are, count only once. */
+gboolean
+json_gvariant_profile_enter (JsonGVariantProfile      *profile,
+                             JsonScanner              *scanner,
+                             JsonGVariantProfileProbe *probe)
+{
+  if (!profile->pending)
+    return FALSE;
+
+  profile->pending = FALSE;
+
+  probe->parent_length = profile->parent_length;
+  probe->offset = json_scanner_get_token_offset (scanner);
+  /* the current token has been counted already */
+  probe->n_nodes = scanner->n_nodes - 1;
+  probe->n_allocations = profile->n_allocations +
+                         json_gvariant_arena_get_n_allocations (profile->arena);
+  probe->time = json_gvariant_profile_get_time ();
+
+  return TRUE;
+}
+
+/* Adds the cost of the value measured by 'probe', which the scanner has
+ * gone past, to the totals of its path, and moves back to the path of
+ * the value containing it */
+void
+json_gvariant_profile_leave (JsonGVariantProfile      *profile,
+                             JsonScanner              *scanner,
+                             JsonGVariantProfileProbe *probe)
+{
+  JsonGVariantProfileEntry *entry;
+  gint64 time = json_gvariant_profile_get_time ();
+
+  entry = json_gvariant_profile_entries_get (profile->entries, profile->path->str);
+  entry->count++;
+  entry->nodes += scanner->n_nodes - probe->n_nodes;
+  entry->bytes += json_scanner_get_offset (scanner) - probe->offset;
+  entry->allocations += profile->n_allocations +
+                        json_gvariant_arena_get_n_allocations (profile->arena) -
+                        probe->n_allocations;
+  entry->time += time - probe->time;
+
+  g_string_truncate (profile->path, probe->parent_length);
+  profile->parent_length = probe->parent_length;
+}
+
+/* Enables the collection of the cost of the conversions from JSON text by
+ * JSON path, see json_gvariant_profile_dump(). Profiling adds some cost
+ * of its own to each value, and arrays are not split over threads while
+ * it is enabled. Conversions of json-c trees are not profiled. */
+void
+json_gvariant_profile_set_enabled (gboolean enabled)
+{
+  g_atomic_int_set (&profile_enabled, enabled);
+}
+
+/* Drops the totals collected so far */
+void
+json_gvariant_profile_reset (void)
+{
+  G_LOCK (profile);
+  g_clear_pointer (&profile_entries, g_hash_table_unref);
+  profile_conversions = 0;
+  G_UNLOCK (profile);
+}
+
+static gint
+json_gvariant_profile_compare_time (gconstpointer a,
+                                    gconstpointer b)
+{
+  const gchar *path_a = *(const gchar **) a;
+  const gchar *path_b = *(const gchar **) b;
+  const JsonGVariantProfileEntry *entry_a = g_hash_table_lookup (profile_entries, path_a);
+  const JsonGVariantProfileEntry *entry_b = g_hash_table_lookup (profile_entries, path_b);
+
+  if (entry_a->time != entry_b->time)
+    return entry_a->time < entry_b->time ? 1 : -1;
+
+  return strcmp (path_a, path_b);
+}
+
+/* Returns the totals collected so far as JSON text, the paths taking the
+ * most time first:
+ *
+ *   { "conversions": 2,
+ *     "paths": [ { "path": "", "count": 2, "nodes": 36, "bytes": 1206,
+ *                  "allocations": 40, "time_ns": 51210 },
+ *                { "path": "/cookies", ... }, ... ] }
+ *
+ * 'count' is the number of values converted at the path, 'nodes' the
+ * values, arrays, objects and member names they hold, themselves
+ * included, and 'bytes' the size of their text. 'allocations' counts
+ * the GVariant instances built for them, which serialized conversions do
+ * not need, and the heap allocations for the temporaries.
+ */
+gchar *
+json_gvariant_profile_dump (void)
+{
+  GVariantBuilder builder;
+  GVariantBuilder paths;
+  GVariant *variant;
+  gchar *json;
+
+  G_LOCK (profile);
+
+  g_variant_builder_init (&builder, G_VARIANT_TYPE_VARDICT);
+  g_variant_builder_add (&builder, "{sv}", "conversions",
+                         g_variant_new_uint64 (profile_conversions));
+
+  g_variant_builder_init (&paths, G_VARIANT_TYPE ("aa{sv}"));
+
+  if (profile_entries != NULL)
+    {
+      GPtrArray *keys = g_ptr_array_sized_new (g_hash_table_size (profile_entries));
+      GHashTableIter iter;
+      gpointer key;
+      guint i;
+
+      g_hash_table_iter_init (&iter, profile_entries);
+      while (g_hash_table_iter_next (&iter, &key, NULL))
+        g_ptr_array_add (keys, key);
+      g_ptr_array_sort (keys, json_gvariant_profile_compare_time);
+
+      for (i = 0; i < keys->len; i++)
+        {
+          const gchar *path = g_ptr_array_index (keys, i);
+          const JsonGVariantProfileEntry *entry = g_hash_table_lookup (profile_entries, path);
+
+          g_variant_builder_open (&paths, G_VARIANT_TYPE_VARDICT);
+          g_variant_builder_add (&paths, "{sv}", "path", g_variant_new_string (path));
+          g_variant_builder_add (&paths, "{sv}", "count", g_variant_new_uint64 (entry->count));
+          g_variant_builder_add (&paths, "{sv}", "nodes", g_variant_new_uint64 (entry->nodes));
+          g_variant_builder_add (&paths, "{sv}", "bytes", g_variant_new_uint64 (entry->bytes));
+          g_variant_builder_add (&paths, "{sv}", "allocations", g_variant_new_uint64 (entry->allocations));
+          g_variant_builder_add (&paths, "{sv}", "time_ns", g_variant_new_uint64 (entry->time));
+          g_variant_builder_close (&paths);
+        }
+
+      g_ptr_array_free (keys, TRUE);
+    }
+
+  G_UNLOCK (profile);
+
+  g_variant_builder_add (&builder, "{sv}", "paths", g_variant_builder_end (&paths));
+  variant = g_variant_ref_sink (g_variant_builder_end (&builder));
+  json = json_gvariant_serialize_data (variant, NULL);
+  g_variant_unref (variant);
+
+  return json;
+}
@@ -0,0 +1,173 @@
+/* json-gvariant-tokener.c - Reusable json-c tokeners
+ *
+ * Copyright (C) 2013  Intel Corporation.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Author:
+ *   Emanuele Aina <emanuele.aina@collabora.com>
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string.h>
+
+#include <glib/gi18n-lib.h>
+
+#include "json-gvariant.h"
+#include "json-gvariant-private.h"
+
+/* json_tokener_new() allocates the tokener, its stack of 'max_depth'
+ * entries and its string buffer: for the small payloads sent by the
+ * content scripts this costs about as much as the parsing itself. Each
+ * thread keeps its tokener instead, and resets it before every use.
+ */
+typedef struct
+{
+  json_tokener *tokener;
+  gint          max_depth;
+} JsonGVariantTokener;
+
+/* deeper than JSON_TOKENER_DEFAULT_DEPTH, which is too shallow for some
+ * of the values converted, but still far from exhausting the stack of
+ * the recursive converters */
+#define JSON_GVARIANT_DEFAULT_MAX_DEPTH 256
+
+static gint max_depth = JSON_GVARIANT_DEFAULT_MAX_DEPTH;
+
+static void
+json_gvariant_tokener_free (gpointer data)
+{
+  JsonGVariantTokener *tokener = data;
+
+  json_tokener_free (tokener->tokener);
+  g_free (tokener);
+}
+
+static GPrivate thread_tokener = G_PRIVATE_INIT (json_gvariant_tokener_free);
+
+static json_tokener *
+json_gvariant_tokener_get (void)
+{
+  JsonGVariantTokener *tokener;
+  gint depth = g_atomic_int_get (&max_depth);
+
+  tokener = g_private_get (&thread_tokener);
+  if (G_UNLIKELY (tokener == NULL))
+    {
+      tokener = g_new0 (JsonGVariantTokener, 1);
+      g_private_set (&thread_tokener, tokener);
+    }
+
+  /* the depth is fixed when the tokener is created */
+  if (G_UNLIKELY (tokener->tokener == NULL || tokener->max_depth != depth))
+    {
+      if (tokener->tokener != NULL)
+        json_tokener_free (tokener->tokener);
+      tokener->tokener = json_tokener_new_ex (depth);
+      tokener->max_depth = depth;
+    }
+  else
+    {
+      json_tokener_reset (tokener->tokener);
+    }
+
+  return tokener->tokener;
+}
+
+/* Parses the JSON text in the first 'length' bytes of 'json', or up to its
+ * terminating NUL if 'length' is negative, into a json-c tree, with the
+ * tokener of the calling thread. The text is read in place.
+ */
+json_object *
+json_gvariant_parse_data (const gchar  *json,
+                          gssize        length,
+                          GError      **error)
+{
+  enum json_tokener_error tokener_error;
+  json_tokener *tokener;
+  json_object *json_node;
+
+  g_return_val_if_fail (json != NULL, NULL);
+
+  if (length < 0)
+    length = strlen (json);
+
+  if (G_UNLIKELY (length > G_MAXINT))
+    {
+      g_set_error_literal (error,
+                           G_IO_ERROR,
+                           G_IO_ERROR_INVALID_ARGUMENT,
+                           _("JSON data is too big"));
+      return NULL;
+    }
+
+  tokener = json_gvariant_tokener_get ();
+  json_node = json_tokener_parse_ex (tokener, json, length);
+  tokener_error = json_tokener_get_error (tokener);
+
+  if (G_UNLIKELY (tokener_error == json_tokener_error_depth))
+    {
+      g_set_error (error,
+                   JSON_GVARIANT_ERROR,
+                   JSON_GVARIANT_ERROR_TOO_DEEP,
+                   _("JSON data is nested more than %u levels deep"),
+                   json_gvariant_get_max_depth ());
+      if (json_node != NULL)
+        json_object_put (json_node);
+      return NULL;
+    }
+
+  if (G_UNLIKELY (json_node == NULL || tokener_error != json_tokener_success))
+    {
+      /* translators: the '%s' is the description of the parsing error */
+      g_set_error (error,
+                   G_IO_ERROR,
+                   G_IO_ERROR_INVALID_DATA,
+                   _("JSON data is malformed: %s"),
+                   tokener_error == json_tokener_continue ? _("unexpected end of data")
+                                                          : json_tokener_error_desc (tokener_error));
+      if (json_node != NULL)
+        json_object_put (json_node);
+      return NULL;
+    }
+
+  return json_node;
+}
+
+/* Sets the maximum nesting depth of the JSON text accepted by
+ * json_gvariant_parse_data(), 256 by default. The tokeners of the threads
+ * pick it up on their next use.
+ *
+ * The same limit applies to the arrays and objects nested in the values
+ * converted to GVariant and in the text validated, so that hostile input
+ * fails with an error instead of exhausting the stack of the thread. The
+ * conversions and the validation of JSON text recurse over it, and accept
+ * no more than 1024 levels whatever the limit.
+ */
+void
+json_gvariant_set_max_depth (guint depth)
+{
+  g_return_if_fail (depth > 0 && depth <= G_MAXINT);
+
+  g_atomic_int_set (&max_depth, depth);
+}
+
+guint
+json_gvariant_get_max_depth (void)
+{
+  return g_atomic_int_get (&max_depth);
+}
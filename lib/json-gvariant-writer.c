@@ -0,0 +1,386 @@
+/* json-gvariant-writer.c - Serialized GVariant data writer
+ *
+ * Copyright (C) 2013  Intel Corporation.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Author:
+ *   Emanuele Aina <emanuele.aina@collabora.com>
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string.h>
+
+#include "json-gvariant-private.h"
+
+/* The layout follows the GVariant specification, as implemented by
+ * gvariant-serialiser.c in GLib:
+ *
+ *  - every value is aligned relative to the start of its container, and
+ *    containers are aligned to the largest alignment of their children,
+ *    so aligning relative to the start of the buffer is equivalent;
+ *  - arrays of variable-sized elements end with the offset of the end of
+ *    each element, in order;
+ *  - tuples and dictionary entries end with the offset of the end of each
+ *    variable-sized member but the last one, in reverse order;
+ *  - the size of the framing offsets is the smallest one able to address
+ *    the whole container, framing offsets included.
+ */
+
+static const guint8 zeros[8] = { 0, };
+
+void
+json_gvariant_writer_init (JsonGVariantWriter *writer,
+                           JsonGVariantArena  *arena,
+                           gsize               size_hint)
+{
+  writer->data = g_byte_array_sized_new (size_hint);
+  writer->arena = arena;
+  writer->offsets = NULL;
+  writer->n_offsets = 0;
+  writer->size = 0;
+}
+
+void
+json_gvariant_writer_clear (JsonGVariantWriter *writer)
+{
+  if (writer->data != NULL)
+    g_byte_array_free (writer->data, TRUE);
+  writer->data = NULL;
+}
+
+/* Hands the written data over to a new GVariant of the given type */
+GVariant *
+json_gvariant_writer_finish (JsonGVariantWriter *writer,
+                             const GVariantType *type)
+{
+  GVariant *variant;
+  GBytes *bytes;
+
+  g_assert (writer->n_offsets == 0);
+
+  bytes = g_byte_array_free_to_bytes (writer->data);
+  writer->data = NULL;
+
+  /* the data is in normal form by construction */
+  variant = g_variant_new_from_bytes (type, bytes, TRUE);
+  g_bytes_unref (bytes);
+
+  return variant;
+}
+
+void
+json_gvariant_writer_align (JsonGVariantWriter *writer,
+                            guint               alignment)
+{
+  gsize padding = (- writer->data->len) & (alignment - 1);
+
+  if (padding > 0)
+    g_byte_array_append (writer->data, zeros, padding);
+}
+
+void
+json_gvariant_writer_write (JsonGVariantWriter *writer,
+                            gconstpointer       data,
+                            gsize               size)
+{
+  g_byte_array_append (writer->data, data, size);
+}
+
+/* Writes a string, object path or signature, with its terminating NUL */
+void
+json_gvariant_writer_write_string (JsonGVariantWriter *writer,
+                                   const gchar        *string,
+                                   gsize               length)
+{
+  g_byte_array_append (writer->data, (const guint8 *) string, length + 1);
+}
+
+/* Starts a container at the current position, which the caller must have
+ * already aligned */
+void
+json_gvariant_writer_open (JsonGVariantWriter      *writer,
+                           JsonGVariantWriterFrame *frame)
+{
+  frame->start = writer->data->len;
+  frame->first_offset = writer->n_offsets;
+}
+
+/* Records the end of the child just written as a framing offset */
+void
+json_gvariant_writer_add_offset (JsonGVariantWriter      *writer,
+                                 JsonGVariantWriterFrame *frame)
+{
+  if (G_UNLIKELY (writer->n_offsets == writer->size))
+    {
+      gsize size = MAX (64, writer->size * 2);
+
+      writer->offsets = json_gvariant_arena_grow (writer->arena,
+                                                  writer->offsets,
+                                                  writer->size * sizeof (gsize),
+                                                  size * sizeof (gsize));
+      writer->size = size;
+    }
+
+  writer->offsets[writer->n_offsets++] = writer->data->len - frame->start;
+}
+
+static guint
+json_gvariant_writer_get_offset_size (gsize body_size,
+                                      gsize n_offsets)
+{
+  if (body_size + n_offsets <= G_MAXUINT8)
+    return 1;
+  if (body_size + 2 * n_offsets <= G_MAXUINT16)
+    return 2;
+  if (body_size + 4 * n_offsets <= G_MAXUINT32)
+    return 4;
+  return 8;
+}
+
+static void
+json_gvariant_writer_write_offsets (JsonGVariantWriter      *writer,
+                                    JsonGVariantWriterFrame *frame,
+                                    gboolean                 reverse)
+{
+  gsize n_offsets = writer->n_offsets - frame->first_offset;
+  gsize body_size = writer->data->len - frame->start;
+  guint offset_size;
+  guint8 *out;
+  gsize i;
+
+  if (n_offsets == 0)
+    return;
+
+  offset_size = json_gvariant_writer_get_offset_size (body_size, n_offsets);
+
+  g_byte_array_set_size (writer->data, writer->data->len + n_offsets * offset_size);
+  out = writer->data->data + frame->start + body_size;
+
+  for (i = 0; i < n_offsets; i++)
+    {
+      gsize offset;
+      guint j;
+
+      if (reverse)
+        offset = writer->offsets[writer->n_offsets - 1 - i];
+      else
+        offset = writer->offsets[frame->first_offset + i];
+
+      /* framing offsets are always little endian */
+      for (j = 0; j < offset_size; j++)
+        {
+          *out++ = offset & 0xff;
+          offset >>= 8;
+        }
+    }
+
+  writer->n_offsets = frame->first_offset;
+}
+
+void
+json_gvariant_writer_close_array (JsonGVariantWriter      *writer,
+                                  JsonGVariantWriterFrame *frame)
+{
+  json_gvariant_writer_write_offsets (writer, frame, FALSE);
+}
+
+/* Closes a tuple or dictionary entry, padding it to 'fixed_size' if the
+ * type has a fixed size */
+void
+json_gvariant_writer_close_tuple (JsonGVariantWriter      *writer,
+                                  JsonGVariantWriterFrame *frame,
+                                  gsize                    fixed_size)
+{
+  if (fixed_size > 0)
+    {
+      gsize size = writer->data->len - frame->start;
+
+      g_assert (size <= fixed_size && writer->n_offsets == frame->first_offset);
+
+      if (size < fixed_size)
+        {
+          g_byte_array_set_size (writer->data, frame->start + fixed_size);
+          memset (writer->data->data + frame->start + size, 0, fixed_size - size);
+        }
+
+      return;
+    }
+
+  json_gvariant_writer_write_offsets (writer, frame, TRUE);
+}
+
+typedef struct
+{
+  gsize start;
+  gsize end;
+  gsize index;
+} JsonGVariantWriterEntry;
+
+/* Compares the serialized keys at 'a' and 'b' as g_variant_compare()
+ * would compare the keys themselves */
+static gint
+json_gvariant_writer_compare_keys (gchar         class,
+                                   const guint8 *a,
+                                   const guint8 *b)
+{
+#define COMPARE_AS(type) \
+  G_STMT_START {                                \
+    type x, y;                                  \
+    memcpy (&x, a, sizeof (type));              \
+    memcpy (&y, b, sizeof (type));              \
+    return x < y ? -1 : x > y ? 1 : 0;          \
+  } G_STMT_END
+
+  switch (class)
+    {
+    case G_VARIANT_CLASS_BOOLEAN:
+    case G_VARIANT_CLASS_BYTE:
+      COMPARE_AS (guint8);
+    case G_VARIANT_CLASS_INT16:
+      COMPARE_AS (gint16);
+    case G_VARIANT_CLASS_UINT16:
+      COMPARE_AS (guint16);
+    case G_VARIANT_CLASS_INT32:
+    case G_VARIANT_CLASS_HANDLE:
+      COMPARE_AS (gint32);
+    case G_VARIANT_CLASS_UINT32:
+      COMPARE_AS (guint32);
+    case G_VARIANT_CLASS_INT64:
+      COMPARE_AS (gint64);
+    case G_VARIANT_CLASS_UINT64:
+      COMPARE_AS (guint64);
+    case G_VARIANT_CLASS_DOUBLE:
+      COMPARE_AS (gdouble);
+    default:
+      /* strings, object paths and signatures, NUL-terminated */
+      return strcmp ((const gchar *) a, (const gchar *) b);
+    }
+
+#undef COMPARE_AS
+}
+
+typedef struct
+{
+  const guint8 *body;
+  gchar         key_class;
+} JsonGVariantWriterSort;
+
+static gint
+json_gvariant_writer_entry_compare (gconstpointer a,
+                                    gconstpointer b,
+                                    gpointer      user_data)
+{
+  const JsonGVariantWriterEntry *entry_a = a;
+  const JsonGVariantWriterEntry *entry_b = b;
+  const JsonGVariantWriterSort *sort = user_data;
+  gint result;
+
+  /* the key is the first member of the entry */
+  result = json_gvariant_writer_compare_keys (sort->key_class,
+                                              sort->body + entry_a->start,
+                                              sort->body + entry_b->start);
+  if (result != 0)
+    return result;
+
+  return entry_a->index < entry_b->index ? -1 : 1;
+}
+
+/* Reorders the dictionary entries of type 'entry' written since 'frame'
+ * was opened by key, keeping only the last of the entries with the same
+ * key. It must be called right before the array is closed. The entries
+ * are moved as they are: their contents are aligned relative to their
+ * own start, which stays aligned to the alignment of the entry.
+ */
+void
+json_gvariant_writer_sort_entries (JsonGVariantWriter      *writer,
+                                   JsonGVariantWriterFrame *frame,
+                                   const JsonGVariantPlan  *entry)
+{
+  JsonGVariantWriterEntry *entries;
+  JsonGVariantWriterSort sort;
+  JsonGVariantArenaMark mark;
+  gsize body_size = writer->data->len - frame->start;
+  gsize n_entries;
+  gsize size;
+  guint8 *sorted;
+  gsize i, n;
+
+  if (entry->fixed_size > 0)
+    n_entries = body_size / entry->fixed_size;
+  else
+    n_entries = writer->n_offsets - frame->first_offset;
+
+  if (n_entries < 2)
+    return;
+
+  /* the offsets stay the last allocation of the arena once released */
+  json_gvariant_arena_mark (writer->arena, &mark);
+  entries = json_gvariant_arena_alloc (writer->arena,
+                                       n_entries * sizeof (JsonGVariantWriterEntry));
+
+  for (i = 0, size = 0; i < n_entries; i++)
+    {
+      if (entry->fixed_size > 0)
+        {
+          entries[i].start = i * entry->fixed_size;
+          entries[i].end = entries[i].start + entry->fixed_size;
+        }
+      else
+        {
+          entries[i].start = i > 0 ? JSON_GVARIANT_ALIGN_UP (entries[i - 1].end, entry->alignment) : 0;
+          entries[i].end = writer->offsets[frame->first_offset + i];
+        }
+      entries[i].index = i;
+      size += entries[i].end - entries[i].start + entry->alignment - 1;
+    }
+
+  sort.body = writer->data->data + frame->start;
+  sort.key_class = entry->children[0].class;
+  g_qsort_with_data (entries, n_entries, sizeof (JsonGVariantWriterEntry),
+                     json_gvariant_writer_entry_compare, &sort);
+
+  sorted = json_gvariant_arena_alloc (writer->arena, size);
+
+  for (i = 0, n = 0, size = 0; i < n_entries; i++)
+    {
+      gsize entry_size = entries[i].end - entries[i].start;
+      gsize start = JSON_GVARIANT_ALIGN_UP (size, entry->alignment);
+
+      if (i + 1 < n_entries &&
+          json_gvariant_writer_compare_keys (sort.key_class,
+                                             sort.body + entries[i].start,
+                                             sort.body + entries[i + 1].start) == 0)
+        continue;
+
+      memset (sorted + size, 0, start - size);
+      memcpy (sorted + start, sort.body + entries[i].start, entry_size);
+      size = start + entry_size;
+
+      if (entry->fixed_size == 0)
+        writer->offsets[frame->first_offset + n] = size;
+      n++;
+    }
+
+  if (entry->fixed_size == 0)
+    writer->n_offsets = frame->first_offset + n;
+
+  g_byte_array_set_size (writer->data, frame->start + size);
+  memcpy (writer->data->data + frame->start, sorted, size);
+
+  json_gvariant_arena_release (writer->arena, &mark);
+}
@@ -25,396 +25,453 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <errno.h>
+#include <math.h>
 
 #include <glib/gi18n-lib.h>
 
 #include "json-gvariant.h"
+#include "json-gvariant-private.h"
+#include "json-scanner.h"
 
 #include <json.h>
 #include <glib-object.h>
 #include <gio/gio.h>
 
-/* custom extension to the GVariantClass enumeration to differentiate
- * a single dictionary entry from an array of dictionary entries
+/* size of the reads of json_gvariant_deserialize_stream() */
+#define JSON_GVARIANT_STREAM_CHUNK_SIZE (64 * 1024)
+
+/* with JSON_GVARIANT_FLAGS_PARALLEL, the minimum number of elements for an
+ * array to be split and the number of elements converted by each job */
+#define JSON_GVARIANT_PARALLEL_MIN_ELEMENTS 256
+#define JSON_GVARIANT_PARALLEL_CHUNK_SIZE 64
+
+/* State shared by all the functions taking part in a conversion.
+ *
+ * With JSON_GVARIANT_FLAGS_INTERN, 'strings' and 'booleans' hold the
+ * leaves already created, shared by all the containers using them.
+ * 'compact' is set for JSON_GVARIANT_FLAGS_COMPACT and 'parallel' for
+ * JSON_GVARIANT_FLAGS_PARALLEL, when the input can be looked ahead.
+ * 'depth' is the number of arrays and objects around the value converted
+ * by json_to_gvariant_convert(), which is not 0 only for the elements of
+ * the arrays converted in parallel. 'generated' writes the whole value in
+ * place of the generic code, see json_gvariant_deserialize_generated().
  */
-#define JSON_G_VARIANT_CLASS_DICTIONARY 'c'
+struct _JsonGVariantContext
+{
+  JsonGVariantArena  *arena;
+  JsonGVariantWriter *writer;
+  gboolean            compact;
+  gboolean            parallel;
+  gboolean            sorted;
+  guint               depth;
+
+  JsonGVariantShape **shapes;
+
+  GHashTable         *strings;
+  GVariant           *booleans[2];
+
+  JsonGVariantProfile *profile;
+
+  const JsonGVariantGenerated *generated;
+};
 
-static GVariant * json_to_gvariant_recurse (json_object   *json_node,
-                                            const gchar  **signature,
-                                            GError       **error);
+/* Children of a container being converted, collected in a vector owned by
+ * the arena of the conversion */
+typedef struct
+{
+  GVariant              **children;
+  gsize                   n_children;
+  gsize                   size;
+  JsonGVariantArenaMark   mark;
+} JsonGVariantChildren;
+
+static GVariant * json_to_gvariant_convert (JsonGVariantContext     *context,
+                                            json_object             *json_node,
+                                            const JsonGVariantPlan  *plan,
+                                            GError                 **error);
+static GVariant * json_to_gvariant_array_parallel (JsonGVariantContext     *context,
+                                                   guint                    depth,
+                                                   json_object             *json_node,
+                                                   const JsonGVariantPlan  *plan,
+                                                   GError                 **error);
+static gboolean json_stream_to_gvariant_array_parallel (JsonGVariantContext     *context,
+                                                        JsonScanner             *scanner,
+                                                        const JsonGVariantPlan  *element,
+                                                        GVariant               **variant,
+                                                        GError                 **error);
 
 /* ========================================================================== */
-/* JSON to GVariant */
+/* Interning */
 /* ========================================================================== */
 
-static GVariantClass
-json_to_gvariant_get_next_class (json_object  *json_node,
-                                 const gchar **signature)
+/* Interned leaves are owned by the context and are not floating: the
+ * containers they are added to take a reference of their own, and they
+ * must be dropped with json_gvariant_discard() rather than unreferenced.
+ *
+ * Only containers can hold interned leaves, so interning is enabled only
+ * when the value converted is one: the caller never gets one back.
+ */
+static void
+json_gvariant_intern_begin (JsonGVariantContext *context,
+                            JsonGVariantFlags    flags,
+                            gboolean             container)
 {
-  if (signature == NULL)
-    {
-      GVariantClass class = 0;
+  if ((flags & JSON_GVARIANT_FLAGS_INTERN) && container)
+    context->strings = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                              NULL, (GDestroyNotify) g_variant_unref);
+}
 
-      switch (json_object_get_type (json_node))
-        {
-        case json_type_boolean:
-          class = G_VARIANT_CLASS_BOOLEAN;
-          break;
+static void
+json_gvariant_intern_end (JsonGVariantContext *context)
+{
+  if (context->strings != NULL)
+    g_hash_table_unref (context->strings);
+  context->strings = NULL;
+
+  if (context->booleans[FALSE] != NULL)
+    g_variant_unref (context->booleans[FALSE]);
+  if (context->booleans[TRUE] != NULL)
+    g_variant_unref (context->booleans[TRUE]);
+  context->booleans[FALSE] = context->booleans[TRUE] = NULL;
+}
 
-        case json_type_int:
-          class = G_VARIANT_CLASS_INT64;
-          break;
+/* Creates a string GVariant from 'string', which is validated as UTF-8 if
+ * 'length' is negative, as for the strings from json-c. The scanner
+ * validates the strings it returns already, which are then passed with
+ * their length and taken as trusted, without checking them again.
+ */
+static GVariant *
+json_gvariant_new_string_unshared (const gchar *string,
+                                   gssize       length)
+{
+  GVariant *variant;
+  GBytes *bytes;
 
-        case json_type_double:
-          class = G_VARIANT_CLASS_DOUBLE;
-          break;
+  if (length < 0)
+    return g_variant_new_string (string);
 
-        case json_type_string:
-          class = G_VARIANT_CLASS_STRING;
-          break;
+  bytes = g_bytes_new (string, length + 1);
+  variant = g_variant_new_from_bytes (G_VARIANT_TYPE_STRING, bytes, TRUE);
+  g_bytes_unref (bytes);
 
-        case json_type_array:
-          class = G_VARIANT_CLASS_ARRAY;
-          break;
+  return variant;
+}
 
-        case json_type_object:
-          class = JSON_G_VARIANT_CLASS_DICTIONARY;
-          break;
+static GVariant *
+json_gvariant_new_string (JsonGVariantContext *context,
+                          const gchar         *string,
+                          gssize               length)
+{
+  GVariant *variant;
 
-        case json_type_null:
-          class = G_VARIANT_CLASS_MAYBE;
-          break;
-        }
+  if (context->strings == NULL)
+    return json_gvariant_new_string_unshared (string, length);
 
-      return class;
-    }
-  else
+  variant = g_hash_table_lookup (context->strings, string);
+  if (variant == NULL)
     {
-      if ((*signature)[0] == G_VARIANT_CLASS_ARRAY &&
-          (*signature)[1] == G_VARIANT_CLASS_DICT_ENTRY)
-        return JSON_G_VARIANT_CLASS_DICTIONARY;
-      else
-        return (*signature)[0];
+      variant = g_variant_ref_sink (json_gvariant_new_string_unshared (string, length));
+      /* the key is the copy held by the variant */
+      g_hash_table_insert (context->strings,
+                           (gpointer) g_variant_get_string (variant, NULL),
+                           variant);
     }
+
+  return variant;
 }
 
-static gboolean
-json_node_assert_type (json_object     *json_node,
-                       json_type        type,
-                       GType            sub_type,
-                       GError         **error)
+static GVariant *
+json_gvariant_new_boolean (JsonGVariantContext *context,
+                           gboolean             value)
 {
-  if (!json_object_is_type (json_node, type))
-    {
-      /* translators: the '%s' is the type name */
-      g_set_error (error,
-                   G_IO_ERROR,
-                   G_IO_ERROR_INVALID_DATA,
-                   _("Unexpected type '%s' in JSON node"),
-                   json_type_to_name (json_object_get_type (json_node)));
-      return FALSE;
-    }
-  else
-    {
-      return TRUE;
-    }
+  value = !!value;
+
+  if (context->strings == NULL)
+    return g_variant_new_boolean (value);
+
+  if (context->booleans[value] == NULL)
+    context->booleans[value] = g_variant_ref_sink (g_variant_new_boolean (value));
+
+  return context->booleans[value];
 }
 
+/* Drops a converted value which ends up not being used, unless it is an
+ * interned one */
 static void
-json_to_gvariant_foreach_add (gpointer data, gpointer user_data)
+json_gvariant_discard (GVariant *variant)
 {
-  GVariantBuilder *builder = (GVariantBuilder *) user_data;
-  GVariant *child = (GVariant *) data;
-
-  g_variant_builder_add_value (builder, child);
+  if (g_variant_is_floating (variant))
+    g_variant_unref (variant);
 }
 
+/* ========================================================================== */
+/* Child vectors */
+/* ========================================================================== */
+
 static void
-json_to_gvariant_foreach_free (gpointer data, gpointer user_data)
+json_gvariant_children_init (JsonGVariantContext  *context,
+                             JsonGVariantChildren *children,
+                             gsize                 size)
 {
-  GVariant *child = (GVariant *) data;
+  json_gvariant_arena_mark (context->arena, &children->mark);
 
-  g_variant_unref (child);
+  children->children = size > 0 ? json_gvariant_arena_alloc (context->arena,
+                                                              size * sizeof (GVariant *))
+                                 : NULL;
+  children->n_children = 0;
+  children->size = size;
 }
 
-static GVariant *
-json_to_gvariant_build_from_glist (GList *list, const gchar *signature)
+/* Every child must be added before anything else is allocated from the
+ * arena, so that the vector can grow in place */
+static void
+json_gvariant_children_add (JsonGVariantContext  *context,
+                            JsonGVariantChildren *children,
+                            GVariant             *child)
 {
-  GVariantBuilder *builder;
-  GVariant *result;
+  if (G_UNLIKELY (children->n_children == children->size))
+    {
+      gsize size = MAX (16, children->size * 2);
+
+      children->children = json_gvariant_arena_grow (context->arena,
+                                                     children->children,
+                                                     children->size * sizeof (GVariant *),
+                                                     size * sizeof (GVariant *));
+      children->size = size;
+    }
 
-  builder = g_variant_builder_new (G_VARIANT_TYPE (signature));
+  children->children[children->n_children++] = child;
+}
 
-  g_list_foreach (list, json_to_gvariant_foreach_add, builder);
-  result = g_variant_builder_end (builder);
+static GVariant *
+json_gvariant_children_end_array (JsonGVariantContext  *context,
+                                  JsonGVariantChildren *children,
+                                  const GVariantType   *element_type)
+{
+  GVariant *variant;
 
-  g_variant_builder_unref (builder);
+  variant = g_variant_new_array (element_type,
+                                 children->children,
+                                 children->n_children);
+  json_gvariant_arena_release (context->arena, &children->mark);
 
-  return result;
+  return variant;
 }
 
-static GVariant *
-json_to_gvariant_tuple (json_object  *json_node,
-                        const gchar **signature,
-                        GError      **error)
+typedef struct
 {
-  GVariant *variant = NULL;
-  gint i;
-  GList *children = NULL;
-  gboolean roll_back = FALSE;
-  const gchar *initial_signature;
+  GVariant *key;
+  GVariant *entry;
+  gsize     index;
+} JsonGVariantSortEntry;
+
+static gint
+json_gvariant_sort_entry_compare (gconstpointer          a,
+                                  gconstpointer          b,
+                                  G_GNUC_UNUSED gpointer user_data)
+{
+  const JsonGVariantSortEntry *entry_a = a;
+  const JsonGVariantSortEntry *entry_b = b;
+  gint result;
 
-  initial_signature = *signature;
-  (*signature)++;
-  i = 1;
-  while ((*signature)[0] != ')' && (*signature)[0] != '\0')
-    {
-      json_object *json_child;
-      GVariant *variant_child;
+  result = g_variant_compare (entry_a->key, entry_b->key);
+  if (result != 0)
+    return result;
 
-      if (i - 1 >= json_object_array_length (json_node))
-        {
-          g_set_error_literal (error,
-                               G_IO_ERROR,
-                               G_IO_ERROR_INVALID_DATA,
-                               _("Missing elements in JSON array to conform to a tuple"));
-          roll_back = TRUE;
-          break;
-        }
+  return entry_a->index < entry_b->index ? -1 : 1;
+}
 
-      json_child = json_object_array_get_idx (json_node, i - 1);
+/* As json_gvariant_children_end_array() for the entries of a dictionary,
+ * sorting them by key and keeping only the last of the entries with the
+ * same key if the context asks for it */
+static GVariant *
+json_gvariant_children_end_dictionary (JsonGVariantContext  *context,
+                                       JsonGVariantChildren *children,
+                                       const GVariantType   *entry_type)
+{
+  JsonGVariantSortEntry *entries;
+  gsize n_entries = children->n_children;
+  gsize i, n;
 
-      variant_child = json_to_gvariant_recurse (json_child, signature, error);
-      if (variant_child != NULL)
-        {
-          children = g_list_append (children, variant_child);
-        }
-      else
-        {
-          roll_back = TRUE;
-          break;
-        }
+  if (!context->sorted || n_entries < 2)
+    return json_gvariant_children_end_array (context, children, entry_type);
 
-      i++;
+  /* released along with the children */
+  entries = json_gvariant_arena_alloc (context->arena,
+                                       n_entries * sizeof (JsonGVariantSortEntry));
+  for (i = 0; i < n_entries; i++)
+    {
+      entries[i].entry = children->children[i];
+      entries[i].key = g_variant_get_child_value (entries[i].entry, 0);
+      entries[i].index = i;
     }
 
-  if (! roll_back)
+  g_qsort_with_data (entries, n_entries, sizeof (JsonGVariantSortEntry),
+                     json_gvariant_sort_entry_compare, NULL);
+
+  for (i = 0, n = 0; i < n_entries; i++)
     {
-      if ( (*signature)[0] != ')')
-        {
-          g_set_error_literal (error,
-                               G_IO_ERROR,
-                               G_IO_ERROR_INVALID_DATA,
-                               _("Missing closing symbol ')' in the GVariant tuple type"));
-          roll_back = TRUE;
-        }
-      else if (json_object_array_length (json_node) >= i)
-        {
-          g_set_error_literal (error,
-                               G_IO_ERROR,
-                               G_IO_ERROR_INVALID_DATA,
-                               _("Unexpected extra elements in JSON array"));
-          roll_back = TRUE;
-        }
+      if (i + 1 < n_entries && g_variant_compare (entries[i].key, entries[i + 1].key) == 0)
+        json_gvariant_discard (entries[i].entry);
       else
-        {
-          gchar *tuple_type;
-
-          tuple_type = g_strndup (initial_signature,
-                                  (*signature) - initial_signature + 1);
-
-          variant = json_to_gvariant_build_from_glist (children, tuple_type);
+        children->children[n++] = entries[i].entry;
 
-          g_free (tuple_type);
-        }
+      g_variant_unref (entries[i].key);
     }
+  children->n_children = n;
+
+  return json_gvariant_children_end_array (context, children, entry_type);
+}
 
-  if (roll_back)
-    g_list_foreach (children, json_to_gvariant_foreach_free, NULL);
+static GVariant *
+json_gvariant_children_end_tuple (JsonGVariantContext  *context,
+                                  JsonGVariantChildren *children)
+{
+  GVariant *variant;
 
-  g_list_free (children);
+  variant = g_variant_new_tuple (children->children, children->n_children);
+  json_gvariant_arena_release (context->arena, &children->mark);
 
   return variant;
 }
 
-static gchar *
-signature_get_next_complete_type (const gchar **signature)
+/* Drops the children converted so far, when rolling back */
+static void
+json_gvariant_children_clear (JsonGVariantContext  *context,
+                              JsonGVariantChildren *children)
 {
-  GVariantClass class;
-  const gchar *initial_signature;
-  gchar *result;
+  gsize i;
+
+  for (i = 0; i < children->n_children; i++)
+    json_gvariant_discard (children->children[i]);
 
-  /* here it is assumed that 'signature' is a valid type string */
+  json_gvariant_arena_release (context->arena, &children->mark);
+}
 
-  initial_signature = *signature;
-  class = (*signature)[0];
+/* ========================================================================== */
+/* JSON to GVariant */
+/* ========================================================================== */
 
-  if (class == G_VARIANT_CLASS_TUPLE || class == G_VARIANT_CLASS_DICT_ENTRY)
+static GVariantClass
+json_to_gvariant_get_next_class (json_object            *json_node,
+                                 const JsonGVariantPlan *plan)
+{
+  if (plan == NULL)
     {
-      gchar stack[256] = {0};
-      guint stack_len = 0;
+      GVariantClass class = 0;
 
-      do
+      switch (json_object_get_type (json_node))
         {
-          if ( (*signature)[0] == G_VARIANT_CLASS_TUPLE)
-            {
-              stack[stack_len] = ')';
-              stack_len++;
-            }
-          else if ( (*signature)[0] == G_VARIANT_CLASS_DICT_ENTRY)
-            {
-              stack[stack_len] = '}';
-              stack_len++;
-            }
-
-          (*signature)++;
+        case json_type_boolean:
+          class = G_VARIANT_CLASS_BOOLEAN;
+          break;
 
-          if ( (*signature)[0] == stack[stack_len - 1])
-            stack_len--;
-        }
-      while (stack_len > 0);
+        case json_type_int:
+          class = G_VARIANT_CLASS_INT64;
+          break;
 
-      (*signature)++;
-    }
-  else if (class == G_VARIANT_CLASS_ARRAY || class == G_VARIANT_CLASS_MAYBE)
-    {
-      gchar *tmp_sig;
+        case json_type_double:
+          class = G_VARIANT_CLASS_DOUBLE;
+          break;
 
-      (*signature)++;
-      tmp_sig = signature_get_next_complete_type (signature);
-      g_free (tmp_sig);
-    }
-  else
-    {
-      (*signature)++;
-    }
+        case json_type_string:
+          class = G_VARIANT_CLASS_STRING;
+          break;
 
-  result = g_strndup (initial_signature, (*signature) - initial_signature);
+        case json_type_array:
+          class = G_VARIANT_CLASS_ARRAY;
+          break;
 
-  return result;
-}
+        case json_type_object:
+          class = JSON_G_VARIANT_CLASS_DICTIONARY;
+          break;
 
-static GVariant *
-json_to_gvariant_maybe (json_object  *json_node,
-                        const gchar **signature,
-                        GError      **error)
-{
-  GVariant *variant = NULL;
-  GVariant *value;
-  gchar *maybe_signature;
+        case json_type_null:
+          class = G_VARIANT_CLASS_MAYBE;
+          break;
+        }
 
-  if (signature)
-    {
-      (*signature)++;
-      maybe_signature = signature_get_next_complete_type (signature);
+      return class;
     }
   else
     {
-      maybe_signature = g_strdup ("v");
+      return plan->class;
     }
+}
 
-  if (json_object_is_type (json_node, json_type_null))
+static gboolean
+json_node_assert_type (json_object     *json_node,
+                       json_type        type,
+                       GType            sub_type,
+                       GError         **error)
+{
+  if (!json_object_is_type (json_node, type))
     {
-      variant = g_variant_new_maybe (G_VARIANT_TYPE (maybe_signature), NULL);
+      /* translators: the '%s' is the type name */
+      g_set_error (error,
+                   G_IO_ERROR,
+                   G_IO_ERROR_INVALID_DATA,
+                   _("Unexpected type '%s' in JSON node"),
+                   json_type_to_name (json_object_get_type (json_node)));
+      return FALSE;
     }
   else
     {
-      const gchar *tmp_signature;
-
-      tmp_signature = maybe_signature;
-      value = json_to_gvariant_recurse (json_node,
-                                        &tmp_signature,
-                                        error);
-
-      if (value != NULL)
-        variant = g_variant_new_maybe (G_VARIANT_TYPE (maybe_signature), value);
+      return TRUE;
     }
-
-  g_free (maybe_signature);
-
-  /* compensate the (*signature)++ call at the end of 'recurse()' */
-  if (signature)
-    (*signature)--;
-
-  return variant;
 }
 
-static GVariant *
-json_to_gvariant_array (json_object  *json_node,
-                        const gchar **signature,
-                        GError      **error)
+/* Like g_ascii_strtoll(), g_ascii_strtoull() and g_ascii_strtod(), for
+ * the strings of dictionary keys: the plain numbers are converted by the
+ * parsers of the scanner, the rest by GLib */
+static gint64
+json_gvariant_key_to_int64 (const gchar  *st,
+                            gchar       **nptr)
 {
-  GVariant *variant = NULL;
-  GList *children = NULL;
-  gboolean roll_back = FALSE;
-  const gchar *orig_signature;
-  gchar *child_signature;
+  gsize length = strlen (st);
+  gint64 value;
 
-  if (signature != NULL)
+  if (json_scanner_parse_int64 (st, length, &value))
     {
-      orig_signature = *signature;
-
-      (*signature)++;
-      child_signature = signature_get_next_complete_type (signature);
+      *nptr = (gchar *) st + length;
+      return value;
     }
-  else
-    child_signature = g_strdup ("v");
-
-  if (json_object_array_length (json_node) > 0)
-    {
-      gint i;
-      guint len;
 
-      len = json_object_array_length (json_node);
-      for (i = 0; i < len; i++)
-        {
-          json_object *json_child;
-          GVariant *variant_child;
-          const gchar *tmp_signature;
-
-          json_child = json_object_array_get_idx (json_node, i);
+  return g_ascii_strtoll (st, nptr, 10);
+}
 
-          tmp_signature = child_signature;
-          variant_child = json_to_gvariant_recurse (json_child,
-                                                    &tmp_signature,
-                                                    error);
-          if (variant_child != NULL)
-            {
-              children = g_list_append (children, variant_child);
-            }
-          else
-            {
-              roll_back = TRUE;
-              break;
-            }
-        }
-    }
+static guint64
+json_gvariant_key_to_uint64 (const gchar  *st,
+                             gchar       **nptr)
+{
+  gsize length = strlen (st);
+  guint64 value;
 
-  if (!roll_back)
+  if (json_scanner_parse_uint64 (st, length, &value))
     {
-      gchar *array_signature;
-
-      if (signature)
-        array_signature = g_strndup (orig_signature, (*signature) - orig_signature);
-      else
-        array_signature = g_strdup ("av");
+      *nptr = (gchar *) st + length;
+      return value;
+    }
 
-      variant = json_to_gvariant_build_from_glist (children, array_signature);
+  return g_ascii_strtoull (st, nptr, 10);
+}
 
-      g_free (array_signature);
+static gdouble
+json_gvariant_key_to_double (const gchar  *st,
+                             gchar       **nptr)
+{
+  gsize length = strlen (st);
+  gdouble value;
 
-      /* compensate the (*signature)++ call at the end of 'recurse()' */
-      if (signature)
-        (*signature)--;
+  if (json_scanner_parse_double (st, length, &value))
+    {
+      *nptr = (gchar *) st + length;
+      return value;
     }
-  else
-    g_list_foreach (children, json_to_gvariant_foreach_free, NULL);
-
-  g_list_free (children);
-  g_free (child_signature);
 
-  return variant;
+  return g_ascii_strtod (st, nptr);
 }
 
 static GVariant *
@@ -439,31 +496,31 @@ gvariant_simple_from_string (const gchar    *st,
       break;
 
     case G_VARIANT_CLASS_BYTE:
-      variant = g_variant_new_byte (g_ascii_strtoll (st, &nptr, 10));
+      variant = g_variant_new_byte (json_gvariant_key_to_int64 (st, &nptr));
       break;
 
     case G_VARIANT_CLASS_INT16:
-      variant = g_variant_new_int16 (g_ascii_strtoll (st, &nptr, 10));
+      variant = g_variant_new_int16 (json_gvariant_key_to_int64 (st, &nptr));
       break;
 
     case G_VARIANT_CLASS_UINT16:
-      variant = g_variant_new_uint16 (g_ascii_strtoll (st, &nptr, 10));
+      variant = g_variant_new_uint16 (json_gvariant_key_to_int64 (st, &nptr));
       break;
 
     case G_VARIANT_CLASS_INT32:
-      variant = g_variant_new_int32 (g_ascii_strtoll (st, &nptr, 10));
+      variant = g_variant_new_int32 (json_gvariant_key_to_int64 (st, &nptr));
       break;
 
     case G_VARIANT_CLASS_UINT32:
-      variant = g_variant_new_uint32 (g_ascii_strtoull (st, &nptr, 10));
+      variant = g_variant_new_uint32 (json_gvariant_key_to_uint64 (st, &nptr));
       break;
 
     case G_VARIANT_CLASS_INT64:
-      variant = g_variant_new_int64 (g_ascii_strtoll (st, &nptr, 10));
+      variant = g_variant_new_int64 (json_gvariant_key_to_int64 (st, &nptr));
       break;
 
     case G_VARIANT_CLASS_UINT64:
-      variant = g_variant_new_uint64 (g_ascii_strtoull (st, &nptr, 10));
+      variant = g_variant_new_uint64 (json_gvariant_key_to_uint64 (st, &nptr));
       break;
 
     case G_VARIANT_CLASS_HANDLE:
@@ -471,7 +528,7 @@ gvariant_simple_from_string (const gchar    *st,
       break;
 
     case G_VARIANT_CLASS_DOUBLE:
-      variant = g_variant_new_double (g_ascii_strtod (st, &nptr));
+      variant = g_variant_new_double (json_gvariant_key_to_double (st, &nptr));
       break;
 
     case G_VARIANT_CLASS_STRING:
@@ -501,345 +558,3941 @@ gvariant_simple_from_string (const gchar    *st,
   return variant;
 }
 
-static void
-parse_dict_entry_signature (const gchar **signature,
-                            gchar       **entry_signature,
-                            gchar       **key_signature,
-                            gchar       **value_signature)
+/* Like gvariant_simple_from_string(), but for the string classes which
+ * g_variant_new_object_path() and g_variant_new_signature() would otherwise
+ * reject with a critical warning.
+ */
+static GVariant *
+gvariant_checked_from_string (const gchar    *st,
+                              GVariantClass   class,
+                              GError        **error)
 {
-  const gchar *tmp_sig;
+  if (class == G_VARIANT_CLASS_OBJECT_PATH && g_variant_is_object_path (st))
+    return g_variant_new_object_path (st);
 
-  if (signature != NULL)
-    *entry_signature = signature_get_next_complete_type (signature);
-  else
-    *entry_signature = g_strdup ("{sv}");
+  if (class == G_VARIANT_CLASS_SIGNATURE && g_variant_is_signature (st))
+    return g_variant_new_signature (st);
 
-  tmp_sig = (*entry_signature) + 1;
-  *key_signature = signature_get_next_complete_type (&tmp_sig);
-  *value_signature = signature_get_next_complete_type (&tmp_sig);
+  g_set_error_literal (error,
+                       G_IO_ERROR,
+                       G_IO_ERROR_INVALID_DATA,
+                       _("Invalid string value converting to GVariant"));
+  return NULL;
 }
 
+/* Converts a member name to a dictionary key, sharing the string keys when
+ * interning. 'length' is as for json_gvariant_new_string(). */
 static GVariant *
-json_to_gvariant_dict_entry (json_object  *json_node,
-                             const gchar **signature,
-                             GError      **error)
+json_gvariant_new_key (JsonGVariantContext  *context,
+                       const gchar          *st,
+                       gssize                length,
+                       GVariantClass         class,
+                       GError              **error)
 {
-  GVariant *variant = NULL;
+  if (class == G_VARIANT_CLASS_STRING)
+    return json_gvariant_new_string (context, st, length);
 
-  gchar *entry_signature;
-  gchar *key_signature;
-  gchar *value_signature;
-  const gchar *tmp_signature;
+  return gvariant_simple_from_string (st, class, error);
+}
 
-  struct lh_entry *member;
+/* A container being converted by json_to_gvariant_convert().
+ *
+ * Instead of recursing, the converter keeps the containers still open in
+ * a stack of frames allocated from the arena, each right before the
+ * vector of its children, and releases them in LIFO order: the nesting it
+ * accepts is bounded by json_gvariant_set_max_depth(), not by the stack
+ * of the thread.
+ *
+ * 'index' counts the children started so far. Dictionaries keep their
+ * next 'member' and the 'key' of the entry being converted, while maybes,
+ * variants and dictionary entries hold their only 'child' by itself.
+ * 'depth' is the number of arrays and objects open, this one included.
+ */
+typedef struct _JsonGVariantFrame JsonGVariantFrame;
 
-  const gchar *json_member;
-  json_object *json_value;
-  GVariant *variant_member;
-  GVariant *variant_value;
-  struct json_object_iter iter;
-  int count = 0;
+struct _JsonGVariantFrame
+{
+  JsonGVariantFrame      *parent;
+  JsonGVariantArenaMark   mark;
+
+  json_object            *json_node;
+  const JsonGVariantPlan *plan;
+  JsonGVariantPlan       *inferred;
+  gchar                   class;
+  guint                   depth;
+
+  guint                   index;
+  guint                   len;
+  struct lh_entry        *member;
+  GVariant               *key;
+  GVariant               *child;
+  JsonGVariantChildren    children;
+};
+
+/* Converts the JSON values which do not contain any other */
+static GVariant *
+json_to_gvariant_leaf (JsonGVariantContext  *context,
+                       json_object          *json_node,
+                       GVariantClass         class,
+                       GError              **error)
+{
+  GVariant *variant = NULL;
 
-  json_object_object_foreachC (json_node, iter)
-    count++;
+  switch (class)
+    {
+    case G_VARIANT_CLASS_BOOLEAN:
+      if (json_node_assert_type (json_node, json_type_boolean, 0, error))
+        variant = json_gvariant_new_boolean (context, json_object_get_boolean (json_node));
+      break;
+
+    case G_VARIANT_CLASS_BYTE:
+      if (json_node_assert_type (json_node, json_type_int, 0, error))
+        variant = g_variant_new_byte (json_object_get_int (json_node));
+      break;
+
+    case G_VARIANT_CLASS_INT16:
+      if (json_node_assert_type (json_node, json_type_int, 0, error))
+        variant = g_variant_new_int16 (json_object_get_int (json_node));
+      break;
+
+    case G_VARIANT_CLASS_UINT16:
+      if (json_node_assert_type (json_node, json_type_int, 0, error))
+        variant = g_variant_new_uint16 (json_object_get_int (json_node));
+      break;
+
+    case G_VARIANT_CLASS_INT32:
+      if (json_node_assert_type (json_node, json_type_int, 0, error))
+        variant = g_variant_new_int32 (json_object_get_int (json_node));
+      break;
+
+    case G_VARIANT_CLASS_UINT32:
+      if (json_node_assert_type (json_node, json_type_int, 0, error))
+        variant = g_variant_new_uint32 (json_object_get_int64 (json_node));
+      break;
+
+    case G_VARIANT_CLASS_INT64:
+      if (json_node_assert_type (json_node, json_type_int, 0, error))
+        variant = g_variant_new_int64 (json_object_get_int64 (json_node));
+      break;
+
+    case G_VARIANT_CLASS_UINT64:
+      /* values above G_MAXINT64 have been clamped to it by json-c */
+      if (json_node_assert_type (json_node, json_type_int, 0, error))
+        variant = g_variant_new_uint64 (json_object_get_int64 (json_node));
+      break;
+
+    case G_VARIANT_CLASS_HANDLE:
+      if (json_node_assert_type (json_node, json_type_int, 0, error))
+        variant = g_variant_new_handle (json_object_get_int (json_node));
+      break;
+
+    case G_VARIANT_CLASS_DOUBLE:
+      if (json_node_assert_type (json_node, json_type_double, 0, error))
+        variant = g_variant_new_double (json_object_get_double (json_node));
+      break;
+
+    case G_VARIANT_CLASS_STRING:
+      if (json_node_assert_type (json_node, json_type_string, 0, error))
+        variant = json_gvariant_new_string (context, json_object_get_string (json_node), -1);
+      break;
+
+    case G_VARIANT_CLASS_OBJECT_PATH:
+      if (json_node_assert_type (json_node, json_type_string, 0, error))
+        variant = g_variant_new_object_path (json_object_get_string (json_node));
+      break;
+
+    case G_VARIANT_CLASS_SIGNATURE:
+      if (json_node_assert_type (json_node, json_type_string, 0, error))
+        variant = g_variant_new_signature (json_object_get_string (json_node));
+      break;
+
+    default:
+      g_set_error (error,
+                   G_IO_ERROR,
+                   G_IO_ERROR_INVALID_DATA,
+                   _("GVariant class '%c' not supported"), class);
+      break;
+    }
+
+  return variant;
+}
+
+/* Fails if arrays and objects are nested 'depth' times, past the limit */
+static gboolean
+json_to_gvariant_check_depth (guint    depth,
+                              GError **error)
+{
+  if (G_UNLIKELY (depth > json_gvariant_get_max_depth ()))
+    {
+      g_set_error (error,
+                   JSON_GVARIANT_ERROR,
+                   JSON_GVARIANT_ERROR_TOO_DEEP,
+                   _("JSON data is nested more than %u levels deep"),
+                   json_gvariant_get_max_depth ());
+      return FALSE;
+    }
+
+  return TRUE;
+}
+
+static gboolean
+json_to_gvariant_is_container (GVariantClass class)
+{
+  return class == JSON_G_VARIANT_CLASS_DICTIONARY ||
+         class == G_VARIANT_CLASS_VARIANT ||
+         class == G_VARIANT_CLASS_MAYBE ||
+         class == G_VARIANT_CLASS_ARRAY ||
+         class == G_VARIANT_CLASS_TUPLE ||
+         class == G_VARIANT_CLASS_DICT_ENTRY;
+}
+
+/* Checks that 'json_node' can be converted to the container 'class' and
+ * pushes a frame for it on top of 'frame' */
+static gboolean
+json_to_gvariant_open (JsonGVariantContext     *context,
+                       JsonGVariantFrame      **frame,
+                       json_object             *json_node,
+                       const JsonGVariantPlan  *plan,
+                       GVariantClass            class,
+                       GError                 **error)
+{
+  JsonGVariantArenaMark mark;
+  JsonGVariantFrame *opened;
+  json_type type = json_type_null;
+  guint depth;
+  guint len = 0;
+
+  depth = *frame != NULL ? (*frame)->depth : context->depth;
+
+  if (class == JSON_G_VARIANT_CLASS_DICTIONARY || class == G_VARIANT_CLASS_DICT_ENTRY)
+    type = json_type_object;
+  else if (class == G_VARIANT_CLASS_ARRAY || class == G_VARIANT_CLASS_TUPLE)
+    type = json_type_array;
+
+  if (type != json_type_null)
+    {
+      if (!json_node_assert_type (json_node, type, 0, error))
+        return FALSE;
+
+      if (!json_to_gvariant_check_depth (++depth, error))
+        return FALSE;
+
+      if (type == json_type_object)
+        len = json_object_get_object (json_node)->count;
+      else
+        len = json_object_array_length (json_node);
+    }
 
-  if (count != 1)
+  if (class == G_VARIANT_CLASS_DICT_ENTRY && len != 1)
     {
       g_set_error_literal (error,
                            G_IO_ERROR,
                            G_IO_ERROR_INVALID_DATA,
                            _("A GVariant dictionary entry expects a JSON object with exactly one member"));
-      return NULL;
+      return FALSE;
+    }
+
+  if (plan == NULL)
+    plan = json_gvariant_plan_get_default (class);
+
+  json_gvariant_arena_mark (context->arena, &mark);
+  opened = json_gvariant_arena_alloc (context->arena, sizeof (JsonGVariantFrame));
+
+  opened->parent = *frame;
+  opened->mark = mark;
+  opened->json_node = json_node;
+  opened->plan = plan;
+  opened->inferred = NULL;
+  opened->class = class;
+  opened->depth = depth;
+  opened->index = 0;
+  opened->len = len;
+  opened->member = type == json_type_object ? json_object_get_object (json_node)->head : NULL;
+  opened->key = NULL;
+  opened->child = NULL;
+
+  if (class == JSON_G_VARIANT_CLASS_DICTIONARY || class == G_VARIANT_CLASS_ARRAY)
+    json_gvariant_children_init (context, &opened->children, len);
+  else if (class == G_VARIANT_CLASS_TUPLE)
+    json_gvariant_children_init (context, &opened->children, plan->n_children);
+
+  if (class == G_VARIANT_CLASS_VARIANT && context->compact &&
+      (json_object_is_type (json_node, json_type_object) ||
+       json_object_is_type (json_node, json_type_array)))
+    opened->inferred = json_gvariant_infer_plan (context->arena, json_node);
+
+  *frame = opened;
+
+  return TRUE;
+}
+
+/* Moves 'frame' to its next child, returning it in 'json_child' and its
+ * plan in 'plan', or sets 'done' when there are no more: as JSON nulls
+ * are NULL objects, 'json_child' cannot tell. Keys are converted here,
+ * before their values.
+ */
+static gboolean
+json_to_gvariant_next (JsonGVariantContext      *context,
+                       JsonGVariantFrame        *frame,
+                       json_object             **json_child,
+                       const JsonGVariantPlan  **plan,
+                       gboolean                 *done,
+                       GError                  **error)
+{
+  const JsonGVariantPlan *entry;
+
+  *done = TRUE;
+
+  switch (frame->class)
+    {
+    case JSON_G_VARIANT_CLASS_DICTIONARY:
+    case G_VARIANT_CLASS_DICT_ENTRY:
+      if (frame->member == NULL || frame->key != NULL)
+        break;
+
+      entry = frame->class == G_VARIANT_CLASS_DICT_ENTRY ? frame->plan
+                                                        : &frame->plan->children[0];
+      frame->key = json_gvariant_new_key (context,
+                                          frame->member->k,
+                                          -1,
+                                          entry->children[0].class,
+                                          error);
+      if (frame->key == NULL)
+        return FALSE;
+
+      *json_child = (json_object *) frame->member->v;
+      *plan = &entry->children[1];
+      *done = FALSE;
+      frame->member = frame->member->next;
+      break;
+
+    case G_VARIANT_CLASS_ARRAY:
+      if (frame->index < frame->len)
+        {
+          *json_child = json_object_array_get_idx (frame->json_node, frame->index);
+          *plan = &frame->plan->children[0];
+          *done = FALSE;
+        }
+      break;
+
+    case G_VARIANT_CLASS_TUPLE:
+      if (frame->index < frame->plan->n_children)
+        {
+          if (frame->index >= frame->len)
+            {
+              g_set_error_literal (error,
+                                   G_IO_ERROR,
+                                   G_IO_ERROR_INVALID_DATA,
+                                   _("Missing elements in JSON array to conform to a tuple"));
+              return FALSE;
+            }
+
+          *json_child = json_object_array_get_idx (frame->json_node, frame->index);
+          *plan = &frame->plan->children[frame->index];
+          *done = FALSE;
+        }
+      else if (frame->len > frame->plan->n_children)
+        {
+          g_set_error_literal (error,
+                               G_IO_ERROR,
+                               G_IO_ERROR_INVALID_DATA,
+                               _("Unexpected extra elements in JSON array"));
+          return FALSE;
+        }
+      break;
+
+    case G_VARIANT_CLASS_MAYBE:
+      if (frame->index == 0 && !json_object_is_type (frame->json_node, json_type_null))
+        {
+          *json_child = frame->json_node;
+          *plan = &frame->plan->children[0];
+          *done = FALSE;
+        }
+      break;
+
+    case G_VARIANT_CLASS_VARIANT:
+      if (frame->index == 0)
+        {
+          *json_child = frame->json_node;
+          *plan = frame->inferred;
+          *done = FALSE;
+        }
+      break;
+    }
+
+  if (!*done)
+    frame->index++;
+
+  return TRUE;
+}
+
+static void
+json_to_gvariant_add (JsonGVariantContext *context,
+                      JsonGVariantFrame   *frame,
+                      GVariant            *child)
+{
+  switch (frame->class)
+    {
+    case JSON_G_VARIANT_CLASS_DICTIONARY:
+      json_gvariant_children_add (context,
+                                  &frame->children,
+                                  g_variant_new_dict_entry (frame->key, child));
+      frame->key = NULL;
+      break;
+
+    case G_VARIANT_CLASS_ARRAY:
+    case G_VARIANT_CLASS_TUPLE:
+      json_gvariant_children_add (context, &frame->children, child);
+      break;
+
+    default:
+      frame->child = child;
+      break;
+    }
+}
+
+static void
+json_to_gvariant_pop (JsonGVariantContext  *context,
+                      JsonGVariantFrame   **frame)
+{
+  /* the mark is released along with the frame holding it */
+  JsonGVariantArenaMark mark = (*frame)->mark;
+
+  g_free ((*frame)->inferred);
+  *frame = (*frame)->parent;
+  json_gvariant_arena_release (context->arena, &mark);
+}
+
+/* Builds the container of 'frame' from its children and pops it */
+static GVariant *
+json_to_gvariant_close (JsonGVariantContext  *context,
+                        JsonGVariantFrame   **frame)
+{
+  JsonGVariantFrame *closed = *frame;
+  GVariant *variant = NULL;
+
+  switch (closed->class)
+    {
+    case JSON_G_VARIANT_CLASS_DICTIONARY:
+      variant = json_gvariant_children_end_dictionary (context,
+                                                       &closed->children,
+                                                       closed->plan->children[0].type);
+      break;
+
+    case G_VARIANT_CLASS_ARRAY:
+      variant = json_gvariant_children_end_array (context,
+                                                  &closed->children,
+                                                  closed->plan->children[0].type);
+      break;
+
+    case G_VARIANT_CLASS_TUPLE:
+      variant = json_gvariant_children_end_tuple (context, &closed->children);
+      break;
+
+    case G_VARIANT_CLASS_DICT_ENTRY:
+      variant = g_variant_new_dict_entry (closed->key, closed->child);
+      break;
+
+    case G_VARIANT_CLASS_MAYBE:
+      variant = g_variant_new_maybe (closed->plan->children[0].type, closed->child);
+      break;
+
+    case G_VARIANT_CLASS_VARIANT:
+      variant = g_variant_new_variant (closed->child);
+      break;
+    }
+
+  json_to_gvariant_pop (context, frame);
+
+  return variant;
+}
+
+/* Drops the children of 'frame' converted so far and pops it */
+static void
+json_to_gvariant_roll_back (JsonGVariantContext  *context,
+                            JsonGVariantFrame   **frame)
+{
+  JsonGVariantFrame *closed = *frame;
+
+  if (closed->class == JSON_G_VARIANT_CLASS_DICTIONARY ||
+      closed->class == G_VARIANT_CLASS_ARRAY ||
+      closed->class == G_VARIANT_CLASS_TUPLE)
+    json_gvariant_children_clear (context, &closed->children);
+
+  if (closed->key != NULL)
+    json_gvariant_discard (closed->key);
+  if (closed->child != NULL)
+    json_gvariant_discard (closed->child);
+
+  json_to_gvariant_pop (context, frame);
+}
+
+/* Converts 'json_node' to 'plan', or to the defaults if it is NULL.
+ *
+ * The tree is walked depth-first in a single loop: going down, leaves are
+ * converted right away and containers get a frame; going up, each value
+ * is added to the container on top of the stack, which either moves to
+ * its next child or is closed in turn.
+ */
+static GVariant *
+json_to_gvariant_convert (JsonGVariantContext     *context,
+                          json_object             *json_node,
+                          const JsonGVariantPlan  *plan,
+                          GError                 **error)
+{
+  JsonGVariantFrame *frame = NULL;
+  GVariant *variant;
+  gboolean done;
+
+  while (TRUE)
+    {
+      GVariantClass class;
+
+      class = json_to_gvariant_get_next_class (json_node, plan);
+
+      if (class == G_VARIANT_CLASS_ARRAY && context->parallel &&
+          json_object_is_type (json_node, json_type_array) &&
+          json_object_array_length (json_node) >= JSON_GVARIANT_PARALLEL_MIN_ELEMENTS)
+        {
+          variant = json_to_gvariant_array_parallel (context,
+                                                     frame != NULL ? frame->depth : context->depth,
+                                                     json_node,
+                                                     plan,
+                                                     error);
+          if (variant == NULL)
+            goto roll_back;
+        }
+      else if (json_to_gvariant_is_container (class))
+        {
+          if (!json_to_gvariant_open (context, &frame, json_node, plan, class, error))
+            goto roll_back;
+          variant = NULL;
+        }
+      else
+        {
+          variant = json_to_gvariant_leaf (context, json_node, class, error);
+          if (variant == NULL)
+            goto roll_back;
+        }
+
+      while (frame != NULL)
+        {
+          if (variant != NULL)
+            json_to_gvariant_add (context, frame, variant);
+
+          if (!json_to_gvariant_next (context, frame, &json_node, &plan, &done, error))
+            goto roll_back;
+
+          if (!done)
+            break;
+
+          variant = json_to_gvariant_close (context, &frame);
+        }
+
+      if (frame == NULL)
+        return variant;
     }
 
-  parse_dict_entry_signature (signature,
-                              &entry_signature,
-                              &key_signature,
-                              &value_signature);
+roll_back:
+  while (frame != NULL)
+    json_to_gvariant_roll_back (context, &frame);
+
+  return NULL;
+}
+
+/* Converts a value whose type is not given by a plan: the defaults are
+ * used, unless the context asks for compact types */
+static GVariant *
+json_to_gvariant_value (JsonGVariantContext  *context,
+                        json_object          *json_node,
+                        GError              **error)
+{
+  JsonGVariantPlan *inferred = NULL;
+  GVariant *variant;
+
+  if (context->compact &&
+      (json_object_is_type (json_node, json_type_object) ||
+       json_object_is_type (json_node, json_type_array)))
+    inferred = json_gvariant_infer_plan (context->arena, json_node);
+
+  variant = json_to_gvariant_convert (context, json_node, inferred, error);
+  g_free (inferred);
+
+  return variant;
+}
+
+GVariant *
+json_gvariant_deserialize (json_object  *json_node,
+                           const gchar  *signature,
+                           GError      **error)
+{
+  return json_gvariant_deserialize_full (json_node,
+                                         signature,
+                                         JSON_GVARIANT_FLAGS_NONE,
+                                         error);
+}
+
+/* Converts an already parsed json-c tree. JSON_GVARIANT_FLAGS_SERIALIZED
+ * is ignored here.
+ *
+ * json-c keeps integers as signed 64-bit values, clamping the larger ones
+ * to G_MAXINT64 while parsing: this is what they are converted to for
+ * 't', as the tree cannot tell them apart from G_MAXINT64 itself.
+ * Unsigned values above G_MAXINT64 are only kept whole when converting
+ * the text, see json_gvariant_deserialize_data_full(). */
+GVariant *
+json_gvariant_deserialize_full (json_object        *json_node,
+                                const gchar        *signature,
+                                JsonGVariantFlags   flags,
+                                GError            **error)
+{
+  const JsonGVariantPlan *plan = NULL;
+  JsonGVariantContext context = { NULL, };
+  GVariant *variant;
+
+  g_return_val_if_fail (json_node != NULL, NULL);
+
+  if (signature != NULL && (plan = json_gvariant_plan_get (signature, error)) == NULL)
+    return NULL;
+
+  context.arena = json_gvariant_arena_begin ();
+  context.compact = (flags & JSON_GVARIANT_FLAGS_COMPACT) != 0;
+  context.sorted = (flags & JSON_GVARIANT_FLAGS_SORTED) != 0;
+  context.parallel = (flags & JSON_GVARIANT_FLAGS_PARALLEL) != 0 &&
+                     json_gvariant_parallel_get_n_threads () > 1;
+  json_gvariant_intern_begin (&context, flags,
+                              json_object_is_type (json_node, json_type_object) ||
+                              json_object_is_type (json_node, json_type_array));
+
+  if (plan != NULL)
+    variant = json_to_gvariant_convert (&context, json_node, plan, error);
+  else
+    variant = json_to_gvariant_value (&context, json_node, error);
+
+  json_gvariant_intern_end (&context);
+  json_gvariant_arena_end (context.arena);
+
+  return variant;
+}
+
+/* ========================================================================== */
+/* JSON text to GVariant, without building a json-c tree */
+/* ========================================================================== */
+
+/* The functions below mirror the json_to_gvariant_*() ones, but pull their
+ * input from a JsonScanner: each of them is entered with the scanner on the
+ * first token of the value to convert and returns with the scanner on its
+ * last token. Both walk the same compiled JsonGVariantPlan.
+ */
+
+static GVariant * json_stream_to_gvariant_recurse (JsonGVariantContext     *context,
+                                                   JsonScanner             *scanner,
+                                                   const JsonGVariantPlan  *plan,
+                                                   GError                 **error);
 
-  member = json_object_get_object(json_node)->head;
+static GVariantClass
+json_stream_get_next_class (JsonScanner            *scanner,
+                            const JsonGVariantPlan *plan)
+{
+  if (plan == NULL)
+    {
+      GVariantClass class = 0;
+
+      switch (scanner->token)
+        {
+        case JSON_TOKEN_BOOLEAN:
+          class = G_VARIANT_CLASS_BOOLEAN;
+          break;
+
+        case JSON_TOKEN_INT:
+          class = G_VARIANT_CLASS_INT64;
+          break;
+
+        case JSON_TOKEN_DOUBLE:
+          class = G_VARIANT_CLASS_DOUBLE;
+          break;
+
+        case JSON_TOKEN_STRING:
+          class = G_VARIANT_CLASS_STRING;
+          break;
+
+        case JSON_TOKEN_BEGIN_ARRAY:
+          class = G_VARIANT_CLASS_ARRAY;
+          break;
+
+        case JSON_TOKEN_BEGIN_OBJECT:
+          class = JSON_G_VARIANT_CLASS_DICTIONARY;
+          break;
+
+        case JSON_TOKEN_NULL:
+          class = G_VARIANT_CLASS_MAYBE;
+          break;
+
+        default:
+          break;
+        }
+
+      return class;
+    }
+  else
+    {
+      return plan->class;
+    }
+}
+
+static void
+json_stream_set_syntax_error (JsonScanner  *scanner,
+                              GError      **error)
+{
+  /* on JSON_TOKEN_ERROR the scanner already reported the problem */
+  if (scanner->token != JSON_TOKEN_ERROR)
+    g_set_error (error,
+                 G_IO_ERROR,
+                 G_IO_ERROR_INVALID_DATA,
+                 _("JSON data is malformed: unexpected %s at offset %" G_GSIZE_FORMAT),
+                 json_token_get_name (scanner->token),
+                 json_scanner_get_offset (scanner));
+
+  scanner->token = JSON_TOKEN_ERROR;
+}
+
+static void
+json_stream_set_unexpected (JsonScanner  *scanner,
+                            GError      **error)
+{
+  switch (scanner->token)
+    {
+    case JSON_TOKEN_BEGIN_OBJECT:
+    case JSON_TOKEN_BEGIN_ARRAY:
+    case JSON_TOKEN_STRING:
+    case JSON_TOKEN_INT:
+    case JSON_TOKEN_DOUBLE:
+    case JSON_TOKEN_BOOLEAN:
+    case JSON_TOKEN_NULL:
+      /* translators: the '%s' is the type name */
+      g_set_error (error,
+                   G_IO_ERROR,
+                   G_IO_ERROR_INVALID_DATA,
+                   _("Unexpected type '%s' in JSON node"),
+                   json_token_get_name (scanner->token));
+      scanner->token = JSON_TOKEN_ERROR;
+      break;
+
+    default:
+      json_stream_set_syntax_error (scanner, error);
+      break;
+    }
+}
+
+static gboolean
+json_stream_assert_token (JsonScanner  *scanner,
+                          JsonToken     token,
+                          GError      **error)
+{
+  if (G_UNLIKELY (scanner->token != token))
+    {
+      json_stream_set_unexpected (scanner, error);
+      return FALSE;
+    }
+
+  return TRUE;
+}
+
+/* Moves the scanner to the first token of the next element of the array or
+ * object being converted, consuming the separating comma. Returns FALSE
+ * when the closing token is reached or on error, in which case the scanner
+ * token is JSON_TOKEN_ERROR.
+ */
+static gboolean
+json_stream_next_element (JsonScanner  *scanner,
+                          JsonToken     end,
+                          gboolean      first,
+                          GError      **error)
+{
+  JsonToken token;
+
+  token = json_scanner_next (scanner, error);
+  if (token == end)
+    return FALSE;
+
+  if (!first)
+    {
+      if (token != JSON_TOKEN_COMMA)
+        {
+          json_stream_set_syntax_error (scanner, error);
+          return FALSE;
+        }
+
+      token = json_scanner_next (scanner, error);
+    }
+
+  return token != JSON_TOKEN_ERROR;
+}
+
+/* Like json_stream_next_element(), but for objects: on success the member
+ * name is left in the scanner buffer.
+ */
+static gboolean
+json_stream_next_member (JsonScanner  *scanner,
+                         gboolean      first,
+                         GError      **error)
+{
+  if (!json_stream_next_element (scanner, JSON_TOKEN_END_OBJECT, first, error))
+    return FALSE;
+
+  if (scanner->token != JSON_TOKEN_STRING)
+    {
+      json_stream_set_syntax_error (scanner, error);
+      return FALSE;
+    }
+
+  return TRUE;
+}
+
+/* Moves the scanner from a member name to the first token of its value */
+static gboolean
+json_stream_next_value (JsonScanner  *scanner,
+                        GError      **error)
+{
+  if (json_scanner_next (scanner, error) != JSON_TOKEN_COLON)
+    {
+      json_stream_set_syntax_error (scanner, error);
+      return FALSE;
+    }
+
+  return json_scanner_next (scanner, error) != JSON_TOKEN_ERROR;
+}
+
+/* The contents of number tokens are well formed: GLib only gets the values
+ * the parsers of the scanner leave alone, saturating the integers out of
+ * range */
+static gint64
+json_stream_get_int (JsonScanner *scanner)
+{
+  gint64 value;
+
+  if (G_LIKELY (json_scanner_parse_int64 (scanner->buffer->str,
+                                          scanner->buffer->len,
+                                          &value)))
+    return value;
+
+  return g_ascii_strtoll (scanner->buffer->str, NULL, 10);
+}
+
+static guint64
+json_stream_get_uint64 (JsonScanner *scanner)
+{
+  guint64 value;
+
+  if (G_LIKELY (json_scanner_parse_uint64 (scanner->buffer->str,
+                                           scanner->buffer->len,
+                                           &value)))
+    return value;
+
+  return g_ascii_strtoull (scanner->buffer->str, NULL, 10);
+}
+
+static gdouble
+json_stream_get_double (JsonScanner *scanner)
+{
+  gdouble value;
+
+  if (G_LIKELY (json_scanner_parse_double (scanner->buffer->str,
+                                           scanner->buffer->len,
+                                           &value)))
+    return value;
+
+  return g_ascii_strtod (scanner->buffer->str, NULL);
+}
+
+static GVariant *
+json_stream_to_gvariant_tuple (JsonGVariantContext     *context,
+                               JsonScanner             *scanner,
+                               const JsonGVariantPlan  *plan,
+                               GError                 **error)
+{
+  JsonGVariantChildren children;
+  gboolean first = TRUE;
+
+  json_gvariant_children_init (context, &children, plan->n_children);
+
+  while (json_stream_next_element (scanner, JSON_TOKEN_END_ARRAY, first, error))
+    {
+      GVariant *variant_child;
+
+      if (children.n_children >= plan->n_children)
+        {
+          g_set_error_literal (error,
+                               G_IO_ERROR,
+                               G_IO_ERROR_INVALID_DATA,
+                               _("Unexpected extra elements in JSON array"));
+          goto roll_back;
+        }
+
+      if (G_UNLIKELY (context->profile != NULL))
+        json_gvariant_profile_set_element (context->profile, children.n_children);
+
+      variant_child = json_stream_to_gvariant_recurse (context,
+                                                       scanner,
+                                                       &plan->children[children.n_children],
+                                                       error);
+      if (variant_child == NULL)
+        goto roll_back;
+
+      json_gvariant_children_add (context, &children, variant_child);
+      first = FALSE;
+    }
+
+  if (scanner->token == JSON_TOKEN_ERROR)
+    goto roll_back;
+
+  if (children.n_children < plan->n_children)
+    {
+      g_set_error_literal (error,
+                           G_IO_ERROR,
+                           G_IO_ERROR_INVALID_DATA,
+                           _("Missing elements in JSON array to conform to a tuple"));
+      goto roll_back;
+    }
+
+  return json_gvariant_children_end_tuple (context, &children);
+
+roll_back:
+  json_gvariant_children_clear (context, &children);
+  return NULL;
+}
+
+static GVariant *
+json_stream_to_gvariant_maybe (JsonGVariantContext     *context,
+                               JsonScanner             *scanner,
+                               const JsonGVariantPlan  *plan,
+                               GError                 **error)
+{
+  const JsonGVariantPlan *element;
+  GVariant *value;
+
+  if (plan == NULL)
+    plan = json_gvariant_plan_get_default (G_VARIANT_CLASS_MAYBE);
+  element = &plan->children[0];
+
+  if (scanner->token == JSON_TOKEN_NULL)
+    return g_variant_new_maybe (element->type, NULL);
+
+  value = json_stream_to_gvariant_recurse (context, scanner, element, error);
+  if (value == NULL)
+    return NULL;
+
+  return g_variant_new_maybe (element->type, value);
+}
+
+static GVariant *
+json_stream_to_gvariant_array (JsonGVariantContext     *context,
+                               JsonScanner             *scanner,
+                               const JsonGVariantPlan  *plan,
+                               GError                 **error)
+{
+  const JsonGVariantPlan *element;
+  JsonGVariantChildren children;
+  gboolean first = TRUE;
+  GVariant *variant;
+
+  if (plan == NULL)
+    plan = json_gvariant_plan_get_default (G_VARIANT_CLASS_ARRAY);
+  element = &plan->children[0];
+
+  if (context->parallel &&
+      json_stream_to_gvariant_array_parallel (context, scanner, element, &variant, error))
+    return variant;
+
+  json_gvariant_children_init (context, &children, 0);
+
+  while (json_stream_next_element (scanner, JSON_TOKEN_END_ARRAY, first, error))
+    {
+      GVariant *variant_child;
+
+      if (G_UNLIKELY (context->profile != NULL))
+        json_gvariant_profile_set_element (context->profile, -1);
+
+      variant_child = json_stream_to_gvariant_recurse (context, scanner, element, error);
+      if (variant_child == NULL)
+        goto roll_back;
+
+      json_gvariant_children_add (context, &children, variant_child);
+      first = FALSE;
+    }
+
+  if (scanner->token == JSON_TOKEN_ERROR)
+    goto roll_back;
+
+  return json_gvariant_children_end_array (context, &children, element->type);
+
+roll_back:
+  json_gvariant_children_clear (context, &children);
+  return NULL;
+}
+
+static GVariant *
+json_stream_to_gvariant_dict_entry (JsonGVariantContext     *context,
+                                    JsonScanner             *scanner,
+                                    const JsonGVariantPlan  *plan,
+                                    GError                 **error)
+{
+  GVariant *variant_member;
+  GVariant *variant_value;
+
+  if (!json_stream_next_member (scanner, TRUE, error))
+    {
+      if (scanner->token == JSON_TOKEN_END_OBJECT)
+        g_set_error_literal (error,
+                             G_IO_ERROR,
+                             G_IO_ERROR_INVALID_DATA,
+                             _("A GVariant dictionary entry expects a JSON object with exactly one member"));
+      return NULL;
+    }
+
+  variant_member = json_gvariant_new_key (context,
+                                          scanner->buffer->str,
+                                          scanner->buffer->len,
+                                          plan->children[0].class,
+                                          error);
+  if (variant_member == NULL)
+    return NULL;
+
+  if (G_UNLIKELY (context->profile != NULL))
+    json_gvariant_profile_set_member (context->profile,
+                                      scanner->buffer->str,
+                                      scanner->buffer->len);
+
+  if (!json_stream_next_value (scanner, error))
+    {
+      json_gvariant_discard (variant_member);
+      return NULL;
+    }
+
+  variant_value = json_stream_to_gvariant_recurse (context,
+                                                   scanner,
+                                                   &plan->children[1],
+                                                   error);
+  if (variant_value == NULL)
+    {
+      json_gvariant_discard (variant_member);
+      return NULL;
+    }
+
+  if (json_scanner_next (scanner, error) != JSON_TOKEN_END_OBJECT)
+    {
+      if (scanner->token == JSON_TOKEN_COMMA)
+        g_set_error_literal (error,
+                             G_IO_ERROR,
+                             G_IO_ERROR_INVALID_DATA,
+                             _("A GVariant dictionary entry expects a JSON object with exactly one member"));
+      else
+        json_stream_set_syntax_error (scanner, error);
+
+      json_gvariant_discard (variant_member);
+      json_gvariant_discard (variant_value);
+      return NULL;
+    }
+
+  return g_variant_new_dict_entry (variant_member, variant_value);
+}
+
+static GVariant *
+json_stream_to_gvariant_dictionary (JsonGVariantContext     *context,
+                                    JsonScanner             *scanner,
+                                    const JsonGVariantPlan  *plan,
+                                    GError                 **error)
+{
+  const JsonGVariantPlan *entry_plan;
+  const JsonGVariantPlan *value_plan;
+  GVariantClass key_class;
+  JsonGVariantChildren children;
+  gboolean first = TRUE;
+
+  if (plan == NULL)
+    plan = json_gvariant_plan_get_default (JSON_G_VARIANT_CLASS_DICTIONARY);
+  entry_plan = &plan->children[0];
+  key_class = entry_plan->children[0].class;
+  value_plan = &entry_plan->children[1];
+
+  json_gvariant_children_init (context, &children, 0);
+
+  while (json_stream_next_member (scanner, first, error))
+    {
+      GVariant *variant_member;
+      GVariant *variant_value;
+
+      variant_member = json_gvariant_new_key (context,
+                                              scanner->buffer->str,
+                                              scanner->buffer->len,
+                                              key_class,
+                                              error);
+      if (variant_member == NULL)
+        goto roll_back;
+
+      if (G_UNLIKELY (context->profile != NULL))
+        json_gvariant_profile_set_member (context->profile,
+                                          scanner->buffer->str,
+                                          scanner->buffer->len);
+
+      if (!json_stream_next_value (scanner, error))
+        {
+          json_gvariant_discard (variant_member);
+          goto roll_back;
+        }
+
+      variant_value = json_stream_to_gvariant_recurse (context, scanner, value_plan, error);
+      if (variant_value == NULL)
+        {
+          json_gvariant_discard (variant_member);
+          goto roll_back;
+        }
+
+      json_gvariant_children_add (context,
+                                  &children,
+                                  g_variant_new_dict_entry (variant_member,
+                                                            variant_value));
+      first = FALSE;
+    }
+
+  if (scanner->token == JSON_TOKEN_ERROR)
+    goto roll_back;
+
+  return json_gvariant_children_end_dictionary (context, &children, entry_plan->type);
+
+roll_back:
+  json_gvariant_children_clear (context, &children);
+  return NULL;
+}
+
+/* See json_to_gvariant_value() */
+static GVariant *
+json_stream_to_gvariant_value (JsonGVariantContext  *context,
+                               JsonScanner          *scanner,
+                               GError              **error)
+{
+  JsonGVariantPlan *inferred = NULL;
+  GVariant *variant;
+
+  if (context->compact &&
+      (scanner->token == JSON_TOKEN_BEGIN_OBJECT ||
+       scanner->token == JSON_TOKEN_BEGIN_ARRAY))
+    inferred = json_gvariant_infer_plan_scanner (context->arena, scanner,
+                                                 context->shapes);
+
+  variant = json_stream_to_gvariant_recurse (context, scanner, inferred, error);
+  g_free (inferred);
+
+  return variant;
+}
+
+static GVariant *
+json_stream_to_gvariant_node (JsonGVariantContext     *context,
+                              JsonScanner             *scanner,
+                              const JsonGVariantPlan  *plan,
+                              GError                 **error)
+{
+  GVariant *variant = NULL;
+  GVariantClass class;
+
+  class = json_stream_get_next_class (scanner, plan);
+
+  if (class == 0)
+    {
+      /* only happens when inferring the type of a non-value token */
+      json_stream_set_unexpected (scanner, error);
+      return NULL;
+    }
+
+  if (class == JSON_G_VARIANT_CLASS_DICTIONARY)
+    {
+      if (json_stream_assert_token (scanner, JSON_TOKEN_BEGIN_OBJECT, error))
+        variant = json_stream_to_gvariant_dictionary (context, scanner, plan, error);
+
+      return variant;
+    }
+
+  switch (class)
+    {
+    case G_VARIANT_CLASS_BOOLEAN:
+      if (json_stream_assert_token (scanner, JSON_TOKEN_BOOLEAN, error))
+        variant = json_gvariant_new_boolean (context, scanner->boolean_value);
+      break;
+
+    case G_VARIANT_CLASS_BYTE:
+      if (json_stream_assert_token (scanner, JSON_TOKEN_INT, error))
+        variant = g_variant_new_byte (json_stream_get_int (scanner));
+      break;
+
+    case G_VARIANT_CLASS_INT16:
+      if (json_stream_assert_token (scanner, JSON_TOKEN_INT, error))
+        variant = g_variant_new_int16 (json_stream_get_int (scanner));
+      break;
+
+    case G_VARIANT_CLASS_UINT16:
+      if (json_stream_assert_token (scanner, JSON_TOKEN_INT, error))
+        variant = g_variant_new_uint16 (json_stream_get_int (scanner));
+      break;
+
+    case G_VARIANT_CLASS_INT32:
+      if (json_stream_assert_token (scanner, JSON_TOKEN_INT, error))
+        variant = g_variant_new_int32 (json_stream_get_int (scanner));
+      break;
+
+    case G_VARIANT_CLASS_UINT32:
+      if (json_stream_assert_token (scanner, JSON_TOKEN_INT, error))
+        variant = g_variant_new_uint32 (json_stream_get_int (scanner));
+      break;
+
+    case G_VARIANT_CLASS_INT64:
+      if (json_stream_assert_token (scanner, JSON_TOKEN_INT, error))
+        variant = g_variant_new_int64 (json_stream_get_int (scanner));
+      break;
+
+    case G_VARIANT_CLASS_UINT64:
+      if (json_stream_assert_token (scanner, JSON_TOKEN_INT, error))
+        variant = g_variant_new_uint64 (json_stream_get_uint64 (scanner));
+      break;
+
+    case G_VARIANT_CLASS_HANDLE:
+      if (json_stream_assert_token (scanner, JSON_TOKEN_INT, error))
+        variant = g_variant_new_handle (json_stream_get_int (scanner));
+      break;
+
+    case G_VARIANT_CLASS_DOUBLE:
+      if (json_stream_assert_token (scanner, JSON_TOKEN_DOUBLE, error))
+        variant = g_variant_new_double (json_stream_get_double (scanner));
+      break;
+
+    case G_VARIANT_CLASS_STRING:
+      if (json_stream_assert_token (scanner, JSON_TOKEN_STRING, error))
+        variant = json_gvariant_new_string (context, scanner->buffer->str, scanner->buffer->len);
+      break;
+
+    case G_VARIANT_CLASS_OBJECT_PATH:
+      if (json_stream_assert_token (scanner, JSON_TOKEN_STRING, error))
+        variant = gvariant_checked_from_string (scanner->buffer->str, class, error);
+      break;
+
+    case G_VARIANT_CLASS_SIGNATURE:
+      if (json_stream_assert_token (scanner, JSON_TOKEN_STRING, error))
+        variant = gvariant_checked_from_string (scanner->buffer->str, class, error);
+      break;
+
+    case G_VARIANT_CLASS_VARIANT:
+      {
+        GVariant *child;
+
+        child = json_stream_to_gvariant_value (context, scanner, error);
+        if (child != NULL)
+          variant = g_variant_new_variant (child);
+      }
+      break;
+
+    case G_VARIANT_CLASS_MAYBE:
+      variant = json_stream_to_gvariant_maybe (context, scanner, plan, error);
+      break;
+
+    case G_VARIANT_CLASS_ARRAY:
+      if (json_stream_assert_token (scanner, JSON_TOKEN_BEGIN_ARRAY, error))
+        variant = json_stream_to_gvariant_array (context, scanner, plan, error);
+      break;
+
+    case G_VARIANT_CLASS_TUPLE:
+      if (json_stream_assert_token (scanner, JSON_TOKEN_BEGIN_ARRAY, error))
+        variant = json_stream_to_gvariant_tuple (context, scanner, plan, error);
+      break;
+
+    case G_VARIANT_CLASS_DICT_ENTRY:
+      if (json_stream_assert_token (scanner, JSON_TOKEN_BEGIN_OBJECT, error))
+        variant = json_stream_to_gvariant_dict_entry (context, scanner, plan, error);
+      break;
+
+    default:
+      g_set_error (error,
+                   G_IO_ERROR,
+                   G_IO_ERROR_INVALID_DATA,
+                   _("GVariant class '%c' not supported"), class);
+      break;
+    }
+
+  return variant;
+}
+
+/* Converts the value at the scanner, measuring it if it is profiled */
+static GVariant *
+json_stream_to_gvariant_recurse (JsonGVariantContext     *context,
+                                 JsonScanner             *scanner,
+                                 const JsonGVariantPlan  *plan,
+                                 GError                 **error)
+{
+  JsonGVariantProfileProbe probe;
+  gboolean profiled;
+  GVariant *variant;
+
+  if (G_LIKELY (context->profile == NULL))
+    return json_stream_to_gvariant_node (context, scanner, plan, error);
+
+  profiled = json_gvariant_profile_enter (context->profile, scanner, &probe);
+
+  variant = json_stream_to_gvariant_node (context, scanner, plan, error);
+  if (variant != NULL)
+    json_gvariant_profile_add_allocation (context->profile);
+
+  if (profiled)
+    json_gvariant_profile_leave (context->profile, scanner, &probe);
+
+  return variant;
+}
+
+/* ========================================================================== */
+/* Validation of JSON text against a signature */
+/* ========================================================================== */
+
+/* The functions below follow the json_stream_to_gvariant_*() ones and
+ * accept exactly the same input, but only check it: nothing is built and,
+ * once the thread arena is warm, nothing is allocated unless an error is
+ * reported.
+ */
+
+static gboolean json_validate_recurse (JsonScanner             *scanner,
+                                       const JsonGVariantPlan  *plan,
+                                       GError                 **error);
+
+/* Accepts the same keys as gvariant_simple_from_string() */
+static gboolean
+json_validate_key (const gchar    *key,
+                   GVariantClass   class,
+                   GError        **error)
+{
+  gchar *nptr = NULL;
+
+  errno = 0;
+
+  switch (class)
+    {
+    case G_VARIANT_CLASS_BOOLEAN:
+      if (strcmp (key, "true") != 0 && strcmp (key, "false") != 0)
+        errno = 1;
+      break;
+
+    case G_VARIANT_CLASS_UINT32:
+    case G_VARIANT_CLASS_UINT64:
+      json_gvariant_key_to_uint64 (key, &nptr);
+      break;
+
+    case G_VARIANT_CLASS_HANDLE:
+      strtol (key, &nptr, 10);
+      break;
+
+    case G_VARIANT_CLASS_DOUBLE:
+      json_gvariant_key_to_double (key, &nptr);
+      break;
+
+    case G_VARIANT_CLASS_STRING:
+    case G_VARIANT_CLASS_OBJECT_PATH:
+    case G_VARIANT_CLASS_SIGNATURE:
+      break;
+
+    default:
+      json_gvariant_key_to_int64 (key, &nptr);
+      break;
+    }
+
+  if (errno != 0 || nptr == key)
+    {
+      g_set_error_literal (error,
+                           G_IO_ERROR,
+                           G_IO_ERROR_INVALID_DATA,
+                           _("Invalid string value converting to GVariant"));
+      return FALSE;
+    }
+
+  return TRUE;
+}
+
+static gboolean
+json_validate_tuple (JsonScanner             *scanner,
+                     const JsonGVariantPlan  *plan,
+                     GError                 **error)
+{
+  gboolean first = TRUE;
+  guint n_children = 0;
+
+  while (json_stream_next_element (scanner, JSON_TOKEN_END_ARRAY, first, error))
+    {
+      if (n_children >= plan->n_children)
+        {
+          g_set_error_literal (error,
+                               G_IO_ERROR,
+                               G_IO_ERROR_INVALID_DATA,
+                               _("Unexpected extra elements in JSON array"));
+          return FALSE;
+        }
+
+      if (!json_validate_recurse (scanner, &plan->children[n_children], error))
+        return FALSE;
+
+      n_children++;
+      first = FALSE;
+    }
+
+  if (scanner->token == JSON_TOKEN_ERROR)
+    return FALSE;
+
+  if (n_children < plan->n_children)
+    {
+      g_set_error_literal (error,
+                           G_IO_ERROR,
+                           G_IO_ERROR_INVALID_DATA,
+                           _("Missing elements in JSON array to conform to a tuple"));
+      return FALSE;
+    }
+
+  return TRUE;
+}
+
+static gboolean
+json_validate_array (JsonScanner             *scanner,
+                     const JsonGVariantPlan  *plan,
+                     GError                 **error)
+{
+  const JsonGVariantPlan *element;
+  gboolean first = TRUE;
+
+  if (plan == NULL)
+    plan = json_gvariant_plan_get_default (G_VARIANT_CLASS_ARRAY);
+  element = &plan->children[0];
+
+  while (json_stream_next_element (scanner, JSON_TOKEN_END_ARRAY, first, error))
+    {
+      if (!json_validate_recurse (scanner, element, error))
+        return FALSE;
+
+      first = FALSE;
+    }
+
+  return scanner->token != JSON_TOKEN_ERROR;
+}
+
+static gboolean
+json_validate_dict_entry (JsonScanner             *scanner,
+                          const JsonGVariantPlan  *plan,
+                          GError                 **error)
+{
+  if (!json_stream_next_member (scanner, TRUE, error))
+    {
+      if (scanner->token == JSON_TOKEN_END_OBJECT)
+        g_set_error_literal (error,
+                             G_IO_ERROR,
+                             G_IO_ERROR_INVALID_DATA,
+                             _("A GVariant dictionary entry expects a JSON object with exactly one member"));
+      return FALSE;
+    }
+
+  if (!json_validate_key (scanner->buffer->str, plan->children[0].class, error) ||
+      !json_stream_next_value (scanner, error) ||
+      !json_validate_recurse (scanner, &plan->children[1], error))
+    return FALSE;
+
+  if (json_scanner_next (scanner, error) != JSON_TOKEN_END_OBJECT)
+    {
+      if (scanner->token == JSON_TOKEN_COMMA)
+        g_set_error_literal (error,
+                             G_IO_ERROR,
+                             G_IO_ERROR_INVALID_DATA,
+                             _("A GVariant dictionary entry expects a JSON object with exactly one member"));
+      else
+        json_stream_set_syntax_error (scanner, error);
+      return FALSE;
+    }
+
+  return TRUE;
+}
+
+static gboolean
+json_validate_dictionary (JsonScanner             *scanner,
+                          const JsonGVariantPlan  *plan,
+                          GError                 **error)
+{
+  const JsonGVariantPlan *entry_plan;
+  gboolean first = TRUE;
+
+  if (plan == NULL)
+    plan = json_gvariant_plan_get_default (JSON_G_VARIANT_CLASS_DICTIONARY);
+  entry_plan = &plan->children[0];
+
+  while (json_stream_next_member (scanner, first, error))
+    {
+      if (!json_validate_key (scanner->buffer->str, entry_plan->children[0].class, error) ||
+          !json_stream_next_value (scanner, error) ||
+          !json_validate_recurse (scanner, &entry_plan->children[1], error))
+        return FALSE;
+
+      first = FALSE;
+    }
+
+  return scanner->token != JSON_TOKEN_ERROR;
+}
+
+static gboolean
+json_validate_recurse (JsonScanner             *scanner,
+                       const JsonGVariantPlan  *plan,
+                       GError                 **error)
+{
+  GVariantClass class;
+
+  class = json_stream_get_next_class (scanner, plan);
+
+  if (class == 0)
+    {
+      json_stream_set_unexpected (scanner, error);
+      return FALSE;
+    }
+
+  if (class == JSON_G_VARIANT_CLASS_DICTIONARY)
+    return json_stream_assert_token (scanner, JSON_TOKEN_BEGIN_OBJECT, error) &&
+           json_validate_dictionary (scanner, plan, error);
+
+  switch (class)
+    {
+    case G_VARIANT_CLASS_BOOLEAN:
+      return json_stream_assert_token (scanner, JSON_TOKEN_BOOLEAN, error);
+
+    case G_VARIANT_CLASS_BYTE:
+    case G_VARIANT_CLASS_INT16:
+    case G_VARIANT_CLASS_UINT16:
+    case G_VARIANT_CLASS_INT32:
+    case G_VARIANT_CLASS_UINT32:
+    case G_VARIANT_CLASS_INT64:
+    case G_VARIANT_CLASS_UINT64:
+    case G_VARIANT_CLASS_HANDLE:
+      return json_stream_assert_token (scanner, JSON_TOKEN_INT, error);
+
+    case G_VARIANT_CLASS_DOUBLE:
+      return json_stream_assert_token (scanner, JSON_TOKEN_DOUBLE, error);
+
+    case G_VARIANT_CLASS_STRING:
+      return json_stream_assert_token (scanner, JSON_TOKEN_STRING, error);
+
+    case G_VARIANT_CLASS_OBJECT_PATH:
+    case G_VARIANT_CLASS_SIGNATURE:
+      if (!json_stream_assert_token (scanner, JSON_TOKEN_STRING, error))
+        return FALSE;
+
+      if (class == G_VARIANT_CLASS_OBJECT_PATH ? !g_variant_is_object_path (scanner->buffer->str)
+                                               : !g_variant_is_signature (scanner->buffer->str))
+        {
+          g_set_error_literal (error,
+                               G_IO_ERROR,
+                               G_IO_ERROR_INVALID_DATA,
+                               _("Invalid string value converting to GVariant"));
+          return FALSE;
+        }
+      return TRUE;
+
+    case G_VARIANT_CLASS_VARIANT:
+      return json_validate_recurse (scanner, NULL, error);
+
+    case G_VARIANT_CLASS_MAYBE:
+      if (plan == NULL)
+        plan = json_gvariant_plan_get_default (G_VARIANT_CLASS_MAYBE);
+      return scanner->token == JSON_TOKEN_NULL ||
+             json_validate_recurse (scanner, &plan->children[0], error);
+
+    case G_VARIANT_CLASS_ARRAY:
+      return json_stream_assert_token (scanner, JSON_TOKEN_BEGIN_ARRAY, error) &&
+             json_validate_array (scanner, plan, error);
+
+    case G_VARIANT_CLASS_TUPLE:
+      return json_stream_assert_token (scanner, JSON_TOKEN_BEGIN_ARRAY, error) &&
+             json_validate_tuple (scanner, plan, error);
+
+    case G_VARIANT_CLASS_DICT_ENTRY:
+      return json_stream_assert_token (scanner, JSON_TOKEN_BEGIN_OBJECT, error) &&
+             json_validate_dict_entry (scanner, plan, error);
+
+    default:
+      g_set_error (error,
+                   G_IO_ERROR,
+                   G_IO_ERROR_INVALID_DATA,
+                   _("GVariant class '%c' not supported"), class);
+      return FALSE;
+    }
+}
+
+/* ========================================================================== */
+/* Parallel arrays */
+/* ========================================================================== */
+
+/* With JSON_GVARIANT_FLAGS_PARALLEL, the elements of large arrays are
+ * converted in chunks of consecutive elements spread over the thread pool.
+ * Each thread converts its chunks with a context of its own, except the
+ * calling one, which keeps using the context of the conversion. Whatever
+ * order the chunks complete in, the error reported is the one of the first
+ * failing element, as in a sequential conversion.
+ */
+
+typedef struct
+{
+  JsonGVariantContext     *context;
+  GThread                 *thread;
+  const JsonGVariantPlan  *element;
+  guint                    n_elements;
+  GVariant               **children;
+
+  /* the json-c array, when converting a tree */
+  json_object             *json_node;
+
+  /* the scanner positioned on '[' and the start of each element, when
+   * converting text; the last element ends at 'end'. When the scanner
+   * replays a tape, 'nodes' has the node starting each element instead,
+   * and 'end_node' is the one of the closing bracket. */
+  JsonScanner             *scanner;
+  const gchar            **starts;
+  const gchar             *end;
+  gsize                   *nodes;
+  gsize                    end_node;
+
+  GMutex                   mutex;
+  gint                     error_index;
+  GError                  *error;
+} JsonGVariantParallelArray;
+
+/* Both return the index of the element which failed, or 'last' */
+static guint
+json_to_gvariant_parallel_chunk (JsonGVariantContext        *context,
+                                 JsonGVariantParallelArray  *array,
+                                 guint                       first,
+                                 guint                       last,
+                                 GError                    **error)
+{
+  guint i;
+
+  for (i = first; i < last; i++)
+    {
+      GVariant *variant_child;
+
+      variant_child = json_to_gvariant_convert (context,
+                                                json_object_array_get_idx (array->json_node, i),
+                                                array->element,
+                                                error);
+      if (variant_child == NULL)
+        break;
+
+      array->children[i] = variant_child;
+    }
+
+  return i;
+}
+
+static guint
+json_stream_to_gvariant_parallel_chunk (JsonGVariantContext        *context,
+                                        JsonGVariantParallelArray  *array,
+                                        guint                       first,
+                                        guint                       last,
+                                        GError                    **error)
+{
+  JsonScanner scanner;
+  JsonToken end_token;
+  const gchar *end;
+  guint i;
+
+  if (array->nodes != NULL)
+    {
+      /* replay the tape from the first element of the chunk, up to the
+       * comma or the bracket after the last one */
+      scanner = *array->scanner;
+      scanner.buffer = json_gvariant_arena_get_buffer (context->arena);
+      json_gvariant_arena_count_scanner (context->arena, &scanner);
+      scanner.tape_pos = array->nodes[first];
+      end_token = last < array->n_elements ? JSON_TOKEN_COMMA : JSON_TOKEN_END_ARRAY;
+    }
+  else
+    {
+      /* stop right before the comma separating the chunk from the next one */
+      end = last < array->n_elements ? array->starts[last] - 1 : array->end;
+      json_scanner_init (&scanner,
+                         array->starts[first],
+                         end - array->starts[first],
+                         json_gvariant_arena_get_buffer (context->arena));
+      json_gvariant_arena_count_scanner (context->arena, &scanner);
+      scanner.offset = array->scanner->offset +
+                       (array->starts[first] - array->scanner->data);
+      scanner.depth = array->scanner->depth;
+      scanner.max_depth = array->scanner->max_depth;
+      scanner.max_string_length = array->scanner->max_string_length;
+      end_token = JSON_TOKEN_EOF;
+    }
+
+  for (i = first; i < last; i++)
+    {
+      GVariant *variant_child;
+
+      if (json_scanner_next (&scanner, error) == JSON_TOKEN_ERROR)
+        break;
+
+      variant_child = json_stream_to_gvariant_recurse (context, &scanner, array->element, error);
+      if (variant_child == NULL)
+        break;
+
+      array->children[i] = variant_child;
+
+      if (json_scanner_next (&scanner, error) != (i + 1 < last ? JSON_TOKEN_COMMA : end_token))
+        {
+          json_stream_set_syntax_error (&scanner, error);
+          break;
+        }
+    }
+
+  json_scanner_clear (&scanner);
+
+  return i;
+}
+
+static void
+json_gvariant_parallel_array_job (gpointer data,
+                                  guint    job)
+{
+  JsonGVariantParallelArray *array = data;
+  JsonGVariantContext helper = { NULL, };
+  JsonGVariantContext *context;
+  GError *error = NULL;
+  guint first;
+  guint last;
+  guint failed;
+
+  first = job * JSON_GVARIANT_PARALLEL_CHUNK_SIZE;
+  last = MIN (first + JSON_GVARIANT_PARALLEL_CHUNK_SIZE, array->n_elements);
+
+  /* an element before this chunk already failed */
+  if ((gint) first > g_atomic_int_get (&array->error_index))
+    return;
+
+  if (g_thread_self () == array->thread)
+    {
+      context = array->context;
+    }
+  else
+    {
+      helper.arena = json_gvariant_arena_begin ();
+      helper.compact = array->context->compact;
+      helper.sorted = array->context->sorted;
+      helper.depth = array->context->depth;
+      helper.shapes = array->context->shapes;
+      json_gvariant_intern_begin (&helper,
+                                  array->context->strings != NULL ? JSON_GVARIANT_FLAGS_INTERN : 0,
+                                  !g_variant_type_is_basic (array->element->type));
+      context = &helper;
+    }
+
+  if (array->json_node != NULL)
+    failed = json_to_gvariant_parallel_chunk (context, array, first, last, &error);
+  else
+    failed = json_stream_to_gvariant_parallel_chunk (context, array, first, last, &error);
+
+  if (context == &helper)
+    {
+      json_gvariant_intern_end (&helper);
+      json_gvariant_arena_end (helper.arena);
+    }
+
+  if (failed == last)
+    return;
+
+  g_mutex_lock (&array->mutex);
+  if ((gint) failed < array->error_index)
+    {
+      g_clear_error (&array->error);
+      array->error = error;
+      g_atomic_int_set (&array->error_index, failed);
+    }
+  else
+    {
+      g_error_free (error);
+    }
+  g_mutex_unlock (&array->mutex);
+}
+
+static GVariant *
+json_gvariant_parallel_array_run (JsonGVariantContext        *context,
+                                  JsonGVariantParallelArray  *array,
+                                  GError                    **error)
+{
+  JsonGVariantChildren children;
+  guint n_jobs;
+  guint i;
+
+  json_gvariant_children_init (context, &children, array->n_elements);
+  memset (children.children, 0, array->n_elements * sizeof (GVariant *));
+
+  array->context = context;
+  array->thread = g_thread_self ();
+  array->children = children.children;
+  array->error_index = G_MAXINT;
+  array->error = NULL;
+  g_mutex_init (&array->mutex);
+
+  /* the elements are not split any further */
+  n_jobs = (array->n_elements + JSON_GVARIANT_PARALLEL_CHUNK_SIZE - 1) /
+           JSON_GVARIANT_PARALLEL_CHUNK_SIZE;
+  context->parallel = FALSE;
+  json_gvariant_parallel_for (n_jobs, json_gvariant_parallel_array_job, array);
+  context->parallel = TRUE;
+
+  g_mutex_clear (&array->mutex);
+
+  if (array->error != NULL)
+    {
+      /* the chunks after the failing one may be missing */
+      for (i = 0; i < array->n_elements; i++)
+        if (children.children[i] != NULL)
+          json_gvariant_discard (children.children[i]);
+      json_gvariant_arena_release (context->arena, &children.mark);
+
+      g_propagate_error (error, array->error);
+      return NULL;
+    }
+
+  children.n_children = array->n_elements;
+  return json_gvariant_children_end_array (context, &children, array->element->type);
+}
+
+/* Converts the array 'json_node', nested in 'depth' arrays and objects */
+static GVariant *
+json_to_gvariant_array_parallel (JsonGVariantContext     *context,
+                                 guint                    depth,
+                                 json_object             *json_node,
+                                 const JsonGVariantPlan  *plan,
+                                 GError                 **error)
+{
+  JsonGVariantParallelArray array = { NULL, };
+  guint outer_depth = context->depth;
+  GVariant *variant;
+
+  if (!json_to_gvariant_check_depth (depth + 1, error))
+    return NULL;
+
+  if (plan == NULL)
+    plan = json_gvariant_plan_get_default (G_VARIANT_CLASS_ARRAY);
+
+  array.element = &plan->children[0];
+  array.n_elements = json_object_array_length (json_node);
+  array.json_node = json_node;
+
+  /* the elements are converted from within the array */
+  context->depth = depth + 1;
+  variant = json_gvariant_parallel_array_run (context, &array, error);
+  context->depth = outer_depth;
+
+  return variant;
+}
+
+/* Finds where the elements of the array at the scanner start, skipping
+ * over them without any conversion: each element starts right after the
+ * opening bracket or the comma before it. Returns FALSE if the array is
+ * too small to be worth splitting or is malformed in a way that the
+ * skipping notices: the sequential conversion then handles it and reports
+ * the error.
+ */
+/* Like json_stream_split_array(), over the nodes of the tape replayed by
+ * 'scanner'. The limits were checked while recording it: the array is
+ * not split if the tape has an error before its end. */
+static gboolean
+json_stream_split_tape (JsonGVariantContext        *context,
+                        JsonScanner                *scanner,
+                        JsonGVariantParallelArray  *array)
+{
+  const JsonTapeNode *nodes = scanner->tape->nodes;
+  gsize pos = scanner->tape_pos;
+  gsize *starts = NULL;
+  gsize size = 0;
+  guint n = 0;
+  guint depth = 0;
+
+  while (TRUE)
+    {
+      gsize start = pos;
+
+      /* 'pos' is the node starting a new element */
+      if (n == size)
+        {
+          gsize new_size = MAX (JSON_GVARIANT_PARALLEL_MIN_ELEMENTS, size * 2);
+
+          starts = json_gvariant_arena_grow (context->arena, starts,
+                                             size * sizeof (gsize),
+                                             new_size * sizeof (gsize));
+          size = new_size;
+        }
+      starts[n++] = pos;
+
+      /* the tape always ends with an end or an error token */
+      for (;; pos++)
+        {
+          JsonToken token = nodes[pos].token;
+
+          if (token == JSON_TOKEN_ERROR || token == JSON_TOKEN_EOF)
+            return FALSE;
+
+          if (token == JSON_TOKEN_BEGIN_OBJECT || token == JSON_TOKEN_BEGIN_ARRAY)
+            depth++;
+          else if (token == JSON_TOKEN_END_OBJECT || token == JSON_TOKEN_END_ARRAY)
+            {
+              if (depth == 0)
+                break;
+              depth--;
+            }
+          else if (depth == 0 && token == JSON_TOKEN_COMMA)
+            break;
+        }
+
+      /* an empty element */
+      if (pos == start)
+        return FALSE;
+
+      if (nodes[pos].token != JSON_TOKEN_COMMA)
+        break;
+
+      pos++;
+    }
+
+  if (nodes[pos].token != JSON_TOKEN_END_ARRAY || n < JSON_GVARIANT_PARALLEL_MIN_ELEMENTS)
+    return FALSE;
+
+  array->nodes = starts;
+  array->n_elements = n;
+  array->end_node = pos;
+
+  return TRUE;
+}
+
+static gboolean
+json_stream_split_array (JsonGVariantContext        *context,
+                         JsonScanner                *scanner,
+                         JsonGVariantParallelArray  *array)
+{
+  const gchar *p = scanner->pos;
+  const gchar **starts = NULL;
+  gsize size = 0;
+  guint n = 0;
+  guint depth = 0;
+  gboolean element = FALSE;
+  gboolean non_ascii = FALSE;
+
+  if (scanner->tape != NULL)
+    return json_stream_split_tape (context, scanner, array);
+
+  /* the values have to be counted by a single scanner, in order */
+  if (scanner->max_nodes != G_MAXUINT)
+    return FALSE;
+
+  while (TRUE)
+    {
+      /* 'p' is the start of a new element */
+      if (n == size)
+        {
+          gsize new_size = MAX (JSON_GVARIANT_PARALLEL_MIN_ELEMENTS, size * 2);
+
+          starts = json_gvariant_arena_grow (context->arena, starts,
+                                             size * sizeof (const gchar *),
+                                             new_size * sizeof (const gchar *));
+          size = new_size;
+        }
+      starts[n++] = p;
+      element = FALSE;
+
+      for (; p < scanner->end; p++)
+        {
+          if (g_ascii_isspace (*p))
+            continue;
+
+          if (depth == 0 && (*p == ',' || *p == ']' || *p == '}'))
+            break;
+
+          element = TRUE;
+
+          switch (*p)
+            {
+            case '"':
+              for (p++;
+                   (p = json_scanner_find_special (p, scanner->end, &non_ascii)) < scanner->end && *p != '"';
+                   p++)
+                if (*p == '\\')
+                  p++;
+              if (p >= scanner->end)
+                return FALSE;
+              break;
+
+            case '[':
+            case '{':
+              depth++;
+              break;
+
+            case ']':
+            case '}':
+              depth--;
+              break;
+
+            default:
+              break;
+            }
+        }
+
+      /* an empty element, or the end of the input */
+      if (!element || p >= scanner->end)
+        return FALSE;
+
+      if (*p != ',')
+        break;
+
+      p++;
+    }
+
+  if (*p != ']' || n < JSON_GVARIANT_PARALLEL_MIN_ELEMENTS)
+    return FALSE;
+
+  array->starts = starts;
+  array->n_elements = n;
+  array->end = p;
+
+  return TRUE;
+}
+
+/* Returns FALSE without moving the scanner if the array is not converted
+ * in parallel; otherwise the result is in 'variant' and, on success, the
+ * scanner is left on the closing bracket of the array.
+ */
+static gboolean
+json_stream_to_gvariant_array_parallel (JsonGVariantContext     *context,
+                                        JsonScanner             *scanner,
+                                        const JsonGVariantPlan  *element,
+                                        GVariant               **variant,
+                                        GError                 **error)
+{
+  JsonGVariantParallelArray array = { NULL, };
+  JsonGVariantArenaMark mark;
+
+  json_gvariant_arena_mark (context->arena, &mark);
+
+  if (!json_stream_split_array (context, scanner, &array))
+    {
+      json_gvariant_arena_release (context->arena, &mark);
+      return FALSE;
+    }
+
+  array.element = element;
+  array.scanner = scanner;
+
+  *variant = json_gvariant_parallel_array_run (context, &array, error);
+  json_gvariant_arena_release (context->arena, &mark);
+
+  if (*variant != NULL && array.nodes != NULL)
+    {
+      /* go on replaying the tape after the closing bracket */
+      scanner->tape_pos = array.end_node;
+      json_scanner_next (scanner, NULL);
+    }
+  else if (*variant != NULL)
+    {
+      scanner->pos = array.end + 1;
+      scanner->token = JSON_TOKEN_END_ARRAY;
+      scanner->depth--;
+    }
+  else
+    {
+      scanner->token = JSON_TOKEN_ERROR;
+    }
+
+  return TRUE;
+}
+
+/* ========================================================================== */
+/* JSON text to serialized GVariant data */
+/* ========================================================================== */
+
+/* The functions below follow the json_stream_to_gvariant_*() ones, but
+ * instead of creating a GVariant for every value they write its serialized
+ * form straight into the JsonGVariantWriter of the context: the result is
+ * created at the end from a single buffer, without the intermediate
+ * GVariants and the copies made when assembling them.
+ */
+
+static gboolean json_write_recurse (JsonGVariantContext     *context,
+                                    JsonScanner             *scanner,
+                                    const JsonGVariantPlan  *plan,
+                                    GError                 **error);
+
+/* Returns the plan for the value at the scanner, inferring its type from
+ * the JSON value if 'plan' is NULL. Compact plans are returned in
+ * 'inferred' too, for the caller to free them.
+ */
+static const JsonGVariantPlan *
+json_write_resolve_plan (JsonGVariantContext     *context,
+                         JsonScanner             *scanner,
+                         const JsonGVariantPlan  *plan,
+                         JsonGVariantPlan       **inferred,
+                         GError                 **error)
+{
+  GVariantClass class;
+
+  *inferred = NULL;
+
+  if (plan != NULL)
+    return plan;
+
+  if (context->compact &&
+      (scanner->token == JSON_TOKEN_BEGIN_OBJECT ||
+       scanner->token == JSON_TOKEN_BEGIN_ARRAY))
+    {
+      *inferred = json_gvariant_infer_plan_scanner (context->arena, scanner,
+                                                    context->shapes);
+      if (*inferred != NULL)
+        return *inferred;
+    }
+
+  class = json_stream_get_next_class (scanner, NULL);
+  if (class == 0)
+    {
+      json_stream_set_unexpected (scanner, error);
+      return NULL;
+    }
+
+  return json_gvariant_plan_get_default (class);
+}
+
+/* Writes a dictionary key, converting it like gvariant_simple_from_string(),
+ * or like gvariant_checked_from_string() for object paths and signatures */
+static gboolean
+json_write_key (JsonGVariantContext     *context,
+                const gchar             *key,
+                gsize                    length,
+                const JsonGVariantPlan  *plan,
+                GError                 **error)
+{
+  GVariant *variant;
+
+  json_gvariant_writer_align (context->writer, plan->alignment);
+
+  if (plan->class == G_VARIANT_CLASS_STRING)
+    {
+      json_gvariant_writer_write_string (context->writer, key, length);
+      return TRUE;
+    }
+
+  /* the data is written as trusted, so the keys must be valid as much as
+   * the values */
+  if (plan->class == G_VARIANT_CLASS_OBJECT_PATH ||
+      plan->class == G_VARIANT_CLASS_SIGNATURE)
+    variant = gvariant_checked_from_string (key, plan->class, error);
+  else
+    variant = gvariant_simple_from_string (key, plan->class, error);
+  if (variant == NULL)
+    return FALSE;
+
+  json_gvariant_writer_write (context->writer,
+                              g_variant_get_data (variant),
+                              g_variant_get_size (variant));
+  g_variant_unref (variant);
+
+  return TRUE;
+}
+
+static gboolean
+json_write_tuple (JsonGVariantContext     *context,
+                  JsonScanner             *scanner,
+                  const JsonGVariantPlan  *plan,
+                  GError                 **error)
+{
+  JsonGVariantWriterFrame frame;
+  gboolean first = TRUE;
+  guint i = 0;
+
+  json_gvariant_writer_open (context->writer, &frame);
+
+  while (json_stream_next_element (scanner, JSON_TOKEN_END_ARRAY, first, error))
+    {
+      if (i >= plan->n_children)
+        {
+          g_set_error_literal (error,
+                               G_IO_ERROR,
+                               G_IO_ERROR_INVALID_DATA,
+                               _("Unexpected extra elements in JSON array"));
+          return FALSE;
+        }
+
+      if (G_UNLIKELY (context->profile != NULL))
+        json_gvariant_profile_set_element (context->profile, i);
+
+      if (!json_write_recurse (context, scanner, &plan->children[i], error))
+        return FALSE;
+
+      if (plan->children[i].fixed_size == 0 && i + 1 < plan->n_children)
+        json_gvariant_writer_add_offset (context->writer, &frame);
+
+      i++;
+      first = FALSE;
+    }
+
+  if (scanner->token == JSON_TOKEN_ERROR)
+    return FALSE;
+
+  if (i < plan->n_children)
+    {
+      g_set_error_literal (error,
+                           G_IO_ERROR,
+                           G_IO_ERROR_INVALID_DATA,
+                           _("Missing elements in JSON array to conform to a tuple"));
+      return FALSE;
+    }
+
+  json_gvariant_writer_close_tuple (context->writer, &frame, plan->fixed_size);
+
+  return TRUE;
+}
+
+static gboolean
+json_write_maybe (JsonGVariantContext     *context,
+                  JsonScanner             *scanner,
+                  const JsonGVariantPlan  *plan,
+                  GError                 **error)
+{
+  const JsonGVariantPlan *element = &plan->children[0];
+
+  /* Nothing is serialized as no data at all */
+  if (scanner->token == JSON_TOKEN_NULL)
+    return TRUE;
+
+  if (!json_write_recurse (context, scanner, element, error))
+    return FALSE;
+
+  /* Just of a variable-sized element is followed by a zero byte */
+  if (element->fixed_size == 0)
+    json_gvariant_writer_write (context->writer, "", 1);
+
+  return TRUE;
+}
+
+static gboolean
+json_write_array (JsonGVariantContext     *context,
+                  JsonScanner             *scanner,
+                  const JsonGVariantPlan  *plan,
+                  GError                 **error)
+{
+  const JsonGVariantPlan *element = &plan->children[0];
+  JsonGVariantWriterFrame frame;
+  gboolean first = TRUE;
+
+  json_gvariant_writer_open (context->writer, &frame);
+
+  while (json_stream_next_element (scanner, JSON_TOKEN_END_ARRAY, first, error))
+    {
+      if (G_UNLIKELY (context->profile != NULL))
+        json_gvariant_profile_set_element (context->profile, -1);
+
+      if (!json_write_recurse (context, scanner, element, error))
+        return FALSE;
+
+      if (element->fixed_size == 0)
+        json_gvariant_writer_add_offset (context->writer, &frame);
+
+      first = FALSE;
+    }
+
+  if (scanner->token == JSON_TOKEN_ERROR)
+    return FALSE;
+
+  json_gvariant_writer_close_array (context->writer, &frame);
+
+  return TRUE;
+}
+
+/* Writes the member at the scanner as a dictionary entry, leaving the
+ * scanner on the last token of its value */
+static gboolean
+json_write_member (JsonGVariantContext     *context,
+                   JsonScanner             *scanner,
+                   const JsonGVariantPlan  *plan,
+                   GError                 **error)
+{
+  JsonGVariantWriterFrame frame;
+
+  json_gvariant_writer_align (context->writer, plan->alignment);
+  json_gvariant_writer_open (context->writer, &frame);
+
+  if (!json_write_key (context,
+                       scanner->buffer->str,
+                       scanner->buffer->len,
+                       &plan->children[0],
+                       error))
+    return FALSE;
+
+  if (plan->children[0].fixed_size == 0)
+    json_gvariant_writer_add_offset (context->writer, &frame);
+
+  if (G_UNLIKELY (context->profile != NULL))
+    json_gvariant_profile_set_member (context->profile,
+                                      scanner->buffer->str,
+                                      scanner->buffer->len);
+
+  if (!json_stream_next_value (scanner, error))
+    return FALSE;
+
+  if (!json_write_recurse (context, scanner, &plan->children[1], error))
+    return FALSE;
+
+  json_gvariant_writer_close_tuple (context->writer, &frame, plan->fixed_size);
+
+  return TRUE;
+}
+
+static gboolean
+json_write_dict_entry (JsonGVariantContext     *context,
+                       JsonScanner             *scanner,
+                       const JsonGVariantPlan  *plan,
+                       GError                 **error)
+{
+  if (!json_stream_next_member (scanner, TRUE, error))
+    {
+      if (scanner->token == JSON_TOKEN_END_OBJECT)
+        g_set_error_literal (error,
+                             G_IO_ERROR,
+                             G_IO_ERROR_INVALID_DATA,
+                             _("A GVariant dictionary entry expects a JSON object with exactly one member"));
+      return FALSE;
+    }
+
+  if (!json_write_member (context, scanner, plan, error))
+    return FALSE;
+
+  if (json_scanner_next (scanner, error) != JSON_TOKEN_END_OBJECT)
+    {
+      if (scanner->token == JSON_TOKEN_COMMA)
+        g_set_error_literal (error,
+                             G_IO_ERROR,
+                             G_IO_ERROR_INVALID_DATA,
+                             _("A GVariant dictionary entry expects a JSON object with exactly one member"));
+      else
+        json_stream_set_syntax_error (scanner, error);
+
+      return FALSE;
+    }
+
+  return TRUE;
+}
+
+static gboolean
+json_write_dictionary (JsonGVariantContext     *context,
+                       JsonScanner             *scanner,
+                       const JsonGVariantPlan  *plan,
+                       GError                 **error)
+{
+  const JsonGVariantPlan *entry_plan = &plan->children[0];
+  JsonGVariantWriterFrame frame;
+  gboolean first = TRUE;
+
+  json_gvariant_writer_open (context->writer, &frame);
+
+  while (json_stream_next_member (scanner, first, error))
+    {
+      if (!json_write_member (context, scanner, entry_plan, error))
+        return FALSE;
+
+      if (entry_plan->fixed_size == 0)
+        json_gvariant_writer_add_offset (context->writer, &frame);
+
+      first = FALSE;
+    }
+
+  if (scanner->token == JSON_TOKEN_ERROR)
+    return FALSE;
+
+  if (context->sorted)
+    json_gvariant_writer_sort_entries (context->writer, &frame, entry_plan);
+
+  json_gvariant_writer_close_array (context->writer, &frame);
+
+  return TRUE;
+}
+
+static gboolean
+json_write_variant (JsonGVariantContext     *context,
+                    JsonScanner             *scanner,
+                    GError                 **error)
+{
+  const JsonGVariantPlan *plan;
+  JsonGVariantPlan *inferred;
+  gboolean result = FALSE;
+
+  plan = json_write_resolve_plan (context, scanner, NULL, &inferred, error);
+  if (plan == NULL)
+    return FALSE;
+
+  if (json_write_recurse (context, scanner, plan, error))
+    {
+      /* the value is followed by a zero byte and its type string */
+      json_gvariant_writer_write (context->writer, "", 1);
+      json_gvariant_writer_write (context->writer,
+                                  g_variant_type_peek_string (plan->type),
+                                  g_variant_type_get_string_length (plan->type));
+      result = TRUE;
+    }
+
+  g_free (inferred);
+
+  return result;
+}
+
+static gboolean
+json_write_node (JsonGVariantContext     *context,
+                 JsonScanner             *scanner,
+                 const JsonGVariantPlan  *plan,
+                 GError                 **error)
+{
+  JsonGVariantWriter *writer = context->writer;
+  gboolean result = FALSE;
+
+  json_gvariant_writer_align (writer, plan->alignment);
+
+  if (plan->class == JSON_G_VARIANT_CLASS_DICTIONARY)
+    {
+      if (json_stream_assert_token (scanner, JSON_TOKEN_BEGIN_OBJECT, error))
+        result = json_write_dictionary (context, scanner, plan, error);
+
+      return result;
+    }
+
+  switch ((GVariantClass) plan->class)
+    {
+    case G_VARIANT_CLASS_BOOLEAN:
+      if (json_stream_assert_token (scanner, JSON_TOKEN_BOOLEAN, error))
+        {
+          guint8 value = scanner->boolean_value;
+
+          json_gvariant_writer_write (writer, &value, sizeof value);
+          result = TRUE;
+        }
+      break;
+
+    case G_VARIANT_CLASS_BYTE:
+      if (json_stream_assert_token (scanner, JSON_TOKEN_INT, error))
+        {
+          guint8 value = json_stream_get_int (scanner);
+
+          json_gvariant_writer_write (writer, &value, sizeof value);
+          result = TRUE;
+        }
+      break;
+
+    case G_VARIANT_CLASS_INT16:
+    case G_VARIANT_CLASS_UINT16:
+      if (json_stream_assert_token (scanner, JSON_TOKEN_INT, error))
+        {
+          guint16 value = json_stream_get_int (scanner);
+
+          json_gvariant_writer_write (writer, &value, sizeof value);
+          result = TRUE;
+        }
+      break;
+
+    case G_VARIANT_CLASS_INT32:
+    case G_VARIANT_CLASS_UINT32:
+    case G_VARIANT_CLASS_HANDLE:
+      if (json_stream_assert_token (scanner, JSON_TOKEN_INT, error))
+        {
+          guint32 value = json_stream_get_int (scanner);
+
+          json_gvariant_writer_write (writer, &value, sizeof value);
+          result = TRUE;
+        }
+      break;
+
+    case G_VARIANT_CLASS_INT64:
+      if (json_stream_assert_token (scanner, JSON_TOKEN_INT, error))
+        {
+          gint64 value = json_stream_get_int (scanner);
+
+          json_gvariant_writer_write (writer, &value, sizeof value);
+          result = TRUE;
+        }
+      break;
+
+    case G_VARIANT_CLASS_UINT64:
+      if (json_stream_assert_token (scanner, JSON_TOKEN_INT, error))
+        {
+          guint64 value = json_stream_get_uint64 (scanner);
+
+          json_gvariant_writer_write (writer, &value, sizeof value);
+          result = TRUE;
+        }
+      break;
+
+    case G_VARIANT_CLASS_DOUBLE:
+      if (json_stream_assert_token (scanner, JSON_TOKEN_DOUBLE, error))
+        {
+          gdouble value = json_stream_get_double (scanner);
+
+          json_gvariant_writer_write (writer, &value, sizeof value);
+          result = TRUE;
+        }
+      break;
+
+    case G_VARIANT_CLASS_STRING:
+      if (json_stream_assert_token (scanner, JSON_TOKEN_STRING, error))
+        {
+          json_gvariant_writer_write_string (writer,
+                                             scanner->buffer->str,
+                                             scanner->buffer->len);
+          result = TRUE;
+        }
+      break;
+
+    case G_VARIANT_CLASS_OBJECT_PATH:
+    case G_VARIANT_CLASS_SIGNATURE:
+      if (json_stream_assert_token (scanner, JSON_TOKEN_STRING, error))
+        {
+          if ((plan->class == G_VARIANT_CLASS_OBJECT_PATH &&
+               g_variant_is_object_path (scanner->buffer->str)) ||
+              (plan->class == G_VARIANT_CLASS_SIGNATURE &&
+               g_variant_is_signature (scanner->buffer->str)))
+            {
+              json_gvariant_writer_write_string (writer,
+                                                 scanner->buffer->str,
+                                                 scanner->buffer->len);
+              result = TRUE;
+            }
+          else
+            {
+              g_set_error_literal (error,
+                                   G_IO_ERROR,
+                                   G_IO_ERROR_INVALID_DATA,
+                                   _("Invalid string value converting to GVariant"));
+            }
+        }
+      break;
+
+    case G_VARIANT_CLASS_VARIANT:
+      result = json_write_variant (context, scanner, error);
+      break;
+
+    case G_VARIANT_CLASS_MAYBE:
+      result = json_write_maybe (context, scanner, plan, error);
+      break;
+
+    case G_VARIANT_CLASS_ARRAY:
+      if (json_stream_assert_token (scanner, JSON_TOKEN_BEGIN_ARRAY, error))
+        result = json_write_array (context, scanner, plan, error);
+      break;
+
+    case G_VARIANT_CLASS_TUPLE:
+      if (json_stream_assert_token (scanner, JSON_TOKEN_BEGIN_ARRAY, error))
+        result = json_write_tuple (context, scanner, plan, error);
+      break;
+
+    case G_VARIANT_CLASS_DICT_ENTRY:
+      if (json_stream_assert_token (scanner, JSON_TOKEN_BEGIN_OBJECT, error))
+        result = json_write_dict_entry (context, scanner, plan, error);
+      break;
+
+    default:
+      g_set_error (error,
+                   G_IO_ERROR,
+                   G_IO_ERROR_INVALID_DATA,
+                   _("GVariant class '%c' not supported"), plan->class);
+      break;
+    }
+
+  return result;
+}
+
+/* Writes the value at the scanner, measuring it if it is profiled */
+static gboolean
+json_write_recurse (JsonGVariantContext     *context,
+                    JsonScanner             *scanner,
+                    const JsonGVariantPlan  *plan,
+                    GError                 **error)
+{
+  JsonGVariantProfileProbe probe;
+  gboolean profiled;
+  gboolean result;
+
+  if (G_LIKELY (context->profile == NULL))
+    return json_write_node (context, scanner, plan, error);
+
+  profiled = json_gvariant_profile_enter (context->profile, scanner, &probe);
+
+  result = json_write_node (context, scanner, plan, error);
+
+  if (profiled)
+    json_gvariant_profile_leave (context->profile, scanner, &probe);
+
+  return result;
+}
+
+/* Converts the value at the scanner with json_write_recurse() */
+static GVariant *
+json_write_value (JsonGVariantContext     *context,
+                  JsonScanner             *scanner,
+                  gsize                    size_hint,
+                  const JsonGVariantPlan  *plan,
+                  GError                 **error)
+{
+  JsonGVariantWriter writer;
+  JsonGVariantPlan *inferred;
+  GVariant *variant = NULL;
+
+  plan = json_write_resolve_plan (context, scanner, plan, &inferred, error);
+  if (plan == NULL)
+    return NULL;
+
+  json_gvariant_writer_init (&writer, context->arena, size_hint);
+  context->writer = &writer;
+
+  if (context->generated != NULL ?
+      context->generated->write (context, scanner, error) :
+      json_write_recurse (context, scanner, plan, error))
+    variant = json_gvariant_writer_finish (&writer, plan->type);
+
+  json_gvariant_writer_clear (&writer);
+  context->writer = NULL;
+  g_free (inferred);
+
+  return variant;
+}
+
+/* Converts the JSON text in the first 'length' bytes of 'json', or up to
+ * its terminating NUL if 'length' is negative. The text is only borrowed
+ * for the duration of the call and read in place: with an explicit length
+ * it needs not be NUL-terminated, and nothing past 'length' is read.
+ */
+GVariant *
+json_gvariant_deserialize_data (const gchar  *json,
+                                gssize        length,
+                                const gchar  *signature,
+                                GError      **error)
+{
+  return json_gvariant_deserialize_data_full (json,
+                                              length,
+                                              signature,
+                                              JSON_GVARIANT_FLAGS_NONE,
+                                              error);
+}
+
+/* Converts the single JSON value making up the input of 'scanner' */
+static GVariant *
+json_gvariant_deserialize_scanner (JsonGVariantContext     *context,
+                                   JsonScanner             *scanner,
+                                   const JsonGVariantPlan  *plan,
+                                   JsonGVariantFlags        flags,
+                                   gsize                    size_hint,
+                                   GError                 **error)
+{
+  GVariant *variant;
+
+  if (json_scanner_next (scanner, error) == JSON_TOKEN_ERROR)
+    return NULL;
+
+  /* the compact types of values nested in variants are inferred again at
+   * each level: look ahead at the tape once, before any temporary is
+   * allocated, and keep the shapes of all its arrays and objects instead */
+  if (context->compact && scanner->tape != NULL &&
+      (scanner->token == JSON_TOKEN_BEGIN_OBJECT ||
+       scanner->token == JSON_TOKEN_BEGIN_ARRAY) &&
+      (plan == NULL ||
+       memchr (g_variant_type_peek_string (plan->type),
+               G_VARIANT_CLASS_VARIANT,
+               g_variant_type_get_string_length (plan->type)) != NULL))
+    context->shapes = json_gvariant_infer_shapes (context->arena, scanner);
+
+  /* the paths of the elements of split arrays would get mixed up, and the
+   * generated converters do not keep track of them */
+  context->profile = json_gvariant_profile_begin (context->arena);
+  if (context->profile != NULL)
+    {
+      context->parallel = FALSE;
+      context->generated = NULL;
+    }
+
+  if (flags & JSON_GVARIANT_FLAGS_SERIALIZED)
+    {
+      variant = json_write_value (context, scanner, size_hint, plan, error);
+    }
+  else
+    {
+      json_gvariant_intern_begin (context, flags,
+                                  scanner->token == JSON_TOKEN_BEGIN_OBJECT ||
+                                  scanner->token == JSON_TOKEN_BEGIN_ARRAY);
+      if (plan != NULL)
+        variant = json_stream_to_gvariant_recurse (context, scanner, plan, error);
+      else
+        variant = json_stream_to_gvariant_value (context, scanner, error);
+      json_gvariant_intern_end (context);
+    }
+
+  json_gvariant_profile_end (context->profile);
+  context->profile = NULL;
+
+  if (variant != NULL && json_scanner_next (scanner, error) != JSON_TOKEN_EOF)
+    {
+      json_stream_set_syntax_error (scanner, error);
+      g_variant_unref (g_variant_ref_sink (variant));
+      variant = NULL;
+    }
+
+  return variant;
+}
+
+GVariant *
+json_gvariant_deserialize_data_full (const gchar        *json,
+                                     gssize              length,
+                                     const gchar        *signature,
+                                     JsonGVariantFlags   flags,
+                                     GError            **error)
+{
+  return json_gvariant_deserialize_limited (json, length, signature, flags,
+                                            NULL, error);
+}
+
+GQuark
+json_gvariant_error_quark (void)
+{
+  return g_quark_from_static_string ("json-gvariant-error-quark");
+}
+
+/* Applies 'limits', if any, and the global depth limit to 'scanner'. The
+ * converters of JSON text recurse, so they never go deeper than
+ * JSON_SCANNER_MAX_DEPTH, even when the global limit is higher. */
+static void
+json_gvariant_scanner_set_limits (JsonScanner               *scanner,
+                                  const JsonGVariantLimits  *limits)
+{
+  scanner->max_depth = MIN (json_gvariant_get_max_depth (), JSON_SCANNER_MAX_DEPTH);
+
+  if (limits == NULL)
+    return;
+
+  if (limits->max_depth > 0)
+    scanner->max_depth = MIN (scanner->max_depth, limits->max_depth);
+  if (limits->max_nodes > 0)
+    scanner->max_nodes = limits->max_nodes;
+  if (limits->max_string_length > 0)
+    scanner->max_string_length = limits->max_string_length;
+}
+
+/* Sets '*length' to the size of the text, looking no further than the
+ * limit for its terminating NUL, and fails if it is over the limit */
+static gboolean
+json_gvariant_check_size (const gchar               *json,
+                          gssize                    *length,
+                          const JsonGVariantLimits  *limits,
+                          GError                   **error)
+{
+  gsize max_bytes = limits != NULL && limits->max_bytes > 0 ? limits->max_bytes : G_MAXSSIZE;
+
+  if (*length < 0 && max_bytes == G_MAXSSIZE)
+    {
+      *length = strlen (json);
+    }
+  else if (*length < 0)
+    {
+      const gchar *nul = memchr (json, '\0', max_bytes + 1);
+
+      *length = nul != NULL ? nul - json : (gssize) max_bytes + 1;
+    }
+
+  if (G_UNLIKELY ((gsize) *length > max_bytes))
+    {
+      g_set_error (error,
+                   JSON_GVARIANT_ERROR,
+                   JSON_GVARIANT_ERROR_TOO_LARGE,
+                   _("JSON data is larger than %" G_GSIZE_FORMAT " bytes"),
+                   max_bytes);
+      return FALSE;
+    }
+
+  return TRUE;
+}
+
+/* Converts the JSON text with 'plan', or with 'generated' if not NULL, or
+ * inferring its types if both are NULL */
+static GVariant *
+json_gvariant_deserialize_text (const gchar                  *json,
+                                gssize                        length,
+                                const JsonGVariantPlan       *plan,
+                                const JsonGVariantGenerated  *generated,
+                                JsonGVariantFlags             flags,
+                                const JsonGVariantLimits     *limits,
+                                GError                      **error)
+{
+  JsonGVariantContext context = { NULL, };
+  GVariant *variant;
+  JsonScanner scanner;
+
+  if (!json_gvariant_check_size (json, &length, limits, error))
+    return NULL;
+
+  context.arena = json_gvariant_arena_begin ();
+  context.generated = generated;
+  context.compact = (flags & JSON_GVARIANT_FLAGS_COMPACT) != 0;
+  context.sorted = (flags & JSON_GVARIANT_FLAGS_SORTED) != 0;
+  context.parallel = (flags & JSON_GVARIANT_FLAGS_PARALLEL) != 0 &&
+                     json_gvariant_parallel_get_n_threads () > 1;
+  json_scanner_init (&scanner,
+                     json,
+                     length,
+                     json_gvariant_arena_get_buffer (context.arena));
+  json_gvariant_arena_count_scanner (context.arena, &scanner);
+  json_gvariant_scanner_set_limits (&scanner, limits);
+
+  /* compact types are inferred by looking ahead at the arrays and objects
+   * before converting them: scan the text only once and replay it from a
+   * tape instead, which also keeps their shapes apart by node. Arrays
+   * split over threads are replayed by each thread from the same tape. */
+  if (context.compact)
+    {
+      JsonTape *tape = json_gvariant_arena_get_tape (context.arena);
+
+      json_tape_record (tape, &scanner);
+      json_scanner_clear (&scanner);
+      json_scanner_init_tape (&scanner,
+                              tape,
+                              json,
+                              json_gvariant_arena_get_buffer (context.arena));
+      json_gvariant_arena_count_scanner (context.arena, &scanner);
+    }
+
+  variant = json_gvariant_deserialize_scanner (&context, &scanner, plan,
+                                               flags, length, error);
+
+  json_scanner_clear (&scanner);
+  json_gvariant_arena_end (context.arena);
+
+  return variant;
+}
+
+/* As json_gvariant_deserialize_data_full(), failing with a
+ * JSON_GVARIANT_ERROR as soon as the text goes past one of 'limits'. With
+ * a limit on the number of nodes, arrays are not split over threads by
+ * JSON_GVARIANT_FLAGS_PARALLEL.
+ */
+GVariant *
+json_gvariant_deserialize_limited (const gchar               *json,
+                                   gssize                     length,
+                                   const gchar               *signature,
+                                   JsonGVariantFlags          flags,
+                                   const JsonGVariantLimits  *limits,
+                                   GError                   **error)
+{
+  const JsonGVariantPlan *plan = NULL;
+
+  g_return_val_if_fail (json != NULL, NULL);
+
+  if (signature != NULL && (plan = json_gvariant_plan_get (signature, error)) == NULL)
+    return NULL;
+
+  return json_gvariant_deserialize_text (json, length, plan, NULL, flags,
+                                         limits, error);
+}
+
+/* As json_gvariant_deserialize_limited() with JSON_GVARIANT_FLAGS_SERIALIZED,
+ * but writing the value with 'generated'. The generic code is used instead
+ * for JSON_GVARIANT_FLAGS_COMPACT and while profiling, as the generated
+ * converters only infer the default types and do not keep track of the
+ * paths of the values.
+ */
+GVariant *
+json_gvariant_deserialize_generated (const gchar                  *json,
+                                     gssize                        length,
+                                     const JsonGVariantGenerated  *generated,
+                                     JsonGVariantFlags             flags,
+                                     const JsonGVariantLimits     *limits,
+                                     GError                      **error)
+{
+  const JsonGVariantPlan *plan;
+
+  g_return_val_if_fail (json != NULL, NULL);
+  g_return_val_if_fail (generated != NULL, NULL);
+
+  plan = json_gvariant_plan_get (generated->signature, error);
+  if (plan == NULL)
+    return NULL;
+
+  if (flags & JSON_GVARIANT_FLAGS_COMPACT)
+    generated = NULL;
+
+  return json_gvariant_deserialize_text (json, length, plan, generated,
+                                         flags | JSON_GVARIANT_FLAGS_SERIALIZED,
+                                         limits, error);
+}
+
+/* Checks that the JSON text in the first 'length' bytes of 'json', or up
+ * to its terminating NUL if 'length' is negative, converts to 'signature',
+ * or to the types inferred when no signature is given, without converting
+ * it: the text is scanned once and nothing is allocated.
+ *
+ * 'limits', if not NULL, bounds the text accepted as for
+ * json_gvariant_deserialize_limited(). On failure 'error_offset', if not
+ * NULL, is set to the offset of the token at which the text stops
+ * conforming, or to 0 if the whole text is too large.
+ */
+gboolean
+json_gvariant_validate (const gchar               *json,
+                        gssize                     length,
+                        const gchar               *signature,
+                        const JsonGVariantLimits  *limits,
+                        gsize                     *error_offset,
+                        GError                   **error)
+{
+  const JsonGVariantPlan *plan = NULL;
+  JsonGVariantArena *arena;
+  JsonScanner scanner;
+  gboolean valid;
+
+  g_return_val_if_fail (json != NULL, FALSE);
+
+  if (signature != NULL && (plan = json_gvariant_plan_get (signature, error)) == NULL)
+    {
+      if (error_offset != NULL)
+        *error_offset = 0;
+      return FALSE;
+    }
+
+  if (!json_gvariant_check_size (json, &length, limits, error))
+    {
+      if (error_offset != NULL)
+        *error_offset = 0;
+      return FALSE;
+    }
+
+  /* only the buffer for the strings is used */
+  arena = json_gvariant_arena_begin ();
+  json_scanner_init (&scanner, json, length, json_gvariant_arena_get_buffer (arena));
+  json_gvariant_arena_count_scanner (arena, &scanner);
+  json_gvariant_scanner_set_limits (&scanner, limits);
+
+  valid = json_scanner_next (&scanner, error) != JSON_TOKEN_ERROR &&
+          json_validate_recurse (&scanner, plan, error);
+
+  if (valid && json_scanner_next (&scanner, error) != JSON_TOKEN_EOF)
+    {
+      json_stream_set_syntax_error (&scanner, error);
+      valid = FALSE;
+    }
+
+  if (!valid && error_offset != NULL)
+    *error_offset = json_scanner_get_token_offset (&scanner);
+
+  json_scanner_clear (&scanner);
+  json_gvariant_arena_end (arena);
+
+  return valid;
+}
+
+/* Converts the value at the scanner for 'member' */
+static gboolean
+json_gvariant_extract_value (JsonGVariantContext  *context,
+                             JsonScanner          *scanner,
+                             JsonGVariantMember   *member,
+                             GError              **error)
+{
+  const JsonGVariantPlan *plan = NULL;
+  GVariant *variant;
+
+  if (member->signature != NULL &&
+      (plan = json_gvariant_plan_get (member->signature, error)) == NULL)
+    return FALSE;
+
+  if (plan != NULL)
+    variant = json_stream_to_gvariant_recurse (context, scanner, plan, error);
+  else
+    variant = json_stream_to_gvariant_value (context, scanner, error);
+  if (variant == NULL)
+    return FALSE;
+
+  member->value = g_variant_ref_sink (variant);
+  return TRUE;
+}
+
+/* Finds the 'n_members' members of the JSON object making up the text in
+ * the first 'length' bytes of 'json', or up to its terminating NUL if
+ * 'length' is negative, and converts their values only, setting the
+ * 'value' of each of 'members' to a new reference to it, or to NULL if the
+ * object has no such member. Of the members with the same key, the last
+ * one is used, as with JSON_GVARIANT_FLAGS_SORTED.
+ *
+ * The other members are skipped without being converted, looking only at
+ * the brackets and strings of their arrays and objects: getting a few
+ * members of a large object costs about as much as scanning it, and the
+ * values skipped, including those of the members replaced, are not
+ * validated. 'limits' bounds what is scanned as
+ * for json_gvariant_deserialize_limited(). On failure no value is set.
+ */
+gboolean
+json_gvariant_extract_members (const gchar               *json,
+                               gssize                     length,
+                               JsonGVariantMember        *members,
+                               guint                      n_members,
+                               const JsonGVariantLimits  *limits,
+                               GError                   **error)
+{
+  JsonGVariantContext context = { NULL, };
+  JsonScanner scanner, *found;
+  gboolean first = TRUE;
+  gboolean result = TRUE;
+  guint i;
+
+  g_return_val_if_fail (json != NULL, FALSE);
+  g_return_val_if_fail (members != NULL || n_members == 0, FALSE);
+
+  for (i = 0; i < n_members; i++)
+    members[i].value = NULL;
+
+  if (!json_gvariant_check_size (json, &length, limits, error))
+    return FALSE;
+
+  /* the scanner as it was at the key of the last member found for each of
+   * 'members', or zeroed if none was found */
+  found = g_new0 (JsonScanner, n_members);
+
+  context.arena = json_gvariant_arena_begin ();
+  json_scanner_init (&scanner,
+                     json,
+                     length,
+                     json_gvariant_arena_get_buffer (context.arena));
+  json_gvariant_arena_count_scanner (context.arena, &scanner);
+  json_gvariant_scanner_set_limits (&scanner, limits);
+
+  result = json_scanner_next (&scanner, error) != JSON_TOKEN_ERROR &&
+           json_stream_assert_token (&scanner, JSON_TOKEN_BEGIN_OBJECT, error);
+
+  /* the whole object is gone through first, as a later member with the
+   * same key replaces the one found so far: the members replaced are not
+   * converted, so that they cannot fail the extraction */
+  while (result && json_stream_next_member (&scanner, first, error))
+    {
+      for (i = 0; i < n_members; i++)
+        if (strlen (members[i].key) == scanner.buffer->len &&
+            memcmp (members[i].key, scanner.buffer->str, scanner.buffer->len) == 0)
+          {
+            found[i] = scanner;
+            break;
+          }
+
+      first = FALSE;
+      result = json_stream_next_value (&scanner, error) &&
+               json_scanner_skip (&scanner, error);
+    }
+
+  /* the loop above stops only at the end of the object or on errors */
+  if (scanner.token == JSON_TOKEN_ERROR)
+    result = FALSE;
+  else if (result && json_scanner_next (&scanner, error) != JSON_TOKEN_EOF)
+    {
+      json_stream_set_syntax_error (&scanner, error);
+      result = FALSE;
+    }
+
+  /* then the scan is taken up again at each of the members found: the
+   * copies share the buffer of 'scanner', which only held their key */
+  for (i = 0; i < n_members && result; i++)
+    if (found[i].data != NULL)
+      result = json_stream_next_value (&found[i], error) &&
+               json_gvariant_extract_value (&context, &found[i], &members[i], error);
+
+  g_free (found);
+  json_scanner_clear (&scanner);
+  json_gvariant_arena_end (context.arena);
+
+  if (!result)
+    for (i = 0; i < n_members; i++)
+      g_clear_pointer (&members[i].value, g_variant_unref);
+
+  return result;
+}
+
+typedef struct
+{
+  const JsonGVariantDocument  *documents;
+  JsonGVariantFlags            flags;
+  GVariant                   **results;
+  GError                     **errors;
+  gint                         n_failed;
+} JsonGVariantBatch;
+
+static void
+json_gvariant_batch_job (gpointer data,
+                         guint    job)
+{
+  JsonGVariantBatch *batch = data;
+  const JsonGVariantDocument *document = &batch->documents[job];
+  GVariant *variant;
+
+  variant = json_gvariant_deserialize_data_full (document->json,
+                                                 document->length,
+                                                 document->signature,
+                                                 batch->flags,
+                                                 batch->errors != NULL ? &batch->errors[job] : NULL);
+  if (variant != NULL)
+    g_variant_ref_sink (variant);
+  else
+    g_atomic_int_inc (&batch->n_failed);
+
+  batch->results[job] = variant;
+}
+
+/* Converts the 'n_documents' JSON texts of 'documents' concurrently, each
+ * one on a thread of the pool used by JSON_GVARIANT_FLAGS_PARALLEL: the
+ * threads pick the next document as soon as they are done with the
+ * previous one, reusing their scanner and arena for all of them.
+ *
+ * 'results[i]' gets a full reference to the value of 'documents[i]', or
+ * NULL if it failed, in which case 'errors[i]' is set if 'errors' is not
+ * NULL. Returns TRUE if all the documents were converted.
+ */
+gboolean
+json_gvariant_deserialize_batch (const JsonGVariantDocument  *documents,
+                                 guint                        n_documents,
+                                 JsonGVariantFlags            flags,
+                                 GVariant                   **results,
+                                 GError                     **errors)
+{
+  JsonGVariantBatch batch;
+
+  g_return_val_if_fail (documents != NULL || n_documents == 0, FALSE);
+  g_return_val_if_fail (results != NULL || n_documents == 0, FALSE);
+
+  batch.documents = documents;
+  /* the documents are the unit of work, their arrays are not split */
+  batch.flags = flags & ~JSON_GVARIANT_FLAGS_PARALLEL;
+  batch.results = results;
+  batch.errors = errors;
+  batch.n_failed = 0;
+
+  json_gvariant_parallel_for (n_documents, json_gvariant_batch_job, &batch);
+
+  return batch.n_failed == 0;
+}
+
+/* Converts the JSON text read from 'stream', which is consumed up to its
+ * end. The input is read and converted one chunk at a time, so that it
+ * never needs to be held in memory as a whole.
+ */
+GVariant *
+json_gvariant_deserialize_stream (GInputStream       *stream,
+                                  const gchar        *signature,
+                                  JsonGVariantFlags   flags,
+                                  GCancellable       *cancellable,
+                                  GError            **error)
+{
+  const JsonGVariantPlan *plan = NULL;
+  JsonGVariantContext context = { NULL, };
+  GVariant *variant;
+  JsonScanner scanner;
+
+  g_return_val_if_fail (G_IS_INPUT_STREAM (stream), NULL);
+
+  if (signature != NULL && (plan = json_gvariant_plan_get (signature, error)) == NULL)
+    return NULL;
+
+  context.arena = json_gvariant_arena_begin ();
+  context.sorted = (flags & JSON_GVARIANT_FLAGS_SORTED) != 0;
+  json_scanner_init_stream (&scanner,
+                            stream,
+                            JSON_GVARIANT_STREAM_CHUNK_SIZE,
+                            cancellable,
+                            json_gvariant_arena_get_buffer (context.arena));
+  json_gvariant_arena_count_scanner (context.arena, &scanner);
+  json_gvariant_scanner_set_limits (&scanner, NULL);
+
+  variant = json_gvariant_deserialize_scanner (&context, &scanner, plan, flags,
+                                               JSON_GVARIANT_STREAM_CHUNK_SIZE,
+                                               error);
+
+  json_scanner_clear (&scanner);
+  json_gvariant_arena_end (context.arena);
+
+  return variant;
+}
+
+typedef struct
+{
+  gchar             *signature;
+  JsonGVariantFlags  flags;
+} JsonGVariantStreamData;
+
+static void
+json_gvariant_stream_data_free (gpointer data)
+{
+  JsonGVariantStreamData *stream_data = data;
+
+  g_free (stream_data->signature);
+  g_free (stream_data);
+}
+
+static void
+json_gvariant_deserialize_stream_thread (GTask        *task,
+                                         gpointer      source_object,
+                                         gpointer      task_data,
+                                         GCancellable *cancellable)
+{
+  JsonGVariantStreamData *stream_data = task_data;
+  GError *error = NULL;
+  GVariant *variant;
+
+  variant = json_gvariant_deserialize_stream (G_INPUT_STREAM (source_object),
+                                              stream_data->signature,
+                                              stream_data->flags,
+                                              cancellable,
+                                              &error);
+  if (variant == NULL)
+    {
+      g_task_return_error (task, error);
+      return;
+    }
+
+  g_task_return_pointer (task,
+                         g_variant_ref_sink (variant),
+                         (GDestroyNotify) g_variant_unref);
+}
+
+/* Asynchronous version of json_gvariant_deserialize_stream(): the stream is
+ * read and converted in a worker thread, and 'callback' is invoked in the
+ * thread-default main context of the caller once done.
+ */
+void
+json_gvariant_deserialize_stream_async (GInputStream        *stream,
+                                        const gchar         *signature,
+                                        JsonGVariantFlags    flags,
+                                        GCancellable        *cancellable,
+                                        GAsyncReadyCallback  callback,
+                                        gpointer             user_data)
+{
+  JsonGVariantStreamData *stream_data;
+  GTask *task;
+
+  g_return_if_fail (G_IS_INPUT_STREAM (stream));
+
+  stream_data = g_new (JsonGVariantStreamData, 1);
+  stream_data->signature = g_strdup (signature);
+  stream_data->flags = flags;
+
+  task = g_task_new (stream, cancellable, callback, user_data);
+  g_task_set_source_tag (task, json_gvariant_deserialize_stream_async);
+  g_task_set_task_data (task, stream_data, json_gvariant_stream_data_free);
+  g_task_run_in_thread (task, json_gvariant_deserialize_stream_thread);
+  g_object_unref (task);
+}
+
+/* Returns the result of json_gvariant_deserialize_stream_async(), as a
+ * reference owned by the caller rather than a floating one */
+GVariant *
+json_gvariant_deserialize_stream_finish (GInputStream  *stream,
+                                         GAsyncResult  *result,
+                                         GError       **error)
+{
+  g_return_val_if_fail (g_task_is_valid (result, stream), NULL);
 
-  json_member = member->k;
-  variant_member = gvariant_simple_from_string (json_member,
-                                                key_signature[0],
-                                                error);
-  if (variant_member != NULL)
-    {
-      json_value = json_object_object_get (json_node, json_member);
+  return g_task_propagate_pointer (G_TASK (result), error);
+}
 
-      tmp_signature = value_signature;
-      variant_value = json_to_gvariant_recurse (json_value,
-                                                &tmp_signature,
-                                                error);
+/* ========================================================================== */
+/* Support for the converters generated by json-gvariant-codegen.py */
+/* ========================================================================== */
 
-      if (variant_value != NULL)
-        {
-          GVariantBuilder *builder;
+JsonGVariantWriter *
+json_gvariant_generated_get_writer (JsonGVariantContext *context)
+{
+  return context->writer;
+}
 
-          builder = g_variant_builder_new (G_VARIANT_TYPE (entry_signature));
-          g_variant_builder_add_value (builder, variant_member);
-          g_variant_builder_add_value (builder, variant_value);
-          variant = g_variant_builder_end (builder);
+/* Whether the dictionaries are to be sorted, see JSON_GVARIANT_FLAGS_SORTED */
+gboolean
+json_gvariant_generated_is_sorted (JsonGVariantContext *context)
+{
+  return context->sorted;
+}
 
-          g_variant_builder_unref (builder);
-        }
-    }
+gboolean
+json_gvariant_generated_next_element (JsonScanner  *scanner,
+                                      JsonToken     end,
+                                      gboolean      first,
+                                      GError      **error)
+{
+  return json_stream_next_element (scanner, end, first, error);
+}
 
-  g_free (value_signature);
-  g_free (key_signature);
-  g_free (entry_signature);
+gboolean
+json_gvariant_generated_next_member (JsonScanner  *scanner,
+                                     gboolean      first,
+                                     GError      **error)
+{
+  return json_stream_next_member (scanner, first, error);
+}
 
-  /* compensate the (*signature)++ call at the end of 'recurse()' */
-  if (signature)
-    (*signature)--;
+gboolean
+json_gvariant_generated_next_value (JsonScanner  *scanner,
+                                    GError      **error)
+{
+  return json_stream_next_value (scanner, error);
+}
 
-  return variant;
+gint64
+json_gvariant_generated_get_int (JsonScanner *scanner)
+{
+  return json_stream_get_int (scanner);
 }
 
-static GVariant *
-json_to_gvariant_dictionary (json_object  *json_node,
-                             const gchar **signature,
-                             GError      **error)
+gdouble
+json_gvariant_generated_get_double (JsonScanner *scanner)
 {
-  GVariant *variant = NULL;
-  gboolean roll_back = FALSE;
+  return json_stream_get_double (scanner);
+}
 
-  gchar *dict_signature;
-  gchar *entry_signature;
-  gchar *key_signature;
-  gchar *value_signature;
-  const gchar *tmp_signature;
+/* Writes the value at the scanner as 'plan' with the generic code */
+gboolean
+json_gvariant_generated_write_value (JsonGVariantContext     *context,
+                                     JsonScanner             *scanner,
+                                     const JsonGVariantPlan  *plan,
+                                     GError                 **error)
+{
+  return json_write_recurse (context, scanner, plan, error);
+}
 
-  GVariantBuilder *builder;
-  GList *members;
-  GList *member;
+/* Writes the value at the scanner as a variant of the type inferred from
+ * it with the generic code, the writer being aligned for the variant */
+gboolean
+json_gvariant_generated_write_variant (JsonGVariantContext  *context,
+                                       JsonScanner          *scanner,
+                                       GError              **error)
+{
+  return json_write_variant (context, scanner, error);
+}
 
-  if (signature != NULL)
-    (*signature)++;
+/* ========================================================================== */
+/* GVariant to JSON text */
+/* ========================================================================== */
 
-  parse_dict_entry_signature (signature,
-                              &entry_signature,
-                              &key_signature,
-                              &value_signature);
+/* For each byte, the character following the backslash when it has to be
+ * escaped in a JSON string, 'u' for the \uXXXX form or 0 if it can be
+ * copied as is. Bytes of multibyte UTF-8 sequences never need escaping.
+ */
+static const gchar json_escapes[256] = {
+  'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'b', 't', 'n', 'u', 'f', 'r', 'u', 'u',
+  'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u',
+  0,   0,   '"', 0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+  0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+  0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+  0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   '\\', 0,  0,   0,
+};
 
-  dict_signature = g_strdup_printf ("a%s", entry_signature);
+static void
+gvariant_to_json_string (GString     *out,
+                         const gchar *string,
+                         gsize        length)
+{
+  static const gchar hex[] = "0123456789abcdef";
+  const guchar *p = (const guchar *) string;
+  const guchar *end = p + length;
+  const guchar *run = p;
 
-  builder = g_variant_builder_new (G_VARIANT_TYPE (dict_signature));
+  g_string_append_c (out, '"');
 
-  json_object_object_foreach (json_node, json_member, json_value)
+  /* copy the runs of characters which need no escaping in one go */
+  for (; p < end; p++)
     {
-      GVariant *variant_member;
-      GVariant *variant_value;
+      gchar escape = json_escapes[*p];
 
-      variant_member = gvariant_simple_from_string (json_member,
-                                                    key_signature[0],
-                                                    error);
-      if (variant_member == NULL)
-        {
-          roll_back = TRUE;
-          break;
-        }
+      if (G_LIKELY (escape == 0))
+        continue;
 
-      tmp_signature = value_signature;
-      variant_value = json_to_gvariant_recurse (json_value,
-                                                &tmp_signature,
-                                                error);
+      g_string_append_len (out, (const gchar *) run, p - run);
+      g_string_append_c (out, '\\');
+      g_string_append_c (out, escape);
 
-      if (variant_value != NULL)
-        {
-          g_variant_builder_open (builder, G_VARIANT_TYPE (entry_signature));
-          g_variant_builder_add_value (builder, variant_member);
-          g_variant_builder_add_value (builder, variant_value);
-          g_variant_builder_close (builder);
-        }
-      else
+      if (escape == 'u')
         {
-          roll_back = TRUE;
-          break;
+          g_string_append (out, "00");
+          g_string_append_c (out, hex[*p >> 4]);
+          g_string_append_c (out, hex[*p & 0xf]);
         }
+
+      run = p + 1;
     }
 
-  if (! roll_back)
-    variant = g_variant_builder_end (builder);
+  g_string_append_len (out, (const gchar *) run, p - run);
+  g_string_append_c (out, '"');
+}
+
+static void
+gvariant_to_json_int (GString *out,
+                      gint64   value)
+{
+  gchar buffer[24];
+  gchar *p = buffer + sizeof buffer;
+  guint64 magnitude = value < 0 ? - (guint64) value : (guint64) value;
 
-  g_variant_builder_unref (builder);
-  g_free (value_signature);
-  g_free (key_signature);
-  g_free (entry_signature);
-  g_free (dict_signature);
+  do
+    {
+      *--p = '0' + magnitude % 10;
+      magnitude /= 10;
+    }
+  while (magnitude > 0);
 
-  /* compensate the (*signature)++ call at the end of 'recurse()' */
-  if (signature != NULL)
-    (*signature)--;
+  if (value < 0)
+    *--p = '-';
 
-  return variant;
+  g_string_append_len (out, p, buffer + sizeof buffer - p);
 }
 
-static GVariant *
-json_to_gvariant_recurse (json_object   *json_node,
-                          const gchar  **signature,
-                          GError       **error)
+static void
+gvariant_to_json_uint (GString *out,
+                       guint64  value)
 {
-  GVariant *variant = NULL;
-  GVariantClass class;
-
-  class = json_to_gvariant_get_next_class (json_node, signature);
+  gchar buffer[24];
+  gchar *p = buffer + sizeof buffer;
 
-  if (class == JSON_G_VARIANT_CLASS_DICTIONARY)
+  do
     {
-      if (json_node_assert_type (json_node, json_type_object, 0, error))
-        variant = json_to_gvariant_dictionary (json_node, signature, error);
+      *--p = '0' + value % 10;
+      value /= 10;
+    }
+  while (value > 0);
+
+  g_string_append_len (out, p, buffer + sizeof buffer - p);
+}
+
+static void
+gvariant_to_json_double (GString *out,
+                         gdouble  value)
+{
+  gchar buffer[G_ASCII_DTOSTR_BUF_SIZE];
 
-      goto out;
+  /* JSON has no representation for them */
+  if (isnan (value) || isinf (value))
+    {
+      g_string_append (out, "null");
+      return;
     }
 
+  /* use the shortest of the precisions that round-trip */
+  g_ascii_formatd (buffer, sizeof buffer, "%.15g", value);
+  if (g_ascii_strtod (buffer, NULL) != value)
+    g_ascii_formatd (buffer, sizeof buffer, "%.17g", value);
+
+  g_string_append (out, buffer);
+
+  /* make sure it gets parsed back as a double */
+  if (strpbrk (buffer, ".eE") == NULL)
+    g_string_append (out, ".0");
+}
+
+/* Appends the basic value serialized in 'data', as the inverse of
+ * json_to_gvariant_convert() for the JSON scalars. Values other than the
+ * framing offsets are stored in native byte order. */
+static void
+gvariant_to_json_basic (GString      *out,
+                        gchar         class,
+                        const guchar *data,
+                        gsize         size)
+{
+  union
+  {
+    gint16  i16;
+    guint16 u16;
+    gint32  i32;
+    guint32 u32;
+    gint64  i64;
+    guint64 u64;
+    gdouble dbl;
+  } value;
+
   switch (class)
     {
     case G_VARIANT_CLASS_BOOLEAN:
-      if (json_node_assert_type (json_node, json_type_boolean, 0, error))
-        variant = g_variant_new_boolean (json_object_get_boolean (json_node));
+      g_string_append (out, data[0] ? "true" : "false");
       break;
 
     case G_VARIANT_CLASS_BYTE:
-      if (json_node_assert_type (json_node, json_type_int, 0, error))
-        variant = g_variant_new_byte (json_object_get_int (json_node));
+      gvariant_to_json_uint (out, data[0]);
       break;
 
     case G_VARIANT_CLASS_INT16:
-      if (json_node_assert_type (json_node, json_type_int, 0, error))
-        variant = g_variant_new_int16 (json_object_get_int (json_node));
+      memcpy (&value, data, 2);
+      gvariant_to_json_int (out, value.i16);
       break;
 
     case G_VARIANT_CLASS_UINT16:
-      if (json_node_assert_type (json_node, json_type_int, 0, error))
-        variant = g_variant_new_uint16 (json_object_get_int (json_node));
+      memcpy (&value, data, 2);
+      gvariant_to_json_uint (out, value.u16);
       break;
 
     case G_VARIANT_CLASS_INT32:
-      if (json_node_assert_type (json_node, json_type_int, 0, error))
-        variant = g_variant_new_int32 (json_object_get_int (json_node));
+    case G_VARIANT_CLASS_HANDLE:
+      memcpy (&value, data, 4);
+      gvariant_to_json_int (out, value.i32);
       break;
 
     case G_VARIANT_CLASS_UINT32:
-      if (json_node_assert_type (json_node, json_type_int, 0, error))
-        variant = g_variant_new_uint32 (json_object_get_int (json_node));
+      memcpy (&value, data, 4);
+      gvariant_to_json_uint (out, value.u32);
       break;
 
     case G_VARIANT_CLASS_INT64:
-      if (json_node_assert_type (json_node, json_type_int, 0, error))
-        variant = g_variant_new_int64 (json_object_get_int (json_node));
+      memcpy (&value, data, 8);
+      gvariant_to_json_int (out, value.i64);
       break;
 
     case G_VARIANT_CLASS_UINT64:
-      if (json_node_assert_type (json_node, json_type_int, 0, error))
-        variant = g_variant_new_uint64 (json_object_get_int (json_node));
-      break;
-
-    case G_VARIANT_CLASS_HANDLE:
-      if (json_node_assert_type (json_node, json_type_int, 0, error))
-        variant = g_variant_new_handle (json_object_get_int (json_node));
+      memcpy (&value, data, 8);
+      gvariant_to_json_uint (out, value.u64);
       break;
 
     case G_VARIANT_CLASS_DOUBLE:
-      if (json_node_assert_type (json_node, json_type_double, 0, error))
-        variant = g_variant_new_double (json_object_get_double (json_node));
+      memcpy (&value, data, 8);
+      gvariant_to_json_double (out, value.dbl);
       break;
 
     case G_VARIANT_CLASS_STRING:
-      if (json_node_assert_type (json_node, json_type_string, 0, error))
-        variant = g_variant_new_string (json_object_get_string (json_node));
+    case G_VARIANT_CLASS_OBJECT_PATH:
+    case G_VARIANT_CLASS_SIGNATURE:
+      /* without the terminating NUL */
+      gvariant_to_json_string (out, (const gchar *) data, size - 1);
       break;
 
-    case G_VARIANT_CLASS_OBJECT_PATH:
-      if (json_node_assert_type (json_node, json_type_string, 0, error))
-        variant = g_variant_new_object_path (json_object_get_string (json_node));
+    default:
+      g_assert_not_reached ();
       break;
+    }
+}
 
+/* JSON member names are strings, so non-string keys are written in the
+ * form gvariant_simple_from_string() parses back */
+static void
+gvariant_to_json_key (GString      *out,
+                      gchar         class,
+                      const guchar *data,
+                      gsize         size)
+{
+  switch (class)
+    {
+    case G_VARIANT_CLASS_STRING:
+    case G_VARIANT_CLASS_OBJECT_PATH:
     case G_VARIANT_CLASS_SIGNATURE:
-      if (json_node_assert_type (json_node, json_type_string, 0, error))
-        variant = g_variant_new_signature (json_object_get_string (json_node));
+      gvariant_to_json_basic (out, class, data, size);
+      break;
+
+    default:
+      g_string_append_c (out, '"');
+      gvariant_to_json_basic (out, class, data, size);
+      g_string_append_c (out, '"');
       break;
+    }
+}
+
+/* The size of the framing offsets depends only on the size of their
+ * container, see json_gvariant_writer_get_offset_size() */
+static guint
+gvariant_to_json_offset_size (gsize size)
+{
+  if (size > G_MAXUINT32)
+    return 8;
+  if (size > G_MAXUINT16)
+    return 4;
+  if (size > G_MAXUINT8)
+    return 2;
+  return 1;
+}
+
+static gsize
+gvariant_to_json_read_offset (const guchar *data,
+                              guint         offset_size)
+{
+  guint64 offset = 0;
+  guint i;
+
+  for (i = 0; i < offset_size; i++)
+    offset |= (guint64) data[i] << (8 * i);
+
+  return offset;
+}
+
+/* Locates the next member of a tuple or dictionary entry. 'offset' is the
+ * end of the previous member and 'frame' the position of the last framing
+ * offset consumed, both updated for the next call. */
+static void
+gvariant_to_json_next_member (const JsonGVariantPlan *member,
+                              gboolean                last,
+                              const guchar           *data,
+                              guint                   offset_size,
+                              gsize                  *offset,
+                              gsize                  *frame,
+                              gsize                  *start)
+{
+  *start = JSON_GVARIANT_ALIGN_UP (*offset, member->alignment);
+
+  if (member->fixed_size > 0)
+    {
+      *offset = *start + member->fixed_size;
+    }
+  else if (last)
+    {
+      /* the last member extends up to the framing offsets */
+      *offset = *frame;
+    }
+  else
+    {
+      *frame -= offset_size;
+      *offset = gvariant_to_json_read_offset (data + *frame, offset_size);
+    }
+}
+
+/* A conversion to JSON text. The types of the variant converted and of
+ * the values of the variants it holds come from the data: their plans are
+ * taken from the cache of json_gvariant_plan_get() only if they are there
+ * already, and are compiled into 'plans' for the duration of the
+ * conversion otherwise, so that arbitrary data cannot grow the cache */
+typedef struct
+{
+  GString    *out;
+  GHashTable *plans;
+} GVariantToJson;
+
+static const JsonGVariantPlan *
+gvariant_to_json_get_plan (GVariantToJson *json,
+                           const gchar    *signature)
+{
+  JsonGVariantPlan *plan;
+  const JsonGVariantPlan *cached;
+
+  cached = json_gvariant_plan_lookup (signature);
+  if (G_LIKELY (cached != NULL))
+    return cached;
+
+  if (json->plans == NULL)
+    json->plans = g_hash_table_new_full (g_str_hash, g_str_equal, NULL, g_free);
+
+  plan = g_hash_table_lookup (json->plans, signature);
+  if (plan == NULL)
+    {
+      plan = json_gvariant_plan_new_uncached (signature);
+      g_assert (plan != NULL);
+      g_hash_table_insert (json->plans,
+                           (gpointer) g_variant_type_peek_string (plan->type),
+                           plan);
+    }
+
+  return plan;
+}
+
+static void gvariant_to_json_recurse (GVariantToJson         *json,
+                                      const JsonGVariantPlan *plan,
+                                      const guchar           *data,
+                                      gsize                   size);
+
+static void
+gvariant_to_json_member (GVariantToJson         *json,
+                         const JsonGVariantPlan *plan,
+                         const guchar           *data,
+                         gsize                   size)
+{
+  guint offset_size = gvariant_to_json_offset_size (size);
+  gsize key_start, key_end;
+  gsize value_start;
+  gsize offset = 0;
+  gsize frame = size;
+
+  gvariant_to_json_next_member (&plan->children[0], FALSE, data, offset_size,
+                                &offset, &frame, &key_start);
+  key_end = offset;
+  gvariant_to_json_next_member (&plan->children[1], TRUE, data, offset_size,
+                                &offset, &frame, &value_start);
+
+  gvariant_to_json_key (json->out, plan->children[0].class,
+                        data + key_start, key_end - key_start);
+  g_string_append_c (json->out, ':');
+  gvariant_to_json_recurse (json, &plan->children[1],
+                            data + value_start, offset - value_start);
+}
+
+static void
+gvariant_to_json_tuple (GVariantToJson         *json,
+                        const JsonGVariantPlan *plan,
+                        const guchar           *data,
+                        gsize                   size)
+{
+  guint offset_size = gvariant_to_json_offset_size (size);
+  gsize offset = 0;
+  gsize frame = size;
+  guint i;
+
+  g_string_append_c (json->out, '[');
+
+  for (i = 0; i < plan->n_children; i++)
+    {
+      gsize start;
+
+      gvariant_to_json_next_member (&plan->children[i], i == plan->n_children - 1,
+                                    data, offset_size, &offset, &frame, &start);
+
+      if (i > 0)
+        g_string_append_c (json->out, ',');
+      gvariant_to_json_recurse (json, &plan->children[i],
+                                data + start, offset - start);
+    }
+
+  g_string_append_c (json->out, ']');
+}
+
+/* Writes arrays as JSON arrays and arrays of dictionary entries as JSON
+ * objects */
+static void
+gvariant_to_json_array (GVariantToJson         *json,
+                        const JsonGVariantPlan *plan,
+                        const guchar           *data,
+                        gsize                   size)
+{
+  const JsonGVariantPlan *element = &plan->children[0];
+  gboolean dictionary = plan->class == JSON_G_VARIANT_CLASS_DICTIONARY;
+  guint offset_size = 0;
+  gsize n_elements;
+  gsize offset = 0;
+  gsize i;
+
+  if (size == 0)
+    n_elements = 0;
+  else if (element->fixed_size > 0)
+    n_elements = size / element->fixed_size;
+  else
+    {
+      /* the last framing offset tells where the framing offsets start */
+      offset_size = gvariant_to_json_offset_size (size);
+      n_elements = (size - gvariant_to_json_read_offset (data + size - offset_size,
+                                                         offset_size)) / offset_size;
+    }
+
+  g_string_append_c (json->out, dictionary ? '{' : '[');
+
+  for (i = 0; i < n_elements; i++)
+    {
+      gsize start, end;
+
+      if (element->fixed_size > 0)
+        {
+          start = i * element->fixed_size;
+          end = start + element->fixed_size;
+        }
+      else
+        {
+          start = JSON_GVARIANT_ALIGN_UP (offset, element->alignment);
+          end = gvariant_to_json_read_offset (data + size - (n_elements - i) * offset_size,
+                                              offset_size);
+          offset = end;
+        }
+
+      if (i > 0)
+        g_string_append_c (json->out, ',');
+
+      if (dictionary)
+        gvariant_to_json_member (json, element, data + start, end - start);
+      else
+        gvariant_to_json_recurse (json, element, data + start, end - start);
+    }
+
+  g_string_append_c (json->out, dictionary ? '}' : ']');
+}
+
+/* Variants store their value, a zero byte and then their type string */
+static void
+gvariant_to_json_variant (GVariantToJson *json,
+                          const guchar   *data,
+                          gsize           size)
+{
+  const JsonGVariantPlan *plan;
+  gchar buffer[64];
+  gchar *signature;
+  gsize length;
+  gsize end;
+
+  for (end = size; end > 0 && data[end - 1] != '\0'; end--)
+    ;
+  g_assert (end > 0);
+
+  length = size - end;
+  signature = length < sizeof buffer ? buffer : g_malloc (length + 1);
+  memcpy (signature, data + end, length);
+  signature[length] = '\0';
+
+  plan = gvariant_to_json_get_plan (json, signature);
+
+  if (signature != buffer)
+    g_free (signature);
+
+  gvariant_to_json_recurse (json, plan, data, end - 1);
+}
 
+static void
+gvariant_to_json_recurse (GVariantToJson         *json,
+                          const JsonGVariantPlan *plan,
+                          const guchar           *data,
+                          gsize                   size)
+{
+  switch (plan->class)
+    {
     case G_VARIANT_CLASS_VARIANT:
-      variant = g_variant_new_variant (json_to_gvariant_recurse (json_node,
-                                                                 NULL,
-                                                                 error));
+      gvariant_to_json_variant (json, data, size);
       break;
 
     case G_VARIANT_CLASS_MAYBE:
-      variant = json_to_gvariant_maybe (json_node, signature, error);
+      if (size == 0)
+        g_string_append (json->out, "null");
+      else if (plan->children[0].fixed_size > 0)
+        gvariant_to_json_recurse (json, &plan->children[0], data, size);
+      else
+        /* skip the trailing zero byte */
+        gvariant_to_json_recurse (json, &plan->children[0], data, size - 1);
       break;
 
     case G_VARIANT_CLASS_ARRAY:
-      if (json_node_assert_type (json_node, json_type_array, 0, error))
-        variant = json_to_gvariant_array (json_node, signature, error);
+    case JSON_G_VARIANT_CLASS_DICTIONARY:
+      gvariant_to_json_array (json, plan, data, size);
       break;
 
     case G_VARIANT_CLASS_TUPLE:
-      if (json_node_assert_type (json_node, json_type_array, 0, error))
-        variant = json_to_gvariant_tuple (json_node, signature, error);
+      gvariant_to_json_tuple (json, plan, data, size);
       break;
 
     case G_VARIANT_CLASS_DICT_ENTRY:
-      if (json_node_assert_type (json_node, json_type_object, 0, error))
-        variant = json_to_gvariant_dict_entry (json_node, signature, error);
+      g_string_append_c (json->out, '{');
+      gvariant_to_json_member (json, plan, data, size);
+      g_string_append_c (json->out, '}');
       break;
 
     default:
-      g_set_error (error,
-                   G_IO_ERROR,
-                   G_IO_ERROR_INVALID_DATA,
-                   _("GVariant class '%c' not supported"), class);
+      gvariant_to_json_basic (json->out, plan->class, data, size);
       break;
     }
-
-out:
-  if (signature)
-    (*signature)++;
-
-  return variant;
 }
 
-static GVariant *
-json_gvariant_deserialize (json_object *json_node,
-                           const gchar  *signature,
-                           GError      **error)
+/* Converts 'variant' to JSON text, without building any intermediate
+ * tree: its serialized data is read once, guided by the compiled plan of
+ * its type, and written straight into the output buffer.
+ *
+ * The output follows the conventions used by
+ * json_gvariant_deserialize_data(), so that converting it back with the
+ * type of 'variant' as signature gives the same value. Variants are
+ * written as their content and maybes as null or their content.
+ *
+ * Returns a newly allocated, NUL-terminated string, and its length in
+ * 'length' if not NULL.
+ */
+gchar *
+json_gvariant_serialize_data (GVariant *variant,
+                              gsize    *length)
 {
-  g_return_val_if_fail (json_node != NULL, NULL);
+  GVariantToJson json = { NULL, };
+  const JsonGVariantPlan *plan;
+  GVariant *normal;
+  gsize size;
 
-  if (signature != NULL && ! g_variant_type_string_is_valid (signature))
-    {
-      g_set_error_literal (error,
-                           G_IO_ERROR,
-                           G_IO_ERROR_INVALID_ARGUMENT,
-                           _("Invalid GVariant signature"));
-      return NULL;
-    }
+  g_return_val_if_fail (variant != NULL, NULL);
 
-  return json_to_gvariant_recurse (json_node, signature ? &signature : NULL, error);
+  plan = gvariant_to_json_get_plan (&json, g_variant_get_type_string (variant));
+
+  /* the reader relies on the framing offsets being consistent, which is
+   * only guaranteed in normal form: data from untrusted sources has to be
+   * normalised first */
+  normal = g_variant_get_normal_form (variant);
+  size = g_variant_get_size (normal);
+
+  /* JSON text is usually a bit bigger than the serialized GVariant, which
+   * makes it a good estimate to avoid growing the buffer */
+  json.out = g_string_sized_new (size + size / 2 + 64);
+
+  gvariant_to_json_recurse (&json, plan, g_variant_get_data (normal), size);
+
+  g_variant_unref (normal);
+  if (json.plans != NULL)
+    g_hash_table_unref (json.plans);
+
+  if (length != NULL)
+    *length = json.out->len;
+
+  return g_string_free (json.out, FALSE);
 }
 
+/* ========================================================================== */
+/* Lookups in sorted dictionaries */
+/* ========================================================================== */
+
+/* As g_variant_lookup_value(), but with a binary search over the entries
+ * of 'dictionary', which must be sorted by key as done by
+ * JSON_GVARIANT_FLAGS_SORTED: the cost is logarithmic in the number of
+ * entries instead of linear. 'dictionary' must have type 'a{s*}', 'a{o*}'
+ * or 'a{g*}'; values of type 'v' are unboxed.
+ *
+ * Returns a new reference to the value, or NULL if there is no entry for
+ * 'key' or its value does not have 'expected_type'.
+ */
 GVariant *
-json_gvariant_deserialize_data (const gchar  *json,
-                                gssize        length,
-                                const gchar  *signature,
-                                GError      **error)
+json_gvariant_lookup_value (GVariant           *dictionary,
+                            const gchar        *key,
+                            const GVariantType *expected_type)
 {
-  GVariant *variant = NULL;
-  enum json_tokener_error err = json_tokener_success;
-  json_object *json_node;
-  
-  json_node = json_tokener_parse_verbose (json, &err);
-  if (G_UNLIKELY (err != json_tokener_success))
+  gsize low, high;
+
+  g_return_val_if_fail (dictionary != NULL, NULL);
+  g_return_val_if_fail (key != NULL, NULL);
+  g_return_val_if_fail (g_variant_is_of_type (dictionary, G_VARIANT_TYPE ("a{s*}")) ||
+                        g_variant_is_of_type (dictionary, G_VARIANT_TYPE ("a{o*}")) ||
+                        g_variant_is_of_type (dictionary, G_VARIANT_TYPE ("a{g*}")), NULL);
+
+  low = 0;
+  high = g_variant_n_children (dictionary);
+
+  while (low < high)
     {
-      g_set_error (error,
-                   G_IO_ERROR,
-                   G_IO_ERROR_INVALID_DATA,
-                   _("JSON data is malformed:%s"), json_tokener_error_desc(err));
-      return FALSE;
+      gsize middle = low + (high - low) / 2;
+      GVariant *entry;
+      GVariant *entry_key;
+      GVariant *value;
+      gint result;
+
+      entry = g_variant_get_child_value (dictionary, middle);
+      entry_key = g_variant_get_child_value (entry, 0);
+      result = strcmp (key, g_variant_get_string (entry_key, NULL));
+      g_variant_unref (entry_key);
+
+      if (result < 0)
+        {
+          high = middle;
+        }
+      else if (result > 0)
+        {
+          low = middle + 1;
+        }
+      else
+        {
+          value = g_variant_get_child_value (entry, 1);
+          g_variant_unref (entry);
+
+          if (g_variant_is_of_type (value, G_VARIANT_TYPE_VARIANT))
+            {
+              GVariant *boxed = g_variant_get_variant (value);
+
+              g_variant_unref (value);
+              value = boxed;
+            }
+
+          if (expected_type != NULL && !g_variant_is_of_type (value, expected_type))
+            {
+              g_variant_unref (value);
+              value = NULL;
+            }
+
+          return value;
+        }
+
+      g_variant_unref (entry);
     }
-  variant = json_gvariant_deserialize (json_node, signature, error);
-  json_object_put (json_node);
 
-  return variant;
+  return NULL;
 }
@@ -26,14 +26,198 @@
 #define __JSON_GVARIANT_H__
 
 #include <glib.h>
+#include <gio/gio.h>
+#include <json.h>
 
 G_BEGIN_DECLS
 
+/* Options for json_gvariant_deserialize_full() and the functions below:
+ *
+ * JSON_GVARIANT_FLAGS_SERIALIZED: write the serialized GVariant data for
+ *   the whole value into a single buffer instead of assembling it from a
+ *   GVariant per JSON value. This is best when the result is going to be
+ *   serialized anyway, for instance to be sent over D-Bus.
+ *
+ * JSON_GVARIANT_FLAGS_INTERN: share a single GVariant between all the
+ *   identical strings and booleans of the value, dictionary keys included.
+ *   This saves memory on repetitive input, like arrays of objects with the
+ *   same members. It has no effect with JSON_GVARIANT_FLAGS_SERIALIZED,
+ *   which does not create a GVariant per JSON value in the first place.
+ *
+ * JSON_GVARIANT_FLAGS_COMPACT: when no signature is given, and for the
+ *   variants of the signature, infer the tightest type from the values
+ *   instead of using 'av' for arrays and 'a{sv}' for objects: homogeneous
+ *   arrays get their element type, as in 'as' or 'aa{ss}', arrays of
+ *   arrays with the same types at each position become arrays of tuples,
+ *   and values mixed with nulls become maybes. The values are looked
+ *   ahead before being converted, once per variant holding them, so deep
+ *   nesting of mixed objects is costly; text in memory is scanned only
+ *   once and replayed for each look. The flag is ignored when reading
+ *   from a GInputStream.
+ *
+ * JSON_GVARIANT_FLAGS_PARALLEL: split arrays with many elements into
+ *   chunks converted on a thread pool shared by all the conversions, see
+ *   json_gvariant_set_max_threads(). The result is the same as without the
+ *   flag, errors included: the first failing element is the one reported.
+ *   It has no effect with JSON_GVARIANT_FLAGS_SERIALIZED and when reading
+ *   from a GInputStream.
+ *
+ * JSON_GVARIANT_FLAGS_SORTED: emit the entries of every dictionary sorted
+ *   by key, as by g_variant_compare(), keeping only the last of the
+ *   members with the same key. Values can then be looked up in
+ *   logarithmic time with json_gvariant_lookup_value(). The types inferred
+ *   for JSON texts with JSON_GVARIANT_FLAGS_COMPACT still account for the
+ *   members replaced.
+ */
+typedef enum
+{
+  JSON_GVARIANT_FLAGS_NONE       = 0,
+  JSON_GVARIANT_FLAGS_SERIALIZED = 1 << 0,
+  JSON_GVARIANT_FLAGS_INTERN     = 1 << 1,
+  JSON_GVARIANT_FLAGS_COMPACT    = 1 << 2,
+  JSON_GVARIANT_FLAGS_PARALLEL   = 1 << 3,
+  JSON_GVARIANT_FLAGS_SORTED     = 1 << 4
+} JsonGVariantFlags;
+
+/* Errors for input exceeding a JsonGVariantLimits, or the nesting depth
+ * set by json_gvariant_set_max_depth(); malformed input and values not
+ * matching the signature are reported as G_IO_ERROR_INVALID_DATA */
+#define JSON_GVARIANT_ERROR (json_gvariant_error_quark ())
+
+typedef enum
+{
+  JSON_GVARIANT_ERROR_TOO_LARGE,
+  JSON_GVARIANT_ERROR_TOO_MANY_NODES,
+  JSON_GVARIANT_ERROR_TOO_DEEP,
+  JSON_GVARIANT_ERROR_STRING_TOO_LONG
+} JsonGVariantError;
+
+GQuark     json_gvariant_error_quark      (void);
+
+/* Bounds on the JSON text accepted by json_gvariant_deserialize_limited()
+ * and json_gvariant_validate(), for input from untrusted sources. A field
+ * set to 0 leaves that dimension unbounded.
+ *
+ * max_bytes: the size of the whole text, checked before scanning it.
+ * max_nodes: the number of values, arrays, objects and member names.
+ * max_depth: the nesting of arrays and objects; the lower of this one
+ *   and the global json_gvariant_set_max_depth() applies.
+ * max_string_length: the length in bytes of each string once unescaped,
+ *   member names included, checked before it is buffered.
+ *
+ * The limits are enforced while the text is scanned, so a conversion
+ * failing with a JSON_GVARIANT_ERROR has not allocated more than they
+ * allow.
+ */
+typedef struct
+{
+  gsize max_bytes;
+  guint max_nodes;
+  guint max_depth;
+  gsize max_string_length;
+} JsonGVariantLimits;
+
+GVariant * json_gvariant_deserialize      (json_object  *json_node,
+                                           const gchar  *signature,
+                                           GError      **error);
+
+GVariant * json_gvariant_deserialize_full (json_object        *json_node,
+                                           const gchar        *signature,
+                                           JsonGVariantFlags   flags,
+                                           GError            **error);
+
 GVariant * json_gvariant_deserialize_data (const gchar  *json,
                                            gssize        length,
                                            const gchar  *signature,
                                            GError      **error);
 
+GVariant * json_gvariant_deserialize_data_full (const gchar        *json,
+                                                gssize              length,
+                                                const gchar        *signature,
+                                                JsonGVariantFlags   flags,
+                                                GError            **error);
+
+GVariant * json_gvariant_deserialize_limited (const gchar               *json,
+                                              gssize                     length,
+                                              const gchar               *signature,
+                                              JsonGVariantFlags          flags,
+                                              const JsonGVariantLimits  *limits,
+                                              GError                   **error);
+
+gboolean   json_gvariant_validate         (const gchar               *json,
+                                           gssize                     length,
+                                           const gchar               *signature,
+                                           const JsonGVariantLimits  *limits,
+                                           gsize                     *error_offset,
+                                           GError                   **error);
+
+/* A member of the JSON object making up a text, to be converted to
+ * 'signature', or to the types inferred if it is NULL, by
+ * json_gvariant_extract_members(), which sets 'value' */
+typedef struct
+{
+  const gchar *key;
+  const gchar *signature;
+  GVariant    *value;
+} JsonGVariantMember;
+
+gboolean   json_gvariant_extract_members  (const gchar               *json,
+                                           gssize                     length,
+                                           JsonGVariantMember        *members,
+                                           guint                      n_members,
+                                           const JsonGVariantLimits  *limits,
+                                           GError                   **error);
+
+/* A JSON text and the signature to convert it to, as for
+ * json_gvariant_deserialize_data() */
+typedef struct
+{
+  const gchar *json;
+  gssize       length;
+  const gchar *signature;
+} JsonGVariantDocument;
+
+gboolean   json_gvariant_deserialize_batch (const JsonGVariantDocument  *documents,
+                                            guint                        n_documents,
+                                            JsonGVariantFlags            flags,
+                                            GVariant                   **results,
+                                            GError                     **errors);
+
+GVariant * json_gvariant_deserialize_stream (GInputStream       *stream,
+                                             const gchar        *signature,
+                                             JsonGVariantFlags   flags,
+                                             GCancellable       *cancellable,
+                                             GError            **error);
+void       json_gvariant_deserialize_stream_async  (GInputStream        *stream,
+                                                    const gchar         *signature,
+                                                    JsonGVariantFlags    flags,
+                                                    GCancellable        *cancellable,
+                                                    GAsyncReadyCallback  callback,
+                                                    gpointer             user_data);
+GVariant * json_gvariant_deserialize_stream_finish (GInputStream        *stream,
+                                                    GAsyncResult        *result,
+                                                    GError             **error);
+
+json_object * json_gvariant_parse_data    (const gchar  *json,
+                                           gssize        length,
+                                           GError      **error);
+void       json_gvariant_set_max_depth    (guint         depth);
+
+gchar *    json_gvariant_serialize_data   (GVariant     *variant,
+                                           gsize        *length);
+
+GVariant * json_gvariant_lookup_value     (GVariant           *dictionary,
+                                           const gchar        *key,
+                                           const GVariantType *expected_type);
+
+guint      json_gvariant_get_scratch_allocation_count (void);
+
+void       json_gvariant_set_max_threads  (guint         n_threads);
+
+void       json_gvariant_profile_set_enabled (gboolean    enabled);
+void       json_gvariant_profile_reset       (void);
+gchar *    json_gvariant_profile_dump        (void);
+
 G_END_DECLS
 
 #endif /* __JSON_GVARIANT_H__ */
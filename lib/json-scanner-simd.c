@@ -0,0 +1,248 @@
+/* json-scanner-simd.c - Vectorized inner loops of the JSON scanner
+ *
+ * Copyright (C) 2013  Intel Corporation.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Author:
+ *   Emanuele Aina <emanuele.aina@collabora.com>
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "json-scanner.h"
+
+/* The bulk of the time spent on string-heavy text, like cookie values and
+ * tokens, goes into going over the contents of the strings looking for
+ * the closing quote. The loops below look at 16 or 32 bytes at a time,
+ * and note on the way whether any of them is not ASCII: when none is, the
+ * string needs no UTF-8 validation at all.
+ *
+ * SSE2 is part of x86-64, AVX2 is only used if the processor supports it.
+ * Other architectures and compilers get the scalar loop.
+ */
+#if defined(__GNUC__) && defined(__SSE2__) && (defined(__x86_64__) || defined(__i386__))
+#define JSON_SCANNER_HAVE_SSE2 1
+#include <emmintrin.h>
+#if defined(__clang__) || __GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9)
+#define JSON_SCANNER_HAVE_AVX2 1
+#include <immintrin.h>
+#endif
+#endif
+
+typedef const gchar * (* JsonScannerFindFunc) (const gchar *p,
+                                               const gchar *end,
+                                               gboolean    *non_ascii);
+
+static const gchar *
+json_scanner_find_special_scalar (const gchar *p,
+                                  const gchar *end,
+                                  gboolean    *non_ascii)
+{
+  guchar high = 0;
+
+  for (; p < end; p++)
+    {
+      guchar c = *p;
+
+      if (c == '"' || c == '\\' || c < 0x20)
+        break;
+      high |= c;
+    }
+
+  if (high & 0x80)
+    *non_ascii = TRUE;
+
+  return p;
+}
+
+#ifdef JSON_SCANNER_HAVE_SSE2
+static const gchar *
+json_scanner_find_special_sse2 (const gchar *p,
+                                const gchar *end,
+                                gboolean    *non_ascii)
+{
+  const __m128i quote = _mm_set1_epi8 ('"');
+  const __m128i backslash = _mm_set1_epi8 ('\\');
+  const __m128i control = _mm_set1_epi8 (0x1f);
+  guint high = 0;
+
+  while (end - p >= 16)
+    {
+      __m128i bytes = _mm_loadu_si128 ((const __m128i *) p);
+      __m128i special;
+      guint mask;
+
+      /* the unsigned minimum equals the byte only for bytes up to 0x1f */
+      special = _mm_or_si128 (_mm_or_si128 (_mm_cmpeq_epi8 (bytes, quote),
+                                            _mm_cmpeq_epi8 (bytes, backslash)),
+                              _mm_cmpeq_epi8 (_mm_min_epu8 (bytes, control), bytes));
+      mask = _mm_movemask_epi8 (special);
+
+      if (mask != 0)
+        {
+          guint n = __builtin_ctz (mask);
+
+          high |= _mm_movemask_epi8 (bytes) & ((1u << n) - 1);
+          if (high != 0)
+            *non_ascii = TRUE;
+          return p + n;
+        }
+
+      high |= _mm_movemask_epi8 (bytes);
+      p += 16;
+    }
+
+  if (high != 0)
+    *non_ascii = TRUE;
+
+  return json_scanner_find_special_scalar (p, end, non_ascii);
+}
+#endif
+
+#ifdef JSON_SCANNER_HAVE_AVX2
+__attribute__ ((target ("avx2")))
+static const gchar *
+json_scanner_find_special_avx2 (const gchar *p,
+                                const gchar *end,
+                                gboolean    *non_ascii)
+{
+  const __m256i quote = _mm256_set1_epi8 ('"');
+  const __m256i backslash = _mm256_set1_epi8 ('\\');
+  const __m256i control = _mm256_set1_epi8 (0x1f);
+  guint high = 0;
+
+  while (end - p >= 32)
+    {
+      __m256i bytes = _mm256_loadu_si256 ((const __m256i *) p);
+      __m256i special;
+      guint mask;
+
+      special = _mm256_or_si256 (_mm256_or_si256 (_mm256_cmpeq_epi8 (bytes, quote),
+                                                   _mm256_cmpeq_epi8 (bytes, backslash)),
+                                 _mm256_cmpeq_epi8 (_mm256_min_epu8 (bytes, control), bytes));
+      mask = _mm256_movemask_epi8 (special);
+
+      if (mask != 0)
+        {
+          guint n = __builtin_ctz (mask);
+
+          high |= _mm256_movemask_epi8 (bytes) & ((1u << n) - 1);
+          if (high != 0)
+            *non_ascii = TRUE;
+          return p + n;
+        }
+
+      high |= _mm256_movemask_epi8 (bytes);
+      p += 32;
+    }
+
+  if (high != 0)
+    *non_ascii = TRUE;
+
+  return json_scanner_find_special_sse2 (p, end, non_ascii);
+}
+#endif
+
+static JsonScannerFindFunc
+json_scanner_get_find_func (JsonScannerSimd simd)
+{
+  switch (simd)
+    {
+#ifdef JSON_SCANNER_HAVE_AVX2
+    case JSON_SCANNER_SIMD_AVX2:
+      return json_scanner_find_special_avx2;
+#endif
+#ifdef JSON_SCANNER_HAVE_SSE2
+    case JSON_SCANNER_SIMD_SSE2:
+      return json_scanner_find_special_sse2;
+#endif
+    default:
+      return json_scanner_find_special_scalar;
+    }
+}
+
+/* Returns the best instruction set supported by both the build and the
+ * processor */
+static JsonScannerSimd
+json_scanner_get_best_simd (void)
+{
+#ifdef JSON_SCANNER_HAVE_AVX2
+  __builtin_cpu_init ();
+  if (__builtin_cpu_supports ("avx2"))
+    return JSON_SCANNER_SIMD_AVX2;
+#endif
+#ifdef JSON_SCANNER_HAVE_SSE2
+  return JSON_SCANNER_SIMD_SSE2;
+#else
+  return JSON_SCANNER_SIMD_NONE;
+#endif
+}
+
+static const gchar * json_scanner_find_special_resolve (const gchar *p,
+                                                        const gchar *end,
+                                                        gboolean    *non_ascii);
+
+static JsonScannerFindFunc find_special = json_scanner_find_special_resolve;
+static JsonScannerSimd current_simd = JSON_SCANNER_SIMD_NONE;
+
+/* Picks the implementation on the first call */
+static const gchar *
+json_scanner_find_special_resolve (const gchar *p,
+                                   const gchar *end,
+                                   gboolean    *non_ascii)
+{
+  json_scanner_set_simd (json_scanner_get_best_simd ());
+
+  return json_scanner_find_special (p, end, non_ascii);
+}
+
+/* Returns the first quote, backslash or control character between 'p' and
+ * 'end', or 'end' if there is none, and sets '*non_ascii' to TRUE if any
+ * of the bytes before it is not ASCII. '*non_ascii' is left alone
+ * otherwise, so that it can be carried over several runs of a string.
+ */
+const gchar *
+json_scanner_find_special (const gchar *p,
+                           const gchar *end,
+                           gboolean    *non_ascii)
+{
+  JsonScannerFindFunc func = g_atomic_pointer_get (&find_special);
+
+  return func (p, end, non_ascii);
+}
+
+/* Selects the instruction set used by the scanner, falling back to the
+ * best one below it if 'simd' is not supported by the build or by the
+ * processor. The best one available is picked by default. */
+void
+json_scanner_set_simd (JsonScannerSimd simd)
+{
+  JsonScannerSimd best = json_scanner_get_best_simd ();
+
+  simd = MIN (simd, best);
+  g_atomic_int_set (&current_simd, simd);
+  g_atomic_pointer_set (&find_special, json_scanner_get_find_func (simd));
+}
+
+JsonScannerSimd
+json_scanner_get_simd (void)
+{
+  if (g_atomic_pointer_get (&find_special) == json_scanner_find_special_resolve)
+    json_scanner_set_simd (json_scanner_get_best_simd ());
+
+  return g_atomic_int_get (&current_simd);
+}
@@ -0,0 +1,944 @@
+/* json-scanner.c - Pull tokenizer for JSON text
+ *
+ * Copyright (C) 2013  Intel Corporation.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Author:
+ *   Emanuele Aina <emanuele.aina@collabora.com>
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string.h>
+
+#include <glib/gi18n-lib.h>
+#include <gio/gio.h>
+
+#include "json-scanner.h"
+#include "json-gvariant.h"
+
+void
+json_scanner_init (JsonScanner *scanner,
+                   const gchar *data,
+                   gsize        length,
+                   GString     *buffer)
+{
+  scanner->data = data;
+  scanner->end = data + length;
+  scanner->pos = data;
+  scanner->token_start = data;
+  scanner->offset = 0;
+  scanner->token = JSON_TOKEN_EOF;
+  scanner->depth = 0;
+  scanner->max_depth = JSON_SCANNER_MAX_DEPTH;
+  scanner->n_nodes = 0;
+  scanner->max_nodes = G_MAXUINT;
+  scanner->max_string_length = G_MAXSIZE;
+  scanner->owns_buffer = buffer == NULL;
+  scanner->buffer = buffer != NULL ? buffer : g_string_sized_new (64);
+  scanner->boolean_value = FALSE;
+  scanner->stream = NULL;
+  scanner->cancellable = NULL;
+  scanner->window = NULL;
+  scanner->window_size = 0;
+  scanner->tape = NULL;
+  scanner->tape_pos = 0;
+  scanner->n_allocations = NULL;
+}
+
+/* Sets up 'scanner' to read its input from 'stream', 'chunk_size' bytes
+ * at a time. Only the input of the token being scanned is kept, so the
+ * memory needed does not depend on the size of the whole input but on the
+ * size of the chunks and of the longest token. The window holding it is
+ * allocated by the first read.
+ */
+void
+json_scanner_init_stream (JsonScanner  *scanner,
+                          GInputStream *stream,
+                          gsize         chunk_size,
+                          GCancellable *cancellable,
+                          GString      *buffer)
+{
+  json_scanner_init (scanner, NULL, 0, buffer);
+
+  scanner->stream = g_object_ref (stream);
+  scanner->cancellable = cancellable != NULL ? g_object_ref (cancellable) : NULL;
+  scanner->window_size = MAX (chunk_size, 64);
+}
+
+void
+json_scanner_clear (JsonScanner *scanner)
+{
+  if (scanner->owns_buffer && scanner->buffer != NULL)
+    g_string_free (scanner->buffer, TRUE);
+  scanner->buffer = NULL;
+
+  g_clear_object (&scanner->stream);
+  g_clear_object (&scanner->cancellable);
+  g_free (scanner->window);
+  scanner->window = NULL;
+}
+
+gsize
+json_scanner_get_offset (JsonScanner *scanner)
+{
+  return scanner->offset + (scanner->pos - scanner->data);
+}
+
+/* Returns the position of 'token_start' in the whole input */
+gsize
+json_scanner_get_token_offset (JsonScanner *scanner)
+{
+  return scanner->offset + (scanner->token_start - scanner->data);
+}
+
+const gchar *
+json_token_get_name (JsonToken token)
+{
+  /* keep the names used by json_type_to_name() for values, so that error
+   * messages do not depend on the parser in use */
+  switch (token)
+    {
+    case JSON_TOKEN_BEGIN_OBJECT:
+      return "object";
+    case JSON_TOKEN_BEGIN_ARRAY:
+      return "array";
+    case JSON_TOKEN_STRING:
+      return "string";
+    case JSON_TOKEN_INT:
+      return "int";
+    case JSON_TOKEN_DOUBLE:
+      return "double";
+    case JSON_TOKEN_BOOLEAN:
+      return "boolean";
+    case JSON_TOKEN_NULL:
+      return "null";
+    case JSON_TOKEN_END_OBJECT:
+      return "'}'";
+    case JSON_TOKEN_END_ARRAY:
+      return "']'";
+    case JSON_TOKEN_COLON:
+      return "':'";
+    case JSON_TOKEN_COMMA:
+      return "','";
+    case JSON_TOKEN_EOF:
+      return "end of data";
+    case JSON_TOKEN_ERROR:
+      break;
+    }
+
+  return "error";
+}
+
+static JsonToken
+json_scanner_set_error (JsonScanner  *scanner,
+                        GError      **error,
+                        const gchar  *reason)
+{
+  g_set_error (error,
+               G_IO_ERROR,
+               G_IO_ERROR_INVALID_DATA,
+               _("JSON data is malformed: %s at offset %" G_GSIZE_FORMAT),
+               reason, json_scanner_get_offset (scanner));
+  scanner->token = JSON_TOKEN_ERROR;
+  return JSON_TOKEN_ERROR;
+}
+
+/* Fails on the array or object at 'token_start', which is one too many */
+static JsonToken
+json_scanner_set_too_deep (JsonScanner  *scanner,
+                           GError      **error)
+{
+  g_set_error (error,
+               JSON_GVARIANT_ERROR,
+               JSON_GVARIANT_ERROR_TOO_DEEP,
+               _("JSON data is nested more than %u levels deep at offset %" G_GSIZE_FORMAT),
+               scanner->max_depth, json_scanner_get_token_offset (scanner));
+  scanner->token = JSON_TOKEN_ERROR;
+  return JSON_TOKEN_ERROR;
+}
+
+/* Counts a heap allocation made for the temporaries of 'scanner' */
+static inline void
+json_scanner_count_allocation (JsonScanner *scanner)
+{
+  if (scanner->n_allocations != NULL)
+    (*scanner->n_allocations)++;
+}
+
+/* Appends to the buffer, counting the times it has to grow */
+static inline void
+json_scanner_append_len (JsonScanner *scanner,
+                         const gchar *data,
+                         gsize        length)
+{
+  gsize allocated_len = scanner->buffer->allocated_len;
+
+  g_string_append_len (scanner->buffer, data, length);
+  if (G_UNLIKELY (scanner->buffer->allocated_len != allocated_len))
+    json_scanner_count_allocation (scanner);
+}
+
+static inline void
+json_scanner_append_c (JsonScanner *scanner,
+                       gchar        c)
+{
+  json_scanner_append_len (scanner, &c, 1);
+}
+
+/* Fails if the string being scanned is longer than allowed once the run
+ * of 'length' bytes still to be copied is added to the buffer */
+static gboolean
+json_scanner_check_string_length (JsonScanner  *scanner,
+                                  gsize         length,
+                                  GError      **error)
+{
+  if (G_LIKELY (scanner->buffer->len + length <= scanner->max_string_length))
+    return TRUE;
+
+  g_set_error (error,
+               JSON_GVARIANT_ERROR,
+               JSON_GVARIANT_ERROR_STRING_TOO_LONG,
+               _("JSON string is longer than %" G_GSIZE_FORMAT " bytes at offset %" G_GSIZE_FORMAT),
+               scanner->max_string_length, json_scanner_get_token_offset (scanner));
+  scanner->token = JSON_TOKEN_ERROR;
+  return FALSE;
+}
+
+static gboolean
+json_scanner_match_literal (JsonScanner *scanner,
+                            const gchar *literal,
+                            gsize        length)
+{
+  if ((gsize) (scanner->end - scanner->pos) < length ||
+      memcmp (scanner->pos, literal, length) != 0)
+    return FALSE;
+
+  scanner->pos += length;
+  return TRUE;
+}
+
+static gint
+json_scanner_parse_hex4 (const gchar *p)
+{
+  gint value = 0;
+  gint i;
+
+  for (i = 0; i < 4; i++)
+    {
+      gint digit = g_ascii_xdigit_value (p[i]);
+
+      if (digit < 0)
+        return -1;
+      value = (value << 4) | digit;
+    }
+
+  return value;
+}
+
+static JsonToken
+json_scanner_scan_string (JsonScanner  *scanner,
+                          GError      **error)
+{
+  const gchar *run;
+  gboolean validate = FALSE;
+
+  g_string_truncate (scanner->buffer, 0);
+
+  /* skip the opening quote */
+  scanner->pos++;
+  run = scanner->pos;
+
+  while (TRUE)
+    {
+      guchar c;
+
+      scanner->pos = json_scanner_find_special (scanner->pos, scanner->end, &validate);
+      if (scanner->pos >= scanner->end)
+        return json_scanner_set_error (scanner, error, _("unterminated string"));
+
+      c = *scanner->pos;
+
+      if (c == '"')
+        {
+          if (!json_scanner_check_string_length (scanner, scanner->pos - run, error))
+            return JSON_TOKEN_ERROR;
+          json_scanner_append_len (scanner, run, scanner->pos - run);
+          scanner->pos++;
+          break;
+        }
+      else if (c == '\\')
+        {
+          gunichar unichar;
+          gchar utf8[6];
+          gint hex;
+
+          if (!json_scanner_check_string_length (scanner, scanner->pos - run, error))
+            return JSON_TOKEN_ERROR;
+          json_scanner_append_len (scanner, run, scanner->pos - run);
+
+          if (scanner->end - scanner->pos < 2)
+            return json_scanner_set_error (scanner, error, _("unterminated string"));
+
+          scanner->pos++;
+          switch (*scanner->pos)
+            {
+            case '"':
+            case '\\':
+            case '/':
+              json_scanner_append_c (scanner, *scanner->pos);
+              break;
+            case 'b':
+              json_scanner_append_c (scanner, '\b');
+              break;
+            case 'f':
+              json_scanner_append_c (scanner, '\f');
+              break;
+            case 'n':
+              json_scanner_append_c (scanner, '\n');
+              break;
+            case 'r':
+              json_scanner_append_c (scanner, '\r');
+              break;
+            case 't':
+              json_scanner_append_c (scanner, '\t');
+              break;
+            case 'u':
+              if (scanner->end - scanner->pos < 5 ||
+                  (hex = json_scanner_parse_hex4 (scanner->pos + 1)) < 0)
+                return json_scanner_set_error (scanner, error, _("invalid unicode escape"));
+              scanner->pos += 4;
+              unichar = hex;
+
+              if (unichar >= 0xd800 && unichar < 0xdc00)
+                {
+                  gint low;
+
+                  /* a high surrogate must be followed by an escaped low one */
+                  if (scanner->end - scanner->pos < 7 ||
+                      scanner->pos[1] != '\\' || scanner->pos[2] != 'u' ||
+                      (low = json_scanner_parse_hex4 (scanner->pos + 3)) < 0 ||
+                      low < 0xdc00 || low >= 0xe000)
+                    return json_scanner_set_error (scanner, error, _("invalid unicode surrogate pair"));
+                  scanner->pos += 6;
+                  unichar = 0x10000 + ((unichar - 0xd800) << 10) + (low - 0xdc00);
+                }
+              else if (unichar >= 0xdc00 && unichar < 0xe000)
+                {
+                  return json_scanner_set_error (scanner, error, _("invalid unicode surrogate pair"));
+                }
+              else if (unichar == 0)
+                {
+                  validate = TRUE;
+                }
+
+              json_scanner_append_len (scanner, utf8, g_unichar_to_utf8 (unichar, utf8));
+              break;
+            default:
+              return json_scanner_set_error (scanner, error, _("invalid escape sequence"));
+            }
+
+          scanner->pos++;
+          run = scanner->pos;
+        }
+      else
+        {
+          return json_scanner_set_error (scanner, error, _("control character in string"));
+        }
+    }
+
+  /* the last escape may have taken the string past the limit */
+  if (!json_scanner_check_string_length (scanner, 0, error))
+    return JSON_TOKEN_ERROR;
+
+  /* escapes other than \u0000 always produce valid UTF-8, so only strings
+   * with bytes which are not ASCII need validating. g_utf8_validate() also
+   * rejects the embedded NULs \u0000 produces, which a GVariant string
+   * cannot represent: the strings scanned can be used as trusted. */
+  if (validate && !g_utf8_validate (scanner->buffer->str, scanner->buffer->len, NULL))
+    return json_scanner_set_error (scanner, error, _("invalid UTF-8 in string"));
+
+  return JSON_TOKEN_STRING;
+}
+
+static JsonToken
+json_scanner_scan_number (JsonScanner  *scanner,
+                          GError      **error)
+{
+  const gchar *start = scanner->pos;
+  const gchar *p = scanner->pos;
+  JsonToken token = JSON_TOKEN_INT;
+
+  if (p < scanner->end && *p == '-')
+    p++;
+
+  if (p < scanner->end && *p == '0')
+    {
+      p++;
+    }
+  else if (p < scanner->end && g_ascii_isdigit (*p))
+    {
+      while (p < scanner->end && g_ascii_isdigit (*p))
+        p++;
+    }
+  else
+    {
+      scanner->pos = p;
+      return json_scanner_set_error (scanner, error, _("invalid number"));
+    }
+
+  if (p < scanner->end && *p == '.')
+    {
+      token = JSON_TOKEN_DOUBLE;
+      p++;
+      if (p >= scanner->end || !g_ascii_isdigit (*p))
+        {
+          scanner->pos = p;
+          return json_scanner_set_error (scanner, error, _("invalid number"));
+        }
+      while (p < scanner->end && g_ascii_isdigit (*p))
+        p++;
+    }
+
+  if (p < scanner->end && (*p == 'e' || *p == 'E'))
+    {
+      token = JSON_TOKEN_DOUBLE;
+      p++;
+      if (p < scanner->end && (*p == '+' || *p == '-'))
+        p++;
+      if (p >= scanner->end || !g_ascii_isdigit (*p))
+        {
+          scanner->pos = p;
+          return json_scanner_set_error (scanner, error, _("invalid number"));
+        }
+      while (p < scanner->end && g_ascii_isdigit (*p))
+        p++;
+    }
+
+  g_string_truncate (scanner->buffer, 0);
+  json_scanner_append_len (scanner, start, p - start);
+  scanner->pos = p;
+
+  return token;
+}
+
+/* Reads the next chunk of the stream after the input not consumed yet,
+ * which is moved to the start of the window. The window grows when the
+ * token being scanned takes more than half of it. Returns the number of bytes
+ * read, 0 at the end of the stream and -1 on errors.
+ */
+static gssize
+json_scanner_fill (JsonScanner  *scanner,
+                   GError      **error)
+{
+  gsize kept = scanner->end - scanner->pos;
+  gssize n_read;
+
+  if (G_UNLIKELY (scanner->window == NULL))
+    {
+      scanner->window = g_malloc (scanner->window_size);
+      scanner->data = scanner->end = scanner->pos = scanner->window;
+      json_scanner_count_allocation (scanner);
+    }
+
+  scanner->offset += scanner->pos - scanner->data;
+  memmove (scanner->window, scanner->pos, kept);
+
+  /* make sure each read gets at least half of the window */
+  if (kept > scanner->window_size / 2)
+    {
+      scanner->window_size *= 2;
+      scanner->window = g_realloc (scanner->window, scanner->window_size);
+      json_scanner_count_allocation (scanner);
+    }
+
+  /* not all the streams check the cancellable themselves */
+  if (g_cancellable_set_error_if_cancelled (scanner->cancellable, error))
+    n_read = -1;
+  else
+    n_read = g_input_stream_read (scanner->stream,
+                                  scanner->window + kept,
+                                  scanner->window_size - kept,
+                                  scanner->cancellable,
+                                  error);
+
+  /* the next token starts at the beginning of the window */
+  scanner->data = scanner->pos = scanner->token_start = scanner->window;
+  scanner->end = scanner->window + kept + MAX (n_read, 0);
+
+  /* the input is complete, from now on it is scanned as a whole */
+  if (n_read == 0)
+    g_clear_object (&scanner->stream);
+
+  if (n_read < 0)
+    scanner->token = JSON_TOKEN_ERROR;
+
+  return n_read;
+}
+
+/* Checks whether the token at the current position ends inside the
+ * window. Only the end of the token is looked for: its validation is left
+ * to the actual scanning. */
+static gboolean
+json_scanner_has_token (JsonScanner *scanner)
+{
+  const gchar *p = scanner->pos + 1;
+  const gchar *quote;
+
+  switch (*scanner->pos)
+    {
+    case '"':
+      while ((quote = memchr (p, '"', scanner->end - p)) != NULL)
+        {
+          const gchar *escape = quote;
+
+          /* a quote preceded by an odd number of backslashes is escaped */
+          while (escape > scanner->pos + 1 && escape[-1] == '\\')
+            escape--;
+          if ((quote - escape) % 2 == 0)
+            return TRUE;
+
+          p = quote + 1;
+        }
+      return FALSE;
+
+    case '-':
+    case '0': case '1': case '2': case '3': case '4':
+    case '5': case '6': case '7': case '8': case '9':
+    case 't':
+    case 'f':
+    case 'n':
+      for (; p < scanner->end; p++)
+        if (!g_ascii_isalnum (*p) && *p != '.' && *p != '+' && *p != '-')
+          return TRUE;
+      return FALSE;
+
+    default:
+      return TRUE;
+    }
+}
+
+static JsonToken json_scanner_next_tape (JsonScanner  *scanner,
+                                         GError      **error);
+
+JsonToken
+json_scanner_next (JsonScanner  *scanner,
+                   GError      **error)
+{
+  JsonToken token;
+
+  if (scanner->tape != NULL)
+    return json_scanner_next_tape (scanner, error);
+
+  while (TRUE)
+    {
+      while (scanner->pos < scanner->end &&
+             (*scanner->pos == ' ' || *scanner->pos == '\t' ||
+              *scanner->pos == '\n' || *scanner->pos == '\r'))
+        scanner->pos++;
+
+      if (scanner->pos < scanner->end &&
+          (G_LIKELY (scanner->stream == NULL) || json_scanner_has_token (scanner)))
+        break;
+
+      if (scanner->stream == NULL)
+        {
+          scanner->token_start = scanner->pos;
+          scanner->token = JSON_TOKEN_EOF;
+          return JSON_TOKEN_EOF;
+        }
+
+      if (json_scanner_fill (scanner, error) < 0)
+        return JSON_TOKEN_ERROR;
+    }
+
+  scanner->token_start = scanner->pos;
+
+  switch (*scanner->pos)
+    {
+    case '{':
+    case '[':
+      if (G_UNLIKELY (scanner->depth >= scanner->max_depth))
+        return json_scanner_set_too_deep (scanner, error);
+      token = *scanner->pos == '{' ? JSON_TOKEN_BEGIN_OBJECT : JSON_TOKEN_BEGIN_ARRAY;
+      scanner->depth++;
+      scanner->pos++;
+      break;
+    case '}':
+    case ']':
+      token = *scanner->pos == '}' ? JSON_TOKEN_END_OBJECT : JSON_TOKEN_END_ARRAY;
+      if (scanner->depth > 0)
+        scanner->depth--;
+      scanner->pos++;
+      break;
+    case ':':
+      token = JSON_TOKEN_COLON;
+      scanner->pos++;
+      break;
+    case ',':
+      token = JSON_TOKEN_COMMA;
+      scanner->pos++;
+      break;
+    case '"':
+      token = json_scanner_scan_string (scanner, error);
+      break;
+    case '-':
+    case '0': case '1': case '2': case '3': case '4':
+    case '5': case '6': case '7': case '8': case '9':
+      token = json_scanner_scan_number (scanner, error);
+      break;
+    case 't':
+      if (!json_scanner_match_literal (scanner, "true", 4))
+        return json_scanner_set_error (scanner, error, _("invalid literal"));
+      token = JSON_TOKEN_BOOLEAN;
+      scanner->boolean_value = TRUE;
+      break;
+    case 'f':
+      if (!json_scanner_match_literal (scanner, "false", 5))
+        return json_scanner_set_error (scanner, error, _("invalid literal"));
+      token = JSON_TOKEN_BOOLEAN;
+      scanner->boolean_value = FALSE;
+      break;
+    case 'n':
+      if (!json_scanner_match_literal (scanner, "null", 4))
+        return json_scanner_set_error (scanner, error, _("invalid literal"));
+      token = JSON_TOKEN_NULL;
+      break;
+    default:
+      return json_scanner_set_error (scanner, error, _("unexpected character"));
+    }
+
+  if (token >= JSON_TOKEN_STRING ||
+      token == JSON_TOKEN_BEGIN_OBJECT || token == JSON_TOKEN_BEGIN_ARRAY)
+    {
+      if (G_UNLIKELY (scanner->n_nodes >= scanner->max_nodes))
+        {
+          g_set_error (error,
+                       JSON_GVARIANT_ERROR,
+                       JSON_GVARIANT_ERROR_TOO_MANY_NODES,
+                       _("JSON data has more than %u values at offset %" G_GSIZE_FORMAT),
+                       scanner->max_nodes, json_scanner_get_token_offset (scanner));
+          scanner->token = JSON_TOKEN_ERROR;
+          return JSON_TOKEN_ERROR;
+        }
+      scanner->n_nodes++;
+    }
+
+  scanner->token = token;
+  return token;
+}
+
+/* Skips the array or object of text in memory whose opening bracket is
+ * the current token, looking only for brackets and for the ends of the
+ * strings, which may hold brackets of their own */
+static gboolean
+json_scanner_skip_text (JsonScanner  *scanner,
+                        GError      **error)
+{
+  JsonToken end = scanner->token == JSON_TOKEN_BEGIN_OBJECT ? JSON_TOKEN_END_OBJECT : JSON_TOKEN_END_ARRAY;
+  guint outer_depth = scanner->depth - 1;
+  guint depth = scanner->depth;
+  const gchar *p = scanner->pos;
+  gboolean non_ascii;
+
+  while (p < scanner->end)
+    {
+      switch (*p)
+        {
+        case '"':
+          for (p++; ; p += 2)
+            {
+              p = json_scanner_find_special (p, scanner->end, &non_ascii);
+              if (p < scanner->end && *p == '"')
+                break;
+
+              scanner->pos = p;
+              if (p >= scanner->end || (*p == '\\' && scanner->end - p < 2))
+                {
+                  json_scanner_set_error (scanner, error, _("unterminated string"));
+                  return FALSE;
+                }
+              if (*p != '\\')
+                {
+                  json_scanner_set_error (scanner, error, _("control character in string"));
+                  return FALSE;
+                }
+            }
+          break;
+
+        case '{':
+        case '[':
+          if (G_UNLIKELY (depth >= scanner->max_depth))
+            {
+              scanner->token_start = scanner->pos = p;
+              json_scanner_set_too_deep (scanner, error);
+              return FALSE;
+            }
+          depth++;
+          break;
+
+        case '}':
+        case ']':
+          if (--depth > outer_depth)
+            break;
+
+          scanner->token_start = scanner->pos = p;
+          if ((*p == '}') != (end == JSON_TOKEN_END_OBJECT))
+            {
+              json_scanner_set_error (scanner, error, _("unexpected character"));
+              return FALSE;
+            }
+
+          scanner->pos++;
+          scanner->depth = outer_depth;
+          scanner->token = end;
+          return TRUE;
+        }
+
+      p++;
+    }
+
+  scanner->token_start = scanner->pos = scanner->end;
+  json_scanner_set_error (scanner, error, _("unexpected end of data"));
+  return FALSE;
+}
+
+/* Moves the scanner past the value whose first token is the current one,
+ * leaving the last token of the value as the current one, without looking
+ * at what is inside it: the arrays and objects of text in memory are gone
+ * over looking only at their brackets and strings, which are not
+ * buffered, so their contents are neither checked nor counted against
+ * 'max_nodes', only against 'max_depth'. Scanners reading a stream or a
+ * tape go through the tokens instead.
+ */
+gboolean
+json_scanner_skip (JsonScanner  *scanner,
+                   GError      **error)
+{
+  guint outer_depth;
+
+  if (scanner->token != JSON_TOKEN_BEGIN_OBJECT &&
+      scanner->token != JSON_TOKEN_BEGIN_ARRAY)
+    return scanner->token != JSON_TOKEN_ERROR;
+
+  if (scanner->stream == NULL && scanner->tape == NULL)
+    return json_scanner_skip_text (scanner, error);
+
+  outer_depth = scanner->depth - 1;
+  while (scanner->depth > outer_depth)
+    {
+      switch (json_scanner_next (scanner, error))
+        {
+        case JSON_TOKEN_ERROR:
+          return FALSE;
+        case JSON_TOKEN_EOF:
+          json_scanner_set_error (scanner, error, _("unexpected end of data"));
+          return FALSE;
+        default:
+          break;
+        }
+    }
+
+  return TRUE;
+}
+
+/* ========================================================================== */
+/* Tapes */
+/* ========================================================================== */
+
+void
+json_tape_init (JsonTape *tape)
+{
+  tape->nodes = NULL;
+  tape->n_nodes = 0;
+  tape->size = 0;
+  tape->strings = g_string_sized_new (64);
+  tape->error = NULL;
+}
+
+void
+json_tape_clear (JsonTape *tape)
+{
+  g_free (tape->nodes);
+  tape->nodes = NULL;
+  tape->n_nodes = tape->size = 0;
+
+  if (tape->strings != NULL)
+    g_string_free (tape->strings, TRUE);
+  tape->strings = NULL;
+
+  g_clear_error (&tape->error);
+}
+
+/* Records all the tokens of 'scanner', which must read from memory, on
+ * 'tape', replacing the ones recorded before. The text is only tokenized,
+ * not parsed: errors in its structure are left to the scanners replaying
+ * the tape, and a failure of 'scanner' is recorded as an error token, to
+ * be reported when it is reached.
+ */
+void
+json_tape_record (JsonTape    *tape,
+                  JsonScanner *scanner)
+{
+  JsonToken token;
+
+  g_assert (scanner->stream == NULL && scanner->tape == NULL);
+
+  tape->n_nodes = 0;
+  g_string_truncate (tape->strings, 0);
+  g_clear_error (&tape->error);
+
+  do
+    {
+      JsonTapeNode *node;
+
+      token = json_scanner_next (scanner, &tape->error);
+
+      if (G_UNLIKELY (tape->n_nodes == tape->size))
+        {
+          tape->size = MAX (tape->size * 2, 256);
+          tape->nodes = g_renew (JsonTapeNode, tape->nodes, tape->size);
+          json_scanner_count_allocation (scanner);
+        }
+
+      node = &tape->nodes[tape->n_nodes++];
+      node->token = token;
+      node->escaped = FALSE;
+      node->start = json_scanner_get_token_offset (scanner);
+      node->end = json_scanner_get_offset (scanner);
+      node->data = 0;
+      node->length = 0;
+
+      switch (token)
+        {
+        case JSON_TOKEN_STRING:
+          /* escapes always take more room than what they stand for */
+          if (scanner->buffer->len == node->end - node->start - 2)
+            {
+              node->data = node->start + 1;
+            }
+          else
+            {
+              gsize allocated_len = tape->strings->allocated_len;
+
+              node->escaped = TRUE;
+              node->data = tape->strings->len;
+              g_string_append_len (tape->strings,
+                                   scanner->buffer->str,
+                                   scanner->buffer->len);
+              if (G_UNLIKELY (tape->strings->allocated_len != allocated_len))
+                json_scanner_count_allocation (scanner);
+            }
+          node->length = scanner->buffer->len;
+          break;
+
+        case JSON_TOKEN_INT:
+        case JSON_TOKEN_DOUBLE:
+          node->data = node->start;
+          node->length = scanner->buffer->len;
+          break;
+
+        case JSON_TOKEN_BOOLEAN:
+          node->data = scanner->boolean_value;
+          break;
+
+        default:
+          break;
+        }
+    }
+  while (token != JSON_TOKEN_EOF && token != JSON_TOKEN_ERROR);
+}
+
+/* Sets up 'scanner' to replay the tokens recorded on 'tape' from the text
+ * at 'data', which must be the one recorded. The tokens, their contents
+ * and the offsets in the errors are the same as those of a scanner
+ * reading 'data' itself, but nothing is scanned again; copies of the
+ * scanner replay the tape from where they are, independently.
+ */
+void
+json_scanner_init_tape (JsonScanner    *scanner,
+                        const JsonTape *tape,
+                        const gchar    *data,
+                        GString        *buffer)
+{
+  g_return_if_fail (tape->n_nodes > 0);
+
+  json_scanner_init (scanner, data, tape->nodes[tape->n_nodes - 1].end, buffer);
+  scanner->tape = tape;
+}
+
+static JsonToken
+json_scanner_next_tape (JsonScanner  *scanner,
+                        GError      **error)
+{
+  const JsonTape *tape = scanner->tape;
+  const JsonTapeNode *node = &tape->nodes[scanner->tape_pos];
+  const gchar *contents;
+
+  /* the last token is repeated, as the scanners do at the end of the text */
+  if (node->token != JSON_TOKEN_EOF && node->token != JSON_TOKEN_ERROR)
+    scanner->tape_pos++;
+
+  scanner->token_start = scanner->data + node->start;
+  scanner->pos = scanner->data + node->end;
+  scanner->token = node->token;
+
+  if (node->token >= JSON_TOKEN_STRING ||
+      node->token == JSON_TOKEN_BEGIN_OBJECT || node->token == JSON_TOKEN_BEGIN_ARRAY)
+    scanner->n_nodes++;
+
+  switch (node->token)
+    {
+    case JSON_TOKEN_ERROR:
+      g_propagate_error (error, g_error_copy (tape->error));
+      break;
+
+    case JSON_TOKEN_BEGIN_OBJECT:
+    case JSON_TOKEN_BEGIN_ARRAY:
+      scanner->depth++;
+      break;
+
+    case JSON_TOKEN_END_OBJECT:
+    case JSON_TOKEN_END_ARRAY:
+      if (scanner->depth > 0)
+        scanner->depth--;
+      break;
+
+    case JSON_TOKEN_STRING:
+    case JSON_TOKEN_INT:
+    case JSON_TOKEN_DOUBLE:
+      contents = node->escaped ? tape->strings->str : scanner->data;
+      if (G_UNLIKELY (scanner->buffer->allocated_len <= node->length))
+        {
+          g_string_set_size (scanner->buffer, node->length);
+          json_scanner_count_allocation (scanner);
+        }
+      memcpy (scanner->buffer->str, contents + node->data, node->length);
+      scanner->buffer->str[node->length] = '\0';
+      scanner->buffer->len = node->length;
+      break;
+
+    case JSON_TOKEN_BOOLEAN:
+      scanner->boolean_value = node->data != 0;
+      break;
+
+    default:
+      break;
+    }
+
+  return node->token;
+}
@@ -0,0 +1,198 @@
+/* json-scanner.h - Pull tokenizer for JSON text
+ *
+ * Copyright (C) 2013  Intel Corporation.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Author:
+ *   Emanuele Aina <emanuele.aina@collabora.com>
+ */
+
+#ifndef __JSON_SCANNER_H__
+#define __JSON_SCANNER_H__
+
+#include <glib.h>
+#include <gio/gio.h>
+
+G_BEGIN_DECLS
+
+typedef enum
+{
+  JSON_TOKEN_ERROR,
+  JSON_TOKEN_EOF,
+  JSON_TOKEN_BEGIN_OBJECT,
+  JSON_TOKEN_END_OBJECT,
+  JSON_TOKEN_BEGIN_ARRAY,
+  JSON_TOKEN_END_ARRAY,
+  JSON_TOKEN_COLON,
+  JSON_TOKEN_COMMA,
+  JSON_TOKEN_STRING,
+  JSON_TOKEN_INT,
+  JSON_TOKEN_DOUBLE,
+  JSON_TOKEN_BOOLEAN,
+  JSON_TOKEN_NULL
+} JsonToken;
+
+/* The scanner never keeps pointers to the input in its tokens: string
+ * tokens are unescaped and number tokens are copied into 'buffer', which
+ * is NUL-terminated and only valid until the next call to
+ * json_scanner_next(). The buffer can be provided by the caller, to reuse
+ * its storage across scanners.
+ *
+ * Scanners reading from a GInputStream only hold a window of the input,
+ * refilled one chunk at a time: 'data' is then the start of the window and
+ * 'offset' its position in the whole input.
+ *
+ * 'token_start' points to the first character of the last token scanned,
+ * or of the one which failed to scan.
+ *
+ * 'depth' is the number of arrays and objects open after the last token.
+ * Opening one more than 'max_depth' is an error, so that the callers
+ * recursing over the input are bounded: it is JSON_SCANNER_MAX_DEPTH by
+ * default, and the callers can only lower it.
+ * Likewise 'n_nodes' counts the tokens standing for a value or a member
+ * name, up to 'max_nodes', and strings longer than 'max_string_length'
+ * once unescaped fail before being buffered. These errors are in the
+ * JSON_GVARIANT_ERROR domain.
+ *
+ * Scanners can also replay the tokens recorded on a JsonTape, see
+ * json_scanner_init_tape().
+ *
+ * When 'n_allocations' is set, it is incremented each time the scanner
+ * gets memory from the heap for its buffer, its window or the tape it
+ * records.
+ */
+typedef struct _JsonTape JsonTape;
+
+/* About half a kilobyte of stack is needed for each level the converters
+ * recurse into, so this keeps them well within the stack of any thread */
+#define JSON_SCANNER_MAX_DEPTH 1024
+
+typedef struct
+{
+  const gchar  *data;
+  const gchar  *end;
+  const gchar  *pos;
+  const gchar  *token_start;
+  gsize         offset;
+
+  JsonToken     token;
+  guint         depth;
+  guint         max_depth;
+  guint         n_nodes;
+  guint         max_nodes;
+  gsize         max_string_length;
+  GString      *buffer;
+  gboolean      owns_buffer;
+  gboolean      boolean_value;
+
+  GInputStream *stream;
+  GCancellable *cancellable;
+  gchar        *window;
+  gsize         window_size;
+
+  const JsonTape *tape;
+  gsize           tape_pos;
+
+  guint        *n_allocations;
+} JsonScanner;
+
+/* A JSON text scanned once into a flat sequence of tokens, so that it can
+ * be gone over again any number of times without scanning it again.
+ *
+ * The nodes are the tokens in order, up to the end of the text or to the
+ * first error, included. 'start' and 'end' are the offsets of the token in
+ * the text. The contents of strings and numbers are 'length' bytes at
+ * offset 'data' in the text, where they are read in place, or in 'strings'
+ * for the strings which had escapes. 'data' is the value of booleans.
+ *
+ * The storage of a tape is kept across recordings.
+ */
+typedef struct
+{
+  JsonToken token;
+  gboolean  escaped;
+  gsize     start;
+  gsize     end;
+  gsize     data;
+  gsize     length;
+} JsonTapeNode;
+
+struct _JsonTape
+{
+  JsonTapeNode *nodes;
+  gsize         n_nodes;
+  gsize         size;
+  GString      *strings;
+  GError       *error;
+};
+
+void         json_scanner_init        (JsonScanner  *scanner,
+                                       const gchar  *data,
+                                       gsize         length,
+                                       GString      *buffer);
+void         json_scanner_init_stream (JsonScanner  *scanner,
+                                       GInputStream *stream,
+                                       gsize         chunk_size,
+                                       GCancellable *cancellable,
+                                       GString      *buffer);
+void         json_scanner_clear       (JsonScanner  *scanner);
+JsonToken    json_scanner_next        (JsonScanner  *scanner,
+                                       GError      **error);
+gboolean     json_scanner_skip        (JsonScanner  *scanner,
+                                       GError      **error);
+gsize        json_scanner_get_offset  (JsonScanner  *scanner);
+gsize        json_scanner_get_token_offset (JsonScanner *scanner);
+const gchar *json_token_get_name      (JsonToken     token);
+
+void         json_tape_init           (JsonTape     *tape);
+void         json_tape_clear          (JsonTape     *tape);
+void         json_tape_record         (JsonTape     *tape,
+                                       JsonScanner  *scanner);
+void         json_scanner_init_tape   (JsonScanner    *scanner,
+                                       const JsonTape *tape,
+                                       const gchar    *data,
+                                       GString        *buffer);
+
+/* Instruction sets for the inner loops of the scanner, in increasing
+ * order, see json-scanner-simd.c */
+typedef enum
+{
+  JSON_SCANNER_SIMD_NONE,
+  JSON_SCANNER_SIMD_SSE2,
+  JSON_SCANNER_SIMD_AVX2
+} JsonScannerSimd;
+
+const gchar *   json_scanner_find_special (const gchar     *p,
+                                           const gchar     *end,
+                                           gboolean        *non_ascii);
+void            json_scanner_set_simd     (JsonScannerSimd  simd);
+JsonScannerSimd json_scanner_get_simd     (void);
+
+/* Exact conversions of the contents of number tokens, returning FALSE for
+ * the values to be converted with GLib instead, see
+ * json-scanner-number.c */
+gboolean        json_scanner_parse_int64  (const gchar     *string,
+                                           gsize            length,
+                                           gint64          *value);
+gboolean        json_scanner_parse_uint64 (const gchar     *string,
+                                           gsize            length,
+                                           guint64         *value);
+gboolean        json_scanner_parse_double (const gchar     *string,
+                                           gsize            length,
+                                           gdouble         *value);
+
+G_END_DECLS
+
+#endif /* __JSON_SCANNER_H__ */
@@ -23,6 +23,7 @@
  */
 
 #include "goabrowser.h"
+#include "json-gvariant.h"
 #include "object.h"
 
 #include <string.h>
@@ -36,9 +37,10 @@ typedef struct {
     GoaBrowserObject *goa;
 } GoaBrowserObjectWrapper;
 
-#define METHODS                           \
-  METHOD (loginDetected, login_detected)  \
-  METHOD (listAccounts, list_accounts)    \
+#define METHODS                                       \
+  METHOD (loginDetected, login_detected)              \
+  METHOD (listAccounts, list_accounts)                \
+  METHOD (isAccountConfigured, is_account_configured) \
   /* */
 
 /* Method wrapper prototypes */
@@ -69,14 +71,16 @@ init_identifiers (void)
       }
 }
 
+/* Borrows the string held by 'variant', which is not NUL-terminated */
 static gboolean
-variant_to_string (const NPVariant *variant,
-                   gchar **string)
+variant_peek_string (const NPVariant *variant,
+                     const gchar **string,
+                     gsize *length)
 {
     if (G_UNLIKELY (!NPVARIANT_IS_STRING (*variant)))
       return FALSE;
-    *string = g_strndup (NPVARIANT_TO_STRING (*variant).UTF8Characters,
-                         NPVARIANT_TO_STRING (*variant).UTF8Length);
+    *string = NPVARIANT_TO_STRING (*variant).UTF8Characters;
+    *length = NPVARIANT_TO_STRING (*variant).UTF8Length;
     return TRUE;
 }
 
@@ -207,20 +211,58 @@ goabrowser_create_plugin_object (NPP instance, NPObject *window, GoaClient *clie
 }
 
 static gboolean
-is_valid_json (const gchar* data)
+is_valid_json (const gchar *data,
+               gsize length)
 {
-    enum json_tokener_error error = json_tokener_success;
-    json_object *json = json_tokener_parse_verbose (data, &error);
-    if (G_UNLIKELY (error != json_tokener_success))
+    GError *error = NULL;
+    gsize offset;
+
+    if (G_UNLIKELY (length > G_MAXINT))
+      {
+        g_debug ("%s() argument #1 (collectedData) is too big", G_STRFUNC);
+        return FALSE;
+      }
+
+    /* the data is only checked against the signature it is converted to
+     * later, in place and without building anything */
+    if (G_UNLIKELY (!json_gvariant_validate (data, length, "a{sv}",
+                                             goabrowser_get_collected_data_limits (),
+                                             &offset, &error)))
       {
-        g_debug ("%s() failed to parse argument #1 (collectedData) as JSON: %s", G_STRFUNC,
-                 json_tokener_error_desc(error));
+        g_debug ("%s() argument #1 (collectedData) is not a valid JSON object at offset %" G_GSIZE_FORMAT ": %s",
+                 G_STRFUNC, offset, error->message);
+        g_error_free (error);
         return FALSE;
     }
-    json_object_put (json);
     return TRUE;
 }
 
+/* Looks only at the provider and identity in the data, so that the rest
+ * is not converted for accounts which have been configured already */
+static gboolean
+is_account_configured (GoaBrowserObjectWrapper *wrapper,
+                       const gchar *data,
+                       gsize length)
+{
+    GError *error = NULL;
+    gchar *provider, *identity;
+    gboolean configured;
+
+    if (G_UNLIKELY (length > G_MAXINT ||
+                    !goabrowser_peek_collected_account (data, length, &provider, &identity, &error)))
+      {
+        g_clear_error (&error);
+        return FALSE;
+      }
+
+    configured = provider != NULL && identity != NULL &&
+                 goabrowser_object_has_account (wrapper->goa, provider, identity);
+
+    g_free (provider);
+    g_free (identity);
+    return configured;
+}
+
 static gboolean
 goabrowser_login_detected_wrapper (NPObject *object,
                                    const NPVariant *args,
@@ -228,28 +270,48 @@ goabrowser_login_detected_wrapper (NPObject *object,
                                    NPVariant *result)
 {
     GoaBrowserObjectWrapper *wrapper = (GoaBrowserObjectWrapper*)object;
-    gchar *collected_data = NULL;
-    gboolean success = TRUE;
+    const gchar *collected_data = NULL;
+    gsize length = 0;
 
     g_debug ("%s()", G_STRFUNC);
 
-    if (G_UNLIKELY (argc < 1 || !variant_to_string (&args[0], &collected_data) || collected_data == NULL))
+    if (G_UNLIKELY (argc < 1 || !variant_peek_string (&args[0], &collected_data, &length) || collected_data == NULL))
       {
         g_debug ("%s() JSON-encoded string expected for argument #1 (collectedData)", G_STRFUNC);
-        success = FALSE;
-        goto out;
+        return FALSE;
     }
 
-    if (G_UNLIKELY (!is_valid_json (collected_data)))
+    if (G_UNLIKELY (!is_valid_json (collected_data, length)))
+      return FALSE;
+
+    /* accounts configured already are left out by the background script,
+     * which asks isAccountConfigured() first, so that an explicit request for
+     * the creation of an account always reaches the control center;
+     * the string belongs to the browser and is only valid during the call */
+    goabrowser_object_login_detected (wrapper->goa, collected_data, length);
+    return TRUE;
+}
+
+static gboolean
+goabrowser_is_account_configured_wrapper (NPObject *object,
+                                          const NPVariant *args,
+                                          uint32_t argc,
+                                          NPVariant *result)
+{
+    GoaBrowserObjectWrapper *wrapper = (GoaBrowserObjectWrapper*)object;
+    const gchar *collected_data = NULL;
+    gsize length = 0;
+
+    g_debug ("%s()", G_STRFUNC);
+
+    if (G_UNLIKELY (argc < 1 || !variant_peek_string (&args[0], &collected_data, &length) || collected_data == NULL))
       {
-        success = FALSE;
-        goto out;
-      }
+        g_debug ("%s() JSON-encoded string expected for argument #1 (collectedData)", G_STRFUNC);
+        return FALSE;
+    }
 
-    goabrowser_object_login_detected (wrapper->goa, collected_data);
-out:
-    g_free (collected_data);
-    return success;
+    BOOLEAN_TO_NPVARIANT (is_account_configured (wrapper, collected_data, length), *result);
+    return TRUE;
 }
 
 static gboolean